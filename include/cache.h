@@ -0,0 +1,55 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "ext2.h"
+#include <stdint.h>
+#include <stddef.h>
+
+// 块缓存大小（缓冲区个数）与哈希桶数量
+#define BCACHE_BUFFERS 128
+#define BCACHE_BUCKETS 256
+
+// 锁分段数（缓冲区和哈希桶平均分到各段）
+#define BCACHE_STRIPES 8
+
+// 块缓存统计信息
+typedef struct {
+    uint64_t hits;        // 命中次数
+    uint64_t misses;      // 未命中次数
+    uint64_t writebacks;  // 脏块写回次数
+    uint64_t evictions;   // 淘汰次数
+} bcache_stats_t;
+
+// 缓存生命周期
+void bcache_init(void);
+int bcache_flush(void);
+void bcache_invalidate(void);
+
+// 经过缓存的块读写
+int bcache_read(uint32_t block_no, void *buffer);
+int bcache_write(uint32_t block_no, const void *buffer);
+
+// 只查缓存不读盘：命中时拷贝内容并返回0，未命中返回-1
+int bcache_peek(uint32_t block_no, void *buffer);
+
+// 块已被直接写盘后，更新缓存中的副本（如果存在）并清除脏标志
+void bcache_update_clean(uint32_t block_no, const void *buffer);
+
+// 丢弃缓存中的副本（包括还没写回的修改）：块已不再属于文件系统，旧的修改不能再写到它上面
+void bcache_discard(uint32_t block_no);
+
+/*元数据日志：log 收到所有未提交脏块（块号升序）及其缓冲区，写进日志后返回0，
+这些块随即标记为已提交。启用日志时未提交的脏块不会被淘汰写回。*/
+typedef int (*bcache_log_fn)(const uint32_t *blocks, void *const *bufs, int count, void *arg);
+int bcache_commit(bcache_log_fn log, void *arg);
+void bcache_set_journaling(int enabled);
+int bcache_pressure(void);
+
+// 缓冲区所在的内存区域（注册为 io_uring 固定缓冲区）
+void bcache_region(void **base, size_t *size);
+
+// 统计信息
+const bcache_stats_t *bcache_get_stats(void);
+void bcache_reset_stats(void);
+
+#endif // CACHE_H
@@ -2,14 +2,28 @@
 #define COMMANDS_H
 
 #include "ext2.h"
+#include <stdio.h>
 
 // 文件操作命令
 int cmd_create(const char *path);
 int cmd_delete(const char *path);
+int cmd_symlink(const char *target, const char *path);
+int cmd_readlink(const char *path);
+int cmd_ln(const char *target, const char *path, int symbolic);
+int cmd_mv(const char *source, const char *dest);
 int cmd_open(const char *path, int flags);
 int cmd_close(int fd);
 int cmd_read(int fd, void *buffer, size_t size);
 int cmd_write(int fd, const void *buffer, size_t size);
+int cmd_fallocate(const char *path, off_t size);
+int cmd_truncate(const char *path, off_t size);
+int cmd_punch(const char *path, off_t offset, off_t length);
+int cmd_seek(int fd, off_t offset);
+int cmd_compress(const char *path, int enable);
+
+// 宿主文件导入导出（导出的 host_path 为 "-" 时写到标准输出）
+int cmd_import(const char *host_path, const char *path);
+int cmd_export(const char *path, const char *host_path);
 
 // 目录操作命令
 int cmd_dir(const char *path);
@@ -21,12 +35,30 @@ int cmd_cd(const char *path);
 int cmd_login(const char *username, const char *password);
 int cmd_logout(void);
 int cmd_users(void);
+int cmd_groups(void);
+int cmd_useradd(const char *username, const char *password, uint16_t uid, uint16_t gid);
+int cmd_userdel(const char *username);
+int cmd_groupadd(const char *name, uint16_t gid);
+int cmd_passwd(const char *username, const char *old_password, const char *new_password);
 
 // 文件系统管理命令
-int cmd_format(const char *disk_image);
-int cmd_mount(const char *disk_image);
+int cmd_format(const char *disk_image, uint64_t size, uint32_t block_size, uint32_t inode_ratio);
+int cmd_mount(const char *disk_image, disk_backend_t backend);
 int cmd_umount(void);
 int cmd_status(void);
+int cmd_sync(void);
+int cmd_syncmode(const char *mode);
+int cmd_readahead(const char *mode);
+int cmd_stats(const char *arg);
+int cmd_fsck(int repair);
+
+// 快照命令（apply 只处理宿主文件，不需要挂载）
+int cmd_snapshot_create(const char *name);
+int cmd_snapshot_delete(const char *name);
+int cmd_snapshot_list(void);
+int cmd_snapshot_export(const char *name, const char *host_image);
+int cmd_snapshot_apply(const char *host_delta, const char *host_image);
+int cmd_snapdiff(const char *from, const char *to, const char *host_delta);
 
 // 权限管理命令
 int cmd_chmod(const char *path, uint16_t mode);
@@ -40,4 +72,9 @@ void print_usage(void);
 int parse_command(char *line);
 void command_loop(void);
 
+/*批处理：不输出提示符，依次执行命令文件中的每一行或 -c 给出的分号分隔的命令，
+空行和 # 开头的行跳过，遇到 quit 结束，遇到第一条失败的命令停止并返回-1。*/
+int command_batch(FILE *input);
+int command_string(char *commands);
+
 #endif // COMMANDS_H 
\ No newline at end of file
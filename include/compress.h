@@ -0,0 +1,20 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*LZ4 块格式的压缩和解压（不含帧头，输出可以用标准的 LZ4_decompress_safe 解开）。
+只用于压缩簇（见 inode.c），输入不超过 64KB。*/
+
+// 压缩 src 的 len 字节到 dst，返回压缩后的字节数；放不进 capacity 字节（数据不可压缩）时返回0
+size_t lz_compress(const uint8_t *src, size_t len, uint8_t *dst, size_t capacity);
+
+// 解压到 dst（最多 capacity 字节），返回解压后的字节数；输入损坏或超出 capacity 时返回-1
+ssize_t lz_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t capacity);
+
+// 压缩内容的校验和（FNV-1a），写在簇头中
+uint32_t lz_checksum(const uint8_t *data, size_t len);
+
+#endif // COMPRESS_H
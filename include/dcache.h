@@ -0,0 +1,35 @@
+#ifndef DCACHE_H
+#define DCACHE_H
+
+#include "ext2.h"
+#include <stdint.h>
+
+// 目录项缓存大小与哈希桶数量
+#define DCACHE_ENTRIES 256
+#define DCACHE_BUCKETS 512
+
+// 查找结果
+#define DCACHE_MISS     -1  // 缓存中没有记录
+#define DCACHE_NEGATIVE  0  // 缓存记录该名称不存在
+#define DCACHE_HIT       1  // 找到子inode
+
+typedef struct {
+    uint64_t hits;           // 正向命中
+    uint64_t negative_hits;  // 负向命中（确认不存在）
+    uint64_t misses;         // 未命中
+    uint64_t evictions;      // 淘汰次数
+} dcache_stats_t;
+
+// (父目录inode, 名称) -> 子inode 缓存，child 为 0 表示负向项
+int dcache_lookup(uint32_t parent_inode, const char *name, uint32_t *child_inode);
+void dcache_insert(uint32_t parent_inode, const char *name, uint32_t child_inode);
+
+// 失效
+void dcache_remove(uint32_t parent_inode, const char *name);
+void dcache_purge_dir(uint32_t dir_inode);
+void dcache_invalidate(void);
+
+// 统计信息
+const dcache_stats_t *dcache_get_stats(void);
+
+#endif // DCACHE_H
@@ -3,6 +3,11 @@
 
 #include "ext2.h"
 
+// 名字空间锁：修改目录结构时持有写锁，只做路径解析时持有读锁
+void dir_lock_shared(void);
+void dir_lock_exclusive(void);
+void dir_unlock(void);
+
 // 目录操作
 int create_directory(const char *path, uint16_t mode);
 int delete_directory(const char *path);
@@ -13,12 +18,30 @@ int change_directory(const char *path);
 int add_directory_entry(uint32_t parent_inode, const char *name, uint32_t child_inode, uint8_t file_type);
 int remove_directory_entry(uint32_t parent_inode, const char *name);
 int find_directory_entry(uint32_t parent_inode, const char *name, ext2_dir_entry_t *entry);
+int replace_directory_entry(uint32_t parent_inode, const char *name, uint32_t new_inode);
+
+// 删除非目录的目录项，最后一个链接被删除时释放inode；重命名/移动只修改目录项（返回 -errno）
+int unlink_entry(uint32_t parent_inode, const char *name);
+int rename_path(const char *old_path, const char *new_path);
+
+// 变长目录项块操作
+void dir_block_init(uint8_t *block);
+int dir_block_next(const uint8_t *block, int offset, ext2_dir_entry_t *entry);
+int dir_block_insert(uint8_t *block, const char *name, uint32_t inode, uint8_t file_type);
+int dir_block_remove(uint8_t *block, int offset);
+
+// 目录哈希索引
+void dir_index_drop(uint32_t dir_inode);
+void dir_index_invalidate(void);
 
-// 路径解析
+// 路径解析：跟随路径中的符号链接；nofollow 版本不跟随最后一个分量
+#define SYMLINK_MAX_FOLLOW 8
 int path_to_inode(const char *path, uint32_t *inode_no);
+int path_to_inode_nofollow(const char *path, uint32_t *inode_no);
 int get_parent_inode(const char *path, uint32_t *parent_inode, char *child_name);
 
-// 目录遍历
+// 目录遍历：目录最多使用 DIR_MAX_BLOCKS 个数据块（直接块）
+#define DIR_MAX_BLOCKS 12
 int read_directory_entries(uint32_t inode_no, ext2_dir_entry_t *entries, int max_entries);
 
 // 特殊目录项
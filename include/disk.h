@@ -9,25 +9,84 @@ void set_bitmap_bit(uint8_t *bitmap, int bit);
 void clear_bitmap_bit(uint8_t *bitmap, int bit);
 int get_bitmap_bit(uint8_t *bitmap, int bit);
 int find_free_bit(uint8_t *bitmap, int size);
+int find_free_bit_from(uint8_t *bitmap, int nbits, int start);
+int count_free_bits(uint8_t *bitmap, int nbits);
+
+// 位图中的有效位数：块位图位i对应块i+1（块0为超级块），inode位图位i对应inode i+1
+#define BLOCK_BITMAP_BITS ((int)MAX_BLOCKS - 1)
+#define INODE_BITMAP_BITS ((int)MAX_INODES - 1)
+
+// 预留窗口：初始块数、最大块数与同时存在的窗口数
+#define RSV_WINDOW_BLOCKS 8
+#define RSV_WINDOW_MAX 64
+#define MAX_RSV_WINDOWS 32
 
 // 磁盘操作
 int read_block(uint32_t block_no, void *buffer);
 int write_block(uint32_t block_no, const void *buffer);
+
+// 只读访问一个块：mmap 后端直接返回映射中的地址（零拷贝），否则读入 scratch 并返回它
+const uint8_t *read_block_ref(uint32_t block_no, uint8_t *scratch);
 int read_inode(uint32_t inode_no, ext2_inode_t *inode);
 int write_inode(uint32_t inode_no, const ext2_inode_t *inode);
 
+// inode所在的inode表块（*index 为块内序号），以及inode所在组的第一个块
+uint32_t inode_table_block(uint32_t inode_no, uint32_t *index);
+uint32_t inode_goal_block(uint32_t inode_no);
+
+// 一次多块I/O的最大块数
+#define MAX_IO_BLOCKS 64
+
+// 连续多块读写：第i块对应内存 bufs[i]，整段只做一次系统调用
+int read_blocks(uint32_t block_no, uint32_t count, void *const *bufs);
+int write_blocks(uint32_t block_no, uint32_t count, void *const *bufs);
+
+// 底层磁盘I/O（绕过块缓存）
+int disk_read_block(uint32_t block_no, void *buffer);
+int disk_write_block(uint32_t block_no, const void *buffer);
+int disk_read_blocks(uint32_t block_no, uint32_t count, void *const *bufs);
+int disk_write_blocks(uint32_t block_no, uint32_t count, void *const *bufs);
+
+// 把若干不一定连续的块（块号升序）作为一批写回，块号连续的部分合并
+int disk_write_scattered(const uint32_t *blocks, void *const *bufs, uint32_t count);
+
+// 预读提示：让内核在后台把这些块读进页缓存，调用本身不等待I/O
+void disk_prefetch(uint32_t block_no, uint32_t count);
+
 // 块分配和释放
 uint32_t allocate_block(void);
+uint32_t allocate_block_near(uint32_t goal);
+uint32_t allocate_file_block(uint32_t inode_no, uint32_t goal);
+uint32_t allocate_block_run(uint32_t inode_no, uint32_t goal, uint32_t want, uint32_t *got);
+void release_block_reservation(uint32_t inode_no);
 void free_block(uint32_t block_no);
-uint32_t allocate_inode(void);
-void free_inode(uint32_t inode_no);
+uint32_t allocate_inode(uint32_t parent_inode, int is_dir);
+void free_inode(uint32_t inode_no, int is_dir);
+int inode_is_allocated(uint32_t inode_no);
+
+// 块组：格式化时建立组描述符，挂载时按位图校正空闲计数
+void format_groups(void);
+void recount_free_counts(void);
+
+// 用一致性检查重建的位图替换内存中的位图，dirs 为每组的目录数；重新统计空闲计数并全部置脏
+void install_bitmaps(const uint8_t *blocks, const uint8_t *inodes, const uint32_t *dirs);
+
+// 超级块、组描述符与位图的延迟写回
+void mark_superblock_dirty(void);
+int write_superblock(const ext2_superblock_t *superblock);
+int flush_metadata(void);
 
 // 文件系统初始化
-int init_disk_image(const char *filename);
+int init_disk_image(const char *filename, disk_backend_t backend);
 void close_disk_image(void);
+disk_backend_t disk_get_backend(void);
+
+// 把已写入的数据持久化到镜像文件（mmap 后端执行 msync，其余执行 fdatasync）
+int disk_sync(void);
 
 // 位图管理
-extern uint8_t block_bitmap[BLOCK_SIZE];
-extern uint8_t inode_bitmap[BLOCK_SIZE];
+extern uint8_t *block_bitmap;
+extern uint8_t *inode_bitmap;
+extern ext2_group_desc_t *group_desc;
 
 #endif // DISK_H 
\ No newline at end of file
@@ -6,13 +6,10 @@
 #include <sys/types.h>
 
 // 文件系统常量
-#define BLOCK_SIZE 1024
-#define MAX_BLOCKS 1024
-#define MAX_INODES 128
-#define MAX_USERS 16
+#define EXT2_MIN_BLOCK_SIZE 1024
+#define EXT2_MAX_BLOCK_SIZE 4096
 #define MAX_FILENAME 255
 #define MAX_PATH 1024
-#define MAX_OPEN_FILES 16
 
 // 文件类型
 #define EXT2_S_IFSOCK 0xC000
@@ -34,6 +31,24 @@
 #define EXT2_S_IWOTH 0x0002
 #define EXT2_S_IXOTH 0x0001
 
+// 超级块 s_state：不用日志时 VALID 在挂载时清除、正常卸载时设置，挂载时没有 VALID 就要检查
+#define EXT2_VALID_FS 1
+#define EXT2_ERROR_FS 2
+
+/*快照表项（见 snapshot.c）：快照创建之后第一次被覆盖或释放的块，旧内容记在以 map 为根的映射树中，
+没有记录的块在更新的快照或当前镜像中找。*/
+#define EXT2_MAX_SNAPSHOTS 8
+#define EXT2_SNAPSHOT_NAME_LEN 16
+#define EXT2_SNAPSHOT_BROKEN 1    // 有块没能保存旧内容（空间不足），快照已不完整，只能删除
+
+typedef struct {
+    char name[EXT2_SNAPSHOT_NAME_LEN];  // 快照名（以'\0'结尾）
+    uint32_t id;                  // 创建序号，只增不减
+    uint32_t time;                // 创建时间
+    uint32_t map;                 // 映射树的根块
+    uint32_t flags;               // EXT2_SNAPSHOT_BROKEN
+} ext2_snapshot_t;
+
 // 超级块结构
 typedef struct {
     uint32_t s_inodes_count;      // Inode数量
@@ -71,6 +86,12 @@ typedef struct {
     char s_volume_name[16];       // 卷名
     char s_last_mounted[64];      // 最后挂载点
     uint32_t s_journal_uuid[4];   // 日志UUID
+    uint32_t s_users_inode;       // 用户/组数据库所在的隐藏inode，0 表示没有（使用默认用户）
+    uint32_t s_journal_block;     // 元数据日志区的第一个块，0 表示没有日志
+    uint32_t s_journal_blocks;    // 日志区块数
+    uint32_t s_snapshot_count;    // 快照数，s_snapshots 按创建先后排列，最后一个是活动快照
+    uint32_t s_snapshot_next_id;  // 下一个快照的创建序号
+    ext2_snapshot_t s_snapshots[EXT2_MAX_SNAPSHOTS];
 } ext2_superblock_t;
 
 // Inode结构
@@ -84,9 +105,9 @@ typedef struct {
     uint32_t i_dtime;             // 删除时间
     uint16_t i_gid;               // 组ID
     uint16_t i_links_count;       // 硬链接数
-    uint32_t i_blocks;            // 块数
+    uint32_t i_blocks;            // 文件已分配的数据块数（不含间接块，空洞不计）
     uint32_t i_flags;             // 文件标志
-    uint32_t i_block[15];         // 块指针数组
+    uint32_t i_block[15];         // 块指针数组（带 EXT2_INLINE_DATA_FL 时直接存放文件内容）
     // uint32_t i_generation;        // 文件版本
     // uint32_t i_file_acl;          // 文件ACL
     // uint32_t i_dir_acl;           // 目录ACL
@@ -98,46 +119,161 @@ typedef struct {
 } ext2_inode_t;
 
 // 目录项结构
+// 磁盘上的目录项是变长的：8字节头部后紧跟 name_len 个字符（不以'\0'结尾），
+// rec_len 为到下一个目录项的距离（4字节对准），块中最后一项的 rec_len 延伸到块尾。
+// 内存中使用时 name 以'\0'结尾。
 typedef struct {
     uint32_t inode;               // inode号
     uint16_t rec_len;             // 目录项长度
     uint8_t name_len;             // 名称长度
     uint8_t file_type;            // 文件类型
-    char name[255];               // 文件名
+    char name[MAX_FILENAME + 1];  // 文件名
 } ext2_dir_entry_t;
 
-// 用户结构
+#define EXT2_DIR_ENTRY_HEADER 8
+#define EXT2_DIR_REC_LEN(name_len) (((name_len) + EXT2_DIR_ENTRY_HEADER + 3) & ~3)
+
+// 块组描述符
+typedef struct {
+    uint32_t bg_block_bitmap;       // 块位图所在块
+    uint32_t bg_inode_bitmap;       // inode位图所在块
+    uint32_t bg_inode_table;        // inode表起始块
+    uint16_t bg_free_blocks_count;  // 空闲块数
+    uint16_t bg_free_inodes_count;  // 空闲inode数
+    uint16_t bg_used_dirs_count;    // 目录数
+    uint16_t bg_pad;
+    uint32_t bg_reserved[3];
+} ext2_group_desc_t;
+
+// 不兼容特性标志
+#define EXT2_FEATURE_INCOMPAT_COMPRESSION 0x0001  // 有按簇压缩的文件，第一次打开压缩时设置
+#define EXT2_FEATURE_INCOMPAT_VARDIR      0x0002  // 变长目录项
+#define EXT2_FEATURE_INCOMPAT_GROUPS      0x0010  // 块组布局（组描述符表、每组位图和inode表）
+#define EXT2_FEATURE_INCOMPAT_SNAPSHOTS   0x0100  // 有快照：块被覆盖前要先保存旧内容，有快照时才设置
+#define EXT2_FEATURE_INCOMPAT_INLINE_DATA 0x8000  // 小文件和符号链接目标内联在inode中
+#define EXT2_FEATURE_INCOMPAT_REQUIRED    (EXT2_FEATURE_INCOMPAT_VARDIR | EXT2_FEATURE_INCOMPAT_GROUPS)
+#define EXT2_FEATURE_INCOMPAT_DEFAULT     (EXT2_FEATURE_INCOMPAT_REQUIRED | EXT2_FEATURE_INCOMPAT_INLINE_DATA)
+#define EXT2_FEATURE_INCOMPAT_SUPP        (EXT2_FEATURE_INCOMPAT_DEFAULT | EXT2_FEATURE_INCOMPAT_SNAPSHOTS | \
+                                           EXT2_FEATURE_INCOMPAT_COMPRESSION)
+
+/*inode标志：文件内容直接存放在 i_block[] 中（最多 EXT2_INLINE_DATA_MAX 字节），没有数据块。
+普通文件和符号链接在镜像支持内联数据时以内联方式创建，超过上限时自动迁移到数据块。*/
+#define EXT2_INLINE_DATA_FL 0x10000000
+#define EXT2_INLINE_DATA_MAX (15 * sizeof(uint32_t))
+
+/*inode标志：普通文件的内容按 EXT2_CLUSTER_SIZE 字节一簇压缩存放（见 inode.c）。
+目录带这个标志时，其中新建的普通文件和子目录继承它。*/
+#define EXT2_COMPR_FL 0x00000004
+#define EXT2_CLUSTER_SIZE 16384
+
+/*压缩簇的头部，放在簇第一个数据块的开头，后面紧跟压缩后的内容（LZ4 块格式）。
+压缩后的簇只映射簇中前面的若干块，其余是空洞；没有空洞或头部校验不通过的簇是原样存放的。*/
+#define EXT2_CLUSTER_MAGIC 0x435A4C45u  // "ELZC"
+
+typedef struct {
+    uint32_t c_magic;
+    uint16_t c_length;      // 簇在文件中的长度（解压后的字节数），之后到簇尾都是零
+    uint16_t c_compressed;  // 压缩后的字节数
+    uint32_t c_checksum;    // 压缩内容的校验和
+    uint32_t c_reserved;
+} ext2_cluster_header_t;
+
+// 用户和组记录（也是它们在用户数据库文件中的存储格式，名字必须是第一个字段）
 typedef struct {
     char username[32];
     char password[32];
     uint16_t uid;
     uint16_t gid;
-    int is_active;
 } user_t;
 
-// 打开文件结构
+typedef struct {
+    char name[32];
+    uint16_t gid;
+    uint16_t reserved;
+} group_t;
+
+// 顺序预读状态（见 readahead.c），逻辑块号
+typedef struct {
+    off_t next_offset;     // 上一次读结束的位置，下一次读从这里开始即为顺序读
+    uint32_t start;        // 当前预读窗口的第一个块
+    uint32_t size;         // 当前窗口块数，0 表示没有窗口
+    uint32_t async_start;  // 读到这个块时发起下一个窗口
+    uint32_t hit_from;     // 已预读但还没被读到的第一个块
+    uint32_t issued_end;   // 已发起预读的范围的结束块
+} readahead_t;
+
+// 打开文件结构（属于会话的文件表，见 session.h）
 typedef struct {
     int fd;
     uint32_t inode_no;
     int flags;
     off_t offset;
     int is_open;
+    readahead_t ra;
 } open_file_t;
 
+// 元数据同步策略：何时把缓存中的位图、超级块、inode等写到磁盘
+typedef enum {
+    SYNC_PER_OP,      // 每次操作结束都落盘
+    SYNC_EVERY_N,     // 每N次操作落盘一次
+    SYNC_ON_UMOUNT    // 只在同步和卸载时落盘
+} sync_policy_t;
+
+// 磁盘镜像的访问方式
+typedef enum {
+    DISK_BACKEND_FD,    // 通过文件描述符读写
+    DISK_BACKEND_MMAP,  // 把整个镜像映射到内存
+    DISK_BACKEND_URING  // 通过 io_uring 批量提交读写（内核不支持时退回 FD）
+} disk_backend_t;
+
 // 文件系统状态
 typedef struct {
     ext2_superblock_t superblock;
-    user_t users[MAX_USERS];
-    int current_user;
-    open_file_t open_files[MAX_OPEN_FILES];
-    int next_fd;
     char disk_image[256];
+    sync_policy_t sync_policy;
+    int sync_interval;    // SYNC_EVERY_N 时的操作次数
+    int ops_since_sync;   // 上次落盘之后完成的操作数
+    int quiet;            // 批处理模式：不输出成功信息，只输出错误和查询结果
+    // 几何参数
+    uint32_t block_size;
+    uint32_t blocks_count;
+    uint32_t inodes_count;
+    uint32_t groups_count;
+    uint32_t blocks_per_group;
+    uint32_t inodes_per_group;
+    uint32_t inode_table_blocks;  // 每组inode表占用的块数
+    uint32_t gdt_blocks;          // 组描述符表占用的块数
 } ext2_fs_t;
 
+// 默认几何参数：1 MiB 镜像，1 KiB 块，每 8 KiB 一个inode
+#define DEFAULT_BLOCK_SIZE 1024
+#define DEFAULT_BLOCKS_COUNT 1024
+#define DEFAULT_INODE_RATIO 8192
+
+// 当前文件系统的几何参数（格式化或挂载时由 ext2_set_geometry 设置）
+#define BLOCK_SIZE ((int)fs.block_size)
+#define MAX_BLOCKS (fs.blocks_count)
+#define MAX_INODES (fs.inodes_count)
+
+/*磁盘布局：块0为超级块，从块1开始每 blocks_per_group 个块为一个块组。
+块组0开头是组描述符表，之后每个组依次是块位图、inode位图、inode表和数据块。*/
+#define INODES_PER_BLOCK (BLOCK_SIZE / sizeof(ext2_inode_t))
+#define GDT_START 1
+
 // 函数声明
 int ext2_init(const char *disk_image);
-int ext2_format(const char *disk_image);
+int ext2_format(const char *disk_image, uint32_t block_size, uint32_t blocks_count, uint32_t inodes_count);
+int ext2_set_geometry(uint32_t block_size, uint32_t blocks_count, uint32_t inodes_count);
 void ext2_cleanup(void);
+int ext2_sync(void);
+
+// 操作括号：每个操作（一条命令或一批请求）在 ext2_op_begin 和 ext2_op_end 之间执行
+void ext2_op_begin(void);
+void ext2_op_end(void);
+void ext2_op_leave(void);
+
+// 输出成功信息（quiet 时不输出）
+void ext2_info(const char *format, ...);
 
 // 全局变量
 extern ext2_fs_t fs;
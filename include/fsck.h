@@ -0,0 +1,40 @@
+#ifndef FSCK_H
+#define FSCK_H
+
+#include "ext2.h"
+#include <stdint.h>
+
+// 检查线程数上限（实际线程数还受CPU数和块组数限制）
+#define FSCK_MAX_THREADS 8
+
+typedef struct {
+    uint32_t inodes;             // 在用的inode数
+    uint32_t directories;        // 其中的目录数
+    uint32_t blocks;             // 在用的块数（含元数据）
+    uint32_t bad_pointers;       // 越界的块指针
+    uint32_t duplicate_blocks;   // 被多次引用或指向元数据的块
+    uint32_t damaged_dirs;       // 目录项格式损坏的目录块
+    uint32_t bad_entries;        // 指向越界或空闲inode的目录项
+    uint32_t orphans;            // 在用但没有目录项指向的inode
+    uint32_t block_bitmap_errors;  // 块位图中状态与实际不符的块
+    uint32_t inode_bitmap_errors;  // inode位图中状态与实际不符的inode
+    uint32_t count_errors;       // 组描述符和超级块中不对的空闲计数和目录数
+    uint32_t link_count_errors;  // 链接计数与指向它的目录项数不符的inode
+    int repaired;                // 位图和计数已按检查结果重建
+    int threads;
+    double seconds;
+} fsck_report_t;
+
+/*检查已挂载的文件系统：并行扫描inode表和所有目录，按实际引用重建块位图、inode位图，
+并校验各组和超级块的空闲计数以及每个inode的链接计数。repair 为真时用重建的结果替换内存中的
+位图、计数和链接计数（随下一次元数据写回落盘），否则只报告。调用者保证没有其他操作在进行。
+内存不足或读盘失败返回-1。*/
+int fsck_check(int repair, fsck_report_t *report);
+
+// 挂载时是否需要检查：需要时返回原因，干净的镜像返回 NULL
+const char *fsck_reason(const ext2_superblock_t *sb);
+
+// 报告中是否有问题
+int fsck_has_errors(const fsck_report_t *report);
+
+#endif // FSCK_H
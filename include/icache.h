@@ -0,0 +1,38 @@
+#ifndef ICACHE_H
+#define ICACHE_H
+
+#include "ext2.h"
+#include <stdint.h>
+#include <pthread.h>
+
+// 内存inode表：按inode号直接索引，大小为当前文件系统的 MAX_INODES
+typedef struct {
+    ext2_inode_t inode;   // inode的内存副本
+    int loaded;           // 是否已从磁盘读入
+    int dirty;            // 是否需要写回inode表
+    int refcount;         // 引用计数，大于0时不会被丢弃
+    pthread_rwlock_t lock; // 修改inode内容时持有写锁
+} icache_entry_t;
+
+// 获取/释放inode的内存副本（引用计数）
+ext2_inode_t *icache_get(uint32_t inode_no);
+void icache_put(uint32_t inode_no);
+
+// 标记inode已修改，在操作结束或同步时统一写回
+void icache_mark_dirty(uint32_t inode_no);
+
+// 读操作更新访问时间（只持有读锁时使用）
+void icache_set_atime(uint32_t inode_no, uint32_t atime);
+
+// inode读写锁：读文件持有读锁，修改inode持有写锁（同一线程不能重复加锁）
+void icache_lock_shared(uint32_t inode_no);
+void icache_lock_exclusive(uint32_t inode_no);
+void icache_unlock(uint32_t inode_no);
+
+// 写回所有脏inode（同一inode表块中的脏inode合并为一次写；调用者不能持有inode锁）
+int icache_flush(void);
+
+// 丢弃所有inode副本（卸载或重新挂载时调用，调用前应先 icache_flush）
+void icache_invalidate(void);
+
+#endif // ICACHE_H
@@ -4,19 +4,61 @@
 #include "ext2.h"
 #include <sys/types.h>
 
+// 物理上连续的一段数据块
+typedef struct {
+    uint32_t logical;   // 起始逻辑块号
+    uint32_t physical;  // 起始物理块号，0 表示空洞
+    uint32_t count;     // 块数
+} inode_extent_t;
+
+// 碎片统计
+typedef struct {
+    uint32_t files;             // 有数据块的普通文件数
+    uint32_t blocks;            // 这些文件的数据块总数
+    uint32_t fragments;         // 物理连续区段总数
+    uint32_t fragmented_files;  // 区段数大于1的文件数
+    uint32_t inline_files;      // 内容内联在inode中、没有数据块的文件数
+    uint32_t sparse_files;      // 有空洞的文件数
+    uint32_t hole_blocks;       // 这些文件中空洞占的块数
+    uint32_t compressed_files;  // 按簇压缩的文件数（不计入上面的统计）
+    uint32_t compressed_blocks; // 它们占用的数据块数
+    uint64_t compressed_bytes;  // 它们的总长度
+} frag_stats_t;
+
 // Inode操作
-int create_inode(uint16_t mode, uint16_t uid, uint16_t gid);
+int create_inode(uint32_t parent_inode, uint16_t mode, uint16_t uid, uint16_t gid);
 int delete_inode(uint32_t inode_no);
 int get_inode_block(uint32_t inode_no, uint32_t block_index, uint32_t *block_no);
 int set_inode_block(uint32_t inode_no, uint32_t block_index, uint32_t block_no);
+uint32_t inode_max_blocks(void);
+
+// 间接块映射缓存：文件关闭时释放它的槽位，卸载或重新挂载时全部丢弃
+void inode_map_release(uint32_t inode_no);
+void inode_map_invalidate(void);
 
-// 文件读写操作
+// 区段映射：把逻辑块区间解析为连续物理块
+int map_inode_blocks(uint32_t inode_no, uint32_t first_index, uint32_t count, uint32_t *block_nos);
+int map_inode_extents(uint32_t inode_no, uint32_t first_index, uint32_t count,
+                      inode_extent_t *extents, int max_extents);
+
+// 文件读写操作：没有分配块的部分（空洞）读出来是零，截断可以加长文件（加长的部分是空洞）
 ssize_t read_inode_data(uint32_t inode_no, void *buffer, size_t size, off_t offset);
 ssize_t write_inode_data(uint32_t inode_no, const void *buffer, size_t size, off_t offset);
 int truncate_inode(uint32_t inode_no, off_t length);
+int preallocate_inode(uint32_t inode_no, off_t length);
+int reserve_inode_blocks(uint32_t inode_no, off_t length);
+int punch_inode(uint32_t inode_no, off_t offset, off_t length);
+
+/*打开或关闭按簇压缩（EXT2_COMPR_FL）：目录只改标志，之后在其中新建的文件继承它；
+普通文件把已有内容逐簇改写。不是普通文件或目录、空间不足时返回-1。*/
+int set_inode_compression(uint32_t inode_no, int enable);
 
-// 权限检查
+// 权限检查（access 以 EXT2_S_IRUSR 等属主权限位给出）
 int check_permission(uint32_t inode_no, int access);
+
+/*类型和权限一起检查：允许返回0，inode不存在返回 -ENOENT，要求目录而不是目录返回 -ENOTDIR，
+要求普通文件而不是返回 -EISDIR，权限不足返回 -EACCES。*/
+int check_access(uint32_t inode_no, uint16_t type, int access);
 int change_permission(uint32_t inode_no, uint16_t mode);
 int change_owner(uint32_t inode_no, uint16_t uid, uint16_t gid);
 
@@ -28,10 +70,15 @@ void update_ctime(uint32_t inode_no);
 // 链接计数
 int increment_link_count(uint32_t inode_no);
 int decrement_link_count(uint32_t inode_no);
+int set_link_count(uint32_t inode_no, uint16_t count);
+uint16_t get_link_count(uint32_t inode_no);
 
 // 工具函数
 int is_directory(uint32_t inode_no);
 int is_regular_file(uint32_t inode_no);
+int is_symlink(uint32_t inode_no);
+int read_symlink(uint32_t inode_no, char *target, size_t size);
 uint32_t get_file_size(uint32_t inode_no);
+void compute_fragmentation(frag_stats_t *stats);
 
 #endif // INODE_H 
\ No newline at end of file
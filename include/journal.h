@@ -0,0 +1,53 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "ext2.h"
+#include <stdint.h>
+
+// 日志区大小：块数的 1/32，限定在最小和最大值之间；块数太少的镜像不建日志
+#define JOURNAL_MIN_BLOCKS 256
+#define JOURNAL_MAX_BLOCKS 8192
+#define JOURNAL_MIN_FS_BLOCKS 4096
+
+typedef struct {
+    uint32_t blocks;       // 日志区块数，0 表示没有使用日志
+    uint32_t used;         // 还没检查点的事务占用的块数
+    uint64_t commits;      // 写进日志的事务数
+    uint64_t grouped;      // 搭上别的线程的提交、不用自己等一次同步的操作数
+    uint64_t checkpoints;  // 检查点次数（日志清空重新开始）
+    uint64_t replayed;     // 挂载时重放的事务数
+} journal_stats_t;
+
+// 格式化时在镜像中划出日志区并写入空的日志超级块（镜像太小时不建日志，返回0）
+int journal_create(void);
+
+// 挂载时重放日志中已提交的事务（在读入位图之前调用）；日志损坏返回-1
+int journal_recover(const ext2_superblock_t *sb);
+
+// 启用和关闭日志；关闭时提交剩余修改并做检查点（调用者保证没有其他操作在进行）
+int journal_open(const ext2_superblock_t *sb);
+void journal_close(void);
+int journal_active(void);
+
+// 提交所有修改并做检查点：返回后镜像中的内容完整、日志为空（调用者保证没有其他操作在进行）
+int journal_checkpoint(void);
+
+/*操作括号：每个文件系统操作在 journal_op_begin/journal_op_end 之间进行，
+提交等到正在进行的操作全部结束后才开始，保证每个事务只包含完整的操作。
+journal_op_end 返回本操作所属的事务序号，*sync_requested 表示操作中途请求过同步。*/
+void journal_op_begin(void);
+uint64_t journal_op_end(int *sync_requested);
+
+/*组提交：提交到事务 txn 为止的所有修改（多个线程的操作合成一个事务，只同步一次）。
+已经被别的线程提交时直接返回。*/
+int journal_commit(uint64_t txn);
+
+// 把目前为止的修改提交进日志；在操作括号内调用时推迟到操作结束
+int journal_sync(void);
+
+// 块被释放：如果日志中还有它的旧副本，记录撤销，重放时不再覆盖它的新用途
+void journal_revoke(uint32_t block_no);
+
+const journal_stats_t *journal_get_stats(void);
+
+#endif // JOURNAL_H
@@ -0,0 +1,29 @@
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include "ext2.h"
+#include <stdint.h>
+#include <sys/types.h>
+
+// 预读窗口的最小和最大块数（检测到顺序读后窗口从最小值开始逐次翻倍）
+#define RA_MIN_BLOCKS 4
+#define RA_MAX_BLOCKS 128
+
+typedef struct {
+    uint64_t windows;     // 发起的预读窗口数
+    uint64_t prefetched;  // 预读的块数
+    uint64_t hits;        // 之后确实被读到的预读块数
+} readahead_stats_t;
+
+// 打开文件时清空预读状态
+void readahead_reset(readahead_t *ra);
+
+// 每次读之前调用：记录访问模式，顺序读时提前发起后续块的预读
+void readahead_access(readahead_t *ra, uint32_t inode_no, off_t offset, size_t size);
+
+// 开关与统计
+void readahead_set_enabled(int enabled);
+int readahead_enabled(void);
+const readahead_stats_t *readahead_get_stats(void);
+
+#endif // READAHEAD_H
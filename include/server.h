@@ -0,0 +1,107 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "ext2.h"
+#include <stdint.h>
+
+/*守护进程模式的二进制协议。
+
+客户端连接后发送任意多个请求帧，不必等待前一个请求的响应（流水线）；
+服务器按收到的顺序处理同一连接上的请求，并按同样的顺序返回响应帧。
+所有整数都是本机字节序（服务器和客户端在同一台机器或同构机器上）。
+
+请求帧：srv_request_t 帧头 + length 字节负载
+响应帧：srv_response_t 帧头 + length 字节负载
+status >= 0 表示成功（含义见各操作），< 0 为 -errno。*/
+
+typedef struct {
+    uint32_t length;   // 负载长度（不含帧头）
+    uint32_t id;       // 请求号，原样放回响应
+    uint16_t op;       // SRV_OP_*
+    uint16_t reserved;
+} srv_request_t;
+
+typedef struct {
+    uint32_t length;   // 负载长度（不含帧头）
+    uint32_t id;       // 对应请求的请求号
+    int32_t status;
+} srv_response_t;
+
+/*操作及负载：
+LOGIN    请求 "用户名\0密码\0"
+OPEN     请求 uint32 flags + "路径\0"            status 为文件描述符
+CLOSE    请求 uint32 fd
+READ     请求 srv_io_t（size 为要读的字节数）    响应为数据，status 为读到的字节数
+WRITE    请求 srv_io_t + 数据                    status 为写入的字节数
+STAT     请求 "路径\0"                           响应 srv_stat_t
+READDIR  请求 "路径\0"                           响应 status 个 srv_dirent_t，各自后跟 name_len 字节名称
+SYNC     无负载                                  把修改写回磁盘镜像
+STATS    请求 uint32 flags（可以省略）           响应 status 个 srv_stats_t（热路径计数器，见 stats.h）
+         flags 含 SRV_STATS_RESET 时读出后清零（只有 root 可以），编译时去掉了计数器返回 -ENOSYS
+READ/WRITE 的 offset 为 SRV_OFFSET_CURRENT 时使用并推进文件当前位置。*/
+#define SRV_OP_LOGIN   1
+#define SRV_OP_OPEN    2
+#define SRV_OP_CLOSE   3
+#define SRV_OP_READ    4
+#define SRV_OP_WRITE   5
+#define SRV_OP_STAT    6
+#define SRV_OP_READDIR 7
+#define SRV_OP_SYNC    8
+#define SRV_OP_STATS   9
+
+#define SRV_STATS_RESET 1
+
+#define SRV_OFFSET_CURRENT UINT64_MAX
+
+// 单次读写的数据上限（WRITE 请求的负载还包括 srv_io_t），负载更长的请求会断开连接
+#define SRV_MAX_PAYLOAD (1 << 20)
+
+typedef struct {
+    uint32_t fd;
+    uint32_t size;
+    uint64_t offset;
+} srv_io_t;
+
+typedef struct {
+    uint32_t inode;
+    uint16_t mode;
+    uint16_t links_count;
+    uint16_t uid;
+    uint16_t gid;
+    uint32_t size;
+    uint32_t blocks;
+    uint32_t atime;
+    uint32_t mtime;
+    uint32_t ctime;
+} srv_stat_t;
+
+typedef struct {
+    uint32_t inode;
+    uint16_t name_len;
+    uint8_t file_type;
+    uint8_t reserved;
+} srv_dirent_t;
+
+/*一个计数器的汇总值。buckets[i] 是耗时在 [2^i, 2^(i+1)) 纳秒之间的调用数，最后一个桶包括更慢的调用；
+seconds_ms 是计数的时长（毫秒，所有条目相同）。*/
+#define SRV_STATS_BUCKETS 32
+
+typedef struct {
+    char name[24];
+    uint64_t calls;
+    uint64_t failed;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t seconds_ms;
+    uint64_t buckets[SRV_STATS_BUCKETS];
+} srv_stats_t;
+
+// 默认工作线程数
+#define SRV_DEFAULT_WORKERS 4
+
+/*监听地址：含 '/' 的是Unix域套接字路径，否则是TCP的 [主机:]端口（默认 127.0.0.1）。
+server_run 一直运行到 server_stop 被调用（可以在信号处理函数中调用）。*/
+int server_run(const char *address, int workers);
+void server_stop(void);
+
+#endif // SERVER_H
@@ -0,0 +1,43 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "ext2.h"
+
+// 会话的第一个文件描述符（0, 1, 2 是标准输入输出）
+#define SESSION_FIRST_FD 3
+
+/*会话：一个客户端的登录身份和打开文件表。
+文件表按文件描述符直接索引，需要时成倍增长；一个会话同一时间只由一个线程使用。*/
+typedef struct {
+    int logged_in;          // 是否已登录
+    uint16_t uid;           // 登录用户的身份（登录时从用户表复制，权限检查不必再查用户表）
+    uint16_t gid;
+    char username[32];
+    open_file_t *files;     // files[fd]，is_open 为 0 的项空闲
+    int capacity;           // files 的项数
+    int open_count;         // 已打开的文件数
+    int free_hint;          // 不小于它的描述符中才可能有空闲的
+} session_t;
+
+// 会话生命周期（销毁时关闭所有打开的文件）
+session_t *session_create(void);
+void session_destroy(session_t *session);
+
+// 当前线程的会话：没有绑定时使用控制台会话
+session_t *session_current(void);
+void session_attach(session_t *session);
+
+// 文件描述符：分配最小的空闲描述符，失败返回-1
+int session_alloc_fd(session_t *session);
+open_file_t *session_file(session_t *session, int fd);
+void session_free_fd(session_t *session, int fd);
+
+/*按路径打开普通文件，返回文件描述符，失败返回 -ENOENT、-EISDIR、-EACCES 或 -EMFILE
+（调用者持有名字空间锁）。关闭无效的描述符返回 -EBADF。*/
+int session_open(session_t *session, const char *path, int flags);
+int session_close(session_t *session, int fd);
+
+// 会话中是否还有打开该inode的文件
+int session_has_inode(const session_t *session, uint32_t inode_no);
+
+#endif // SESSION_H
@@ -0,0 +1,68 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "ext2.h"
+#include <stdint.h>
+
+// 增量文件（snapdiff 的输出）的魔数和版本
+#define SNAPSHOT_DELTA_MAGIC 0x44534E53u   // "SNSD"
+#define SNAPSHOT_DELTA_VERSION 1
+
+/*增量文件格式：头部之后是 count 条记录，每条是4字节块号紧跟该块 block_size 字节的内容。
+记录按块号升序排列，块0（超级块）已去掉快照表。*/
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t block_size;
+    uint32_t blocks_count;
+    uint32_t count;
+    uint32_t from_id;
+    uint32_t to_id;
+    uint32_t reserved;
+} snapshot_delta_header_t;
+
+typedef struct {
+    ext2_snapshot_t snapshot;
+    uint32_t blocks;     // 快照占用的块数（保存的旧内容和映射树）
+} snapshot_info_t;
+
+typedef struct {
+    uint32_t blocks;     // 写出的块数
+    uint64_t bytes;
+    double seconds;
+} snapshot_stats_t;
+
+/*挂载：init_disk_image 在重放日志之前调用 snapshot_load（重放的写同样要先保存旧内容，
+这时位图还没读入，旧内容暂存在内存里），读入位图后用重放之后的超级块调用 snapshot_attach：
+把快照占用的块并入 block_bitmap，再把暂存的内容写进快照，返回并入的块数，失败返回-1。
+snapshot_claim_storage 把快照占用的块并入块位图 bitmap（与 block_bitmap 相同布局），
+返回原来没有置位的块数；一致性检查用它保证快照的块不会被当成空闲块。*/
+int snapshot_load(const ext2_superblock_t *sb);
+int snapshot_attach(const ext2_superblock_t *sb);
+uint32_t snapshot_claim_storage(uint8_t *bitmap);
+void snapshot_unload(void);
+int snapshot_active(void);
+
+/*写时复制的钩子（只由 disk.c 调用）：snapshot_cow 在块被原地覆盖之前调用，
+活动快照还没保存的块先把旧内容复制一份；snapshot_keep_block 在块被释放时调用，
+返回1表示块转归活动快照所有（内容不用复制），调用者不再释放它。*/
+void snapshot_cow(uint32_t block_no, uint32_t count);
+int snapshot_keep_block(uint32_t block_no);
+
+/*快照命令（调用者持有名字空间写锁；export/diff 只读快照，持有读锁即可）。
+create 先把所有修改写回镜像，再以当前位图为准开始跟踪，不复制任何数据块；
+delete 把还被更早的快照需要的旧内容移交给它，其余的块释放。出错时打印原因并返回-1。*/
+int snapshot_create(const char *name);
+int snapshot_delete(const char *name);
+int snapshot_list(snapshot_info_t *infos, int max);
+
+// 把快照时刻的整个镜像写成宿主文件 host_image（可以直接挂载，挂载时会检查一遍）
+int snapshot_export(const char *name, const char *host_image, snapshot_stats_t *stats);
+
+// 把从快照 from 到更新的快照 to 之间变化的块写成增量文件
+int snapshot_diff(const char *from, const char *to, const char *host_delta, snapshot_stats_t *stats);
+
+// 把增量文件应用到宿主镜像文件上（通常是 from 快照导出的镜像），不需要挂载
+int snapshot_apply(const char *host_delta, const char *host_image, snapshot_stats_t *stats);
+
+#endif // SNAPSHOT_H
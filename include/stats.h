@@ -0,0 +1,69 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <time.h>
+
+/*热路径计数器：read_block/write_block、read_inode/write_inode、位图查找、目录项查找和路径解析
+各自统计调用次数、失败次数、总耗时、最大耗时和按2的幂分桶的延迟直方图。
+
+每个线程写自己的计数器，热路径上没有锁和原子读改写；汇总时把所有线程的计数器加起来。
+耗时包括内部调用的其他函数（path_to_inode 的时间包括它读目录和inode的时间）。
+编译时定义 EXT2_NO_STATS（make STATS=0）后 STATS_START/STATS_RECORD 展开为空，没有任何开销。*/
+
+typedef enum {
+    STATS_READ_BLOCK,
+    STATS_WRITE_BLOCK,
+    STATS_READ_INODE,
+    STATS_WRITE_INODE,
+    STATS_FIND_FREE_BIT,     // 所有位图查找（块和inode的分配、预留窗口）
+    STATS_FIND_DIR_ENTRY,
+    STATS_PATH_TO_INODE,
+    STATS_COUNT
+} stats_id_t;
+
+// 第 i 个桶统计耗时在 [2^i, 2^(i+1)) 纳秒之间的调用，最后一个桶包括所有更慢的调用
+#define STATS_BUCKETS 32
+
+typedef struct {
+    uint64_t calls;
+    uint64_t failed;        // 返回错误（位图已满、目录项或路径不存在）的调用
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t buckets[STATS_BUCKETS];
+} stats_counter_t;
+
+// 计数器名称（与函数名相同）
+const char *stats_name(int id);
+
+// 编译时是否启用了计数器
+int stats_enabled(void);
+
+/*汇总所有线程的计数器到 out[STATS_COUNT]，*seconds 返回距上次清零的秒数，*threads 返回记录过的线程数。
+读的同时其他线程可能还在计数，结果是近似的一致快照。*/
+void stats_collect(stats_counter_t *out, double *seconds, int *threads);
+
+// 清零所有计数器（各线程下次计数时清空自己的计数器）
+void stats_reset(void);
+
+// 由直方图估算第 p 分位的耗时（纳秒，取所在桶的上界）
+uint64_t stats_percentile(const stats_counter_t *c, double p);
+
+#ifndef EXT2_NO_STATS
+void stats_record(int id, uint64_t start, int failed);
+
+static inline uint64_t stats_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// 用法：函数开头 STATS_START(start)，返回之前 STATS_RECORD(STATS_xxx, start, ret != 0)
+#define STATS_START(var) uint64_t var = stats_clock()
+#define STATS_RECORD(id, var, failed) stats_record((id), (var), (failed))
+#else
+#define STATS_START(var) ((void)0)
+#define STATS_RECORD(id, var, failed) ((void)0)
+#endif
+
+#endif // STATS_H
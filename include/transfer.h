@@ -0,0 +1,31 @@
+#ifndef TRANSFER_H
+#define TRANSFER_H
+
+#include "ext2.h"
+#include <stdint.h>
+
+// 流水线每段缓冲区的大小和段数：读端最多领先写端 TRANSFER_DEPTH 段
+#define TRANSFER_CHUNK (1024 * 1024)
+#define TRANSFER_DEPTH 8
+
+typedef struct {
+    uint32_t files;        // 写完的普通文件数
+    uint32_t directories;  // 创建或合并的目录数（含顶层目录，单个文件时为0）
+    uint32_t symlinks;     // 符号链接数
+    uint32_t failed;       // 出错跳过的项目数
+    uint64_t bytes;        // 写入的文件内容字节数
+    double seconds;
+} transfer_stats_t;
+
+/*批量导入：host_path 是普通文件时导入到 path（不存在则创建，已存在则覆盖）；
+是目录时把整棵树导入到 path 下（目录已存在时合并），保留权限位和符号链接。
+宿主端由一个后台线程遍历和读取，调用线程写入镜像，两边通过 TRANSFER_DEPTH 段缓冲区并行；
+每个文件按宿主大小一次预留连续的块。调用者持有名字空间写锁。
+单个项目出错时打印原因并跳过，继续处理其余项目；有项目出错或空间不足中止时返回-1。*/
+int transfer_import(const char *host_path, const char *path, transfer_stats_t *stats);
+
+/*批量导出：path 是普通文件时导出到宿主文件 host_path，是目录时把整棵树导出到 host_path 下。
+调用线程读取镜像，后台线程写宿主端。调用者至少持有名字空间读锁。返回值同 transfer_import。*/
+int transfer_export(const char *path, const char *host_path, transfer_stats_t *stats);
+
+#endif // TRANSFER_H
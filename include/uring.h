@@ -0,0 +1,33 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// 每个环的提交队列项数（一批超过这个数目的请求分几次提交）
+#define URING_ENTRIES 64
+
+// 调用线程无法建立环（内核不支持或资源不足），调用者应改用同步I/O
+#define URING_UNAVAILABLE (-2)
+
+/*一次I/O：从 offset 开始按 iov 读或写 length 字节。
+短读写时环会推进 iov、offset 和 length 继续提交剩余部分，调用者在完成后不能再依赖它们的内容。*/
+typedef struct {
+    int writing;
+    off_t offset;
+    struct iovec *iov;
+    int iovcnt;
+    size_t length;
+} uring_io_t;
+
+// 探测内核是否支持 io_uring（同时为调用线程建立环），支持返回0
+int uring_probe(void);
+
+// 设置固定缓冲区区域（块缓存的内存），之后建立的环都会注册它
+void uring_set_region(void *base, size_t size);
+
+// 用调用线程的环提交一批请求并等待全部完成，任何一个失败返回-1
+int uring_submit_batch(int fd, uring_io_t *ios, int count);
+
+#endif // URING_H
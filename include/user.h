@@ -3,30 +3,38 @@
 
 #include "ext2.h"
 
-// 用户管理
+/*用户/组数据库：挂载时从超级块 s_users_inode 指向的隐藏文件读入，
+修改后立即写回该文件；镜像中没有数据库时使用默认用户（root、user1、user2）。*/
 int init_users(void);
+int load_users(void);
+int create_user_db(void);
+
+/*用户和组管理：成功返回0，名字或ID冲突返回-2，参数无效（含用户或组不存在）返回-3，
+写回镜像失败返回-1（此时修改被撤销）。查找返回记录下标，不存在返回-1。*/
 int add_user(const char *username, const char *password, uint16_t uid, uint16_t gid);
 int remove_user(const char *username);
 int find_user(const char *username);
+int add_group(const char *name, uint16_t gid);
+int find_group(const char *name);
 
 // 用户认证
 int login(const char *username, const char *password);
 void logout(void);
 int is_logged_in(void);
 
-// 权限检查
-int check_file_permission(uint32_t inode_no, int access);
-int check_directory_permission(uint32_t inode_no, int access);
+// 按当前会话的身份判断对一个inode副本的访问权限（access 以 EXT2_S_IRUSR 等属主权限位给出）
+int inode_permits(const ext2_inode_t *inode, int access);
 
 // 当前用户信息
 uint16_t get_current_uid(void);
 uint16_t get_current_gid(void);
 const char* get_current_username(void);
 
-// 用户列表
+// 用户和组列表
 void list_users(void);
+void list_groups(void);
 
-// 密码管理
+// 密码管理：用户不存在或旧密码不对返回-1，新密码太长返回-3
 int change_password(const char *username, const char *old_password, const char *new_password);
 
-#endif // USER_H 
\ No newline at end of file
+#endif // USER_H
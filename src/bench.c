@@ -0,0 +1,573 @@
+#include "../include/ext2.h"
+#include "../include/commands.h"
+#include "../include/inode.h"
+#include "../include/directory.h"
+#include "../include/disk.h"
+#include "../include/cache.h"
+#include "../include/journal.h"
+#include "../include/user.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+
+/*基准测试驱动（make bench）：与 ext2fs 链接同样的目标文件，不经过命令解析，直接调用内部接口。
+每个负载在一个新格式化的镜像上按固定的随机种子运行，结果可以重复。每个负载开始前重新挂载，
+块缓存、inode缓存和目录项缓存都是冷的。每个操作和命令一样放在 ext2_op_begin/ext2_op_end 之间，
+计时包括按同步策略落盘的时间。
+
+报告每个负载的操作数、ops/s、MB/s、延迟分位数，以及 /proc/self/io 中读写系统调用次数的增量
+（pread/pwrite 等都计入；io_uring 后端提交的I/O不经过这些系统调用）。*/
+
+#define BENCH_DIR_ENTRIES 256          // 每个目录放的文件数（目录最多 DIR_MAX_BLOCKS 块）
+#define BENCH_SEQ_CHUNK (64 * 1024)    // 顺序读写每次的字节数
+#define BENCH_RAND_CHUNK 4096          // 随机读写每次的字节数
+#define BENCH_FILL_FILE (1024 * 1024)  // 写满镜像时每个文件的大小
+#define BENCH_DEPTH 16                 // 深路径查找的目录层数
+
+typedef struct {
+    const char *image;
+    uint64_t size;
+    uint32_t block_size;
+    uint32_t ops;             // 元数据和随机读写负载的操作数
+    uint64_t file_size;       // 顺序和随机读写的文件大小
+    unsigned int seed;
+    disk_backend_t backend;
+    const char *sync_mode;
+} bench_config_t;
+
+typedef struct {
+    const char *name;
+    uint32_t ops;
+    uint64_t bytes;           // 读写的文件内容字节数，元数据负载为0
+    double seconds;
+    uint64_t *latencies;      // 每个操作的耗时（纳秒）
+    uint64_t reads;           // 读写系统调用次数
+    uint64_t writes;
+    int failed;
+} bench_result_t;
+
+static bench_config_t config;
+static uint8_t *data_buffer;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// 本进程到目前为止的读写系统调用次数，不支持时都是0
+static void syscall_counts(uint64_t *reads, uint64_t *writes) {
+    *reads = 0;
+    *writes = 0;
+    FILE *f = fopen("/proc/self/io", "r");
+    if (f == NULL) {
+        return;
+    }
+    char line[128];
+    unsigned long long value;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "syscr: %llu", &value) == 1) {
+            *reads = value;
+        } else if (sscanf(line, "syscw: %llu", &value) == 1) {
+            *writes = value;
+        }
+    }
+    fclose(f);
+}
+
+// 重新挂载：负载之间清空所有缓存
+static int remount(void) {
+    if (cmd_mount(config.image, config.backend) != 0 || cmd_login("root", "root") != 0) {
+        return -1;
+    }
+    return cmd_syncmode(config.sync_mode);
+}
+
+static void result_begin(bench_result_t *r, const char *name, uint32_t max_ops) {
+    memset(r, 0, sizeof(*r));
+    r->name = name;
+    r->latencies = malloc(sizeof(uint64_t) * (max_ops > 0 ? max_ops : 1));
+    if (r->latencies == NULL) {
+        r->failed = 1;
+    }
+    syscall_counts(&r->reads, &r->writes);
+    r->seconds = now_ns() / 1e9;
+}
+
+static void result_end(bench_result_t *r) {
+    r->seconds = now_ns() / 1e9 - r->seconds;
+    uint64_t reads, writes;
+    syscall_counts(&reads, &writes);
+    r->reads = reads - r->reads;
+    r->writes = writes - r->writes;
+}
+
+static void record(bench_result_t *r, uint64_t start, uint64_t bytes) {
+    r->latencies[r->ops++] = now_ns() - start;
+    r->bytes += bytes;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// 排好序的延迟中第 p 分位的值（微秒）
+static double percentile(const bench_result_t *r, double p) {
+    if (r->ops == 0) {
+        return 0.0;
+    }
+    uint32_t index = (uint32_t)(p * r->ops);
+    if (index >= r->ops) {
+        index = r->ops - 1;
+    }
+    return r->latencies[index] / 1000.0;
+}
+
+static void print_header(void) {
+    printf("%-10s %8s %9s %11s %9s %9s %9s %9s %9s %9s %9s\n", "workload", "ops", "seconds", "ops/s",
+           "MB/s", "p50 us", "p90 us", "p99 us", "max us", "reads", "writes");
+}
+
+static void print_result(bench_result_t *r) {
+    qsort(r->latencies, r->ops, sizeof(uint64_t), compare_u64);
+    double seconds = r->seconds > 1e-9 ? r->seconds : 1e-9;
+    char mbs[16] = "-";
+    if (r->bytes > 0) {
+        snprintf(mbs, sizeof(mbs), "%.1f", r->bytes / (1024.0 * 1024.0) / seconds);
+    }
+    printf("%-10s %8u %9.3f %11.1f %9s %9.1f %9.1f %9.1f %9.1f %9llu %9llu%s\n", r->name, r->ops,
+           r->seconds, r->ops / seconds, mbs, percentile(r, 0.50), percentile(r, 0.90),
+           percentile(r, 0.99), r->ops > 0 ? r->latencies[r->ops - 1] / 1000.0 : 0.0,
+           (unsigned long long)r->reads, (unsigned long long)r->writes,
+           r->failed ? "  (failed)" : "");
+    free(r->latencies);
+    r->latencies = NULL;
+}
+
+// 元数据负载的第 i 个文件：目录 /m/dNNNN 下的 fNNNNN
+static void meta_name(uint32_t i, char *dir, char *name) {
+    sprintf(dir, "/m/d%04u", i / BENCH_DIR_ENTRIES);
+    sprintf(name, "f%05u", i % BENCH_DIR_ENTRIES + i / BENCH_DIR_ENTRIES * BENCH_DIR_ENTRIES);
+}
+
+// 0 .. n-1 的随机排列（用配置的种子，结果可重复）
+static uint32_t *shuffled(uint32_t n) {
+    uint32_t *order = malloc(sizeof(uint32_t) * (n > 0 ? n : 1));
+    if (order == NULL) {
+        return NULL;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        order[i] = i;
+    }
+    for (uint32_t i = n; i > 1; i--) {
+        uint32_t j = rand() % i;
+        uint32_t t = order[i - 1];
+        order[i - 1] = order[j];
+        order[j] = t;
+    }
+    return order;
+}
+
+/*元数据风暴：create 用 create_inode + add_directory_entry 建文件，stat 按随机顺序解析路径并读inode，
+unlink 按随机顺序删除。三个阶段各自报告，文件分散在每个 BENCH_DIR_ENTRIES 项的目录中。*/
+static void bench_meta(bench_result_t *results, int *count) {
+    uint32_t n = config.ops;
+    uint32_t dirs = (n + BENCH_DIR_ENTRIES - 1) / BENCH_DIR_ENTRIES;
+    uint32_t *parents = malloc(sizeof(uint32_t) * (dirs > 0 ? dirs : 1));
+    uint32_t *order = shuffled(n);
+    char dir[32];
+    char name[32];
+    char path[64];
+    if (parents == NULL || order == NULL || remount() != 0) {
+        free(parents);
+        free(order);
+        return;
+    }
+
+    ext2_op_begin();
+    int ok = create_directory("/m", 0755) == 0;
+    for (uint32_t d = 0; d < dirs && ok; d++) {
+        meta_name(d * BENCH_DIR_ENTRIES, dir, name);
+        ok = create_directory(dir, 0755) == 0 && path_to_inode(dir, &parents[d]) == 0;
+    }
+    ext2_op_end();
+
+    bench_result_t *r = &results[(*count)++];
+    result_begin(r, "create", n);
+    for (uint32_t i = 0; i < n && ok && !r->failed; i++) {
+        meta_name(i, dir, name);
+        uint64_t start = now_ns();
+        ext2_op_begin();
+        dir_lock_exclusive();
+        uint32_t inode_no = create_inode(parents[i / BENCH_DIR_ENTRIES], EXT2_S_IFREG | 0644, 0, 0);
+        if (inode_no == 0 || add_directory_entry(parents[i / BENCH_DIR_ENTRIES], name, inode_no, 1) != 0) {
+            r->failed = 1;
+        }
+        dir_unlock();
+        ext2_op_end();
+        record(r, start, 0);
+    }
+    result_end(r);
+    r->failed |= !ok;
+
+    remount();
+    r = &results[(*count)++];
+    result_begin(r, "stat", n);
+    for (uint32_t i = 0; i < n && ok && !r->failed; i++) {
+        meta_name(order[i], dir, name);
+        snprintf(path, sizeof(path), "%s/%s", dir, name);
+        uint64_t start = now_ns();
+        ext2_op_begin();
+        dir_lock_shared();
+        uint32_t inode_no;
+        if (path_to_inode(path, &inode_no) != 0 || !is_regular_file(inode_no)) {
+            r->failed = 1;
+        }
+        dir_unlock();
+        ext2_op_end();
+        record(r, start, 0);
+    }
+    result_end(r);
+
+    remount();
+    r = &results[(*count)++];
+    result_begin(r, "unlink", n);
+    for (uint32_t i = 0; i < n && ok && !r->failed; i++) {
+        meta_name(order[i], dir, name);
+        uint64_t start = now_ns();
+        ext2_op_begin();
+        dir_lock_exclusive();
+        if (unlink_entry(parents[order[i] / BENCH_DIR_ENTRIES], name) != 0) {
+            r->failed = 1;
+        }
+        dir_unlock();
+        ext2_op_end();
+        record(r, start, 0);
+    }
+    result_end(r);
+
+    free(parents);
+    free(order);
+}
+
+static int open_data_file(const char *path, uint32_t *inode_no) {
+    if (path_to_inode(path, inode_no) == 0) {
+        return 0;
+    }
+    fs.quiet = 1;
+    if (cmd_create(path) != 0) {
+        return -1;
+    }
+    return path_to_inode(path, inode_no);
+}
+
+// 顺序或随机地读写 /data：顺序每次 BENCH_SEQ_CHUNK 字节写满（读完）整个文件，随机每次 BENCH_RAND_CHUNK 字节
+static void bench_data(bench_result_t *results, int *count, const char *name, int writing, int random) {
+    uint32_t chunk = random ? BENCH_RAND_CHUNK : BENCH_SEQ_CHUNK;
+    uint64_t chunks = config.file_size / chunk;
+    uint32_t n = random ? config.ops : (uint32_t)chunks;
+    uint32_t inode_no;
+    bench_result_t *r = &results[(*count)++];
+    if (remount() != 0 || chunks == 0) {
+        result_begin(r, name, 0);
+        result_end(r);
+        r->failed = 1;
+        return;
+    }
+    ext2_op_begin();
+    int ok = open_data_file("/data", &inode_no) == 0;
+    ext2_op_end();
+    // 单独运行读负载时先把文件写满（不计时），再重新挂载让缓存变冷
+    if (ok && !writing && get_file_size(inode_no) < config.file_size) {
+        for (uint64_t offset = 0; offset < config.file_size && ok; offset += BENCH_SEQ_CHUNK) {
+            ext2_op_begin();
+            ok = write_inode_data(inode_no, data_buffer, BENCH_SEQ_CHUNK, offset) == BENCH_SEQ_CHUNK;
+            ext2_op_end();
+        }
+        ok = ok && remount() == 0;
+    }
+
+    result_begin(r, name, n);
+    r->failed |= !ok;
+    for (uint32_t i = 0; i < n && !r->failed; i++) {
+        off_t offset = (off_t)(random ? (uint64_t)rand() % chunks : i) * chunk;
+        uint64_t start = now_ns();
+        ext2_op_begin();
+        ssize_t done = writing ? write_inode_data(inode_no, data_buffer, chunk, offset) :
+                                 read_inode_data(inode_no, data_buffer, chunk, offset);
+        ext2_op_end();
+        if (done != (ssize_t)chunk) {
+            r->failed = 1;
+        }
+        record(r, start, done > 0 ? (uint64_t)done : 0);
+    }
+    result_end(r);
+}
+
+// 深路径查找：BENCH_DEPTH 层目录下的一个文件，反复解析它的完整路径
+static void bench_lookup(bench_result_t *results, int *count) {
+    char path[MAX_PATH] = "/l";
+    bench_result_t *r = &results[(*count)++];
+    if (remount() != 0) {
+        result_begin(r, "lookup", 0);
+        result_end(r);
+        r->failed = 1;
+        return;
+    }
+    ext2_op_begin();
+    int ok = path_to_inode(path, &(uint32_t){0}) == 0 || create_directory(path, 0755) == 0;
+    for (int level = 0; level < BENCH_DEPTH && ok; level++) {
+        size_t len = strlen(path);
+        snprintf(path + len, sizeof(path) - len, "/level%02d", level);
+        ok = path_to_inode(path, &(uint32_t){0}) == 0 || create_directory(path, 0755) == 0;
+    }
+    strcat(path, "/leaf");
+    uint32_t leaf;
+    ok = ok && open_data_file(path, &leaf) == 0;
+    ext2_op_end();
+    remount();
+
+    result_begin(r, "lookup", config.ops);
+    r->failed |= !ok;
+    for (uint32_t i = 0; i < config.ops && !r->failed; i++) {
+        uint64_t start = now_ns();
+        ext2_op_begin();
+        dir_lock_shared();
+        uint32_t inode_no;
+        if (path_to_inode(path, &inode_no) != 0 || inode_no != leaf) {
+            r->failed = 1;
+        }
+        dir_unlock();
+        ext2_op_end();
+        record(r, start, 0);
+    }
+    result_end(r);
+}
+
+/*写满镜像：不断建 BENCH_FILL_FILE 字节的文件，每次写 BENCH_SEQ_CHUNK 字节，直到空间不足（写不满一次），
+测的是分配器在越来越满的位图上的表现。之后的 drain 把这些文件全部删除。*/
+static void bench_fill(bench_result_t *results, int *count) {
+    // 文件数的上限按整个镜像的大小算，写不满之前一定会碰到空间不足
+    uint32_t max_files = (uint32_t)(config.size / BENCH_FILL_FILE) + 2;
+    uint32_t max_ops = max_files * (BENCH_FILL_FILE / BENCH_SEQ_CHUNK);
+    char dir[32];
+    char name[32];
+    char path[64];
+    bench_result_t *r = &results[(*count)++];
+    if (remount() != 0) {
+        result_begin(r, "fill", 0);
+        result_end(r);
+        r->failed = 1;
+        return;
+    }
+    // 前面的负载留下的数据文件先删掉
+    ext2_op_begin();
+    dir_lock_exclusive();
+    uint32_t root;
+    if (path_to_inode("/", &root) == 0) {
+        unlink_entry(root, "data");
+    }
+    dir_unlock();
+    int ok = create_directory("/f", 0755) == 0;
+    ext2_op_end();
+
+    result_begin(r, "fill", max_ops);
+    r->failed |= !ok;
+    uint32_t files = 0;
+    int full = 0;
+    while (!full && ok && files < max_files && !r->failed) {
+        if (files % BENCH_DIR_ENTRIES == 0) {
+            sprintf(dir, "/f/d%04u", files / BENCH_DIR_ENTRIES);
+            ext2_op_begin();
+            ok = create_directory(dir, 0755) == 0;
+            ext2_op_end();
+        }
+        snprintf(path, sizeof(path), "%s/f%05u", dir, files);
+        uint32_t inode_no;
+        ext2_op_begin();
+        ok = ok && open_data_file(path, &inode_no) == 0;
+        ext2_op_end();
+        files += ok;
+        for (off_t offset = 0; ok && offset < BENCH_FILL_FILE && r->ops < max_ops; offset += BENCH_SEQ_CHUNK) {
+            uint64_t start = now_ns();
+            ext2_op_begin();
+            ssize_t done = write_inode_data(inode_no, data_buffer, BENCH_SEQ_CHUNK, offset);
+            ext2_op_end();
+            record(r, start, done > 0 ? (uint64_t)done : 0);
+            if (done != BENCH_SEQ_CHUNK) {
+                full = 1;
+                break;
+            }
+        }
+    }
+    result_end(r);
+    r->failed |= !full;
+
+    remount();
+    r = &results[(*count)++];
+    result_begin(r, "drain", files);
+    for (uint32_t i = 0; i < files && !r->failed; i++) {
+        sprintf(dir, "/f/d%04u", i / BENCH_DIR_ENTRIES);
+        snprintf(name, sizeof(name), "f%05u", i);
+        uint32_t parent;
+        uint64_t start = now_ns();
+        ext2_op_begin();
+        dir_lock_exclusive();
+        if (path_to_inode(dir, &parent) != 0 || unlink_entry(parent, name) != 0) {
+            r->failed = 1;
+        }
+        dir_unlock();
+        ext2_op_end();
+        record(r, start, 0);
+    }
+    result_end(r);
+}
+
+// 解析带 K/M/G 后缀的大小
+static int parse_size(const char *str, uint64_t *size) {
+    char *end;
+    unsigned long long value = strtoull(str, &end, 10);
+    if (end == str) {
+        return -1;
+    }
+    switch (*end) {
+    case 'G': case 'g': value <<= 10; /* fall through */
+    case 'M': case 'm': value <<= 10; /* fall through */
+    case 'K': case 'k': value <<= 10; end++; break;
+    case '\0': break;
+    default: return -1;
+    }
+    if (*end != '\0') {
+        return -1;
+    }
+    *size = value;
+    return 0;
+}
+
+static void usage(void) {
+    printf("Usage: ./ext2fs_bench [-i image] [-s size] [-b block_size] [-n ops] [-f file_size]\n"
+           "                      [-r seed] [-m op|N|umount] [-M | -U] [workload ...]\n");
+    printf("  -i image       Scratch image, formatted for each run (default bench.img)\n");
+    printf("  -s size        Image size (default 256M)\n");
+    printf("  -b block_size  Block size (default 1024)\n");
+    printf("  -n ops         Operations for create/stat/unlink, random I/O and lookup (default 10000)\n");
+    printf("  -f file_size   File size for sequential and random I/O (default 64M)\n");
+    printf("  -r seed        Random seed (default 1)\n");
+    printf("  -m mode        Sync mode, as for the syncmode command (default op)\n");
+    printf("  -M, -U         Use the mmap or io_uring backend\n");
+    printf("Workloads: meta (create, stat, unlink), seqwrite, seqread, randwrite, randread, lookup, fill (fill, drain)\n");
+    printf("Without workloads, all of them run in this order\n");
+}
+
+int main(int argc, char *argv[]) {
+    static const char *all[] = {"meta", "seqwrite", "seqread", "randwrite", "randread", "lookup", "fill"};
+    config.image = "bench.img";
+    config.size = 256ull << 20;
+    config.block_size = DEFAULT_BLOCK_SIZE;
+    config.ops = 10000;
+    config.file_size = 64ull << 20;
+    config.seed = 1;
+    config.backend = DISK_BACKEND_FD;
+    config.sync_mode = "op";
+
+    int opt;
+    uint64_t value;
+    while ((opt = getopt(argc, argv, "i:s:b:n:f:r:m:MUh")) != -1) {
+        switch (opt) {
+        case 'i':
+            config.image = optarg;
+            break;
+        case 's':
+        case 'f':
+            if (parse_size(optarg, &value) != 0) {
+                usage();
+                return 1;
+            }
+            *(opt == 's' ? &config.size : &config.file_size) = value;
+            break;
+        case 'b':
+            config.block_size = atoi(optarg);
+            break;
+        case 'n':
+            config.ops = atoi(optarg);
+            break;
+        case 'r':
+            config.seed = atoi(optarg);
+            break;
+        case 'm':
+            config.sync_mode = optarg;
+            break;
+        case 'M':
+            config.backend = DISK_BACKEND_MMAP;
+            break;
+        case 'U':
+            config.backend = DISK_BACKEND_URING;
+            break;
+        default:
+            usage();
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    const char **workloads = optind < argc ? (const char **)&argv[optind] : all;
+    int workload_count = optind < argc ? argc - optind : (int)(sizeof(all) / sizeof(all[0]));
+    for (int i = 0; i < workload_count; i++) {
+        int known = 0;
+        for (size_t j = 0; j < sizeof(all) / sizeof(all[0]); j++) {
+            known |= strcmp(workloads[i], all[j]) == 0;
+        }
+        if (!known) {
+            printf("Error: Unknown workload: %s\n", workloads[i]);
+            usage();
+            return 1;
+        }
+    }
+
+    data_buffer = malloc(BENCH_SEQ_CHUNK);
+    if (data_buffer == NULL || ext2_init(NULL) != 0) {
+        printf("Error: Failed to initialize file system\n");
+        return 1;
+    }
+    fs.quiet = 1;
+    srand(config.seed);
+    for (int i = 0; i < BENCH_SEQ_CHUNK; i++) {
+        data_buffer[i] = rand();
+    }
+    if (cmd_format(config.image, config.size, config.block_size, 8192) != 0) {
+        return 1;
+    }
+
+    printf("Image %s: %llu MB, %u-byte blocks, %s backend, sync mode %s, seed %u\n", config.image,
+           (unsigned long long)(config.size >> 20), config.block_size,
+           config.backend == DISK_BACKEND_MMAP ? "mmap" : config.backend == DISK_BACKEND_URING ? "io_uring" : "fd",
+           config.sync_mode, config.seed);
+    print_header();
+
+    bench_result_t results[4];
+    for (int i = 0; i < workload_count; i++) {
+        int count = 0;
+        const char *w = workloads[i];
+        if (strcmp(w, "meta") == 0) {
+            bench_meta(results, &count);
+        } else if (strcmp(w, "seqwrite") == 0 || strcmp(w, "seqread") == 0 ||
+                   strcmp(w, "randwrite") == 0 || strcmp(w, "randread") == 0) {
+            bench_data(results, &count, w, strstr(w, "write") != NULL, strncmp(w, "rand", 4) == 0);
+        } else if (strcmp(w, "lookup") == 0) {
+            bench_lookup(results, &count);
+        } else {
+            bench_fill(results, &count);
+        }
+        for (int j = 0; j < count; j++) {
+            print_result(&results[j]);
+        }
+        fflush(stdout);
+    }
+
+    ext2_cleanup();
+    free(data_buffer);
+    return 0;
+}
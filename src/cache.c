@@ -0,0 +1,423 @@
+#include "../include/cache.h"
+#include "../include/disk.h"
+#include "../include/ext2.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/*块缓存：位于 read_block/write_block 与磁盘镜像之间。
+
+以块号为键做哈希查找，使用 CLOCK 算法淘汰（每个缓冲区一个访问位，
+时钟指针扫过时清除访问位，遇到访问位为 0 的缓冲区即淘汰）。
+写操作只修改缓存并置脏，脏块在被淘汰或 bcache_flush 时才写回磁盘。
+缓存按块号分段加锁，多个线程可以同时访问。
+
+启用日志后，脏块在写进日志（bcache_commit）之前被钉在缓存中，淘汰时跳过，
+原地写回的只会是已经提交的内容；已提交的脏块照常在淘汰或检查点时写回。*/
+
+typedef struct {
+    uint32_t block_no;
+    int valid;            // 缓冲区中是否有有效数据
+    int dirty;            // 是否需要写回
+    int logged;           // 当前内容已写进日志（只对脏块有意义）
+    int referenced;       // CLOCK 访问位
+    int hash_next;        // 同一哈希桶中的下一个缓冲区，-1 表示结束
+    uint8_t data[EXT2_MAX_BLOCK_SIZE];
+} bcache_buf_t;
+
+/*锁分段：按块号哈希把缓存分成 BCACHE_STRIPES 段，每段有自己的缓冲区、哈希桶、
+时钟指针、统计和互斥锁，访问不同段的线程互不阻塞。*/
+#define STRIPE_BUFFERS (BCACHE_BUFFERS / BCACHE_STRIPES)
+#define STRIPE_BUCKETS (BCACHE_BUCKETS / BCACHE_STRIPES)
+
+typedef struct {
+    pthread_mutex_t lock;
+    bcache_buf_t buffers[STRIPE_BUFFERS];
+    int buckets[STRIPE_BUCKETS];
+    int clock_hand;
+    int pinned;           // 段内未提交的脏块数
+    bcache_stats_t stats;
+} bcache_stripe_t;
+
+static bcache_stripe_t stripes[BCACHE_STRIPES];
+static int journaling = 0;
+static pthread_once_t locks_once = PTHREAD_ONCE_INIT;
+static bcache_stats_t total_stats;
+
+static void init_locks(void) {
+    for (int s = 0; s < BCACHE_STRIPES; s++) {
+        pthread_mutex_init(&stripes[s].lock, NULL);
+    }
+}
+
+static unsigned int hash_of(uint32_t block_no) {
+    return block_no * 2654435761u;
+}
+
+// 块所在的段，调用者随后对它加锁
+static bcache_stripe_t *stripe_of(uint32_t block_no) {
+    pthread_once(&locks_once, init_locks);
+    return &stripes[(hash_of(block_no) >> 16) % BCACHE_STRIPES];
+}
+
+static unsigned int bucket_of(uint32_t block_no) {
+    return hash_of(block_no) % STRIPE_BUCKETS;
+}
+
+static int lookup(bcache_stripe_t *st, uint32_t block_no) {
+    int i = st->buckets[bucket_of(block_no)];
+    while (i != -1) {
+        if (st->buffers[i].valid && st->buffers[i].block_no == block_no) {
+            return i;
+        }
+        i = st->buffers[i].hash_next;
+    }
+    return -1;
+}
+
+static void hash_remove(bcache_stripe_t *st, int index) {
+    int *link = &st->buckets[bucket_of(st->buffers[index].block_no)];
+    while (*link != -1) {
+        if (*link == index) {
+            *link = st->buffers[index].hash_next;
+            return;
+        }
+        link = &st->buffers[*link].hash_next;
+    }
+}
+
+static void hash_insert(bcache_stripe_t *st, int index) {
+    unsigned int b = bucket_of(st->buffers[index].block_no);
+    st->buffers[index].hash_next = st->buckets[b];
+    st->buckets[b] = index;
+}
+
+// 修改缓冲区的脏/已记录状态，同时维护段内未提交脏块的计数
+static void set_state(bcache_stripe_t *st, int index, int dirty, int logged) {
+    bcache_buf_t *buf = &st->buffers[index];
+    st->pinned -= buf->dirty && !buf->logged;
+    buf->dirty = dirty;
+    buf->logged = logged;
+    st->pinned += dirty && !logged;
+}
+
+static int write_back(bcache_stripe_t *st, int index) {
+    if (disk_write_block(st->buffers[index].block_no, st->buffers[index].data) != 0) {
+        return -1;
+    }
+    set_state(st, index, 0, 0);
+    st->stats.writebacks++;
+    return 0;
+}
+
+// 用 CLOCK 算法在段内挑选一个可复用的缓冲区，脏块先写回
+static int get_victim(bcache_stripe_t *st) {
+    for (int scanned = 0; scanned < 2 * STRIPE_BUFFERS + 1; scanned++) {
+        int i = st->clock_hand;
+        st->clock_hand = (st->clock_hand + 1) % STRIPE_BUFFERS;
+        bcache_buf_t *buf = &st->buffers[i];
+
+        if (!buf->valid) {
+            return i;
+        }
+        if (buf->referenced) {
+            buf->referenced = 0;
+            continue;
+        }
+        if (buf->dirty && journaling && !buf->logged) {
+            continue; // 还没提交的修改不能原地写回
+        }
+        if (buf->dirty && write_back(st, i) != 0) {
+            continue; // 写回失败的块保留在缓存中
+        }
+
+        hash_remove(st, i);
+        buf->valid = 0;
+        st->stats.evictions++;
+        return i;
+    }
+    return -1;
+}
+
+static void reset_stripe(bcache_stripe_t *st) {
+    memset(st->buffers, 0, sizeof(st->buffers));
+    for (int i = 0; i < STRIPE_BUCKETS; i++) {
+        st->buckets[i] = -1;
+    }
+    for (int i = 0; i < STRIPE_BUFFERS; i++) {
+        st->buffers[i].hash_next = -1;
+    }
+    st->clock_hand = 0;
+    st->pinned = 0;
+}
+
+void bcache_init(void) {
+    pthread_once(&locks_once, init_locks);
+    for (int s = 0; s < BCACHE_STRIPES; s++) {
+        pthread_mutex_lock(&stripes[s].lock);
+        reset_stripe(&stripes[s]);
+        pthread_mutex_unlock(&stripes[s].lock);
+    }
+}
+
+int bcache_read(uint32_t block_no, void *buffer) {
+    bcache_stripe_t *st = stripe_of(block_no);
+    pthread_mutex_lock(&st->lock);
+
+    int i = lookup(st, block_no);
+    if (i != -1) {
+        st->stats.hits++;
+        st->buffers[i].referenced = 1;
+        memcpy(buffer, st->buffers[i].data, BLOCK_SIZE);
+        pthread_mutex_unlock(&st->lock);
+        return 0;
+    }
+
+    st->stats.misses++;
+    i = get_victim(st);
+    if (i == -1) {
+        // 缓存无法腾出空间时直接读盘
+        pthread_mutex_unlock(&st->lock);
+        return disk_read_block(block_no, buffer);
+    }
+
+    bcache_buf_t *buf = &st->buffers[i];
+    if (disk_read_block(block_no, buf->data) != 0) {
+        pthread_mutex_unlock(&st->lock);
+        return -1;
+    }
+
+    buf->block_no = block_no;
+    buf->valid = 1;
+    set_state(st, i, 0, 0);
+    buf->referenced = 1;
+    hash_insert(st, i);
+
+    memcpy(buffer, buf->data, BLOCK_SIZE);
+    pthread_mutex_unlock(&st->lock);
+    return 0;
+}
+
+int bcache_write(uint32_t block_no, const void *buffer) {
+    bcache_stripe_t *st = stripe_of(block_no);
+    pthread_mutex_lock(&st->lock);
+
+    int i = lookup(st, block_no);
+    if (i == -1) {
+        // 整块写入，无需先从磁盘读出旧内容
+        i = get_victim(st);
+        if (i == -1) {
+            // 段内全是未提交的脏块时只能直接写盘（这个块不受日志保护）
+            pthread_mutex_unlock(&st->lock);
+            return disk_write_block(block_no, buffer);
+        }
+        st->buffers[i].block_no = block_no;
+        st->buffers[i].valid = 1;
+        hash_insert(st, i);
+    }
+
+    memcpy(st->buffers[i].data, buffer, BLOCK_SIZE);
+    set_state(st, i, 1, 0);
+    st->buffers[i].referenced = 1;
+    pthread_mutex_unlock(&st->lock);
+    return 0;
+}
+
+int bcache_peek(uint32_t block_no, void *buffer) {
+    bcache_stripe_t *st = stripe_of(block_no);
+    pthread_mutex_lock(&st->lock);
+
+    int i = lookup(st, block_no);
+    if (i != -1) {
+        st->stats.hits++;
+        st->buffers[i].referenced = 1;
+        memcpy(buffer, st->buffers[i].data, BLOCK_SIZE);
+    }
+    pthread_mutex_unlock(&st->lock);
+    return i != -1 ? 0 : -1;
+}
+
+void bcache_update_clean(uint32_t block_no, const void *buffer) {
+    bcache_stripe_t *st = stripe_of(block_no);
+    pthread_mutex_lock(&st->lock);
+
+    int i = lookup(st, block_no);
+    if (i != -1) {
+        memcpy(st->buffers[i].data, buffer, BLOCK_SIZE);
+        set_state(st, i, 0, 0);
+    }
+    pthread_mutex_unlock(&st->lock);
+}
+
+void bcache_discard(uint32_t block_no) {
+    bcache_stripe_t *st = stripe_of(block_no);
+    pthread_mutex_lock(&st->lock);
+
+    int i = lookup(st, block_no);
+    if (i != -1) {
+        set_state(st, i, 0, 0);
+        hash_remove(st, i);
+        st->buffers[i].valid = 0;
+    }
+    pthread_mutex_unlock(&st->lock);
+}
+
+typedef struct {
+    uint32_t block_no;
+    bcache_stripe_t *stripe;
+    int index;
+} dirty_ref_t;
+
+static int compare_dirty(const void *a, const void *b) {
+    uint32_t x = ((const dirty_ref_t*)a)->block_no;
+    uint32_t y = ((const dirty_ref_t*)b)->block_no;
+    return (x > y) - (x < y);
+}
+
+/*按块号顺序写回所有脏块（写回期间持有所有段的锁）。
+所有脏块作为一批交给 disk_write_scattered，相邻块合并为一次写；
+整批失败时改为逐块写回，写不进去的块保持为脏。*/
+int bcache_flush(void) {
+    dirty_ref_t dirty[BCACHE_BUFFERS];
+    uint32_t blocks[BCACHE_BUFFERS];
+    void *bufs[BCACHE_BUFFERS];
+    int count = 0;
+
+    pthread_once(&locks_once, init_locks);
+    for (int s = 0; s < BCACHE_STRIPES; s++) {
+        pthread_mutex_lock(&stripes[s].lock);
+        for (int i = 0; i < STRIPE_BUFFERS; i++) {
+            if (stripes[s].buffers[i].valid && stripes[s].buffers[i].dirty) {
+                dirty[count].block_no = stripes[s].buffers[i].block_no;
+                dirty[count].stripe = &stripes[s];
+                dirty[count].index = i;
+                count++;
+            }
+        }
+    }
+
+    qsort(dirty, count, sizeof(dirty_ref_t), compare_dirty);
+    for (int i = 0; i < count; i++) {
+        blocks[i] = dirty[i].block_no;
+        bufs[i] = dirty[i].stripe->buffers[dirty[i].index].data;
+    }
+
+    int result = 0;
+    if (count > 0 && disk_write_scattered(blocks, bufs, count) == 0) {
+        for (int i = 0; i < count; i++) {
+            set_state(dirty[i].stripe, dirty[i].index, 0, 0);
+            dirty[i].stripe->stats.writebacks++;
+        }
+    } else {
+        for (int i = 0; i < count; i++) {
+            if (write_back(dirty[i].stripe, dirty[i].index) != 0) {
+                result = -1;
+            }
+        }
+    }
+
+    for (int s = BCACHE_STRIPES - 1; s >= 0; s--) {
+        pthread_mutex_unlock(&stripes[s].lock);
+    }
+    return result;
+}
+
+/*把所有未提交的脏块（块号升序）交给 log 写进日志，成功后这些块标记为已提交，
+之后可以原地写回。收集和写日志期间持有所有段的锁，缓冲区内容不会变化。
+返回 log 的结果；没有未提交的块时仍然调用 log（count 为0）。*/
+int bcache_commit(bcache_log_fn log, void *arg) {
+    dirty_ref_t dirty[BCACHE_BUFFERS];
+    uint32_t blocks[BCACHE_BUFFERS];
+    void *bufs[BCACHE_BUFFERS];
+    int count = 0;
+
+    pthread_once(&locks_once, init_locks);
+    for (int s = 0; s < BCACHE_STRIPES; s++) {
+        pthread_mutex_lock(&stripes[s].lock);
+        for (int i = 0; i < STRIPE_BUFFERS; i++) {
+            bcache_buf_t *buf = &stripes[s].buffers[i];
+            if (buf->valid && buf->dirty && !buf->logged) {
+                dirty[count].block_no = buf->block_no;
+                dirty[count].stripe = &stripes[s];
+                dirty[count].index = i;
+                count++;
+            }
+        }
+    }
+
+    qsort(dirty, count, sizeof(dirty_ref_t), compare_dirty);
+    for (int i = 0; i < count; i++) {
+        blocks[i] = dirty[i].block_no;
+        bufs[i] = dirty[i].stripe->buffers[dirty[i].index].data;
+    }
+
+    int result = log(blocks, bufs, count, arg);
+    if (result == 0) {
+        for (int i = 0; i < count; i++) {
+            set_state(dirty[i].stripe, dirty[i].index, 1, 1);
+        }
+    }
+
+    for (int s = BCACHE_STRIPES - 1; s >= 0; s--) {
+        pthread_mutex_unlock(&stripes[s].lock);
+    }
+    return result;
+}
+
+void bcache_set_journaling(int enabled) {
+    pthread_once(&locks_once, init_locks);
+    for (int s = 0; s < BCACHE_STRIPES; s++) {
+        pthread_mutex_lock(&stripes[s].lock);
+    }
+    journaling = enabled;
+    for (int s = BCACHE_STRIPES - 1; s >= 0; s--) {
+        pthread_mutex_unlock(&stripes[s].lock);
+    }
+}
+
+// 有一个段的未提交脏块超过一半时返回1，提示调用者尽快提交
+int bcache_pressure(void) {
+    int busy = 0;
+    pthread_once(&locks_once, init_locks);
+    for (int s = 0; s < BCACHE_STRIPES && !busy; s++) {
+        pthread_mutex_lock(&stripes[s].lock);
+        busy = stripes[s].pinned > STRIPE_BUFFERS / 2;
+        pthread_mutex_unlock(&stripes[s].lock);
+    }
+    return busy;
+}
+
+// 丢弃所有缓存内容（调用前应先 bcache_flush）
+void bcache_invalidate(void) {
+    bcache_init();
+}
+
+void bcache_region(void **base, size_t *size) {
+    *base = stripes;
+    *size = sizeof(stripes);
+}
+
+// 汇总各段的统计（返回的结构在下次调用时更新）
+const bcache_stats_t *bcache_get_stats(void) {
+    memset(&total_stats, 0, sizeof(total_stats));
+    pthread_once(&locks_once, init_locks);
+    for (int s = 0; s < BCACHE_STRIPES; s++) {
+        pthread_mutex_lock(&stripes[s].lock);
+        total_stats.hits += stripes[s].stats.hits;
+        total_stats.misses += stripes[s].stats.misses;
+        total_stats.writebacks += stripes[s].stats.writebacks;
+        total_stats.evictions += stripes[s].stats.evictions;
+        pthread_mutex_unlock(&stripes[s].lock);
+    }
+    return &total_stats;
+}
+
+void bcache_reset_stats(void) {
+    pthread_once(&locks_once, init_locks);
+    for (int s = 0; s < BCACHE_STRIPES; s++) {
+        pthread_mutex_lock(&stripes[s].lock);
+        memset(&stripes[s].stats, 0, sizeof(bcache_stats_t));
+        pthread_mutex_unlock(&stripes[s].lock);
+    }
+}
@@ -3,12 +3,46 @@
 #include "../include/directory.h"
 #include "../include/user.h"
 #include "../include/disk.h"
+#include "../include/cache.h"
+#include "../include/icache.h"
+#include "../include/dcache.h"
+#include "../include/readahead.h"
+#include "../include/journal.h"
+#include "../include/fsck.h"
+#include "../include/transfer.h"
+#include "../include/snapshot.h"
+#include "../include/session.h"
+#include "../include/server.h"
+#include "../include/stats.h"
 #include "../include/ext2.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+
+// 命令中整段读写（read、导出到标准输出）每次处理的字节数
+#define CMD_IO_CHUNK (256 * 1024)
+
+// session_open 的错误码对应的提示
+static void print_open_error(int error) {
+    switch (error) {
+    case -ENOENT:
+        printf("Error: File not found\n");
+        break;
+    case -EISDIR:
+        printf("Error: Not a regular file\n");
+        break;
+    case -EACCES:
+        printf("Error: Permission denied\n");
+        break;
+    default:
+        printf("Error: Too many open files\n");
+        break;
+    }
+}
 
 // 文件操作命令
 int cmd_create(const char *path) {
@@ -30,18 +64,14 @@ int cmd_create(const char *path) {
         return -1;
     }
     
-    if (!is_directory(parent_inode)) {
-        printf("Error: Parent is not a directory\n");
-        return -1;
-    }
-    
-    if (!check_permission(parent_inode, EXT2_S_IWUSR)) {
-        printf("Error: Permission denied\n");
+    int error = check_access(parent_inode, EXT2_S_IFDIR, EXT2_S_IWUSR);
+    if (error != 0) {
+        printf(error == -ENOTDIR ? "Error: Parent is not a directory\n" : "Error: Permission denied\n");
         return -1;
     }
     
     // 创建文件inode
-    uint32_t file_inode = create_inode(EXT2_S_IFREG | 0644, get_current_uid(), get_current_gid());
+    uint32_t file_inode = create_inode(parent_inode, EXT2_S_IFREG | 0644, get_current_uid(), get_current_gid());
     if (file_inode == 0) {
         printf("Error: Failed to create file\n");
         return -1;
@@ -54,7 +84,74 @@ int cmd_create(const char *path) {
         return -1;
     }
     
-    printf("File created: %s\n", path);
+    ext2_info("File created: %s\n", path);
+    return 0;
+}
+
+/*符号链接：目标不超过 EXT2_INLINE_DATA_MAX 字节时内联在inode中（快速符号链接），
+更长的目标存放在数据块中。目标不必存在，解析路径时才跟随。*/
+int cmd_symlink(const char *target, const char *path) {
+    if (!is_logged_in()) {
+        printf("Error: Not logged in\n");
+        return -1;
+    }
+    
+    size_t len = strlen(target);
+    if (len == 0 || len >= MAX_PATH) {
+        printf("Error: Invalid link target\n");
+        return -1;
+    }
+    
+    uint32_t parent_inode;
+    char child_name[MAX_FILENAME];
+    if (get_parent_inode(path, &parent_inode, child_name) != 0 || parent_inode == 0) {
+        printf("Error: Parent directory does not exist\n");
+        return -1;
+    }
+    
+    int error = check_access(parent_inode, EXT2_S_IFDIR, EXT2_S_IWUSR);
+    if (error != 0) {
+        printf(error == -ENOTDIR ? "Error: Parent is not a directory\n" : "Error: Permission denied\n");
+        return -1;
+    }
+    
+    uint32_t link_inode = create_inode(parent_inode, EXT2_S_IFLNK | 0777, get_current_uid(), get_current_gid());
+    if (link_inode == 0) {
+        printf("Error: Failed to create symlink\n");
+        return -1;
+    }
+    
+    // 目录项类型 7 为符号链接
+    if (write_inode_data(link_inode, target, len, 0) != (ssize_t)len ||
+        add_directory_entry(parent_inode, child_name, link_inode, 7) != 0) {
+        delete_inode(link_inode);
+        printf("Error: Failed to create symlink\n");
+        return -1;
+    }
+    
+    ext2_info("Symlink created: %s -> %s\n", path, target);
+    return 0;
+}
+
+int cmd_readlink(const char *path) {
+    if (!is_logged_in()) {
+        printf("Error: Not logged in\n");
+        return -1;
+    }
+    
+    uint32_t inode_no;
+    if (path_to_inode_nofollow(path, &inode_no) != 0) {
+        printf("Error: File not found\n");
+        return -1;
+    }
+    
+    char target[MAX_PATH];
+    if (read_symlink(inode_no, target, sizeof(target)) < 0) {
+        printf("Error: Not a symbolic link\n");
+        return -1;
+    }
+    
+    printf("%s\n", target);
     return 0;
 }
 
@@ -64,8 +161,9 @@ int cmd_delete(const char *path) {
         return -1;
     }
     
+    // 删除符号链接本身，不跟随到它的目标
     uint32_t inode_no;
-    if (path_to_inode(path, &inode_no) != 0) {
+    if (path_to_inode_nofollow(path, &inode_no) != 0) {
         printf("Error: File not found\n");
         return -1;
     }
@@ -88,73 +186,122 @@ int cmd_delete(const char *path) {
         return -1;
     }
     
-    // 从父目录中删除目录项
-    if (remove_directory_entry(parent_inode, child_name) != 0) {
+    // 从父目录中删除目录项；还有其他硬链接时文件保留，最后一个链接删除时才释放
+    if (unlink_entry(parent_inode, child_name) != 0) {
         printf("Error: Failed to remove directory entry\n");
         return -1;
     }
     
-    // 删除文件inode
-    if (delete_inode(inode_no) != 0) {
-        printf("Error: Failed to delete file\n");
-        return -1;
-    }
-    
-    printf("File deleted: %s\n", path);
+    ext2_info("File deleted: %s\n", path);
     return 0;
 }
 
-int cmd_open(const char *path, int flags) {
+/*硬链接：在新路径添加一个指向同一inode的目录项，链接计数加一（目录不能硬链接）。
+symbolic 为真时创建符号链接。*/
+int cmd_ln(const char *target, const char *path, int symbolic) {
+    if (symbolic) {
+        return cmd_symlink(target, path);
+    }
     if (!is_logged_in()) {
         printf("Error: Not logged in\n");
         return -1;
     }
     
     uint32_t inode_no;
-    if (path_to_inode(path, &inode_no) != 0) {
+    if (path_to_inode(target, &inode_no) != 0) {
         printf("Error: File not found\n");
         return -1;
     }
+    if (is_directory(inode_no)) {
+        printf("Error: Cannot hard link a directory\n");
+        return -1;
+    }
     
-    if (!is_regular_file(inode_no)) {
-        printf("Error: Not a regular file\n");
+    uint32_t parent_inode;
+    char child_name[MAX_FILENAME + 1];
+    if (get_parent_inode(path, &parent_inode, child_name) != 0 || parent_inode == 0) {
+        printf("Error: Parent directory does not exist\n");
         return -1;
     }
     
-    // 检查权限
-    int access = 0;
-    if (flags & O_RDONLY) access |= EXT2_S_IRUSR;
-    if (flags & O_WRONLY) access |= EXT2_S_IWUSR;
-    if (flags & O_RDWR) access |= (EXT2_S_IRUSR | EXT2_S_IWUSR);
+    int error = check_access(parent_inode, EXT2_S_IFDIR, EXT2_S_IWUSR);
+    if (error != 0) {
+        printf(error == -ENOTDIR ? "Error: Parent is not a directory\n" : "Error: Permission denied\n");
+        return -1;
+    }
     
-    if (!check_permission(inode_no, access)) {
-        printf("Error: Permission denied\n");
+    uint8_t file_type = is_symlink(inode_no) ? 7 : 1;
+    if (add_directory_entry(parent_inode, child_name, inode_no, file_type) != 0) {
+        printf("Error: Failed to create link (file exists or directory full)\n");
         return -1;
     }
+    update_ctime(inode_no);
     
-    // 查找空闲文件描述符
-    int fd = -1;
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        if (!fs.open_files[i].is_open) {
-            fd = i;
-            break;
+    ext2_info("Link created: %s => %s\n", path, target);
+    return 0;
+}
+
+/*移动/重命名：只修改目录项，不复制文件数据。目标是已有的目录时移到该目录下，保留原来的名字。*/
+int cmd_mv(const char *source, const char *dest) {
+    if (!is_logged_in()) {
+        printf("Error: Not logged in\n");
+        return -1;
+    }
+    
+    char target[MAX_PATH];
+    uint32_t dest_inode;
+    if (path_to_inode(dest, &dest_inode) == 0 && is_directory(dest_inode)) {
+        const char *slash = strrchr(source, '/');
+        const char *name = slash != NULL ? slash + 1 : source;
+        if (snprintf(target, sizeof(target), "%s/%s", dest, name) >= (int)sizeof(target)) {
+            printf("Error: Path too long\n");
+            return -1;
         }
+    } else {
+        snprintf(target, sizeof(target), "%s", dest);
     }
     
-    if (fd == -1) {
-        printf("Error: Too many open files\n");
+    int error = rename_path(source, target);
+    switch (error) {
+    case 0:
+        ext2_info("Moved: %s -> %s\n", source, target);
+        return 0;
+    case -ENOENT:
+        printf("Error: File not found\n");
+        break;
+    case -EEXIST:
+        printf("Error: Destination already exists\n");
+        break;
+    case -EINVAL:
+        printf("Error: Invalid move\n");
+        break;
+    case -EACCES:
+        printf("Error: Permission denied\n");
+        break;
+    case -ENOTDIR:
+        printf("Error: Parent is not a directory\n");
+        break;
+    default:
+        printf("Error: Failed to move\n");
+        break;
+    }
+    return -1;
+}
+
+int cmd_open(const char *path, int flags) {
+    if (!is_logged_in()) {
+        printf("Error: Not logged in\n");
         return -1;
     }
     
-    // 打开文件
-    fs.open_files[fd].fd = fs.next_fd++;
-    fs.open_files[fd].inode_no = inode_no;
-    fs.open_files[fd].flags = flags;
-    fs.open_files[fd].offset = 0;
-    fs.open_files[fd].is_open = 1;
+    int fd = session_open(session_current(), path, flags);
+    if (fd < 0) {
+        print_open_error(fd);
+        return -1;
+    }
     
-    printf("File opened: %s (fd=%d)\n", path, fs.open_files[fd].fd);
-    return fs.open_files[fd].fd;
+    ext2_info("File opened: %s (fd=%d)\n", path, fd);
+    return fd;
 }
 
 int cmd_close(int fd) {
@@ -163,17 +310,13 @@ int cmd_close(int fd) {
         return -1;
     }
     
-    // 查找文件描述符
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        if (fs.open_files[i].is_open && fs.open_files[i].fd == fd) {
-            fs.open_files[i].is_open = 0;
-            printf("File closed: fd=%d\n", fd);
-            return 0;
-        }
+    if (session_close(session_current(), fd) != 0) {
+        printf("Error: Invalid file descriptor\n");
+        return -1;
     }
     
-    printf("Error: Invalid file descriptor\n");
-    return -1;
+    ext2_info("File closed: fd=%d\n", fd);
+    return 0;
 }
 
 int cmd_read(int fd, void *buffer, size_t size) {
@@ -182,25 +325,20 @@ int cmd_read(int fd, void *buffer, size_t size) {
         return -1;
     }
     
-    // 查找文件描述符
-    open_file_t *file = NULL;
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        if (fs.open_files[i].is_open && fs.open_files[i].fd == fd) {
-            file = &fs.open_files[i];
-            break;
-        }
-    }
-    
+    open_file_t *file = session_file(session_current(), fd);
     if (file == NULL) {
         printf("Error: Invalid file descriptor\n");
         return -1;
     }
     
-    if (!(file->flags & O_RDONLY) && !(file->flags & O_RDWR)) {
+    if ((file->flags & O_ACCMODE) == O_WRONLY) {
         printf("Error: File not opened for reading\n");
         return -1;
     }
     
+    // 顺序读时提前预读后面的块
+    readahead_access(&file->ra, file->inode_no, file->offset, size);
+    
     ssize_t bytes_read = read_inode_data(file->inode_no, buffer, size, file->offset);
     if (bytes_read > 0) {
         file->offset += bytes_read;
@@ -215,33 +353,172 @@ int cmd_write(int fd, const void *buffer, size_t size) {
         return -1;
     }
     
-    // 查找文件描述符
-    open_file_t *file = NULL;
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        if (fs.open_files[i].is_open && fs.open_files[i].fd == fd) {
-            file = &fs.open_files[i];
-            break;
-        }
-    }
-    
+    open_file_t *file = session_file(session_current(), fd);
     if (file == NULL) {
         printf("Error: Invalid file descriptor\n");
         return -1;
     }
     
-    if (!(file->flags & O_WRONLY) && !(file->flags & O_RDWR)) {
+    if ((file->flags & O_ACCMODE) == O_RDONLY) {
         printf("Error: File not opened for writing\n");
         return -1;
     }
     
+    // 失败或只写了一部分（空间不足、超过最大文件大小）都报错并返回-1，批处理在这里停下
     ssize_t bytes_written = write_inode_data(file->inode_no, buffer, size, file->offset);
-    if (bytes_written > 0) {
-        file->offset += bytes_written;
+    if (bytes_written < 0) {
+        printf((uint64_t)file->offset + size > UINT32_MAX ? "Error: File too large\n" : "Error: Failed to write file\n");
+        return -1;
+    }
+    file->offset += bytes_written;
+    if ((size_t)bytes_written < size) {
+        printf("Error: Only %zd of %zu bytes written (disk full or file too large)\n", bytes_written, size);
+        return -1;
     }
     
     return bytes_written;
 }
 
+int cmd_fallocate(const char *path, off_t size) {
+    if (!is_logged_in()) {
+        printf("Error: Not logged in\n");
+        return -1;
+    }
+    
+    uint32_t inode_no;
+    if (path_to_inode(path, &inode_no) != 0) {
+        printf("Error: File not found\n");
+        return -1;
+    }
+    
+    int error = check_access(inode_no, EXT2_S_IFREG, EXT2_S_IWUSR);
+    if (error != 0) {
+        printf(error == -EISDIR ? "Error: Not a regular file\n" : "Error: Permission denied\n");
+        return -1;
+    }
+    
+    error = preallocate_inode(inode_no, size);
+    if (error != 0) {
+        printf(error == -EFBIG ? "Error: File too large\n" : "Error: Failed to preallocate space\n");
+        return -1;
+    }
+    
+    ext2_info("Preallocated %ld bytes: %s\n", (long)size, path);
+    return 0;
+}
+
+/*截断到 size：变短时释放多余的块，变长时增加的部分是空洞（不分配块，读出来是零）。*/
+int cmd_truncate(const char *path, off_t size) {
+    if (!is_logged_in()) {
+        printf("Error: Not logged in\n");
+        return -1;
+    }
+    
+    uint32_t inode_no;
+    if (path_to_inode(path, &inode_no) != 0) {
+        printf("Error: File not found\n");
+        return -1;
+    }
+    
+    int error = check_access(inode_no, EXT2_S_IFREG, EXT2_S_IWUSR);
+    if (error != 0) {
+        printf(error == -EISDIR ? "Error: Not a regular file\n" : "Error: Permission denied\n");
+        return -1;
+    }
+    
+    if (truncate_inode(inode_no, size) != 0) {
+        printf("Error: Failed to truncate file (too large?)\n");
+        return -1;
+    }
+    
+    ext2_info("Truncated to %lld bytes: %s\n", (long long)size, path);
+    return 0;
+}
+
+// 打洞：区间内的整块释放，文件长度不变
+int cmd_punch(const char *path, off_t offset, off_t length) {
+    if (!is_logged_in()) {
+        printf("Error: Not logged in\n");
+        return -1;
+    }
+    
+    uint32_t inode_no;
+    if (path_to_inode(path, &inode_no) != 0) {
+        printf("Error: File not found\n");
+        return -1;
+    }
+    
+    int error = check_access(inode_no, EXT2_S_IFREG, EXT2_S_IWUSR);
+    if (error != 0) {
+        printf(error == -EISDIR ? "Error: Not a regular file\n" : "Error: Permission denied\n");
+        return -1;
+    }
+    
+    int freed = punch_inode(inode_no, offset, length);
+    if (freed < 0) {
+        printf("Error: Failed to punch hole\n");
+        return -1;
+    }
+    
+    ext2_info("Punched %lld bytes at %lld: %s (%d blocks freed)\n",
+              (long long)length, (long long)offset, path, freed);
+    return 0;
+}
+
+/*打开或关闭按簇压缩：对普通文件立即改写已有内容，对目录只影响之后在其中新建的文件。
+需要对它有写权限。*/
+int cmd_compress(const char *path, int enable) {
+    if (!is_logged_in()) {
+        printf("Error: Not logged in\n");
+        return -1;
+    }
+    
+    uint32_t inode_no;
+    if (path_to_inode(path, &inode_no) != 0) {
+        printf("Error: File not found\n");
+        return -1;
+    }
+    
+    int error = check_access(inode_no, 0, EXT2_S_IWUSR);
+    if (error != 0) {
+        printf("Error: Permission denied\n");
+        return -1;
+    }
+    if (!is_regular_file(inode_no) && !is_directory(inode_no)) {
+        printf("Error: Not a regular file or directory\n");
+        return -1;
+    }
+    
+    if (set_inode_compression(inode_no, enable) != 0) {
+        printf("Error: Failed to %s compression (no space left?)\n", enable ? "enable" : "disable");
+        return -1;
+    }
+    ext2_info("Compression %s: %s\n", enable ? "enabled" : "disabled", path);
+    return 0;
+}
+
+// 设置文件当前位置（可以越过文件末尾，之后的写入在中间留下空洞）
+int cmd_seek(int fd, off_t offset) {
+    if (!is_logged_in()) {
+        printf("Error: Not logged in\n");
+        return -1;
+    }
+    
+    open_file_t *file = session_file(session_current(), fd);
+    if (file == NULL) {
+        printf("Error: Invalid file descriptor\n");
+        return -1;
+    }
+    if (offset < 0) {
+        printf("Error: Invalid offset\n");
+        return -1;
+    }
+    
+    file->offset = offset;
+    ext2_info("Offset of fd %d set to %lld\n", fd, (long long)offset);
+    return 0;
+}
+
 // 目录操作命令
 int cmd_dir(const char *path) {
     if (!is_logged_in()) {
@@ -260,7 +537,7 @@ int cmd_mkdir(const char *path) {
     
     int result = create_directory(path, 0755);
     if (result == 0) {
-        printf("Directory created: %s\n", path);
+        ext2_info("Directory created: %s\n", path);
     } else {
         printf("Error: Failed to create directory\n");
     }
@@ -275,7 +552,7 @@ int cmd_rmdir(const char *path) {
     
     int result = delete_directory(path);
     if (result == 0) {
-        printf("Directory removed: %s\n", path);
+        ext2_info("Directory removed: %s\n", path);
     } else {
         printf("Error: Failed to remove directory\n");
     }
@@ -290,7 +567,7 @@ int cmd_cd(const char *path) {
     
     int result = change_directory(path);
     if (result == 0) {
-        printf("Changed directory to: %s\n", path);
+        ext2_info("Changed directory to: %s\n", path);
     } else {
         printf("Error: Failed to change directory\n");
     }
@@ -321,87 +598,319 @@ int cmd_users(void) {
     return 0;
 }
 
+int cmd_groups(void) {
+    if (!is_logged_in()) {
+        printf("Error: Not logged in\n");
+        return -1;
+    }
+    
+    list_groups();
+    return 0;
+}
+
+// 用户数据库的修改保存在镜像中，需要挂载镜像；增删用户和组只有root可以执行
+static int check_user_admin(int root_only) {
+    if (!is_logged_in()) {
+        printf("Error: Not logged in\n");
+        return -1;
+    }
+    if (fs.disk_image[0] == '\0') {
+        printf("Error: No disk image mounted\n");
+        return -1;
+    }
+    if (root_only && get_current_uid() != 0) {
+        printf("Error: Permission denied\n");
+        return -1;
+    }
+    return 0;
+}
+
+static void print_user_error(int result) {
+    if (result == -2) {
+        printf("Error: Name or ID already in use\n");
+    } else if (result == -3) {
+        printf("Error: Invalid name, password or group\n");
+    } else {
+        printf("Error: Failed to save user database\n");
+    }
+}
+
+int cmd_useradd(const char *username, const char *password, uint16_t uid, uint16_t gid) {
+    if (check_user_admin(1) != 0) {
+        return -1;
+    }
+    int result = add_user(username, password, uid, gid);
+    if (result != 0) {
+        print_user_error(result);
+        return -1;
+    }
+    ext2_info("User added: %s\n", username);
+    return 0;
+}
+
+int cmd_userdel(const char *username) {
+    if (check_user_admin(1) != 0) {
+        return -1;
+    }
+    if (strcmp(username, "root") == 0) {
+        printf("Error: Cannot remove root\n");
+        return -1;
+    }
+    int result = remove_user(username);
+    if (result != 0) {
+        printf(result == -3 ? "Error: User not found\n" : "Error: Failed to save user database\n");
+        return -1;
+    }
+    ext2_info("User removed: %s\n", username);
+    return 0;
+}
+
+int cmd_groupadd(const char *name, uint16_t gid) {
+    if (check_user_admin(1) != 0) {
+        return -1;
+    }
+    int result = add_group(name, gid);
+    if (result != 0) {
+        print_user_error(result);
+        return -1;
+    }
+    ext2_info("Group added: %s\n", name);
+    return 0;
+}
+
+int cmd_passwd(const char *username, const char *old_password, const char *new_password) {
+    if (check_user_admin(0) != 0) {
+        return -1;
+    }
+    int result = change_password(username, old_password, new_password);
+    if (result != 0) {
+        printf(result == -3 ? "Error: Password too long\n" : "Error: Wrong user or password\n");
+        return -1;
+    }
+    ext2_info("Password changed: %s\n", username);
+    return 0;
+}
+
 // 文件系统管理命令
-int cmd_format(const char *disk_image) {
-    printf("Formatting disk image: %s\n", disk_image);
-    
-    // 创建磁盘镜像文件
-    FILE *fp = fopen(disk_image, "wb");
-    if (fp == NULL) {
-        printf("Error: Cannot create disk image\n");
-        return -1;
-    }
-    
-    // 写入空块
-    uint8_t zero_block[BLOCK_SIZE] = {0};
-    for (int i = 0; i < MAX_BLOCKS; i++) {
-        fwrite(zero_block, 1, BLOCK_SIZE, fp);
-    }
-    
-    fclose(fp);
-    
-    // 初始化超级块
-    ext2_superblock_t superblock;
-    memset(&superblock, 0, sizeof(superblock));
-    
-    superblock.s_inodes_count = MAX_INODES;
-    superblock.s_blocks_count = MAX_BLOCKS;
-    superblock.s_r_blocks_count = 10;
-    superblock.s_free_blocks_count = MAX_BLOCKS - 10;
-    superblock.s_free_inodes_count = MAX_INODES - 1;
-    superblock.s_first_data_block = 1;
-    superblock.s_log_block_size = 0;
-    superblock.s_log_frag_size = 0;
-    superblock.s_blocks_per_group = MAX_BLOCKS;
-    superblock.s_frags_per_group = MAX_BLOCKS;
-    superblock.s_inodes_per_group = MAX_INODES;
-    superblock.s_mtime = time(NULL);
-    superblock.s_wtime = time(NULL);
-    superblock.s_mnt_count = 0;
-    superblock.s_max_mnt_count = 20;
-    superblock.s_magic = 0xEF53;
-    superblock.s_state = 1;
-    superblock.s_errors = 1;
-    superblock.s_minor_rev_level = 0;
-    superblock.s_lastcheck = time(NULL);
-    superblock.s_checkinterval = 1800;
-    superblock.s_creator_os = 0;
-    superblock.s_rev_level = 0;
-    superblock.s_def_resuid = 0;
-    superblock.s_def_resgid = 0;
-    superblock.s_first_ino = 11;
-    superblock.s_inode_size = sizeof(ext2_inode_t);
-    superblock.s_block_group_nr = 0;
-    superblock.s_feature_compat = 0;
-    superblock.s_feature_incompat = 0;
-    superblock.s_feature_ro_compat = 0;
-    
-    // 写入超级块
-    FILE *fp2 = fopen(disk_image, "r+b");
-    if (fp2 == NULL) {
-        printf("Error: Cannot write superblock\n");
-        return -1;
-    }
-    
-    fwrite(&superblock, 1, sizeof(superblock), fp2);
-    fclose(fp2);
-    
-    printf("Disk image formatted successfully\n");
-    return 0;
-}
-
-int cmd_mount(const char *disk_image) {
-    if (init_disk_image(disk_image) != 0) {
+// 如果已挂载镜像，先写回并卸载
+static void unmount_current(void) {
+    if (fs.disk_image[0] != '\0') {
+        icache_flush();
+        close_disk_image();
+        icache_invalidate();
+        dir_index_invalidate();
+        inode_map_invalidate();
+        fs.disk_image[0] = '\0';
+    }
+}
+
+int cmd_format(const char *disk_image, uint64_t size, uint32_t block_size, uint32_t inode_ratio) {
+    if (block_size == 0 || inode_ratio == 0 || size / block_size > UINT32_MAX) {
+        printf("Error: Invalid format parameters\n");
+        return -1;
+    }
+    
+    uint32_t blocks_count = size / block_size;
+    uint64_t inodes_count = size / inode_ratio;
+    if (inodes_count < 16) {
+        inodes_count = 16;
+    }
+    if (inodes_count > blocks_count) {
+        inodes_count = blocks_count;
+    }
+    
+    unmount_current();
+    ext2_info("Formatting disk image: %s\n", disk_image);
+    
+    // 格式化（包括位图和根目录）统一由 ext2_format 完成
+    if (ext2_format(disk_image, block_size, blocks_count, (uint32_t)inodes_count) != 0) {
+        printf("Error: Failed to format disk image\n");
+        return -1;
+    }
+    
+    // 块数和inode数按 ext2_set_geometry 调整后的值（inode数向上取整到整块、每组8的倍数）
+    ext2_info("Disk image formatted successfully (%llu bytes, %u-byte blocks, %u inodes)\n",
+              (unsigned long long)fs.blocks_count * block_size, block_size, fs.inodes_count);
+    return 0;
+}
+
+// 检查结果：没有问题时只有一行（quiet 时不输出），有问题逐项列出
+static void print_fsck_report(const fsck_report_t *report) {
+    ext2_info("Checked %u inodes (%u directories), %u blocks in use, %d threads, %.3f s\n",
+              report->inodes, report->directories, report->blocks, report->threads, report->seconds);
+    if (!fsck_has_errors(report)) {
+        return;
+    }
+    if (report->bad_pointers) {
+        printf("Warning: %u out-of-range block pointers\n", report->bad_pointers);
+    }
+    if (report->duplicate_blocks) {
+        printf("Warning: %u blocks claimed twice or by metadata\n", report->duplicate_blocks);
+    }
+    if (report->damaged_dirs) {
+        printf("Warning: %u damaged directory blocks\n", report->damaged_dirs);
+    }
+    if (report->bad_entries) {
+        printf("Warning: %u directory entries point to free inodes\n", report->bad_entries);
+    }
+    if (report->orphans) {
+        printf("Warning: %u inodes are not linked from any directory\n", report->orphans);
+    }
+    if (report->block_bitmap_errors || report->inode_bitmap_errors || report->count_errors ||
+        report->link_count_errors) {
+        printf("%s: %u block bitmap, %u inode bitmap, %u free count, %u link count errors\n",
+               report->repaired ? "Fixed" : "Found", report->block_bitmap_errors,
+               report->inode_bitmap_errors, report->count_errors, report->link_count_errors);
+    }
+}
+
+int cmd_fsck(int repair) {
+    if (check_user_admin(1) != 0) {
+        return -1;
+    }
+    
+    // 检查直接读inode表，先把缓存中的脏inode合并进去；持有名字空间写锁，目录在检查期间不变
+    icache_flush();
+    dir_lock_exclusive();
+    fsck_report_t report;
+    int result = fsck_check(repair, &report);
+    dir_unlock();
+    if (result != 0) {
+        printf("Error: File system check failed\n");
+        return -1;
+    }
+    
+    print_fsck_report(&report);
+    if (repair) {
+        fs.superblock.s_lastcheck = time(NULL);
+        mark_superblock_dirty();
+    }
+    if (!fsck_has_errors(&report)) {
+        ext2_info("File system is clean\n");
+    }
+    return 0;
+}
+
+// 快照导出、增量和应用的统计
+static void print_snapshot_summary(const char *verb, const char *what, const char *to,
+                                   const snapshot_stats_t *stats) {
+    double mb = stats->bytes / (1024.0 * 1024.0);
+    double seconds = stats->seconds > 1e-6 ? stats->seconds : 1e-6;
+    ext2_info("%s %s -> %s: %u blocks, %.1f MB in %.2f s (%.1f MB/s)\n",
+              verb, what, to, stats->blocks, mb, stats->seconds, mb / seconds);
+}
+
+/*快照（见 snapshot.c）：create/delete 修改快照表，调用者持有名字空间写锁；
+list/export/diff 只读，持有读锁即可。apply 只处理宿主文件，不需要挂载和登录。*/
+int cmd_snapshot_create(const char *name) {
+    if (check_user_admin(1) != 0) {
+        return -1;
+    }
+    if (snapshot_create(name) != 0) {
+        return -1;
+    }
+    ext2_info("Created snapshot %s\n", name);
+    return 0;
+}
+
+int cmd_snapshot_delete(const char *name) {
+    if (check_user_admin(1) != 0) {
+        return -1;
+    }
+    if (snapshot_delete(name) != 0) {
+        return -1;
+    }
+    ext2_info("Deleted snapshot %s\n", name);
+    return 0;
+}
+
+int cmd_snapshot_list(void) {
+    if (check_user_admin(0) != 0) {
+        return -1;
+    }
+    
+    snapshot_info_t infos[EXT2_MAX_SNAPSHOTS];
+    int count = snapshot_list(infos, EXT2_MAX_SNAPSHOTS);
+    if (count == 0) {
+        printf("No snapshots\n");
+        return 0;
+    }
+    printf("%-16s %6s %-19s %10s\n", "Name", "ID", "Created", "Blocks");
+    for (int i = 0; i < count; i++) {
+        const ext2_snapshot_t *snapshot = &infos[i].snapshot;
+        char created[32];
+        time_t t = snapshot->time;
+        strftime(created, sizeof(created), "%Y-%m-%d %H:%M:%S", localtime(&t));
+        const char *state = "";
+        if (snapshot->flags & EXT2_SNAPSHOT_BROKEN) {
+            state = " (broken)";
+        } else if (i == count - 1) {
+            state = " (active)";
+        }
+        printf("%-16.16s %6u %-19s %10u%s\n", snapshot->name, snapshot->id, created,
+               infos[i].blocks, state);
+    }
+    return 0;
+}
+
+int cmd_snapshot_export(const char *name, const char *host_image) {
+    if (check_user_admin(1) != 0) {
+        return -1;
+    }
+    snapshot_stats_t stats;
+    if (snapshot_export(name, host_image, &stats) != 0) {
+        return -1;
+    }
+    print_snapshot_summary("Exported snapshot", name, host_image, &stats);
+    return 0;
+}
+
+int cmd_snapshot_apply(const char *host_delta, const char *host_image) {
+    snapshot_stats_t stats;
+    if (snapshot_apply(host_delta, host_image, &stats) != 0) {
+        return -1;
+    }
+    print_snapshot_summary("Applied", host_delta, host_image, &stats);
+    return 0;
+}
+
+int cmd_snapdiff(const char *from, const char *to, const char *host_delta) {
+    if (check_user_admin(1) != 0) {
+        return -1;
+    }
+    snapshot_stats_t stats;
+    if (snapshot_diff(from, to, host_delta, &stats) != 0) {
+        return -1;
+    }
+    char what[2 * EXT2_SNAPSHOT_NAME_LEN + 8];
+    snprintf(what, sizeof(what), "%s..%s", from, to);
+    print_snapshot_summary("Wrote delta", what, host_delta, &stats);
+    return 0;
+}
+
+static const char *backend_suffix(disk_backend_t backend) {
+    if (backend == DISK_BACKEND_MMAP) {
+        return " (mmap)";
+    }
+    return backend == DISK_BACKEND_URING ? " (io_uring)" : "";
+}
+
+int cmd_mount(const char *disk_image, disk_backend_t backend) {
+    unmount_current();
+    
+    if (init_disk_image(disk_image, backend) != 0) {
         printf("Error: Failed to mount disk image\n");
         return -1;
     }
     
-    // 读取超级块
-    if (read_block(0, &fs.superblock) != 0) {
+    // 读取超级块（超级块结构小于一个块，先读入块缓冲区再拷贝）
+    uint8_t sb_block[EXT2_MAX_BLOCK_SIZE];
+    if (read_block(0, sb_block) != 0) {
         printf("Error: Failed to read superblock\n");
         close_disk_image();
         return -1;
     }
+    memcpy(&fs.superblock, sb_block, sizeof(fs.superblock));
     
     // 验证魔数
     if (fs.superblock.s_magic != 0xEF53) {
@@ -410,35 +919,229 @@ int cmd_mount(const char *disk_image) {
         return -1;
     }
     
+    // 不认识的不兼容特性，或旧的定长目录项格式，都不能挂载
+    if ((fs.superblock.s_feature_incompat & ~EXT2_FEATURE_INCOMPAT_SUPP) != 0 ||
+        (fs.superblock.s_feature_incompat & EXT2_FEATURE_INCOMPAT_REQUIRED) != EXT2_FEATURE_INCOMPAT_REQUIRED) {
+        printf("Error: Unsupported file system features (0x%x), please reformat\n",
+               fs.superblock.s_feature_incompat);
+        close_disk_image();
+        return -1;
+    }
+    
+    icache_invalidate();
+    dir_index_invalidate();
+    inode_map_invalidate();
+    fs.ops_since_sync = 0;
+    
+    /*上次没有正常卸载、挂载次数或检查间隔到了时检查一遍并重建位图和计数；
+    干净的镜像跳过检查，空闲计数只按位图重新统计*/
+    const char *reason = fsck_reason(&fs.superblock);
+    if (reason != NULL) {
+        ext2_info("Checking file system (%s)...\n", reason);
+        fsck_report_t report;
+        if (fsck_check(1, &report) != 0) {
+            printf("Error: File system check failed\n");
+            close_disk_image();
+            return -1;
+        }
+        print_fsck_report(&report);
+        fs.superblock.s_lastcheck = time(NULL);
+        fs.superblock.s_mnt_count = 0;
+    } else {
+        recount_free_counts();
+    }
+    
+    /*记录挂载信息，随下一次元数据写回落盘。不用日志时清除 VALID，卸载时才恢复；
+    用日志时崩溃后靠重放恢复一致，VALID 保持不变*/
+    fs.superblock.s_mtime = time(NULL);
+    fs.superblock.s_mnt_count++;
+    if (!journal_active()) {
+        fs.superblock.s_state &= ~EXT2_VALID_FS;
+    }
+    mark_superblock_dirty();
+    
+    // 读入镜像中的用户数据库（已登录的会话保留登录时的身份）
+    if (load_users() != 0) {
+        printf("Warning: User database is damaged, using default users\n");
+    }
+    
     strncpy(fs.disk_image, disk_image, sizeof(fs.disk_image) - 1);
     fs.disk_image[sizeof(fs.disk_image) - 1] = '\0';
     
-    printf("Disk image mounted: %s\n", disk_image);
+    if (backend == DISK_BACKEND_URING && disk_get_backend() != DISK_BACKEND_URING) {
+        printf("Warning: io_uring is not available, using pread/pwrite\n");
+    }
+    ext2_info("Disk image mounted: %s%s\n", disk_image, backend_suffix(disk_get_backend()));
     return 0;
 }
 
 int cmd_umount(void) {
-    close_disk_image();
-    printf("Disk image unmounted\n");
+    unmount_current();
+    ext2_info("Disk image unmounted\n");
+    return 0;
+}
+
+int cmd_sync(void) {
+    if (ext2_sync() != 0 || disk_sync() != 0) {
+        printf("Error: Failed to sync file system\n");
+        return -1;
+    }
+    ext2_info("File system synced\n");
+    return 0;
+}
+
+int cmd_syncmode(const char *mode) {
+    if (strcmp(mode, "op") == 0) {
+        fs.sync_policy = SYNC_PER_OP;
+    } else if (strcmp(mode, "umount") == 0) {
+        fs.sync_policy = SYNC_ON_UMOUNT;
+    } else if (atoi(mode) > 0) {
+        fs.sync_policy = SYNC_EVERY_N;
+        fs.sync_interval = atoi(mode);
+    } else {
+        printf("Error: Sync mode must be 'op', 'umount' or a positive count\n");
+        return -1;
+    }
+    
+    fs.ops_since_sync = 0;
+    ext2_info("Sync mode set to: %s\n", mode);
+    return 0;
+}
+
+int cmd_readahead(const char *mode) {
+    if (strcmp(mode, "on") == 0) {
+        readahead_set_enabled(1);
+    } else if (strcmp(mode, "off") == 0) {
+        readahead_set_enabled(0);
+    } else {
+        printf("Error: Readahead mode must be 'on' or 'off'\n");
+        return -1;
+    }
+    
+    ext2_info("Readahead %s\n", mode);
+    return 0;
+}
+
+/*热路径计数器：每个函数的调用数、失败数、平均和最大耗时，分位数由直方图估算（2的幂的桶上界）。
+耗时包括内部调用，例如 path_to_inode 包括它的 find_directory_entry 和 read_inode。*/
+int cmd_stats(const char *arg) {
+    int reset = 0;
+    if (arg != NULL) {
+        if (strcmp(arg, "reset") != 0) {
+            printf("Error: Usage: stats [reset]\n");
+            return -1;
+        }
+        reset = 1;
+    }
+    if (!stats_enabled()) {
+        printf("Error: Statistics are compiled out (rebuild without STATS=0)\n");
+        return -1;
+    }
+    if (reset) {
+        if (!is_logged_in() || get_current_uid() != 0) {
+            printf("Error: Permission denied\n");
+            return -1;
+        }
+        stats_reset();
+        ext2_info("Statistics reset\n");
+        return 0;
+    }
+
+    stats_counter_t counters[STATS_COUNT];
+    double seconds;
+    int threads;
+    stats_collect(counters, &seconds, &threads);
+    printf("Hot path statistics (%.1f s, %d threads):\n", seconds, threads);
+    printf("%-22s %12s %10s %10s %10s %10s %10s %12s\n", "function", "calls", "failed", "avg us",
+           "p50 us", "p99 us", "max us", "total ms");
+    for (int id = 0; id < STATS_COUNT; id++) {
+        const stats_counter_t *c = &counters[id];
+        printf("%-22s %12llu %10llu %10.2f %10.2f %10.2f %10.2f %12.1f\n", stats_name(id),
+               (unsigned long long)c->calls, (unsigned long long)c->failed,
+               c->calls ? c->total_ns / 1000.0 / c->calls : 0.0,
+               stats_percentile(c, 0.50) / 1000.0, stats_percentile(c, 0.99) / 1000.0,
+               c->max_ns / 1000.0, c->total_ns / 1e6);
+    }
     return 0;
 }
 
 int cmd_status(void) {
     printf("File System Status:\n");
     printf("Disk image: %s\n", fs.disk_image);
+    printf("Block size: %u\n", fs.block_size);
     printf("Total blocks: %u\n", fs.superblock.s_blocks_count);
     printf("Free blocks: %u\n", fs.superblock.s_free_blocks_count);
     printf("Total inodes: %u\n", fs.superblock.s_inodes_count);
     printf("Free inodes: %u\n", fs.superblock.s_free_inodes_count);
+    printf("Block groups: %u (%u blocks, %u inodes per group)\n",
+           fs.groups_count, fs.blocks_per_group, fs.inodes_per_group);
     printf("Current user: %s\n", get_current_username());
     
-    int open_count = 0;
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        if (fs.open_files[i].is_open) {
-            open_count++;
-        }
+    printf("Open files: %d\n", session_current()->open_count);
+    
+    frag_stats_t frag;
+    compute_fragmentation(&frag);
+    printf("Fragmentation: %u files, %u blocks in %u extents (%.2f extents/file), %u fragmented files (%.1f%%)\n",
+           frag.files, frag.blocks, frag.fragments,
+           frag.files ? (double)frag.fragments / frag.files : 0.0,
+           frag.fragmented_files,
+           frag.files ? 100.0 * frag.fragmented_files / frag.files : 0.0);
+    printf("Inline data: %u files\n", frag.inline_files);
+    printf("Sparse files: %u (%u blocks in holes)\n", frag.sparse_files, frag.hole_blocks);
+    if (frag.compressed_files > 0) {
+        uint64_t stored = (uint64_t)frag.compressed_blocks * fs.block_size;
+        printf("Compressed files: %u, %.1f MB in %u blocks (%.2fx)\n", frag.compressed_files,
+               frag.compressed_bytes / (1024.0 * 1024.0), frag.compressed_blocks,
+               stored ? (double)frag.compressed_bytes / stored : 0.0);
+    }
+    printf("Snapshots: %u%s\n", fs.superblock.s_snapshot_count,
+           snapshot_active() ? " (tracking writes)" : "");
+    
+    disk_backend_t backend = disk_get_backend();
+    printf("Disk backend: %s\n", backend == DISK_BACKEND_MMAP ? "mmap" :
+                                  backend == DISK_BACKEND_URING ? "io_uring" : "fd");
+    
+    if (fs.sync_policy == SYNC_PER_OP) {
+        printf("Sync mode: every operation\n");
+    } else if (fs.sync_policy == SYNC_EVERY_N) {
+        printf("Sync mode: every %d operations\n", fs.sync_interval);
+    } else {
+        printf("Sync mode: on sync/umount only\n");
     }
-    printf("Open files: %d\n", open_count);
+    
+    const journal_stats_t *journal = journal_get_stats();
+    if (journal->blocks > 0) {
+        uint64_t ops = journal->commits + journal->grouped;
+        printf("Journal: %u blocks (%u in use), %llu commits, %llu group-committed ops (%.2f ops/commit), %llu checkpoints\n",
+               journal->blocks, journal->used, (unsigned long long)journal->commits,
+               (unsigned long long)journal->grouped,
+               journal->commits ? (double)ops / journal->commits : 0.0,
+               (unsigned long long)journal->checkpoints);
+    } else {
+        printf("Journal: none%s\n", fs.superblock.s_journal_block != 0 ? " (not used with mmap backend)" : "");
+    }
+    
+    const bcache_stats_t *cache = bcache_get_stats();
+    uint64_t lookups = cache->hits + cache->misses;
+    printf("Block cache: %llu hits, %llu misses (%.1f%% hit rate), %llu writebacks\n",
+           (unsigned long long)cache->hits, (unsigned long long)cache->misses,
+           lookups ? 100.0 * cache->hits / lookups : 0.0,
+           (unsigned long long)cache->writebacks);
+    
+    const dcache_stats_t *dentry = dcache_get_stats();
+    uint64_t dentry_hits = dentry->hits + dentry->negative_hits;
+    uint64_t dentry_lookups = dentry_hits + dentry->misses;
+    printf("Dentry cache: %llu hits (%llu negative), %llu misses (%.1f%% hit rate)\n",
+           (unsigned long long)dentry_hits, (unsigned long long)dentry->negative_hits,
+           (unsigned long long)dentry->misses,
+           dentry_lookups ? 100.0 * dentry_hits / dentry_lookups : 0.0);
+    
+    const readahead_stats_t *ra = readahead_get_stats();
+    printf("Readahead: %s, %llu windows, %llu blocks prefetched, %llu hits (%.1f%% hit rate)\n",
+           readahead_enabled() ? "on" : "off",
+           (unsigned long long)ra->windows, (unsigned long long)ra->prefetched,
+           (unsigned long long)ra->hits,
+           ra->prefetched ? 100.0 * ra->hits / ra->prefetched : 0.0);
     
     return 0;
 }
@@ -458,7 +1161,7 @@ int cmd_chmod(const char *path, uint16_t mode) {
     
     int result = change_permission(inode_no, mode);
     if (result == 0) {
-        printf("Permissions changed: %s\n", path);
+        ext2_info("Permissions changed: %s\n", path);
     } else {
         printf("Error: Failed to change permissions\n");
     }
@@ -479,33 +1182,175 @@ int cmd_chown(const char *path, uint16_t uid, uint16_t gid) {
     
     int result = change_owner(inode_no, uid, gid);
     if (result == 0) {
-        printf("Owner changed: %s\n", path);
+        ext2_info("Owner changed: %s\n", path);
     } else {
         printf("Error: Failed to change owner\n");
     }
     return result;
 }
 
+// 批量导入导出的统计：单个文件只报字节数，目录树报整体吞吐量
+static void print_transfer_summary(const char *verb, const char *from, const char *to,
+                                   const transfer_stats_t *stats) {
+    double mb = stats->bytes / (1024.0 * 1024.0);
+    double seconds = stats->seconds > 1e-6 ? stats->seconds : 1e-6;
+    if (stats->directories == 0) {
+        ext2_info("%s %llu bytes: %s -> %s\n", verb, (unsigned long long)stats->bytes, from, to);
+        return;
+    }
+    ext2_info("%s %u files, %u directories, %u symlinks: %.1f MB in %.2f s (%.1f MB/s, %.0f files/s)\n",
+              verb, stats->files, stats->directories, stats->symlinks, mb, stats->seconds,
+              mb / seconds, stats->files / seconds);
+    if (stats->failed > 0) {
+        printf("Error: %u entries skipped\n", stats->failed);
+    }
+}
+
+/*宿主文件导入导出：宿主端和镜像端在两个线程上流水线进行（见 transfer.c），
+可以是单个文件，也可以是整棵目录树。导入时镜像中已有的文件被覆盖、已有的目录被合并；
+单个文件导出到 "-" 时写到标准输出。*/
+int cmd_import(const char *host_path, const char *path) {
+    if (!is_logged_in()) {
+        printf("Error: Not logged in\n");
+        return -1;
+    }
+    
+    transfer_stats_t stats;
+    int result = transfer_import(host_path, path, &stats);
+    if (stats.files + stats.directories + stats.symlinks > 0) {
+        print_transfer_summary("Imported", host_path, path, &stats);
+    }
+    return result;
+}
+
+int cmd_export(const char *path, const char *host_path) {
+    if (!is_logged_in()) {
+        printf("Error: Not logged in\n");
+        return -1;
+    }
+    
+    if (strcmp(host_path, "-") != 0) {
+        transfer_stats_t stats;
+        int result = transfer_export(path, host_path, &stats);
+        if (stats.files + stats.directories + stats.symlinks > 0) {
+            print_transfer_summary("Exported", path, host_path, &stats);
+        }
+        return result;
+    }
+    
+    session_t *session = session_current();
+    int fd = session_open(session, path, O_RDONLY);
+    if (fd < 0) {
+        print_open_error(fd);
+        return -1;
+    }
+    
+    uint8_t *chunk = malloc(CMD_IO_CHUNK);
+    int result = chunk != NULL ? 0 : -1;
+    while (result == 0) {
+        int n = cmd_read(fd, chunk, CMD_IO_CHUNK);
+        if (n <= 0) {
+            result = n;
+            break;
+        }
+        if (fwrite(chunk, 1, n, stdout) != (size_t)n) {
+            printf("Error: Failed to write host file: %s\n", host_path);
+            result = -1;
+            break;
+        }
+    }
+    if (result != 0) {
+        printf("Error: Failed to read file: %s\n", path);
+    }
+    
+    free(chunk);
+    session_close(session, fd);
+    return result;
+}
+
+/*read 命令：分段读出并直接输出，大小不受缓冲区限制。
+交互模式下以 "Read: " 开头、换行结尾；批处理模式下只输出原始数据，便于重定向。*/
+static int stream_read(int fd, size_t size) {
+    uint8_t *chunk = malloc(CMD_IO_CHUNK);
+    if (chunk == NULL) {
+        printf("Error: Out of memory\n");
+        return -1;
+    }
+    
+    int result = 0;
+    size_t total = 0;
+    while (total < size) {
+        size_t want = size - total < CMD_IO_CHUNK ? size - total : CMD_IO_CHUNK;
+        int n = cmd_read(fd, chunk, want);
+        if (n < 0) {
+            result = -1;
+            break;
+        }
+        if (n == 0) {
+            break;
+        }
+        if (total == 0 && !fs.quiet) {
+            printf("Read: ");
+        }
+        fwrite(chunk, 1, n, stdout);
+        total += n;
+    }
+    if (total > 0 && !fs.quiet) {
+        printf("\n");
+    }
+    
+    free(chunk);
+    return result;
+}
+
 // 帮助命令
 void cmd_help(void) {
     printf("Available commands:\n");
-    printf("  format <disk_image>     - Format a new disk image\n");
-    printf("  mount <disk_image>      - Mount a disk image\n");
+    printf("  format <disk_image> [size] [block_size] [bytes_per_inode]\n");
+    printf("                          - Format a new disk image (default 1M, 1024, 8192)\n");
+    printf("  mount <disk_image> [fd|mmap|uring] - Mount a disk image (mmap maps the whole image, uring uses io_uring)\n");
     printf("  umount                  - Unmount current disk image\n");
     printf("  status                  - Show file system status\n");
+    printf("  sync                    - Write cached changes to disk\n");
+    printf("  syncmode <op|N|umount>  - Flush metadata per op, every N ops, or on umount\n");
+    printf("  readahead <on|off>      - Prefetch ahead of sequential reads\n");
+    printf("  stats [reset]           - Show hot path call counts and latencies (reset: root only)\n");
+    printf("  fsck [-n]               - Check and repair bitmaps and free counts (-n: report only)\n");
+    printf("  snapshot create <name>  - Take a copy-on-write snapshot (root only)\n");
+    printf("  snapshot delete <name>  - Delete a snapshot and free its blocks\n");
+    printf("  snapshot list           - List snapshots\n");
+    printf("  snapshot export <name> <host_image> - Write the image as of a snapshot to a host file\n");
+    printf("  snapshot apply <delta> <host_image> - Apply a snapdiff delta to an exported host image\n");
+    printf("  snapdiff <from> <to> <delta> - Write the blocks changed between two snapshots\n");
     printf("  login <user> <pass>     - Login as user\n");
     printf("  logout                  - Logout current user\n");
     printf("  users                   - List all users\n");
+    printf("  groups                  - List all groups\n");
+    printf("  useradd <user> <pass> <uid> <gid> - Add a user (root only)\n");
+    printf("  userdel <user>          - Remove a user (root only)\n");
+    printf("  groupadd <group> <gid>  - Add a group (root only)\n");
+    printf("  passwd <user> <old> <new> - Change a password\n");
     printf("  mkdir <path>            - Create directory\n");
     printf("  rmdir <path>            - Remove directory\n");
     printf("  dir <path>              - List directory contents\n");
     printf("  cd <path>               - Change directory\n");
     printf("  create <path>           - Create file\n");
     printf("  delete <path>           - Delete file\n");
+    printf("  symlink <target> <path> - Create symbolic link\n");
+    printf("  readlink <path>         - Show symbolic link target\n");
+    printf("  ln [-s] <target> <path> - Create hard link (-s: symbolic link)\n");
+    printf("  mv <source> <dest>      - Move or rename file or directory\n");
+    printf("  fallocate <path> <size> - Preallocate contiguous blocks for file\n");
+    printf("  truncate <path> <size>  - Shrink or extend file (extension is a hole)\n");
+    printf("  punch <path> <off> <len> - Free the blocks of a range, leaving a hole\n");
+    printf("  compress <path> <on|off> - Store a file compressed in 16K clusters (directories: new files inherit)\n");
     printf("  open <path> <flags>     - Open file (0=read, 1=write, 2=readwrite)\n");
     printf("  close <fd>              - Close file\n");
     printf("  read <fd> <size>        - Read from file\n");
     printf("  write <fd> <data>       - Write to file\n");
+    printf("  seek <fd> <offset>      - Set file offset (may be past end of file)\n");
+    printf("  import <host_path> <path> - Copy a host file or directory tree into the image\n");
+    printf("  export <path> <host_path> - Copy a file or directory tree out of the image ('-' for stdout)\n");
     printf("  chmod <path> <mode>     - Change file permissions\n");
     printf("  chown <path> <uid> <gid> - Change file owner\n");
     printf("  help                    - Show this help\n");
@@ -514,11 +1359,45 @@ void cmd_help(void) {
 
 void print_usage(void) {
     printf("EXT2 File System Simulator\n");
-    printf("Usage: ./ext2fs\n");
-    printf("Type 'help' for available commands\n");
+    printf("Usage: ./ext2fs [-i disk_image] [-M | -U] [-l address] [-w workers] [-b script | -c commands]\n");
+    printf("  -i disk_image  Mount the image at startup\n");
+    printf("  -M             Mount with the mmap backend\n");
+    printf("  -U             Mount with the io_uring backend\n");
+    printf("  -l address     Run as a daemon on a Unix socket path or [host:]port\n");
+    printf("  -w workers     Worker threads in daemon mode (default %d)\n", SRV_DEFAULT_WORKERS);
+    printf("  -b script      Run commands from a file ('-' for stdin) without the prompt\n");
+    printf("  -c commands    Run ';'-separated commands without the prompt\n");
+    printf("Without -l, -b or -c, type 'help' for available commands\n");
+}
+
+// 解析带 K/M/G 后缀的大小
+static int parse_size(const char *str, uint64_t *size) {
+    char *end;
+    unsigned long long value = strtoull(str, &end, 10);
+    if (end == str) {
+        return -1;
+    }
+    
+    if (*end == 'K' || *end == 'k') {
+        value <<= 10;
+        end++;
+    } else if (*end == 'M' || *end == 'm') {
+        value <<= 20;
+        end++;
+    } else if (*end == 'G' || *end == 'g') {
+        value <<= 30;
+        end++;
+    }
+    
+    if (*end != '\0') {
+        return -1;
+    }
+    *size = value;
+    return 0;
 }
 
-// 命令解析
+/*命令解析：增删文件和目录、格式化和挂载持有名字空间写锁，
+按路径访问已有文件的命令持有读锁，按文件描述符读写的命令只需要inode锁。*/
 int parse_command(char *line) {
     char *token = strtok(line, " \t\n");
     if (token == NULL) {
@@ -531,22 +1410,140 @@ int parse_command(char *line) {
             printf("Error: Missing disk image name\n");
             return -1;
         }
-        return cmd_format(disk_image);
+        
+        // 可选参数：镜像大小、块大小、每个inode对应的字节数
+        char *size_str = strtok(NULL, " \t\n");
+        char *block_str = strtok(NULL, " \t\n");
+        char *ratio_str = strtok(NULL, " \t\n");
+        uint64_t size = (uint64_t)DEFAULT_BLOCKS_COUNT * DEFAULT_BLOCK_SIZE;
+        uint64_t block_size = DEFAULT_BLOCK_SIZE;
+        uint64_t inode_ratio = DEFAULT_INODE_RATIO;
+        if ((size_str != NULL && parse_size(size_str, &size) != 0) ||
+            (block_str != NULL && parse_size(block_str, &block_size) != 0) ||
+            (ratio_str != NULL && parse_size(ratio_str, &inode_ratio) != 0) ||
+            block_size > EXT2_MAX_BLOCK_SIZE || inode_ratio > UINT32_MAX) {
+            printf("Error: Usage: format <disk_image> [size[K|M|G]] [block_size] [bytes_per_inode]\n");
+            return -1;
+        }
+        dir_lock_exclusive();
+        int result = cmd_format(disk_image, size, block_size, inode_ratio);
+        dir_unlock();
+        return result;
     }
     else if (strcmp(token, "mount") == 0) {
         char *disk_image = strtok(NULL, " \t\n");
+        char *backend = strtok(NULL, " \t\n");
         if (disk_image == NULL) {
             printf("Error: Missing disk image name\n");
             return -1;
         }
-        return cmd_mount(disk_image);
+        if (backend == NULL || strcmp(backend, "fd") == 0) {
+            dir_lock_exclusive();
+            int result = cmd_mount(disk_image, DISK_BACKEND_FD);
+            dir_unlock();
+            return result;
+        }
+        if (strcmp(backend, "mmap") == 0) {
+            dir_lock_exclusive();
+            int result = cmd_mount(disk_image, DISK_BACKEND_MMAP);
+            dir_unlock();
+            return result;
+        }
+        if (strcmp(backend, "uring") == 0) {
+            dir_lock_exclusive();
+            int result = cmd_mount(disk_image, DISK_BACKEND_URING);
+            dir_unlock();
+            return result;
+        }
+        printf("Error: Backend must be 'fd', 'mmap' or 'uring'\n");
+        return -1;
     }
     else if (strcmp(token, "umount") == 0) {
-        return cmd_umount();
+        dir_lock_exclusive();
+        int result = cmd_umount();
+        dir_unlock();
+        return result;
     }
     else if (strcmp(token, "status") == 0) {
         return cmd_status();
     }
+    else if (strcmp(token, "sync") == 0) {
+        return cmd_sync();
+    }
+    else if (strcmp(token, "syncmode") == 0) {
+        char *mode = strtok(NULL, " \t\n");
+        if (mode == NULL) {
+            printf("Error: Missing sync mode\n");
+            return -1;
+        }
+        return cmd_syncmode(mode);
+    }
+    else if (strcmp(token, "fsck") == 0) {
+        char *option = strtok(NULL, " \t\n");
+        if (option != NULL && strcmp(option, "-n") != 0) {
+            printf("Usage: fsck [-n]\n");
+            return -1;
+        }
+        return cmd_fsck(option == NULL);
+    }
+    else if (strcmp(token, "snapshot") == 0) {
+        char *action = strtok(NULL, " \t\n");
+        char *name = strtok(NULL, " \t\n");
+        char *arg = strtok(NULL, " \t\n");
+        if (action != NULL && strcmp(action, "list") == 0) {
+            dir_lock_shared();
+            int result = cmd_snapshot_list();
+            dir_unlock();
+            return result;
+        }
+        if (action != NULL && strcmp(action, "apply") == 0 && name != NULL && arg != NULL) {
+            return cmd_snapshot_apply(name, arg);
+        }
+        if (action == NULL || name == NULL) {
+            printf("Usage: snapshot <create|delete|export|list|apply> ...\n");
+            return -1;
+        }
+        int result;
+        if (strcmp(action, "create") == 0) {
+            dir_lock_exclusive();
+            result = cmd_snapshot_create(name);
+        } else if (strcmp(action, "delete") == 0) {
+            dir_lock_exclusive();
+            result = cmd_snapshot_delete(name);
+        } else if (strcmp(action, "export") == 0 && arg != NULL) {
+            dir_lock_shared();
+            result = cmd_snapshot_export(name, arg);
+        } else {
+            printf("Usage: snapshot <create|delete|export|list|apply> ...\n");
+            return -1;
+        }
+        dir_unlock();
+        return result;
+    }
+    else if (strcmp(token, "snapdiff") == 0) {
+        char *from = strtok(NULL, " \t\n");
+        char *to = strtok(NULL, " \t\n");
+        char *host_delta = strtok(NULL, " \t\n");
+        if (from == NULL || to == NULL || host_delta == NULL) {
+            printf("Error: Missing snapshot names or delta file\n");
+            return -1;
+        }
+        dir_lock_shared();
+        int result = cmd_snapdiff(from, to, host_delta);
+        dir_unlock();
+        return result;
+    }
+    else if (strcmp(token, "stats") == 0) {
+        return cmd_stats(strtok(NULL, " \t\n"));
+    }
+    else if (strcmp(token, "readahead") == 0) {
+        char *mode = strtok(NULL, " \t\n");
+        if (mode == NULL) {
+            printf("Error: Missing readahead mode\n");
+            return -1;
+        }
+        return cmd_readahead(mode);
+    }
     else if (strcmp(token, "login") == 0) {
         char *username = strtok(NULL, " \t\n");
         char *password = strtok(NULL, " \t\n");
@@ -562,13 +1559,57 @@ int parse_command(char *line) {
     else if (strcmp(token, "users") == 0) {
         return cmd_users();
     }
+    else if (strcmp(token, "groups") == 0) {
+        return cmd_groups();
+    }
+    else if (strcmp(token, "useradd") == 0) {
+        char *username = strtok(NULL, " \t\n");
+        char *password = strtok(NULL, " \t\n");
+        char *uid_str = strtok(NULL, " \t\n");
+        char *gid_str = strtok(NULL, " \t\n");
+        if (username == NULL || password == NULL || uid_str == NULL || gid_str == NULL) {
+            printf("Error: Usage: useradd <user> <pass> <uid> <gid>\n");
+            return -1;
+        }
+        return cmd_useradd(username, password, atoi(uid_str), atoi(gid_str));
+    }
+    else if (strcmp(token, "userdel") == 0) {
+        char *username = strtok(NULL, " \t\n");
+        if (username == NULL) {
+            printf("Error: Missing username\n");
+            return -1;
+        }
+        return cmd_userdel(username);
+    }
+    else if (strcmp(token, "groupadd") == 0) {
+        char *name = strtok(NULL, " \t\n");
+        char *gid_str = strtok(NULL, " \t\n");
+        if (name == NULL || gid_str == NULL) {
+            printf("Error: Usage: groupadd <group> <gid>\n");
+            return -1;
+        }
+        return cmd_groupadd(name, atoi(gid_str));
+    }
+    else if (strcmp(token, "passwd") == 0) {
+        char *username = strtok(NULL, " \t\n");
+        char *old_password = strtok(NULL, " \t\n");
+        char *new_password = strtok(NULL, " \t\n");
+        if (username == NULL || old_password == NULL || new_password == NULL) {
+            printf("Error: Usage: passwd <user> <old> <new>\n");
+            return -1;
+        }
+        return cmd_passwd(username, old_password, new_password);
+    }
     else if (strcmp(token, "mkdir") == 0) {
         char *path = strtok(NULL, " \t\n");
         if (path == NULL) {
             printf("Error: Missing directory path\n");
             return -1;
         }
-        return cmd_mkdir(path);
+        dir_lock_exclusive();
+        int result = cmd_mkdir(path);
+        dir_unlock();
+        return result;
     }
     else if (strcmp(token, "rmdir") == 0) {
         char *path = strtok(NULL, " \t\n");
@@ -576,21 +1617,30 @@ int parse_command(char *line) {
             printf("Error: Missing directory path\n");
             return -1;
         }
-        return cmd_rmdir(path);
+        dir_lock_exclusive();
+        int result = cmd_rmdir(path);
+        dir_unlock();
+        return result;
     }
     else if (strcmp(token, "dir") == 0) {
         char *path = strtok(NULL, " \t\n");
         if (path == NULL) {
             path = "/";
         }
-        return cmd_dir(path);
+        dir_lock_shared();
+        int result = cmd_dir(path);
+        dir_unlock();
+        return result;
     }
     else if (strcmp(token, "cd") == 0) {
         char *path = strtok(NULL, " \t\n");
         if (path == NULL) {
             path = "/";
         }
-        return cmd_cd(path);
+        dir_lock_shared();
+        int result = cmd_cd(path);
+        dir_unlock();
+        return result;
     }
     else if (strcmp(token, "create") == 0) {
         char *path = strtok(NULL, " \t\n");
@@ -598,7 +1648,61 @@ int parse_command(char *line) {
             printf("Error: Missing file path\n");
             return -1;
         }
-        return cmd_create(path);
+        dir_lock_exclusive();
+        int result = cmd_create(path);
+        dir_unlock();
+        return result;
+    }
+    else if (strcmp(token, "symlink") == 0) {
+        char *target = strtok(NULL, " \t\n");
+        char *path = strtok(NULL, " \t\n");
+        if (target == NULL || path == NULL) {
+            printf("Error: Missing link target or path\n");
+            return -1;
+        }
+        dir_lock_exclusive();
+        int result = cmd_symlink(target, path);
+        dir_unlock();
+        return result;
+    }
+    else if (strcmp(token, "readlink") == 0) {
+        char *path = strtok(NULL, " \t\n");
+        if (path == NULL) {
+            printf("Error: Missing file path\n");
+            return -1;
+        }
+        dir_lock_shared();
+        int result = cmd_readlink(path);
+        dir_unlock();
+        return result;
+    }
+    else if (strcmp(token, "ln") == 0) {
+        char *target = strtok(NULL, " \t\n");
+        int symbolic = target != NULL && strcmp(target, "-s") == 0;
+        if (symbolic) {
+            target = strtok(NULL, " \t\n");
+        }
+        char *path = strtok(NULL, " \t\n");
+        if (target == NULL || path == NULL) {
+            printf("Error: Usage: ln [-s] <target> <path>\n");
+            return -1;
+        }
+        dir_lock_exclusive();
+        int result = cmd_ln(target, path, symbolic);
+        dir_unlock();
+        return result;
+    }
+    else if (strcmp(token, "mv") == 0) {
+        char *source = strtok(NULL, " \t\n");
+        char *dest = strtok(NULL, " \t\n");
+        if (source == NULL || dest == NULL) {
+            printf("Error: Usage: mv <source> <dest>\n");
+            return -1;
+        }
+        dir_lock_exclusive();
+        int result = cmd_mv(source, dest);
+        dir_unlock();
+        return result;
     }
     else if (strcmp(token, "delete") == 0) {
         char *path = strtok(NULL, " \t\n");
@@ -606,7 +1710,51 @@ int parse_command(char *line) {
             printf("Error: Missing file path\n");
             return -1;
         }
-        return cmd_delete(path);
+        dir_lock_exclusive();
+        int result = cmd_delete(path);
+        dir_unlock();
+        return result;
+    }
+    else if (strcmp(token, "fallocate") == 0) {
+        char *path = strtok(NULL, " \t\n");
+        char *size_str = strtok(NULL, " \t\n");
+        uint64_t size;
+        if (path == NULL || size_str == NULL || parse_size(size_str, &size) != 0) {
+            printf("Error: Missing file path or size\n");
+            return -1;
+        }
+        dir_lock_shared();
+        int result = cmd_fallocate(path, (off_t)size);
+        dir_unlock();
+        return result;
+    }
+    else if (strcmp(token, "truncate") == 0) {
+        char *path = strtok(NULL, " \t\n");
+        char *size_str = strtok(NULL, " \t\n");
+        uint64_t size;
+        if (path == NULL || size_str == NULL || parse_size(size_str, &size) != 0) {
+            printf("Error: Missing file path or size\n");
+            return -1;
+        }
+        dir_lock_shared();
+        int result = cmd_truncate(path, (off_t)size);
+        dir_unlock();
+        return result;
+    }
+    else if (strcmp(token, "punch") == 0) {
+        char *path = strtok(NULL, " \t\n");
+        char *offset_str = strtok(NULL, " \t\n");
+        char *length_str = strtok(NULL, " \t\n");
+        uint64_t offset, length;
+        if (path == NULL || offset_str == NULL || length_str == NULL ||
+            parse_size(offset_str, &offset) != 0 || parse_size(length_str, &length) != 0) {
+            printf("Error: Missing file path, offset or length\n");
+            return -1;
+        }
+        dir_lock_shared();
+        int result = cmd_punch(path, (off_t)offset, (off_t)length);
+        dir_unlock();
+        return result;
     }
     else if (strcmp(token, "open") == 0) {
         char *path = strtok(NULL, " \t\n");
@@ -616,7 +1764,10 @@ int parse_command(char *line) {
             return -1;
         }
         int flags = atoi(flags_str);
-        return cmd_open(path, flags);
+        dir_lock_shared();
+        int result = cmd_open(path, flags);
+        dir_unlock();
+        return result < 0 ? -1 : 0;
     }
     else if (strcmp(token, "close") == 0) {
         char *fd_str = strtok(NULL, " \t\n");
@@ -635,14 +1786,8 @@ int parse_command(char *line) {
             return -1;
         }
         int fd = atoi(fd_str);
-        size_t size = atoi(size_str);
-        char buffer[1024];
-        int result = cmd_read(fd, buffer, size);
-        if (result > 0) {
-            buffer[result] = '\0';
-            printf("Read: %s\n", buffer);
-        }
-        return result;
+        size_t size = strtoull(size_str, NULL, 10);
+        return stream_read(fd, size);
     }
     else if (strcmp(token, "write") == 0) {
         char *fd_str = strtok(NULL, " \t\n");
@@ -652,7 +1797,53 @@ int parse_command(char *line) {
             return -1;
         }
         int fd = atoi(fd_str);
-        return cmd_write(fd, data, strlen(data));
+        return cmd_write(fd, data, strlen(data)) < 0 ? -1 : 0;
+    }
+    else if (strcmp(token, "seek") == 0) {
+        char *fd_str = strtok(NULL, " \t\n");
+        char *offset_str = strtok(NULL, " \t\n");
+        uint64_t offset;
+        if (fd_str == NULL || offset_str == NULL || parse_size(offset_str, &offset) != 0) {
+            printf("Error: Missing file descriptor or offset\n");
+            return -1;
+        }
+        return cmd_seek(atoi(fd_str), (off_t)offset);
+    }
+    else if (strcmp(token, "import") == 0) {
+        char *host_path = strtok(NULL, " \t\n");
+        char *path = strtok(NULL, " \t\n");
+        if (host_path == NULL || path == NULL) {
+            printf("Error: Missing host file or path\n");
+            return -1;
+        }
+        dir_lock_exclusive();
+        int result = cmd_import(host_path, path);
+        dir_unlock();
+        return result;
+    }
+    else if (strcmp(token, "export") == 0) {
+        char *path = strtok(NULL, " \t\n");
+        char *host_path = strtok(NULL, " \t\n");
+        if (path == NULL || host_path == NULL) {
+            printf("Error: Missing path or host file\n");
+            return -1;
+        }
+        dir_lock_shared();
+        int result = cmd_export(path, host_path);
+        dir_unlock();
+        return result;
+    }
+    else if (strcmp(token, "compress") == 0) {
+        char *path = strtok(NULL, " \t\n");
+        char *mode = strtok(NULL, " \t\n");
+        if (path == NULL || mode == NULL || (strcmp(mode, "on") != 0 && strcmp(mode, "off") != 0)) {
+            printf("Usage: compress <path> <on|off>\n");
+            return -1;
+        }
+        dir_lock_exclusive();
+        int result = cmd_compress(path, strcmp(mode, "on") == 0);
+        dir_unlock();
+        return result;
     }
     else if (strcmp(token, "chmod") == 0) {
         char *path = strtok(NULL, " \t\n");
@@ -662,7 +1853,10 @@ int parse_command(char *line) {
             return -1;
         }
         uint16_t mode = strtol(mode_str, NULL, 8);
-        return cmd_chmod(path, mode);
+        dir_lock_shared();
+        int result = cmd_chmod(path, mode);
+        dir_unlock();
+        return result;
     }
     else if (strcmp(token, "chown") == 0) {
         char *path = strtok(NULL, " \t\n");
@@ -674,7 +1868,10 @@ int parse_command(char *line) {
         }
         uint16_t uid = atoi(uid_str);
         uint16_t gid = atoi(gid_str);
-        return cmd_chown(path, uid, gid);
+        dir_lock_shared();
+        int result = cmd_chown(path, uid, gid);
+        dir_unlock();
+        return result;
     }
     else if (strcmp(token, "help") == 0) {
         cmd_help();
@@ -691,20 +1888,71 @@ int parse_command(char *line) {
 }
 
 void command_loop(void) {
-    char line[1024];
+    char *line = NULL;
+    size_t capacity = 0;
     
     printf("EXT2 File System Simulator\n");
     printf("Type 'help' for available commands\n");
     
     while (1) {
         printf("ext2fs> ");
-        if (fgets(line, sizeof(line), stdin) == NULL) {
+        // getline 不限制行长，write 的数据可以任意长
+        if (getline(&line, &capacity, stdin) == -1) {
             break;
         }
         
+        ext2_op_begin();
         int result = parse_command(line);
+        
+        // 每条命令结束后统一写回本次修改的inode
+        ext2_op_end();
+        
         if (result == 1) {
             break; // 退出
         }
     }
-} 
\ No newline at end of file
+    free(line);
+}
+
+/*批处理中执行一条命令：跳过空行和 # 开头的注释。
+返回1表示遇到 quit，-1表示命令失败（批处理随之停止），否则返回0。*/
+static int run_batch_command(char *line, int number) {
+    line += strspn(line, " \t\n");
+    if (*line == '\0' || *line == '#') {
+        return 0;
+    }
+    
+    ext2_op_begin();
+    int result = parse_command(line);
+    ext2_op_end();
+    if (result < 0) {
+        printf("Error: Batch stopped at command %d\n", number);
+    }
+    return result;
+}
+
+int command_batch(FILE *input) {
+    char *line = NULL;
+    size_t capacity = 0;
+    int number = 0;
+    int result = 0;
+    
+    while (result == 0 && getline(&line, &capacity, input) != -1) {
+        result = run_batch_command(line, ++number);
+    }
+    free(line);
+    return result < 0 ? -1 : 0;
+}
+
+int command_string(char *commands) {
+    char *saveptr = NULL;
+    int number = 0;
+    int result = 0;
+    
+    // parse_command 内部使用 strtok，外层只能用 strtok_r
+    for (char *command = strtok_r(commands, ";", &saveptr); command != NULL && result == 0;
+         command = strtok_r(NULL, ";", &saveptr)) {
+        result = run_batch_command(command, ++number);
+    }
+    return result < 0 ? -1 : 0;
+}
@@ -0,0 +1,192 @@
+#include "../include/compress.h"
+#include <string.h>
+
+/*LZ4 块格式：由若干序列组成，每个序列是
+  标记字节（高4位字面量长度，低4位匹配长度-4，取15时后面跟扩展字节，每个255继续）
+  + 字面量 + 2字节小端偏移 + 匹配长度的扩展字节。
+最后一个序列只有字面量。格式要求最后5个字节总是字面量，最后一个匹配在结尾前12字节之前开始。
+
+压缩用贪心匹配：4字节哈希表记录每个哈希最近出现的位置，候选位置的4字节相同就向前后扩展。*/
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+#define LZ_LAST_LITERALS 5
+#define LZ_MATCH_LIMIT 12
+#define LZ_MAX_OFFSET 65535
+
+static uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t hash4(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// 长度超过15的部分：每个255字节一个，最后一个小于255
+static uint8_t *put_length(uint8_t *op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+/*写出一个序列：literals 开始的 lit_len 个字面量，然后是偏移 offset、长度 match_len + 4 的匹配；
+last 为真时只写字面量。放不下时返回 NULL。*/
+static uint8_t *put_sequence(uint8_t *op, const uint8_t *op_end, const uint8_t *literals, size_t lit_len,
+                             size_t offset, size_t match_len, int last) {
+    size_t need = 1 + lit_len + lit_len / 255 + 1;
+    if (!last) {
+        need += 2 + match_len / 255 + 1;
+    }
+    if (need > (size_t)(op_end - op)) {
+        return NULL;
+    }
+
+    uint8_t *token = op++;
+    *token = (uint8_t)((lit_len >= 15 ? 15 : lit_len) << 4);
+    if (lit_len >= 15) {
+        op = put_length(op, lit_len - 15);
+    }
+    memcpy(op, literals, lit_len);
+    op += lit_len;
+    if (last) {
+        return op;
+    }
+
+    *op++ = (uint8_t)(offset & 0xFF);
+    *op++ = (uint8_t)(offset >> 8);
+    *token |= (uint8_t)(match_len >= 15 ? 15 : match_len);
+    if (match_len >= 15) {
+        op = put_length(op, match_len - 15);
+    }
+    return op;
+}
+
+size_t lz_compress(const uint8_t *src, size_t len, uint8_t *dst, size_t capacity) {
+    uint32_t table[1 << LZ_HASH_BITS]; // 位置加一，0 表示还没有出现过
+    memset(table, 0, sizeof(table));
+
+    const uint8_t *ip = src;
+    const uint8_t *anchor = src;
+    const uint8_t *end = src + len;
+    const uint8_t *match_limit = len > LZ_MATCH_LIMIT ? end - LZ_MATCH_LIMIT : src;
+    const uint8_t *extend_limit = len > LZ_LAST_LITERALS ? end - LZ_LAST_LITERALS : src;
+    uint8_t *op = dst;
+    const uint8_t *op_end = dst + capacity;
+
+    while (ip < match_limit) {
+        uint32_t h = hash4(read32(ip));
+        uint32_t candidate = table[h];
+        table[h] = (uint32_t)(ip - src) + 1;
+        if (candidate == 0) {
+            ip++;
+            continue;
+        }
+        const uint8_t *ref = src + candidate - 1;
+        if (ip - ref > LZ_MAX_OFFSET || read32(ref) != read32(ip)) {
+            ip++;
+            continue;
+        }
+
+        // 向前扩展到上一个序列的末尾，向后扩展到最后5个字节之前
+        while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+            ip--;
+            ref--;
+        }
+        const uint8_t *mp = ip + LZ_MIN_MATCH;
+        const uint8_t *rp = ref + LZ_MIN_MATCH;
+        while (mp < extend_limit && *mp == *rp) {
+            mp++;
+            rp++;
+        }
+
+        op = put_sequence(op, op_end, anchor, ip - anchor, ip - ref, mp - ip - LZ_MIN_MATCH, 0);
+        if (op == NULL) {
+            return 0;
+        }
+        ip = mp;
+        anchor = ip;
+        // 匹配末尾附近的位置也记进哈希表，后面的重复更容易找到
+        if (ip - 2 < match_limit) {
+            table[hash4(read32(ip - 2))] = (uint32_t)(ip - 2 - src) + 1;
+        }
+    }
+
+    op = put_sequence(op, op_end, anchor, end - anchor, 0, 0, 1);
+    return op != NULL ? (size_t)(op - dst) : 0;
+}
+
+// 读扩展长度字节，输入提前结束时返回-1
+static int get_length(const uint8_t **ipp, const uint8_t *end, size_t *len) {
+    const uint8_t *ip = *ipp;
+    uint8_t b;
+    do {
+        if (ip >= end) {
+            return -1;
+        }
+        b = *ip++;
+        *len += b;
+    } while (b == 255);
+    *ipp = ip;
+    return 0;
+}
+
+ssize_t lz_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t capacity) {
+    const uint8_t *ip = src;
+    const uint8_t *end = src + len;
+    uint8_t *op = dst;
+    const uint8_t *op_end = dst + capacity;
+
+    while (ip < end) {
+        uint8_t token = *ip++;
+        size_t lit_len = token >> 4;
+        if (lit_len == 15 && get_length(&ip, end, &lit_len) != 0) {
+            return -1;
+        }
+        if (lit_len > (size_t)(end - ip) || lit_len > (size_t)(op_end - op)) {
+            return -1;
+        }
+        memcpy(op, ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+        if (ip == end) {
+            break; // 最后一个序列只有字面量
+        }
+
+        if (end - ip < 2) {
+            return -1;
+        }
+        size_t offset = ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst)) {
+            return -1;
+        }
+        size_t match_len = token & 15;
+        if (match_len == 15 && get_length(&ip, end, &match_len) != 0) {
+            return -1;
+        }
+        match_len += LZ_MIN_MATCH;
+        if (match_len > (size_t)(op_end - op)) {
+            return -1;
+        }
+        // 匹配可以和要写的部分重叠（偏移小于长度时重复前面的内容），逐字节复制
+        const uint8_t *ref = op - offset;
+        for (size_t i = 0; i < match_len; i++) {
+            op[i] = ref[i];
+        }
+        op += match_len;
+    }
+    return op - dst;
+}
+
+uint32_t lz_checksum(const uint8_t *data, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
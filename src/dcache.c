@@ -0,0 +1,179 @@
+#include "../include/dcache.h"
+#include "../include/ext2.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/*目录项缓存：缓存路径解析中每一级 (父目录, 名称) 的结果，包括“不存在”的负向结果，
+重复解析同一路径时不再访问目录。条目数固定，用 CLOCK 算法淘汰；
+目录项增删时由 directory.c 同步更新。所有操作在 lock 下进行。*/
+
+typedef struct {
+    uint32_t parent;
+    uint32_t child;         // 0 表示负向项
+    int valid;
+    int referenced;
+    int hash_next;
+    char name[MAX_FILENAME + 1];
+} dcache_entry_t;
+
+static dcache_entry_t entries[DCACHE_ENTRIES];
+static int buckets[DCACHE_BUCKETS];
+static int clock_hand = 0;
+static int initialized = 0;
+static dcache_stats_t stats;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int bucket_of(uint32_t parent, const char *name) {
+    uint32_t h = 2166136261u ^ parent;
+    while (*name) {
+        h ^= (uint8_t)*name++;
+        h *= 16777619u;
+    }
+    return h % DCACHE_BUCKETS;
+}
+
+static void reset(void) {
+    memset(entries, 0, sizeof(entries));
+    for (int i = 0; i < DCACHE_BUCKETS; i++) {
+        buckets[i] = -1;
+    }
+    for (int i = 0; i < DCACHE_ENTRIES; i++) {
+        entries[i].hash_next = -1;
+    }
+    clock_hand = 0;
+    initialized = 1;
+}
+
+static void ensure_init(void) {
+    if (!initialized) {
+        reset();
+    }
+}
+
+static int find(uint32_t parent, const char *name) {
+    int i = buckets[bucket_of(parent, name)];
+    while (i != -1) {
+        if (entries[i].valid && entries[i].parent == parent && strcmp(entries[i].name, name) == 0) {
+            return i;
+        }
+        i = entries[i].hash_next;
+    }
+    return -1;
+}
+
+static void unlink_entry(int index) {
+    int *link = &buckets[bucket_of(entries[index].parent, entries[index].name)];
+    while (*link != -1) {
+        if (*link == index) {
+            *link = entries[index].hash_next;
+            break;
+        }
+        link = &entries[*link].hash_next;
+    }
+    entries[index].valid = 0;
+}
+
+int dcache_lookup(uint32_t parent_inode, const char *name, uint32_t *child_inode) {
+    pthread_mutex_lock(&lock);
+    ensure_init();
+
+    int result = DCACHE_HIT;
+    int i = find(parent_inode, name);
+    if (i == -1) {
+        stats.misses++;
+        result = DCACHE_MISS;
+    } else if (entries[i].child == 0) {
+        entries[i].referenced = 1;
+        stats.negative_hits++;
+        result = DCACHE_NEGATIVE;
+    } else {
+        entries[i].referenced = 1;
+        stats.hits++;
+        *child_inode = entries[i].child;
+    }
+
+    pthread_mutex_unlock(&lock);
+    return result;
+}
+
+static void insert_locked(uint32_t parent_inode, const char *name, uint32_t child_inode) {
+    int i = find(parent_inode, name);
+    if (i != -1) {
+        entries[i].child = child_inode;
+        entries[i].referenced = 1;
+        return;
+    }
+
+    // CLOCK 淘汰
+    while (1) {
+        i = clock_hand;
+        clock_hand = (clock_hand + 1) % DCACHE_ENTRIES;
+        if (!entries[i].valid) {
+            break;
+        }
+        if (entries[i].referenced) {
+            entries[i].referenced = 0;
+            continue;
+        }
+        unlink_entry(i);
+        stats.evictions++;
+        break;
+    }
+
+    entries[i].parent = parent_inode;
+    entries[i].child = child_inode;
+    entries[i].valid = 1;
+    entries[i].referenced = 1;
+    strcpy(entries[i].name, name);
+
+    unsigned int b = bucket_of(parent_inode, name);
+    entries[i].hash_next = buckets[b];
+    buckets[b] = i;
+}
+
+void dcache_insert(uint32_t parent_inode, const char *name, uint32_t child_inode) {
+    if (strlen(name) > MAX_FILENAME) {
+        return;
+    }
+
+    pthread_mutex_lock(&lock);
+    ensure_init();
+    insert_locked(parent_inode, name, child_inode);
+    pthread_mutex_unlock(&lock);
+}
+
+void dcache_remove(uint32_t parent_inode, const char *name) {
+    pthread_mutex_lock(&lock);
+    ensure_init();
+
+    int i = find(parent_inode, name);
+    if (i != -1) {
+        unlink_entry(i);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+// 目录被删除后，它的inode号可能被重新使用，丢弃以它为父目录的所有条目
+void dcache_purge_dir(uint32_t dir_inode) {
+    pthread_mutex_lock(&lock);
+    ensure_init();
+
+    for (int i = 0; i < DCACHE_ENTRIES; i++) {
+        if (entries[i].valid && (entries[i].parent == dir_inode || entries[i].child == dir_inode)) {
+            unlink_entry(i);
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void dcache_invalidate(void) {
+    pthread_mutex_lock(&lock);
+    reset();
+    pthread_mutex_unlock(&lock);
+}
+
+const dcache_stats_t *dcache_get_stats(void) {
+    return &stats;
+}
@@ -2,11 +2,37 @@
 #include "../include/inode.h"
 #include "../include/directory.h"
 #include "../include/disk.h"
+#include "../include/icache.h"
+#include "../include/dcache.h"
+#include "../include/stats.h"
 #include "../include/ext2.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
+
+/*名字空间锁：修改目录结构（创建、删除文件或目录）的命令持有写锁，
+只解析路径或读写已有文件的命令持有读锁。持有读锁时目录内容不会变化，
+但目录索引和目录项缓存仍会在查找时被填充，由 dindex_lock 和dcache自己的锁保护。*/
+static pthread_rwlock_t ns_lock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_mutex_t dindex_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void dir_lock_shared(void) {
+    pthread_rwlock_rdlock(&ns_lock);
+}
+
+void dir_lock_exclusive(void) {
+    pthread_rwlock_wrlock(&ns_lock);
+}
+
+void dir_unlock(void) {
+    pthread_rwlock_unlock(&ns_lock);
+}
+
+static int is_dot_name(const char *name) {
+    return strcmp(name, ".") == 0 || strcmp(name, "..") == 0;
+}
 
 // 目录操作
 int create_directory(const char *path, uint16_t mode) {
@@ -22,31 +48,31 @@ int create_directory(const char *path, uint16_t mode) {
         return -1;
     }
     
-    // 检查父目录是否为目录
-    if (!is_directory(parent_inode)) {
-        return -1;
-    }
-    
-    // 检查权限
-    if (!check_permission(parent_inode, EXT2_S_IWUSR)) {
+    // 父目录必须是可写的目录
+    if (check_access(parent_inode, EXT2_S_IFDIR, EXT2_S_IWUSR) != 0) {
         return -1;
     }
     
     // 创建目录inode
-    uint32_t dir_inode = create_inode(EXT2_S_IFDIR | mode, get_current_uid(), get_current_gid());
+    uint32_t dir_inode = create_inode(parent_inode, EXT2_S_IFDIR | mode, get_current_uid(), get_current_gid());
     if (dir_inode == 0) {
         return -1;
     }
     
-    // 分配数据块
-    uint32_t data_block = allocate_block();
+    // 分配数据块（放在新目录inode所在的组）
+    uint32_t data_block = allocate_block_near(inode_goal_block(dir_inode));
     if (data_block == 0) {
         delete_inode(dir_inode);
         return -1;
     }
     
-    // 设置目录的数据块
+    // 设置目录的数据块（块可能是刚释放的旧块，先初始化以免残留的目录项被当成有效项）
+    uint8_t empty_block[EXT2_MAX_BLOCK_SIZE];
+    dir_block_init(empty_block);
+    write_block(data_block, empty_block);
+    icache_lock_exclusive(dir_inode);
     set_inode_block(dir_inode, 0, data_block);
+    icache_unlock(dir_inode);
     
     // 创建 . 和 .. 目录项
     if (create_dot_entries(dir_inode, parent_inode) != 0) {
@@ -63,18 +89,22 @@ int create_directory(const char *path, uint16_t mode) {
     return 0;
 }
 
+/*删除空目录。最后一个分量是 "." 或 ".." 时拒绝（否则删掉的是 "." 目录项，父目录中的目录项却留着），
+根目录不能删除；需要对目录本身和父目录都有写权限。*/
 int delete_directory(const char *path) {
-    uint32_t inode_no;
-    if (path_to_inode(path, &inode_no) != 0) {
+    uint32_t parent_inode;
+    char child_name[MAX_FILENAME];
+    if (get_parent_inode(path, &parent_inode, child_name) != 0 || is_dot_name(child_name)) {
         return -1;
     }
     
-    if (!is_directory(inode_no)) {
+    uint32_t inode_no;
+    if (path_to_inode_nofollow(path, &inode_no) != 0 || inode_no == 1) {
         return -1;
     }
     
-    // 检查权限
-    if (!check_permission(inode_no, EXT2_S_IWUSR)) {
+    if (check_access(inode_no, EXT2_S_IFDIR, EXT2_S_IWUSR) != 0 ||
+        check_access(parent_inode, EXT2_S_IFDIR, EXT2_S_IWUSR) != 0) {
         return -1;
     }
     
@@ -85,69 +115,80 @@ int delete_directory(const char *path) {
         return -1; // 目录不为空
     }
     
-    // 获取父目录
-    uint32_t parent_inode;
-    char child_name[MAX_FILENAME];
-    if (get_parent_inode(path, &parent_inode, child_name) != 0) {
-        return -1;
-    }
-    
-    // 从父目录中删除目录项
+    // 从父目录中删除目录项，它的 ".." 对父目录的链接也一并去掉
     if (remove_directory_entry(parent_inode, child_name) != 0) {
         return -1;
     }
+    decrement_link_count(parent_inode);
     
     // 删除目录inode
+    dir_index_drop(inode_no);
     return delete_inode(inode_no);
 }
 
+// 每个目录项只查一次inode缓存，类型也从这份副本中取
+static void print_entry(const ext2_dir_entry_t *entry) {
+    ext2_inode_t *cached = icache_get(entry->inode);
+    if (cached == NULL) return;
+    ext2_inode_t inode = *cached;
+    icache_put(entry->inode);
+    
+    char type_char = '?';
+    if ((inode.i_mode & 0xF000) == EXT2_S_IFDIR) type_char = 'd';
+    else if ((inode.i_mode & 0xF000) == EXT2_S_IFREG) type_char = '-';
+    else if ((inode.i_mode & 0xF000) == EXT2_S_IFLNK) type_char = 'l';
+    
+    char permissions[11];
+    snprintf(permissions, sizeof(permissions), "%c%c%c%c%c%c%c%c%c%c",
+            type_char,
+            (inode.i_mode & EXT2_S_IRUSR) ? 'r' : '-',
+            (inode.i_mode & EXT2_S_IWUSR) ? 'w' : '-',
+            (inode.i_mode & EXT2_S_IXUSR) ? 'x' : '-',
+            (inode.i_mode & EXT2_S_IRGRP) ? 'r' : '-',
+            (inode.i_mode & EXT2_S_IWGRP) ? 'w' : '-',
+            (inode.i_mode & EXT2_S_IXGRP) ? 'x' : '-',
+            (inode.i_mode & EXT2_S_IROTH) ? 'r' : '-',
+            (inode.i_mode & EXT2_S_IWOTH) ? 'w' : '-',
+            (inode.i_mode & EXT2_S_IXOTH) ? 'x' : '-');
+    
+    printf("%-20s %-10u %-10c %-10u %-10s\n", 
+           entry->name, entry->inode, type_char, inode.i_size, permissions);
+}
+
 int list_directory(const char *path) {
     uint32_t inode_no;
     if (path_to_inode(path, &inode_no) != 0) {
         return -1;
     }
     
-    if (!is_directory(inode_no)) {
+    if (check_access(inode_no, EXT2_S_IFDIR, EXT2_S_IRUSR) != 0) {
         return -1;
     }
     
-    // 检查权限
-    if (!check_permission(inode_no, EXT2_S_IRUSR)) {
+    uint32_t block_nos[DIR_MAX_BLOCKS];
+    if (map_inode_blocks(inode_no, 0, DIR_MAX_BLOCKS, block_nos) != 0) {
         return -1;
     }
     
-    ext2_dir_entry_t entries[64];
-    int count = read_directory_entries(inode_no, entries, 64);
-    
     printf("Directory listing for: %s\n", path);
     printf("%-20s %-10s %-10s %-10s %-10s\n", "Name", "Inode", "Type", "Size", "Permissions");
     printf("------------------------------------------------------------\n");
     
-    for (int i = 0; i < count; i++) {
-        if (entries[i].inode == 0) continue;
-        
-        ext2_inode_t inode;
-        if (read_inode(entries[i].inode, &inode) != 0) continue;
-        
-        char type_char = '?';
-        if (is_directory(entries[i].inode)) type_char = 'd';
-        else if (is_regular_file(entries[i].inode)) type_char = '-';
-        
-        char permissions[11];
-        snprintf(permissions, sizeof(permissions), "%c%c%c%c%c%c%c%c%c%c",
-                type_char,
-                (inode.i_mode & EXT2_S_IRUSR) ? 'r' : '-',
-                (inode.i_mode & EXT2_S_IWUSR) ? 'w' : '-',
-                (inode.i_mode & EXT2_S_IXUSR) ? 'x' : '-',
-                (inode.i_mode & EXT2_S_IRGRP) ? 'r' : '-',
-                (inode.i_mode & EXT2_S_IWGRP) ? 'w' : '-',
-                (inode.i_mode & EXT2_S_IXGRP) ? 'x' : '-',
-                (inode.i_mode & EXT2_S_IROTH) ? 'r' : '-',
-                (inode.i_mode & EXT2_S_IWOTH) ? 'w' : '-',
-                (inode.i_mode & EXT2_S_IXOTH) ? 'x' : '-');
+    // 逐块遍历变长目录项，不受目录项个数限制
+    uint8_t scratch[EXT2_MAX_BLOCK_SIZE];
+    for (int block_index = 0; block_index < DIR_MAX_BLOCKS && block_nos[block_index] != 0; block_index++) {
+        const uint8_t *buffer = read_block_ref(block_nos[block_index], scratch);
+        if (buffer == NULL) {
+            break;
+        }
         
-        printf("%-20s %-10u %-10c %-10u %-10s\n", 
-               entries[i].name, entries[i].inode, type_char, inode.i_size, permissions);
+        ext2_dir_entry_t entry;
+        int offset = 0;
+        while ((offset = dir_block_next(buffer, offset, &entry)) != -1) {
+            if (entry.inode != 0) {
+                print_entry(&entry);
+            }
+        }
     }
     
     return 0;
@@ -159,178 +200,714 @@ int change_directory(const char *path) {
         return -1;
     }
     
-    if (!is_directory(inode_no)) {
+    if (check_access(inode_no, EXT2_S_IFDIR, EXT2_S_IXUSR) != 0) {
         return -1;
     }
     
-    // 检查权限
-    if (!check_permission(inode_no, EXT2_S_IXUSR)) {
+    // 这里可以设置当前工作目录，简化实现
+    return 0;
+}
+
+// 变长目录项块操作
+static ext2_dir_entry_t *record_at(uint8_t *block, int offset) {
+    return (ext2_dir_entry_t*)(block + offset);
+}
+
+// 检查 offset 处的目录项头部是否合法
+static int record_valid(const uint8_t *block, int offset) {
+    if (offset < 0 || offset + EXT2_DIR_ENTRY_HEADER > BLOCK_SIZE) {
+        return 0;
+    }
+    const ext2_dir_entry_t *e = (const ext2_dir_entry_t*)(block + offset);
+    return e->rec_len >= EXT2_DIR_ENTRY_HEADER && (e->rec_len & 3) == 0 &&
+           offset + e->rec_len <= BLOCK_SIZE &&
+           e->name_len <= e->rec_len - EXT2_DIR_ENTRY_HEADER;
+}
+
+// 空目录块：一个覆盖整块的空闲目录项
+void dir_block_init(uint8_t *block) {
+    memset(block, 0, BLOCK_SIZE);
+    record_at(block, 0)->rec_len = BLOCK_SIZE;
+}
+
+// 解析 offset 处的目录项到 entry（包括空闲项），返回下一项的偏移，块结束或数据损坏时返回-1
+int dir_block_next(const uint8_t *block, int offset, ext2_dir_entry_t *entry) {
+    if (offset >= BLOCK_SIZE || !record_valid(block, offset)) {
         return -1;
     }
+    const ext2_dir_entry_t *e = (const ext2_dir_entry_t*)(block + offset);
+    entry->inode = e->inode;
+    entry->rec_len = e->rec_len;
+    entry->name_len = e->name_len;
+    entry->file_type = e->file_type;
+    memcpy(entry->name, block + offset + EXT2_DIR_ENTRY_HEADER, e->name_len);
+    entry->name[e->name_len] = '\0';
+    return offset + e->rec_len;
+}
+
+// 块中是否有能容纳 need 字节目录项的空间
+static int dir_block_fits(const uint8_t *block, int need) {
+    for (int offset = 0; offset < BLOCK_SIZE; offset += ((const ext2_dir_entry_t*)(block + offset))->rec_len) {
+        if (!record_valid(block, offset)) {
+            return 0;
+        }
+        const ext2_dir_entry_t *e = (const ext2_dir_entry_t*)(block + offset);
+        int used = e->inode != 0 ? EXT2_DIR_REC_LEN(e->name_len) : 0;
+        if (e->rec_len - used >= need) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// 在块中插入目录项：复用足够大的空闲项，或拆分尾部有空余的目录项。返回新项的偏移，没有空间返回-1
+int dir_block_insert(uint8_t *block, const char *name, uint32_t inode, uint8_t file_type) {
+    size_t name_len = strlen(name);
+    if (name_len == 0 || name_len > MAX_FILENAME) {
+        return -1;
+    }
+    int need = EXT2_DIR_REC_LEN(name_len);
     
-    // 这里可以设置当前工作目录，简化实现
+    for (int offset = 0; offset < BLOCK_SIZE; offset += record_at(block, offset)->rec_len) {
+        if (!record_valid(block, offset)) {
+            return -1;
+        }
+        ext2_dir_entry_t *e = record_at(block, offset);
+        int used = e->inode != 0 ? EXT2_DIR_REC_LEN(e->name_len) : 0;
+        if (e->rec_len - used < need) {
+            continue;
+        }
+        
+        if (used > 0) {
+            // 从当前项尾部的空余空间中拆出新项
+            int new_offset = offset + used;
+            ext2_dir_entry_t *n = record_at(block, new_offset);
+            n->rec_len = e->rec_len - used;
+            e->rec_len = used;
+            e = n;
+            offset = new_offset;
+        }
+        e->inode = inode;
+        e->name_len = name_len;
+        e->file_type = file_type;
+        memcpy(block + offset + EXT2_DIR_ENTRY_HEADER, name, name_len);
+        return offset;
+    }
+    return -1;
+}
+
+// 删除 offset 处的目录项：并入前一项；块中第一项只标记为空闲
+int dir_block_remove(uint8_t *block, int offset) {
+    int prev = -1;
+    int cur = 0;
+    while (cur < offset) {
+        if (!record_valid(block, cur)) {
+            return -1;
+        }
+        prev = cur;
+        cur += record_at(block, cur)->rec_len;
+    }
+    if (cur != offset || !record_valid(block, cur)) {
+        return -1;
+    }
+    
+    if (prev == -1) {
+        record_at(block, cur)->inode = 0;
+    } else {
+        record_at(block, prev)->rec_len += record_at(block, cur)->rec_len;
+    }
     return 0;
 }
 
-// 目录项操作
-int add_directory_entry(uint32_t parent_inode, const char *name, uint32_t child_inode, uint8_t file_type) {
-    ext2_inode_t parent;
-    if (read_inode(parent_inode, &parent) != 0) {
+/*目录哈希索引：第一次查找某个目录时扫描它的全部数据块，在内存中建立 名称->目录项位置 的哈希表，
+之后查找、插入、删除都是期望 O(1)，不再逐块 strcmp。
+索引记录每个目录项所在的逻辑块和块内偏移，并维护一个空闲位置提示（可能还有空位的第一个块），
+插入时不用再从块 0 开始找空位。索引槽位数量固定，超出时轮流淘汰，需要时再重建。*/
+
+#define DINDEX_SLOTS 32
+
+typedef struct {
+    char *name;
+    uint32_t hash;
+    uint32_t inode;
+    uint8_t file_type;
+    uint16_t block_index;   // 目录中的逻辑块号
+    uint16_t offset;        // 块内偏移
+    int next;               // 同一哈希桶中的下一项，-1 表示结束
+} dindex_entry_t;
+
+typedef struct {
+    uint32_t dir_inode;     // 所属目录，0 表示空闲槽位
+    int *buckets;
+    int nbuckets;
+    dindex_entry_t *entries;
+    int count;
+    int capacity;
+    int free_entry;         // 已删除项组成的空闲链表
+    uint32_t free_hint;     // 可能有空闲目录项的第一个逻辑块
+} dir_index_t;
+
+static dir_index_t dir_indexes[DINDEX_SLOTS];
+static int dindex_next_slot = 0;
+
+static uint32_t name_hash(const char *name) {
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    while (*name) {
+        h ^= (uint8_t)*name++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void dindex_free(dir_index_t *idx) {
+    for (int i = 0; i < idx->count; i++) {
+        free(idx->entries[i].name);
+    }
+    free(idx->entries);
+    free(idx->buckets);
+    memset(idx, 0, sizeof(dir_index_t));
+}
+
+static void dindex_rehash(dir_index_t *idx, int nbuckets) {
+    free(idx->buckets);
+    idx->nbuckets = nbuckets;
+    idx->buckets = malloc(sizeof(int) * nbuckets);
+    for (int i = 0; i < nbuckets; i++) {
+        idx->buckets[i] = -1;
+    }
+    for (int i = 0; i < idx->count; i++) {
+        if (idx->entries[i].name == NULL) {
+            continue;
+        }
+        int b = idx->entries[i].hash & (nbuckets - 1);
+        idx->entries[i].next = idx->buckets[b];
+        idx->buckets[b] = i;
+    }
+}
+
+static dindex_entry_t *dindex_find(dir_index_t *idx, const char *name) {
+    uint32_t h = name_hash(name);
+    int i = idx->buckets[h & (idx->nbuckets - 1)];
+    while (i != -1) {
+        if (idx->entries[i].hash == h && strcmp(idx->entries[i].name, name) == 0) {
+            return &idx->entries[i];
+        }
+        i = idx->entries[i].next;
+    }
+    return NULL;
+}
+
+static int dindex_add(dir_index_t *idx, const char *name, uint32_t inode, uint8_t file_type,
+                      uint16_t block_index, uint16_t offset) {
+    int i;
+    if (idx->free_entry != -1) {
+        i = idx->free_entry;
+        idx->free_entry = idx->entries[i].next;
+    } else {
+        if (idx->count == idx->capacity) {
+            int capacity = idx->capacity ? idx->capacity * 2 : 16;
+            dindex_entry_t *entries = realloc(idx->entries, sizeof(dindex_entry_t) * capacity);
+            if (entries == NULL) {
+                return -1;
+            }
+            idx->entries = entries;
+            idx->capacity = capacity;
+        }
+        i = idx->count++;
+    }
+
+    dindex_entry_t *e = &idx->entries[i];
+    e->name = strdup(name);
+    e->hash = name_hash(name);
+    e->inode = inode;
+    e->file_type = file_type;
+    e->block_index = block_index;
+    e->offset = offset;
+
+    int b = e->hash & (idx->nbuckets - 1);
+    e->next = idx->buckets[b];
+    idx->buckets[b] = i;
+
+    // 负载过高时扩大哈希表
+    if (idx->count > idx->nbuckets) {
+        dindex_rehash(idx, idx->nbuckets * 2);
+    }
+    return 0;
+}
+
+static void dindex_remove(dir_index_t *idx, dindex_entry_t *e) {
+    int target = e - idx->entries;
+    int *link = &idx->buckets[e->hash & (idx->nbuckets - 1)];
+    while (*link != -1) {
+        if (*link == target) {
+            *link = e->next;
+            break;
+        }
+        link = &idx->entries[*link].next;
+    }
+    free(e->name);
+    e->name = NULL;
+    e->next = idx->free_entry;
+    idx->free_entry = target;
+}
+
+// 扫描目录的所有数据块建立索引
+static int dindex_build(dir_index_t *idx, uint32_t dir_inode) {
+    idx->dir_inode = dir_inode;
+    idx->free_entry = -1;
+    idx->free_hint = DIR_MAX_BLOCKS;
+    dindex_rehash(idx, 16);
+
+    uint32_t block_nos[DIR_MAX_BLOCKS];
+    if (map_inode_blocks(dir_inode, 0, DIR_MAX_BLOCKS, block_nos) != 0) {
+        return -1;
+    }
+
+    uint8_t scratch[EXT2_MAX_BLOCK_SIZE];
+    for (uint32_t block_index = 0; block_index < DIR_MAX_BLOCKS; block_index++) {
+        if (block_nos[block_index] == 0) {
+            if (idx->free_hint > block_index) {
+                idx->free_hint = block_index; // 新块可以直接分配在这里
+            }
+            break;
+        }
+        const uint8_t *buffer = read_block_ref(block_nos[block_index], scratch);
+        if (buffer == NULL) {
+            return -1;
+        }
+
+        if (idx->free_hint > block_index && dir_block_fits(buffer, EXT2_DIR_REC_LEN(1))) {
+            idx->free_hint = block_index;
+        }
+        
+        ext2_dir_entry_t entry;
+        int offset = 0;
+        int next;
+        while ((next = dir_block_next(buffer, offset, &entry)) != -1) {
+            if (entry.inode != 0 &&
+                dindex_add(idx, entry.name, entry.inode, entry.file_type, block_index, offset) != 0) {
+                return -1;
+            }
+            offset = next;
+        }
+    }
+    return 0;
+}
+
+// 取得目录的索引，不存在时建立
+static dir_index_t *get_dir_index(uint32_t dir_inode) {
+    for (int i = 0; i < DINDEX_SLOTS; i++) {
+        if (dir_indexes[i].dir_inode == dir_inode) {
+            return &dir_indexes[i];
+        }
+    }
+
+    dir_index_t *idx = &dir_indexes[dindex_next_slot];
+    dindex_next_slot = (dindex_next_slot + 1) % DINDEX_SLOTS;
+    if (idx->dir_inode != 0) {
+        dindex_free(idx);
+    }
+
+    if (dindex_build(idx, dir_inode) != 0) {
+        dindex_free(idx);
+        return NULL;
+    }
+    return idx;
+}
+
+// 目录被删除时丢弃它的索引
+void dir_index_drop(uint32_t dir_inode) {
+    pthread_mutex_lock(&dindex_lock);
+    for (int i = 0; i < DINDEX_SLOTS; i++) {
+        if (dir_indexes[i].dir_inode == dir_inode) {
+            dindex_free(&dir_indexes[i]);
+        }
+    }
+    dcache_purge_dir(dir_inode);
+    pthread_mutex_unlock(&dindex_lock);
+}
+
+// 丢弃所有目录索引和目录项缓存（卸载时调用）
+void dir_index_invalidate(void) {
+    pthread_mutex_lock(&dindex_lock);
+    for (int i = 0; i < DINDEX_SLOTS; i++) {
+        if (dir_indexes[i].dir_inode != 0) {
+            dindex_free(&dir_indexes[i]);
+        }
+    }
+    dcache_invalidate();
+    pthread_mutex_unlock(&dindex_lock);
+}
+
+/*目录项操作：持有 dindex_lock，修改目录块期间持有父目录inode的写锁。
+链接计数在放开父目录的锁之后再修改，"." 的子inode就是父目录本身。*/
+static int add_entry_locked(uint32_t parent_inode, const char *name, uint32_t child_inode, uint8_t file_type) {
+    dir_index_t *idx = get_dir_index(parent_inode);
+    if (idx == NULL) {
         return -1;
     }
     
-    // 查找空闲空间
-    uint32_t block_index = 0;
+    // 同名目录项已存在
+    if (dindex_find(idx, name) != NULL) {
+        return -1;
+    }
+    
+    // 从空闲位置提示开始查找空闲空间
+    uint32_t block_index = idx->free_hint;
     uint32_t block_no;
-    uint8_t buffer[BLOCK_SIZE];
+    uint8_t buffer[EXT2_MAX_BLOCK_SIZE];
     
-    while (block_index < 12) {
+    while (block_index < DIR_MAX_BLOCKS) {
         if (get_inode_block(parent_inode, block_index, &block_no) != 0) {
             break;
         }
         
         if (block_no == 0) {
-            // 分配新块
-            block_no = allocate_block();
+            // 分配新块，尽量靠近目录所在的组
+            block_no = allocate_block_near(inode_goal_block(parent_inode));
             if (block_no == 0) {
                 return -1;
             }
             set_inode_block(parent_inode, block_index, block_no);
-            memset(buffer, 0, BLOCK_SIZE);
+            dir_block_init(buffer);
         } else {
             if (read_block(block_no, buffer) != 0) {
                 return -1;
             }
         }
         
-        // 查找空闲目录项
-        ext2_dir_entry_t *entry = (ext2_dir_entry_t*)buffer;
-        int entry_count = BLOCK_SIZE / sizeof(ext2_dir_entry_t);
-        
-        for (int i = 0; i < entry_count; i++) {
-            if (entry[i].inode == 0) {
-                // 找到空闲项
-                entry[i].inode = child_inode;
-                entry[i].rec_len = sizeof(ext2_dir_entry_t);
-                entry[i].name_len = strlen(name);
-                entry[i].file_type = file_type;
-                strncpy(entry[i].name, name, sizeof(entry[i].name) - 1);
-                entry[i].name[sizeof(entry[i].name) - 1] = '\0';
-                
-                write_block(block_no, buffer);
-                increment_link_count(child_inode);
-                return 0;
-            }
+        // 在块中找能容纳新目录项的空间
+        int offset = dir_block_insert(buffer, name, child_inode, file_type);
+        if (offset != -1) {
+            write_block(block_no, buffer);
+            icache_unlock(parent_inode);
+            increment_link_count(child_inode);
+            icache_lock_exclusive(parent_inode);
+            
+            dindex_add(idx, name, child_inode, file_type, block_index, offset);
+            dcache_insert(parent_inode, name, child_inode);
+            return 0;
         }
         
+        // 名称较长时块中可能还有放不下它的零碎空间，只有块满时才推进空闲提示
+        if (idx->free_hint == block_index && !dir_block_fits(buffer, EXT2_DIR_REC_LEN(1))) {
+            idx->free_hint = block_index + 1;
+        }
         block_index++;
     }
     
     return -1; // 没有空间
 }
 
-int remove_directory_entry(uint32_t parent_inode, const char *name) {
-    ext2_inode_t parent;
-    if (read_inode(parent_inode, &parent) != 0) {
+int add_directory_entry(uint32_t parent_inode, const char *name, uint32_t child_inode, uint8_t file_type) {
+    pthread_mutex_lock(&dindex_lock);
+    icache_lock_exclusive(parent_inode);
+    int result = add_entry_locked(parent_inode, name, child_inode, file_type);
+    icache_unlock(parent_inode);
+    pthread_mutex_unlock(&dindex_lock);
+    return result;
+}
+
+static int remove_entry_locked(uint32_t parent_inode, const char *name) {
+    dir_index_t *idx = get_dir_index(parent_inode);
+    if (idx == NULL) {
         return -1;
     }
     
-    uint32_t block_index = 0;
+    dindex_entry_t *e = dindex_find(idx, name);
+    if (e == NULL) {
+        return -1; // 未找到
+    }
+    
     uint32_t block_no;
-    uint8_t buffer[BLOCK_SIZE];
+    uint8_t buffer[EXT2_MAX_BLOCK_SIZE];
+    if (get_inode_block(parent_inode, e->block_index, &block_no) != 0 || block_no == 0 ||
+        read_block(block_no, buffer) != 0) {
+        return -1;
+    }
     
-    while (block_index < 12) {
-        if (get_inode_block(parent_inode, block_index, &block_no) != 0 || block_no == 0) {
-            break;
-        }
-        
-        if (read_block(block_no, buffer) != 0) {
-            return -1;
-        }
-        
-        ext2_dir_entry_t *entry = (ext2_dir_entry_t*)buffer;
-        int entry_count = BLOCK_SIZE / sizeof(ext2_dir_entry_t);
-        
-        for (int i = 0; i < entry_count; i++) {
-            if (entry[i].inode != 0 && strcmp(entry[i].name, name) == 0) {
-                uint32_t child_inode = entry[i].inode;
-                entry[i].inode = 0; // 标记为删除
-                
-                write_block(block_no, buffer);
-                decrement_link_count(child_inode);
-                return 0;
-            }
-        }
-        
-        block_index++;
+    uint32_t child_inode = ((ext2_dir_entry_t*)(buffer + e->offset))->inode;
+    if (dir_block_remove(buffer, e->offset) != 0) {
+        return -1;
     }
     
-    return -1; // 未找到
+    write_block(block_no, buffer);
+    icache_unlock(parent_inode);
+    decrement_link_count(child_inode);
+    icache_lock_exclusive(parent_inode);
+    
+    if (e->block_index < idx->free_hint) {
+        idx->free_hint = e->block_index;
+    }
+    dindex_remove(idx, e);
+    dcache_insert(parent_inode, name, 0);
+    return 0;
 }
 
-int find_directory_entry(uint32_t parent_inode, const char *name, ext2_dir_entry_t *entry) {
-    ext2_inode_t parent;
-    if (read_inode(parent_inode, &parent) != 0) {
+int remove_directory_entry(uint32_t parent_inode, const char *name) {
+    pthread_mutex_lock(&dindex_lock);
+    icache_lock_exclusive(parent_inode);
+    int result = remove_entry_locked(parent_inode, name);
+    icache_unlock(parent_inode);
+    pthread_mutex_unlock(&dindex_lock);
+    return result;
+}
+
+// 把目录项改为指向 new_inode（目录移动后修正它的 ".."），两边的链接计数随之调整
+static int replace_entry_locked(uint32_t parent_inode, const char *name, uint32_t new_inode, uint32_t *old_inode) {
+    dir_index_t *idx = get_dir_index(parent_inode);
+    dindex_entry_t *e = idx != NULL ? dindex_find(idx, name) : NULL;
+    if (e == NULL) {
         return -1;
     }
     
-    uint32_t block_index = 0;
     uint32_t block_no;
-    uint8_t buffer[BLOCK_SIZE];
+    uint8_t buffer[EXT2_MAX_BLOCK_SIZE];
+    if (get_inode_block(parent_inode, e->block_index, &block_no) != 0 || block_no == 0 ||
+        read_block(block_no, buffer) != 0) {
+        return -1;
+    }
     
-    while (block_index < 12) {
-        if (get_inode_block(parent_inode, block_index, &block_no) != 0 || block_no == 0) {
-            break;
+    ext2_dir_entry_t *record = (ext2_dir_entry_t*)(buffer + e->offset);
+    *old_inode = record->inode;
+    record->inode = new_inode;
+    write_block(block_no, buffer);
+    e->inode = new_inode;
+    dcache_insert(parent_inode, name, new_inode);
+    return 0;
+}
+
+int replace_directory_entry(uint32_t parent_inode, const char *name, uint32_t new_inode) {
+    uint32_t old_inode = 0;
+    pthread_mutex_lock(&dindex_lock);
+    icache_lock_exclusive(parent_inode);
+    int result = replace_entry_locked(parent_inode, name, new_inode, &old_inode);
+    icache_unlock(parent_inode);
+    pthread_mutex_unlock(&dindex_lock);
+    
+    if (result == 0 && old_inode != new_inode) {
+        increment_link_count(new_inode);
+        decrement_link_count(old_inode);
+    }
+    return result;
+}
+
+/*删除一个非目录的目录项；最后一个链接被删除时释放inode和它的数据块。
+成功返回0，不存在返回 -ENOENT，是目录返回 -EISDIR。*/
+int unlink_entry(uint32_t parent_inode, const char *name) {
+    ext2_dir_entry_t entry;
+    if (find_directory_entry(parent_inode, name, &entry) != 0) {
+        return -ENOENT;
+    }
+    if (is_directory(entry.inode)) {
+        return -EISDIR;
+    }
+    if (remove_directory_entry(parent_inode, name) != 0) {
+        return -EIO;
+    }
+    if (get_link_count(entry.inode) == 0) {
+        delete_inode(entry.inode);
+    }
+    return 0;
+}
+
+// 目录 dir_inode 是否是 ancestor 自己或在它下面（沿 ".." 向上找到根目录为止）
+static int is_within(uint32_t dir_inode, uint32_t ancestor) {
+    for (int depth = 0; depth < MAX_PATH; depth++) {
+        if (dir_inode == ancestor) {
+            return 1;
         }
-        
-        if (read_block(block_no, buffer) != 0) {
-            return -1;
+        ext2_dir_entry_t parent;
+        if (dir_inode == 1 || find_directory_entry(dir_inode, "..", &parent) != 0) {
+            return 0;
         }
-        
-        ext2_dir_entry_t *entries = (ext2_dir_entry_t*)buffer;
-        int entry_count = BLOCK_SIZE / sizeof(ext2_dir_entry_t);
-        
-        for (int i = 0; i < entry_count; i++) {
-            if (entries[i].inode != 0 && strcmp(entries[i].name, name) == 0) {
-                memcpy(entry, &entries[i], sizeof(ext2_dir_entry_t));
-                return 0;
-            }
+        dir_inode = parent.inode;
+    }
+    return 1; // 目录链异常时按在其中处理，拒绝移动
+}
+
+/*重命名/移动：只修改目录项，不复制数据。先在新位置添加目录项，再删除旧目录项，
+链接计数一加一减保持不变；移动目录时把它的 ".." 改为指向新的父目录。
+新路径已有非目录文件时将其替换（最后一个链接被删除时释放）。调用者持有名字空间写锁。
+成功返回0，失败返回 -ENOENT、-EEXIST、-EINVAL、-EACCES、-ENOTDIR 或 -ENOSPC。*/
+int rename_path(const char *old_path, const char *new_path) {
+    uint32_t old_parent;
+    uint32_t new_parent;
+    char old_name[MAX_FILENAME + 1];
+    char new_name[MAX_FILENAME + 1];
+    ext2_dir_entry_t entry;
+    
+    if (get_parent_inode(old_path, &old_parent, old_name) != 0 || old_parent == 0 ||
+        find_directory_entry(old_parent, old_name, &entry) != 0) {
+        return -ENOENT;
+    }
+    if (get_parent_inode(new_path, &new_parent, new_name) != 0 || new_parent == 0) {
+        return -ENOENT;
+    }
+    if (is_dot_name(old_name) || is_dot_name(new_name) || !is_valid_filename(new_name)) {
+        return -EINVAL;
+    }
+    
+    int error = check_access(old_parent, EXT2_S_IFDIR, EXT2_S_IWUSR);
+    if (error == 0) {
+        error = check_access(new_parent, EXT2_S_IFDIR, EXT2_S_IWUSR);
+    }
+    if (error != 0) {
+        return error;
+    }
+    
+    uint32_t inode_no = entry.inode;
+    int is_dir = is_directory(inode_no);
+    if (is_dir && is_within(new_parent, inode_no)) {
+        return -EINVAL; // 不能把目录移到它自己下面
+    }
+    
+    ext2_dir_entry_t existing;
+    if (find_directory_entry(new_parent, new_name, &existing) == 0) {
+        if (existing.inode == inode_no) {
+            return 0; // 同一个文件的两个名字，什么都不用做
+        }
+        if (is_dir || is_directory(existing.inode)) {
+            return -EEXIST;
+        }
+        error = unlink_entry(new_parent, new_name);
+        if (error != 0) {
+            return error;
         }
-        
-        block_index++;
     }
     
-    return -1; // 未找到
+    if (add_directory_entry(new_parent, new_name, inode_no, entry.file_type) != 0) {
+        return -ENOSPC;
+    }
+    if (remove_directory_entry(old_parent, old_name) != 0) {
+        return -EIO;
+    }
+    if (is_dir && old_parent != new_parent && replace_directory_entry(inode_no, "..", new_parent) != 0) {
+        return -EIO;
+    }
+    update_ctime(inode_no);
+    return 0;
+}
+
+int find_directory_entry(uint32_t parent_inode, const char *name, ext2_dir_entry_t *entry) {
+    STATS_START(start);
+    pthread_mutex_lock(&dindex_lock);
+    dir_index_t *idx = get_dir_index(parent_inode);
+    dindex_entry_t *e = idx != NULL ? dindex_find(idx, name) : NULL;
+    if (e == NULL) {
+        pthread_mutex_unlock(&dindex_lock);
+        STATS_RECORD(STATS_FIND_DIR_ENTRY, start, 1);
+        return -1; // 未找到
+    }
+    
+    memset(entry, 0, sizeof(ext2_dir_entry_t));
+    entry->inode = e->inode;
+    entry->name_len = strlen(e->name);
+    entry->rec_len = EXT2_DIR_REC_LEN(entry->name_len);
+    entry->file_type = e->file_type;
+    strncpy(entry->name, e->name, sizeof(entry->name) - 1);
+    pthread_mutex_unlock(&dindex_lock);
+    STATS_RECORD(STATS_FIND_DIR_ENTRY, start, 0);
+    return 0;
 }
 
 // 路径解析
-int path_to_inode(const char *path, uint32_t *inode_no) {
-    if (strcmp(path, "/") == 0) {
-        *inode_no = 1; // 根目录
+// 在目录中查找一个分量：先查目录项缓存，未命中时查目录索引，不存在返回-1
+static int lookup_component(uint32_t dir_inode, const char *name, uint32_t *child) {
+    int cached = dcache_lookup(dir_inode, name, child);
+    if (cached == DCACHE_NEGATIVE) {
+        return -1;
+    }
+    if (cached == DCACHE_HIT) {
         return 0;
     }
     
-    char path_copy[MAX_PATH];
-    strncpy(path_copy, path, sizeof(path_copy) - 1);
-    path_copy[sizeof(path_copy) - 1] = '\0';
+    pthread_mutex_lock(&dindex_lock);
+    dir_index_t *idx = get_dir_index(dir_inode);
+    dindex_entry_t *e = idx != NULL ? dindex_find(idx, name) : NULL;
+    *child = e != NULL ? e->inode : 0;
+    if (idx != NULL) {
+        dcache_insert(dir_inode, name, *child); // 不存在的名称也缓存
+    }
+    pthread_mutex_unlock(&dindex_lock);
+    return *child != 0 ? 0 : -1;
+}
+
+/*逐个分量解析路径。遇到符号链接时用它的目标替换这个分量，与剩余路径拼接后继续解析：
+绝对目标从根目录重新开始，相对目标从链接所在的目录开始。follow_last 为0时最后一个分量
+即使是符号链接也不跟随（删除、readlink 作用于链接本身）。最多跟随 SYMLINK_MAX_FOLLOW 次。*/
+static int resolve_path(const char *path, int follow_last, uint32_t *inode_no) {
+    char buffer[MAX_PATH];
+    strncpy(buffer, path, sizeof(buffer) - 1);
+    buffer[sizeof(buffer) - 1] = '\0';
     
-    char *token = strtok(path_copy, "/");
     uint32_t current_inode = 1; // 从根目录开始
+    int follows = 0;
+    char *p = buffer;
     
-    while (token != NULL) {
-        ext2_dir_entry_t entry;
-        if (find_directory_entry(current_inode, token, &entry) != 0) {
+    for (;;) {
+        while (*p == '/') {
+            p++;
+        }
+        if (*p == '\0') {
+            break;
+        }
+        
+        char *name = p;
+        char *rest = p + strcspn(p, "/");
+        if (*rest == '/') {
+            *rest++ = '\0';
+            rest += strspn(rest, "/");
+        }
+        
+        uint32_t child;
+        if (lookup_component(current_inode, name, &child) != 0) {
             return -1;
         }
+        if ((*rest == '\0' && !follow_last) || !is_symlink(child)) {
+            current_inode = child;
+            p = rest;
+            continue;
+        }
         
-        current_inode = entry.inode;
-        token = strtok(NULL, "/");
+        char target[MAX_PATH];
+        char joined[MAX_PATH];
+        if (++follows > SYMLINK_MAX_FOLLOW || read_symlink(child, target, sizeof(target)) <= 0 ||
+            snprintf(joined, sizeof(joined), "%s/%s", target, rest) >= (int)sizeof(joined)) {
+            return -1;
+        }
+        if (target[0] == '/') {
+            current_inode = 1;
+        }
+        strcpy(buffer, joined);
+        p = buffer;
     }
     
     *inode_no = current_inode;
     return 0;
 }
 
+int path_to_inode(const char *path, uint32_t *inode_no) {
+    STATS_START(start);
+    int ret = 0;
+    if (strcmp(path, "/") == 0) {
+        *inode_no = 1; // 根目录
+    } else {
+        ret = resolve_path(path, 1, inode_no);
+    }
+    STATS_RECORD(STATS_PATH_TO_INODE, start, ret != 0);
+    return ret;
+}
+
+int path_to_inode_nofollow(const char *path, uint32_t *inode_no) {
+    if (strcmp(path, "/") == 0) {
+        *inode_no = 1;
+        return 0;
+    }
+    return resolve_path(path, 0, inode_no);
+}
+
 int get_parent_inode(const char *path, uint32_t *parent_inode, char *child_name) {
     if (strcmp(path, "/") == 0) {
         return -1; // 根目录没有父目录
@@ -362,31 +939,31 @@ int get_parent_inode(const char *path, uint32_t *parent_inode, char *child_name)
 
 // 目录遍历
 int read_directory_entries(uint32_t inode_no, ext2_dir_entry_t *entries, int max_entries) {
-    ext2_inode_t inode;
-    if (read_inode(inode_no, &inode) != 0) {
+    // 确认inode存在（同时把它载入内存inode表）
+    if (icache_get(inode_no) == NULL) {
         return -1;
     }
+    icache_put(inode_no);
     
     int entry_count = 0;
     uint32_t block_index = 0;
     uint32_t block_no;
-    uint8_t buffer[BLOCK_SIZE];
+    uint8_t scratch[EXT2_MAX_BLOCK_SIZE];
     
-    while (block_index < 12 && entry_count < max_entries) {
+    while (block_index < DIR_MAX_BLOCKS && entry_count < max_entries) {
         if (get_inode_block(inode_no, block_index, &block_no) != 0 || block_no == 0) {
             break;
         }
         
-        if (read_block(block_no, buffer) != 0) {
+        const uint8_t *buffer = read_block_ref(block_no, scratch);
+        if (buffer == NULL) {
             break;
         }
         
-        ext2_dir_entry_t *block_entries = (ext2_dir_entry_t*)buffer;
-        int block_entry_count = BLOCK_SIZE / sizeof(ext2_dir_entry_t);
-        
-        for (int i = 0; i < block_entry_count && entry_count < max_entries; i++) {
-            if (block_entries[i].inode != 0) {
-                memcpy(&entries[entry_count], &block_entries[i], sizeof(ext2_dir_entry_t));
+        int offset = 0;
+        while (entry_count < max_entries &&
+               (offset = dir_block_next(buffer, offset, &entries[entry_count])) != -1) {
+            if (entries[entry_count].inode != 0) {
                 entry_count++;
             }
         }
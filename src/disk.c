@@ -1,16 +1,74 @@
 #include "../include/disk.h"
 #include "../include/ext2.h"
+#include "../include/cache.h"
+#include "../include/journal.h"
+#include "../include/uring.h"
+#include "../include/snapshot.h"
+#include "../include/stats.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 // 全局变量
 static int disk_fd = -1;
-uint8_t block_bitmap[BLOCK_SIZE];
-uint8_t inode_bitmap[BLOCK_SIZE];
+
+/*mmap 后端：挂载时把整个镜像映射进来，块读写变成内存拷贝，不再经过块缓存和系统调用。
+被修改的页由内核写回，sync/卸载时用 msync 强制落盘。*/
+static uint8_t *disk_map = NULL;
+static size_t disk_map_size = 0;
+
+/*io_uring 后端：块读写经过每个线程自己的环提交，多段请求一次提交、一起等待完成。
+内核不支持时挂载退回 pread/pwrite。*/
+static int disk_uring = 0;
+
+/*位图在内存中按组首尾相连：块位图每组一个整块（位i对应块i+1），
+inode位图每组 inodes_per_group 位（位i对应inode i+1），挂载时分配。*/
+uint8_t *block_bitmap = NULL;
+uint8_t *inode_bitmap = NULL;
+
+// 组描述符表（按整块分配，写回时直接按块写）
+ext2_group_desc_t *group_desc = NULL;
+
+// allocate_block 的 next-fit 游标（没有目标块的元数据分配从这里开始找）
+static int block_cursor = 0;
+
+/*延迟写回标志：分配和释放只修改内存中的位图、组描述符和超级块计数。
+每个组记录自己的哪个位图被修改过，写回时只写这些块。*/
+#define GROUP_BLOCK_BITMAP_DIRTY 1
+#define GROUP_INODE_BITMAP_DIRTY 2
+
+static uint8_t *group_dirty = NULL;
+static int gdt_dirty = 0;
+static int superblock_dirty = 0;
+
+/*分配锁：保护位图、组描述符、超级块中的空闲计数、预留窗口和上面的脏标志。
+分配只是内存中的位操作，临界区很短，用一把锁即可；对外的分配接口在锁内调用 *_locked 版本。
+锁内不做I/O：写盘时快照的写时复制也要分配块。*/
+static pthread_mutex_t alloc_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// 组 group 的第一个块
+static uint32_t group_first_block(uint32_t group)
+{
+    return 1 + group * fs.blocks_per_group;
+}
+
+static int min_int(int a, int b)
+{
+    return a < b ? a : b;
+}
 
 // 位图操作
 void set_bitmap_bit(uint8_t *bitmap, int bit)
@@ -34,40 +92,222 @@ int get_bitmap_bit(uint8_t *bitmap, int bit)
     return (bitmap[byte] >> offset) & 1;
 }
 
+/*空闲位查找：按64位字扫描，取反后用 ctz 一次定位字内第一个0位；
+支持 SSE2/AVX2 时先以16/32字节为单位跳过全1（已满）的区域。
+位图末尾不足一个字的部分按已占用处理，不会返回超出范围的位。*/
+
+// 读取第 word 个64位字，超出位图的字节视为全1
+static uint64_t load_word(const uint8_t *bitmap, int word, int nbytes)
+{
+    uint64_t value = ~0ULL;
+    int offset = word * 8;
+    int avail = nbytes - offset;
+    memcpy(&value, bitmap + offset, avail >= 8 ? 8 : avail);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap64(value);
+#endif
+    return value;
+}
+
+// 从字节偏移 offset 开始跳过全1的区域，返回第一个可能含0位的字节偏移
+static int skip_full_bytes(const uint8_t *bitmap, int offset, int nbytes)
+{
+#if defined(__AVX2__)
+    const __m256i ones = _mm256_set1_epi8((char)0xFF);
+    while (offset + 32 <= nbytes)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(bitmap + offset));
+        if ((unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, ones)) != 0xFFFFFFFFu)
+        {
+            break;
+        }
+        offset += 32;
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i ones128 = _mm_set1_epi8((char)0xFF);
+    while (offset + 16 <= nbytes)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(bitmap + offset));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, ones128)) != 0xFFFF)
+        {
+            break;
+        }
+        offset += 16;
+    }
+#endif
+    return offset;
+}
+
+// 在 [from, to) 范围内查找第一个0位
+static int scan_bits(const uint8_t *bitmap, int from, int to)
+{
+    int nbytes = (to + 7) / 8;
+    int bit = from;
+
+    while (bit < to)
+    {
+        // 对齐到字边界后尝试批量跳过已满区域
+        if ((bit & 63) == 0)
+        {
+            bit = skip_full_bytes(bitmap, bit / 8, nbytes) * 8;
+            if (bit >= to)
+            {
+                break;
+            }
+        }
+
+        int word = bit / 64;
+        uint64_t free_bits = ~load_word(bitmap, word, nbytes);
+        free_bits &= ~0ULL << (bit & 63); // 忽略起点之前的位
+        if (free_bits != 0)
+        {
+            int found = word * 64 + __builtin_ctzll(free_bits);
+            return found < to ? found : -1;
+        }
+        bit = (word + 1) * 64;
+    }
+    return -1;
+}
+
+// 所有位图查找都经过这里，按 find_free_bit 计数
+static int scan_free_bit(const uint8_t *bitmap, int from, int to)
+{
+    STATS_START(start);
+    int bit = scan_bits(bitmap, from, to);
+    STATS_RECORD(STATS_FIND_FREE_BIT, start, bit == -1);
+    return bit;
+}
+
 /*find_free_bit：
 
-扫描 block_bitmap（块位图），寻找第一个 0（空闲块）。
+扫描 block_bitmap（块位图），寻找第一个 0（空闲块）。size 为位图字节数。
 
 如果找不到空闲块（所有位都是 1），返回 -1，此时 allocate_block 返回 0 表示分配失败。*/
 int find_free_bit(uint8_t *bitmap, int size)
 {
-    for (int i = 0; i < size * 8; i++)
+    return scan_free_bit(bitmap, 0, size * 8);
+}
+
+/*find_free_bit_from：下次适配（next-fit）查找。
+
+从 start 开始查找前 nbits 位中的第一个 0，到末尾后回绕到开头继续查找。*/
+int find_free_bit_from(uint8_t *bitmap, int nbits, int start)
+{
+    if (start < 0 || start >= nbits)
     {
-        if (!get_bitmap_bit(bitmap, i))
+        start = 0;
+    }
+
+    int bit = scan_free_bit(bitmap, start, nbits);
+    if (bit == -1 && start > 0)
+    {
+        bit = scan_free_bit(bitmap, 0, start);
+    }
+    return bit;
+}
+
+// 统计前 nbits 位中0位（空闲项）的个数
+int count_free_bits(uint8_t *bitmap, int nbits)
+{
+    int nbytes = (nbits + 7) / 8;
+    int used = 0;
+
+    for (int word = 0; word * 64 < nbits; word++)
+    {
+        uint64_t value = load_word(bitmap, word, nbytes);
+        int valid = nbits - word * 64;
+        if (valid < 64)
         {
-            return i;
+            value &= (1ULL << valid) - 1;
         }
+        used += __builtin_popcountll(value);
     }
-    return -1;
+    return nbits - used;
 }
 
 /*block_no：要读取的块号（从 0 开始编号）。
 
-buffer：目标内存缓冲区，用于存储读取的数据*/
-int read_block(uint32_t block_no, void *buffer)
+buffer：目标内存缓冲区，用于存储读取的数据
+
+disk_read_block/disk_write_block 直接访问磁盘镜像，只由块缓存调用。*/
+// mmap 后端中块在映射里的地址，超出镜像时返回 NULL
+static uint8_t *mapped_block(uint32_t block_no, uint32_t count)
+{
+    if ((uint64_t)(block_no + (uint64_t)count) * BLOCK_SIZE > disk_map_size)
+    {
+        return NULL;
+    }
+    return disk_map + (size_t)block_no * BLOCK_SIZE;
+}
+
+/*一批I/O请求：io_uring 后端一次提交全部请求；fd 后端（或线程建立不了环时）逐个 preadv/pwritev。*/
+static void prep_io(uring_io_t *io, int writing, uint32_t block_no, struct iovec *iov, int iovcnt, uint32_t count)
+{
+    io->writing = writing;
+    io->offset = (off_t)block_no * BLOCK_SIZE;
+    io->iov = iov;
+    io->iovcnt = iovcnt;
+    io->length = (size_t)count * BLOCK_SIZE;
+}
+
+static int submit_ios(uring_io_t *ios, int count)
+{
+    if (disk_uring)
+    {
+        int result = uring_submit_batch(disk_fd, ios, count);
+        if (result != URING_UNAVAILABLE)
+        {
+            return result;
+        }
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        ssize_t done = ios[i].writing ? pwritev(disk_fd, ios[i].iov, ios[i].iovcnt, ios[i].offset)
+                                      : preadv(disk_fd, ios[i].iov, ios[i].iovcnt, ios[i].offset);
+        if (done != (ssize_t)ios[i].length)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int single_io(int writing, uint32_t block_no, void *buffer)
+{
+    struct iovec iov = { buffer, BLOCK_SIZE };
+    uring_io_t io;
+    prep_io(&io, writing, block_no, &iov, 1, 1);
+    return submit_ios(&io, 1);
+}
+
+int disk_read_block(uint32_t block_no, void *buffer)
 {
     if (disk_fd == -1)
     {
         return -1;
     }
 
-    off_t offset = (off_t)block_no * BLOCK_SIZE;
-    if (lseek(disk_fd, offset, SEEK_SET) == -1)
+    if (disk_map != NULL)
     {
-        return -1;
+        uint8_t *block = mapped_block(block_no, 1);
+        if (block == NULL)
+        {
+            return -1;
+        }
+        memcpy(buffer, block, BLOCK_SIZE);
+        return 0;
     }
 
-    ssize_t bytes_read = read(disk_fd, buffer, BLOCK_SIZE);
+    if (disk_uring)
+    {
+        return single_io(0, block_no, buffer);
+    }
+
+    // pread 不使用也不移动文件偏移，多个线程可以同时读写不同的块
+    off_t offset = (off_t)block_no * BLOCK_SIZE;
+    ssize_t bytes_read = pread(disk_fd, buffer, BLOCK_SIZE, offset);
     if (bytes_read != BLOCK_SIZE)
     {
         return -1;
@@ -79,28 +319,37 @@ int read_block(uint32_t block_no, void *buffer)
 
 块号 block_no 乘以 BLOCK_SIZE，得到该块在文件中的字节偏移量。
 
-调用 lseek 将文件指针移动到 offset 处。
-
-SEEK_SET 表示从文件开头计算偏移量。
-
-如果移动失败（如 offset 超出文件大小），返回错误。
+pwrite 直接在 offset 处写入，不依赖共享的文件指针（以前的 lseek + write 在多线程下会互相干扰）。
 
 */
-int write_block(uint32_t block_no, const void *buffer)
+int disk_write_block(uint32_t block_no, const void *buffer)
 {
     if (disk_fd == -1)
     {
         return -1;
     }
+    snapshot_cow(block_no, 1); // 活动快照还没保存的块先复制旧内容
 
-    off_t offset = (off_t)block_no * BLOCK_SIZE;
-    if (lseek(disk_fd, offset, SEEK_SET) == -1)
+    if (disk_map != NULL)
     {
-        return -1;
+        uint8_t *block = mapped_block(block_no, 1);
+        if (block == NULL)
+        {
+            return -1;
+        }
+        memcpy(block, buffer, BLOCK_SIZE);
+        return 0;
+    }
+
+    if (disk_uring)
+    {
+        return single_io(1, block_no, (void *)buffer);
     }
-    /*调用 write 将 buffer 中的 BLOCK_SIZE 字节数据写入当前文件指针位置。
+
+    off_t offset = (off_t)block_no * BLOCK_SIZE;
+    /*调用 pwrite 将 buffer 中的 BLOCK_SIZE 字节数据写入 offset 处。
     如果实际写入的字节数 bytes_written 不等于 BLOCK_SIZE，说明写入失败（可能磁盘已满或发生 I/O 错误），返回错误。*/
-    ssize_t bytes_written = write(disk_fd, buffer, BLOCK_SIZE);
+    ssize_t bytes_written = pwrite(disk_fd, buffer, BLOCK_SIZE, offset);
     if (bytes_written != BLOCK_SIZE)
     {
         return -1;
@@ -108,154 +357,1272 @@ int write_block(uint32_t block_no, const void *buffer)
 
     return 0;
 }
-/* (BLOCK_SIZE / sizeof(ext2_inode_t)得到的是多少inode占据一个块，比如1024/256=4也就是4个inode一个块*/
-int read_inode(uint32_t inode_no, ext2_inode_t *inode)
+/*多块读写：count 个连续物理块，第 i 块对应内存 bufs[i]（每个 BLOCK_SIZE 字节）。
+相邻的缓冲区合并成一个 iovec，整段只需一次 preadv/pwritev。*/
+static int build_iovec(void *const *bufs, uint32_t count, struct iovec *iov)
 {
-    if (inode_no == 0 || inode_no >= MAX_INODES)
+    int iovcnt = 0;
+    for (uint32_t i = 0; i < count; i++)
     {
-        return -1;
+        if (iovcnt > 0 && (char *)iov[iovcnt - 1].iov_base + iov[iovcnt - 1].iov_len == (char *)bufs[i])
+        {
+            iov[iovcnt - 1].iov_len += BLOCK_SIZE;
+        }
+        else
+        {
+            iov[iovcnt].iov_base = bufs[i];
+            iov[iovcnt].iov_len = BLOCK_SIZE;
+            iovcnt++;
+        }
     }
+    return iovcnt;
+}
 
-    // 计算inode在磁盘上的位置
-    // 超级块占1个块，块位图占1个块，inode位图占1个块
-    // inode表从第4个块开始
-    // inode表存储的是inode信息，每个inode占用sizeof(ext2_inode_t)字节。
-    uint32_t block_no = 3 + (inode_no - 1) / (BLOCK_SIZE / sizeof(ext2_inode_t));
-    uint32_t offset = (inode_no - 1) % (BLOCK_SIZE / sizeof(ext2_inode_t));
+int disk_read_blocks(uint32_t block_no, uint32_t count, void *const *bufs)
+{
+    if (disk_fd == -1 || count == 0 || count > MAX_IO_BLOCKS)
+    {
+        return count == 0 ? 0 : -1;
+    }
 
-    uint8_t buffer[BLOCK_SIZE];
-    if (read_block(block_no, buffer) != 0)
+    if (disk_map != NULL)
     {
-        return -1;
+        uint8_t *block = mapped_block(block_no, count);
+        if (block == NULL)
+        {
+            return -1;
+        }
+        for (uint32_t i = 0; i < count; i++)
+        {
+            memcpy(bufs[i], block + (size_t)i * BLOCK_SIZE, BLOCK_SIZE);
+        }
+        return 0;
     }
-    /*buffer + offset * sizeof(ext2_inode_t) 计算 inode 在缓冲区中的起始地址。
-        memcpy 将数据拷贝到 inode 结构体。
 
-    首先需要知道他的块号block_no，读到对应的块到buffer中，
-    然后计算出inode在该块中的偏移量offset(块为单位的偏移，第一块，第二块，第三块)，最后将该块中对应的inode数据（大小为ext2_inode_t）拷贝到inode返回的指针中。
-    */
-    memcpy(inode, buffer + offset * sizeof(ext2_inode_t), sizeof(ext2_inode_t));
-    return 0;
+    struct iovec iov[MAX_IO_BLOCKS];
+    uring_io_t io;
+    prep_io(&io, 0, block_no, iov, build_iovec(bufs, count, iov), count);
+    return submit_ios(&io, 1);
 }
 
-int write_inode(uint32_t inode_no, const ext2_inode_t *inode)
+int disk_write_blocks(uint32_t block_no, uint32_t count, void *const *bufs)
 {
-    //  inode_no：要写入的 inode 编号（从 1 开始编号）。
-    //  inode：源内存结构体指针，存储待写入的 inode 数据。
-    if (inode_no == 0 || inode_no >= MAX_INODES)
+    if (disk_fd == -1 || count == 0 || count > MAX_IO_BLOCKS)
     {
-        return -1;
+        return count == 0 ? 0 : -1;
     }
+    snapshot_cow(block_no, count);
 
-    uint32_t block_no = 3 + (inode_no - 1) / (BLOCK_SIZE / sizeof(ext2_inode_t));
-    uint32_t offset = (inode_no - 1) % (BLOCK_SIZE / sizeof(ext2_inode_t));
-
-    uint8_t buffer[BLOCK_SIZE];
-    if (read_block(block_no, buffer) != 0)
+    if (disk_map != NULL)
     {
-        return -1;
+        uint8_t *block = mapped_block(block_no, count);
+        if (block == NULL)
+        {
+            return -1;
+        }
+        for (uint32_t i = 0; i < count; i++)
+        {
+            memcpy(block + (size_t)i * BLOCK_SIZE, bufs[i], BLOCK_SIZE);
+        }
+        return 0;
     }
-    // 注意这里的buffer是块的起始地址，如果要写入的是inode_no=2的话，根据块偏移找到对应的位置（同上）
-    memcpy(buffer + offset * sizeof(ext2_inode_t), inode, sizeof(ext2_inode_t));
-    return write_block(block_no, buffer);
+
+    struct iovec iov[MAX_IO_BLOCKS];
+    uring_io_t io;
+    prep_io(&io, 1, block_no, iov, build_iovec(bufs, count, iov), count);
+    return submit_ios(&io, 1);
 }
 
-// 块分配和释放
-uint32_t allocate_block(void)
+/*分散写：blocks 按块号升序，第 i 块的内容在 bufs[i]（块缓存写回用）。
+块号连续的部分合并成一个请求，整批一起提交。*/
+#define SCATTER_BATCH 128
+
+int disk_write_scattered(const uint32_t *blocks, void *const *bufs, uint32_t count)
 {
+    if (disk_fd == -1)
+    {
+        return -1;
+    }
 
-    int free_bit = find_free_bit(block_bitmap, BLOCK_SIZE); // 返回分配的块号（从 1 开始）。
-    if (free_bit == -1)
+    if (disk_map != NULL)
     {
-        return 0; // 没有空闲块
+        for (uint32_t i = 0; i < count; i++)
+        {
+            if (disk_write_block(blocks[i], bufs[i]) != 0)
+            {
+                return -1;
+            }
+        }
+        return 0;
     }
 
-    set_bitmap_bit(block_bitmap, free_bit); // 设置块位图中的对应位为已分配
-    fs.superblock.s_free_blocks_count--;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        snapshot_cow(blocks[i], 1);
+    }
 
-    // 写回位图
-    write_block(1, block_bitmap);
+    struct iovec iov[SCATTER_BATCH];
+    uring_io_t ios[SCATTER_BATCH];
+    uint32_t done = 0;
 
-    return free_bit + 1; // 块号从1开始
+    while (done < count)
+    {
+        int nios = 0;
+        int iovcnt = 0;
+        while (done < count && iovcnt < SCATTER_BATCH)
+        {
+            uint32_t run = 1;
+            while (done + run < count && run < MAX_IO_BLOCKS && iovcnt + (int)run < SCATTER_BATCH &&
+                   blocks[done + run] == blocks[done] + run)
+            {
+                run++;
+            }
+            int n = build_iovec(bufs + done, run, iov + iovcnt);
+            prep_io(&ios[nios++], 1, blocks[done], iov + iovcnt, n, run);
+            iovcnt += n;
+            done += run;
+        }
+        if (submit_ios(ios, nios) != 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
 }
 
-void free_block(uint32_t block_no)
+/*与块缓存保持一致的多块读：已缓存的块直接从缓存拷贝（缓存中的内容可能比磁盘新），
+其余连续未缓存的各段作为一批请求一起提交。读入的数据块不放入缓存，避免大文件顺序读冲掉元数据。*/
+int read_blocks(uint32_t block_no, uint32_t count, void *const *bufs)
 {
-    if (block_no == 0 || block_no > MAX_BLOCKS)
+    if (disk_fd == -1 || count == 0 || count > MAX_IO_BLOCKS)
     {
-        return;
+        return count == 0 ? 0 : -1;
+    }
+    if (disk_map != NULL)
+    {
+        return disk_read_blocks(block_no, count, bufs);
     }
 
-    clear_bitmap_bit(block_bitmap, block_no - 1);
-    fs.superblock.s_free_blocks_count++;
+    struct iovec iov[MAX_IO_BLOCKS];
+    uring_io_t ios[MAX_IO_BLOCKS];
+    int nios = 0;
+    int iovcnt = 0;
+    uint32_t run_start = 0;
+    uint32_t run_len = 0;
+
+    for (uint32_t i = 0; i <= count; i++)
+    {
+        if (i < count && bcache_peek(block_no + i, bufs[i]) != 0)
+        {
+            if (run_len == 0)
+            {
+                run_start = i;
+            }
+            run_len++;
+            continue;
+        }
+        if (run_len > 0)
+        {
+            int n = build_iovec(bufs + run_start, run_len, iov + iovcnt);
+            prep_io(&ios[nios++], 0, block_no + run_start, iov + iovcnt, n, run_len);
+            iovcnt += n;
+            run_len = 0;
+        }
+    }
 
-    // 写回位图
-    write_block(1, block_bitmap);
+    return nios > 0 ? submit_ios(ios, nios) : 0;
 }
 
-uint32_t allocate_inode(void)
+// 多块写：直接写盘，缓存中已有的副本同步更新为干净状态
+int write_blocks(uint32_t block_no, uint32_t count, void *const *bufs)
 {
-    int free_bit = find_free_bit(inode_bitmap, BLOCK_SIZE);
-    if (free_bit == -1)
+    if (disk_write_blocks(block_no, count, bufs) != 0)
     {
-        return 0; // 没有空闲inode
+        return -1;
+    }
+    for (uint32_t i = 0; i < count; i++)
+    {
+        bcache_update_clean(block_no + i, bufs[i]);
     }
+    return 0;
+}
 
-    set_bitmap_bit(inode_bitmap, free_bit);
-    fs.superblock.s_free_inodes_count--;
+/*预读：fd 后端用 posix_fadvise(WILLNEED)，mmap 后端用 madvise(WILLNEED)，
+内核在后台发起读，之后的读直接命中页缓存。*/
+void disk_prefetch(uint32_t block_no, uint32_t count)
+{
+    if (disk_fd == -1 || count == 0 || block_no + count > MAX_BLOCKS)
+    {
+        return;
+    }
 
-    // 写回位图
-    write_block(2, inode_bitmap);
+    if (disk_map != NULL)
+    {
+        uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+        uint8_t *start = mapped_block(block_no, count);
+        if (start == NULL)
+        {
+            return;
+        }
+        uint8_t *aligned = (uint8_t *)((uintptr_t)start & ~(page - 1));
+        madvise(aligned, start + (size_t)count * BLOCK_SIZE - aligned, MADV_WILLNEED);
+        return;
+    }
+    posix_fadvise(disk_fd, (off_t)block_no * BLOCK_SIZE, (off_t)count * BLOCK_SIZE, POSIX_FADV_WILLNEED);
+}
 
-    return free_bit + 1; // inode号从1开始
+// 经过块缓存的读写接口，其余模块都通过它们访问磁盘（mmap 后端时映射本身就是缓存）
+int read_block(uint32_t block_no, void *buffer)
+{
+    STATS_START(start);
+    int ret;
+    if (disk_fd == -1)
+    {
+        ret = -1;
+    }
+    else if (disk_map != NULL)
+    {
+        ret = disk_read_block(block_no, buffer);
+    }
+    else
+    {
+        ret = bcache_read(block_no, buffer);
+    }
+    STATS_RECORD(STATS_READ_BLOCK, start, ret != 0);
+    return ret;
 }
 
-void free_inode(uint32_t inode_no)
+int write_block(uint32_t block_no, const void *buffer)
 {
-    if (inode_no == 0 || inode_no > MAX_INODES)
+    STATS_START(start);
+    int ret;
+    if (disk_fd == -1)
     {
-        return;
+        ret = -1;
+    }
+    else if (disk_map != NULL)
+    {
+        ret = disk_write_block(block_no, buffer);
+    }
+    else
+    {
+        ret = bcache_write(block_no, buffer);
     }
+    STATS_RECORD(STATS_WRITE_BLOCK, start, ret != 0);
+    return ret;
+}
 
-    clear_bitmap_bit(inode_bitmap, inode_no - 1);
-    fs.superblock.s_free_inodes_count++;
+const uint8_t *read_block_ref(uint32_t block_no, uint8_t *scratch)
+{
+    if (disk_fd != -1 && disk_map != NULL)
+    {
+        return mapped_block(block_no, 1);
+    }
+    if (read_block(block_no, scratch) != 0)
+    {
+        return NULL;
+    }
+    return scratch;
+}
 
-    // 写回位图
-    write_block(2, inode_bitmap);
+// inode所在的inode表块，*index 返回它在块中的序号
+uint32_t inode_table_block(uint32_t inode_no, uint32_t *index)
+{
+    uint32_t group = (inode_no - 1) / fs.inodes_per_group;
+    uint32_t local = (inode_no - 1) % fs.inodes_per_group;
+    *index = local % INODES_PER_BLOCK;
+    return group_desc[group].bg_inode_table + local / INODES_PER_BLOCK;
 }
 
-// 文件系统初始化
-int init_disk_image(const char *filename)
+// inode所在组的第一个块，作为它的数据块、目录块的分配目标
+uint32_t inode_goal_block(uint32_t inode_no)
 {
-    disk_fd = open(filename, O_RDWR);
-    if (disk_fd == -1)
+    if (inode_no == 0 || inode_no >= MAX_INODES)
     {
-        return -1;
+        return 0;
     }
+    return group_first_block((inode_no - 1) / fs.inodes_per_group);
+}
 
-    // 读取位图
-    if (read_block(1, block_bitmap) != 0)
+/* (BLOCK_SIZE / sizeof(ext2_inode_t)得到的是多少inode占据一个块，比如1024/256=4也就是4个inode一个块*/
+static int load_inode(uint32_t inode_no, ext2_inode_t *inode)
+{
+    if (inode_no == 0 || inode_no >= MAX_INODES)
     {
-        close(disk_fd);
-        disk_fd = -1;
         return -1;
     }
 
-    if (read_block(2, inode_bitmap) != 0)
+    // 计算inode在磁盘上的位置：所在组inode表中的块号，以及它在块中的序号
+    // inode表存储的是inode信息，每个inode占用sizeof(ext2_inode_t)字节。
+    uint32_t offset;
+    uint32_t block_no = inode_table_block(inode_no, &offset);
+
+    uint8_t scratch[EXT2_MAX_BLOCK_SIZE];
+    const uint8_t *buffer = read_block_ref(block_no, scratch);
+    if (buffer == NULL)
     {
-        close(disk_fd);
-        disk_fd = -1;
         return -1;
     }
+    /*buffer + offset * sizeof(ext2_inode_t) 计算 inode 在缓冲区中的起始地址。
+        memcpy 将数据拷贝到 inode 结构体。
 
+    首先需要知道他的块号block_no，读到对应的块到buffer中，
+    然后计算出inode在该块中的偏移量offset(块为单位的偏移，第一块，第二块，第三块)，最后将该块中对应的inode数据（大小为ext2_inode_t）拷贝到inode返回的指针中。
+    */
+    memcpy(inode, buffer + offset * sizeof(ext2_inode_t), sizeof(ext2_inode_t));
     return 0;
 }
 
-void close_disk_image(void)
+static int store_inode(uint32_t inode_no, const ext2_inode_t *inode)
 {
-    if (disk_fd != -1)
+    //  inode_no：要写入的 inode 编号（从 1 开始编号）。
+    //  inode：源内存结构体指针，存储待写入的 inode 数据。
+    if (inode_no == 0 || inode_no >= MAX_INODES)
     {
+        return -1;
+    }
+
+    uint32_t offset;
+    uint32_t block_no = inode_table_block(inode_no, &offset);
+
+    uint8_t buffer[EXT2_MAX_BLOCK_SIZE];
+    if (read_block(block_no, buffer) != 0)
+    {
+        return -1;
+    }
+    // 注意这里的buffer是块的起始地址，如果要写入的是inode_no=2的话，根据块偏移找到对应的位置（同上）
+    memcpy(buffer + offset * sizeof(ext2_inode_t), inode, sizeof(ext2_inode_t));
+    return write_block(block_no, buffer);
+}
+
+int read_inode(uint32_t inode_no, ext2_inode_t *inode)
+{
+    STATS_START(start);
+    int ret = load_inode(inode_no, inode);
+    STATS_RECORD(STATS_READ_INODE, start, ret != 0);
+    return ret;
+}
+
+int write_inode(uint32_t inode_no, const ext2_inode_t *inode)
+{
+    STATS_START(start);
+    int ret = store_inode(inode_no, inode);
+    STATS_RECORD(STATS_WRITE_INODE, start, ret != 0);
+    return ret;
+}
+
+/*预留窗口：给正在写入的文件预留一段连续的空闲块（只记录在内存中，不占位图），
+文件之后的数据块优先从自己的窗口中分配，其他分配会绕开别人的窗口，
+这样交替写入的多个文件和目录不会把彼此的数据块打散。空间不足时窗口只是建议，可以被占用。*/
+typedef struct
+{
+    uint32_t owner; // inode号，0表示空闲槽位
+    int start;      // 窗口的位范围 [start, end)
+    int end;
+    int size;       // 窗口大小，文件每用完一个窗口就翻倍（不超过 RSV_WINDOW_MAX）
+} rsv_window_t;
+
+static rsv_window_t rsv_windows[MAX_RSV_WINDOWS];
+static int rsv_next_slot = 0;
+
+static rsv_window_t *find_window(uint32_t owner)
+{
+    for (int i = 0; i < MAX_RSV_WINDOWS; i++)
+    {
+        if (rsv_windows[i].owner == owner)
+        {
+            return &rsv_windows[i];
+        }
+    }
+    return NULL;
+}
+
+static void release_window_locked(uint32_t inode_no)
+{
+    rsv_window_t *rsv = find_window(inode_no);
+    if (rsv != NULL)
+    {
+        rsv->owner = 0;
+    }
+}
+
+// bit 落在其他文件的窗口中时返回该窗口的结束位置，否则返回 -1
+static int other_window_end(int bit, uint32_t owner)
+{
+    for (int i = 0; i < MAX_RSV_WINDOWS; i++)
+    {
+        if (rsv_windows[i].owner != 0 && rsv_windows[i].owner != owner &&
+            bit >= rsv_windows[i].start && bit < rsv_windows[i].end)
+        {
+            return rsv_windows[i].end;
+        }
+    }
+    return -1;
+}
+
+// 从 start 开始（回绕）查找空闲位，跳过其他文件的窗口；窗口外没有空闲位时退回到第一个空闲位
+static int search_free_bit(int start, uint32_t owner)
+{
+    int first = find_free_bit_from(block_bitmap, BLOCK_BITMAP_BITS, start);
+    int bit = first;
+
+    for (int tries = 0; bit != -1 && tries < MAX_RSV_WINDOWS + 1; tries++)
+    {
+        int skip = other_window_end(bit, owner);
+        if (skip == -1)
+        {
+            return bit;
+        }
+        bit = find_free_bit_from(block_bitmap, BLOCK_BITMAP_BITS, skip);
+    }
+    return first;
+}
+
+// 从 start 开始（回绕）查找 len 个连续空闲位，不与其他文件的窗口重叠，找不到返回 -1
+static int find_free_run(int start, int len, uint32_t owner)
+{
+    for (int pass = 0; pass < 2; pass++)
+    {
+        int bit = pass == 0 ? start : 0;
+
+        while (bit + len <= BLOCK_BITMAP_BITS)
+        {
+            int candidate = scan_free_bit(block_bitmap, bit, BLOCK_BITMAP_BITS);
+            if (candidate == -1 || candidate + len > BLOCK_BITMAP_BITS || (pass == 1 && candidate >= start))
+            {
+                break;
+            }
+
+            int run = 0;
+            while (run < len && !get_bitmap_bit(block_bitmap, candidate + run) &&
+                   other_window_end(candidate + run, owner) == -1)
+            {
+                run++;
+            }
+            if (run == len)
+            {
+                return candidate;
+            }
+            bit = candidate + run + 1;
+        }
+
+        if (start == 0)
+        {
+            break;
+        }
+    }
+    return -1;
+}
+
+static uint32_t take_bit(int bit)
+{
+    set_bitmap_bit(block_bitmap, bit); // 设置块位图中的对应位为已分配
+    fs.superblock.s_free_blocks_count--;
+
+    uint32_t group = bit / fs.blocks_per_group;
+    group_desc[group].bg_free_blocks_count--;
+
+    // 位图、组描述符和超级块只置脏，由 flush_metadata 统一写回
+    group_dirty[group] |= GROUP_BLOCK_BITMAP_DIRTY;
+    gdt_dirty = 1;
+    superblock_dirty = 1;
+
+    return bit + 1; // 块号从1开始
+}
+
+// 块分配和释放
+static uint32_t alloc_block_locked(void)
+{
+    int free_bit = search_free_bit(block_cursor, 0);
+    if (free_bit == -1)
+    {
+        return 0; // 没有空闲块
+    }
+    block_cursor = free_bit + 1;
+
+    return take_bit(free_bit);
+}
+
+// 目标导向分配：优先分配 goal 块本身，否则分配 goal 之后最近的空闲块
+static uint32_t alloc_near_locked(uint32_t goal)
+{
+    if (goal == 0 || goal >= MAX_BLOCKS)
+    {
+        return alloc_block_locked();
+    }
+
+    int free_bit = search_free_bit(goal - 1, 0);
+    if (free_bit == -1)
+    {
+        return 0;
+    }
+    return take_bit(free_bit);
+}
+
+/*为文件 inode_no 分配数据块，goal 一般是文件上一个数据块的下一块。
+先在文件自己的预留窗口中分配；窗口用完或不存在时，在 goal 附近开一个新的窗口。*/
+static uint32_t alloc_file_block_locked(uint32_t inode_no, uint32_t goal)
+{
+    if (goal == 0 || goal >= MAX_BLOCKS)
+    {
+        goal = inode_goal_block(inode_no); // 文件的第一个块放在inode所在的组
+    }
+    int goal_bit = goal != 0 ? (int)goal - 1 : block_cursor;
+    rsv_window_t *rsv = find_window(inode_no);
+
+    if (rsv != NULL)
+    {
+        int from = (goal_bit >= rsv->start && goal_bit < rsv->end) ? goal_bit : rsv->start;
+        int bit = scan_free_bit(block_bitmap, from, rsv->end);
+        if (bit == -1)
+        {
+            bit = scan_free_bit(block_bitmap, rsv->start, from);
+        }
+        if (bit != -1)
+        {
+            return take_bit(bit);
+        }
+    }
+
+    // 开一个新窗口：连续写入的文件窗口逐步变大
+    int size = RSV_WINDOW_BLOCKS;
+    if (rsv != NULL)
+    {
+        size = rsv->size * 2 > RSV_WINDOW_MAX ? RSV_WINDOW_MAX : rsv->size * 2;
+    }
+
+    int start = find_free_run(goal_bit, size, inode_no);
+    if (start == -1 && size > RSV_WINDOW_BLOCKS)
+    {
+        size = RSV_WINDOW_BLOCKS;
+        start = find_free_run(goal_bit, size, inode_no);
+    }
+    if (start == -1)
+    {
+        release_window_locked(inode_no);
+        return alloc_near_locked(goal);
+    }
+
+    if (rsv == NULL)
+    {
+        rsv = &rsv_windows[rsv_next_slot];
+        rsv_next_slot = (rsv_next_slot + 1) % MAX_RSV_WINDOWS;
+    }
+    rsv->owner = inode_no;
+    rsv->start = start;
+    rsv->end = start + size;
+    rsv->size = size;
+
+    return take_bit(start);
+}
+
+/*分配一段连续块：在 goal 附近查找最多 want 个连续空闲块，找不到时逐步减半。
+*got 返回实际分配的块数，返回第一个块号（失败返回0）。*/
+static uint32_t alloc_run_locked(uint32_t inode_no, uint32_t goal, uint32_t want, uint32_t *got)
+{
+    if (goal == 0 || goal >= MAX_BLOCKS)
+    {
+        goal = inode_goal_block(inode_no);
+    }
+    int goal_bit = goal != 0 ? (int)goal - 1 : block_cursor;
+
+    for (uint32_t len = want; len > 0; len /= 2)
+    {
+        int start = find_free_run(goal_bit, len, inode_no);
+        if (start == -1)
+        {
+            continue;
+        }
+        for (uint32_t i = 0; i < len; i++)
+        {
+            take_bit(start + i);
+        }
+        *got = len;
+        return start + 1;
+    }
+
+    *got = 0;
+    return 0;
+}
+
+static void free_block_locked(uint32_t block_no)
+{
+    if (block_no == 0 || block_no >= MAX_BLOCKS)
+    {
+        return;
+    }
+
+    clear_bitmap_bit(block_bitmap, block_no - 1);
+    fs.superblock.s_free_blocks_count++;
+    journal_revoke(block_no);
+
+    uint32_t group = (block_no - 1) / fs.blocks_per_group;
+    group_desc[group].bg_free_blocks_count++;
+
+    // 位图、组描述符和超级块只置脏，由 flush_metadata 统一写回
+    group_dirty[group] |= GROUP_BLOCK_BITMAP_DIRTY;
+    gdt_dirty = 1;
+    superblock_dirty = 1;
+}
+
+/*Orlov 式的inode组选择。
+目录：根目录下的顶层目录分散到空闲inode、空闲块都不少于平均值且目录最少的组；
+更深的目录从父目录所在组开始，找第一个目录不太多、空间也不太紧张的组。
+普通文件：放在父目录所在组，满了再按二次探测、线性查找的顺序找别的组。*/
+static int find_group_dir(uint32_t parent_group, int top_level)
+{
+    uint32_t ngroups = fs.groups_count;
+    uint32_t avg_free_inodes = fs.superblock.s_free_inodes_count / ngroups;
+    uint32_t avg_free_blocks = fs.superblock.s_free_blocks_count / ngroups;
+
+    if (top_level)
+    {
+        int best = -1;
+        for (uint32_t g = 0; g < ngroups; g++)
+        {
+            ext2_group_desc_t *gd = &group_desc[g];
+            if (gd->bg_free_inodes_count == 0 || gd->bg_free_inodes_count < avg_free_inodes ||
+                gd->bg_free_blocks_count < avg_free_blocks)
+            {
+                continue;
+            }
+            if (best == -1 || gd->bg_used_dirs_count < group_desc[best].bg_used_dirs_count ||
+                (gd->bg_used_dirs_count == group_desc[best].bg_used_dirs_count &&
+                 gd->bg_free_blocks_count > group_desc[best].bg_free_blocks_count))
+            {
+                best = g;
+            }
+        }
+        if (best != -1)
+        {
+            return best;
+        }
+    }
+    else
+    {
+        uint32_t used_dirs = 0;
+        for (uint32_t g = 0; g < ngroups; g++)
+        {
+            used_dirs += group_desc[g].bg_used_dirs_count;
+        }
+        uint32_t max_dirs = used_dirs / ngroups + fs.inodes_per_group / 16;
+        uint32_t min_inodes = avg_free_inodes / 4 > 0 ? avg_free_inodes / 4 : 1;
+        uint32_t min_blocks = avg_free_blocks / 4;
+
+        for (uint32_t i = 0; i < ngroups; i++)
+        {
+            uint32_t group = (parent_group + i) % ngroups;
+            ext2_group_desc_t *gd = &group_desc[group];
+            if (gd->bg_used_dirs_count < max_dirs && gd->bg_free_inodes_count >= min_inodes &&
+                gd->bg_free_blocks_count >= min_blocks)
+            {
+                return group;
+            }
+        }
+    }
+
+    // 退而求其次：从父目录所在组开始第一个还有空闲inode的组
+    for (uint32_t i = 0; i < ngroups; i++)
+    {
+        uint32_t group = (parent_group + i) % ngroups;
+        if (group_desc[group].bg_free_inodes_count > 0)
+        {
+            return group;
+        }
+    }
+    return -1;
+}
+
+static int find_group_other(uint32_t parent_group)
+{
+    uint32_t ngroups = fs.groups_count;
+    ext2_group_desc_t *gd = &group_desc[parent_group];
+    if (gd->bg_free_inodes_count > 0 && gd->bg_free_blocks_count > 0)
+    {
+        return parent_group;
+    }
+
+    // 二次探测：依次尝试 parent+1, parent+3, parent+7 ...
+    uint32_t group = parent_group;
+    for (uint32_t step = 1; step < ngroups; step <<= 1)
+    {
+        group = (group + step) % ngroups;
+        gd = &group_desc[group];
+        if (gd->bg_free_inodes_count > 0 && gd->bg_free_blocks_count > 0)
+        {
+            return group;
+        }
+    }
+
+    // 最后线性查找任何还有空闲inode的组
+    for (uint32_t i = 1; i <= ngroups; i++)
+    {
+        group = (parent_group + i) % ngroups;
+        if (group_desc[group].bg_free_inodes_count > 0)
+        {
+            return group;
+        }
+    }
+    return -1;
+}
+
+// 在目录 parent_inode 下分配一个inode（parent_inode 为0表示根目录本身，固定在组0）
+static uint32_t alloc_inode_locked(uint32_t parent_inode, int is_dir)
+{
+    uint32_t parent_group = 0;
+    if (parent_inode != 0 && parent_inode < MAX_INODES)
+    {
+        parent_group = (parent_inode - 1) / fs.inodes_per_group;
+    }
+
+    int group;
+    if (parent_inode == 0)
+    {
+        group = 0;
+    }
+    else if (is_dir)
+    {
+        group = find_group_dir(parent_group, parent_inode == 1);
+    }
+    else
+    {
+        group = find_group_other(parent_group);
+    }
+    if (group == -1)
+    {
+        return 0; // 没有空闲inode
+    }
+
+    int from = group * fs.inodes_per_group;
+    int free_bit = scan_free_bit(inode_bitmap, from, min_int(from + fs.inodes_per_group, INODE_BITMAP_BITS));
+    if (free_bit == -1)
+    {
+        return 0;
+    }
+
+    set_bitmap_bit(inode_bitmap, free_bit);
+    fs.superblock.s_free_inodes_count--;
+    group_desc[group].bg_free_inodes_count--;
+    if (is_dir)
+    {
+        group_desc[group].bg_used_dirs_count++;
+    }
+
+    // 位图、组描述符和超级块只置脏，由 flush_metadata 统一写回
+    group_dirty[group] |= GROUP_INODE_BITMAP_DIRTY;
+    gdt_dirty = 1;
+    superblock_dirty = 1;
+
+    return free_bit + 1; // inode号从1开始
+}
+
+static void free_inode_locked(uint32_t inode_no, int is_dir)
+{
+    if (inode_no == 0 || inode_no >= MAX_INODES)
+    {
+        return;
+    }
+
+    clear_bitmap_bit(inode_bitmap, inode_no - 1);
+    fs.superblock.s_free_inodes_count++;
+
+    uint32_t group = (inode_no - 1) / fs.inodes_per_group;
+    group_desc[group].bg_free_inodes_count++;
+    if (is_dir && group_desc[group].bg_used_dirs_count > 0)
+    {
+        group_desc[group].bg_used_dirs_count--;
+    }
+
+    // 位图、组描述符和超级块只置脏，由 flush_metadata 统一写回
+    group_dirty[group] |= GROUP_INODE_BITMAP_DIRTY;
+    gdt_dirty = 1;
+    superblock_dirty = 1;
+}
+
+// 对外的分配接口：在分配锁内调用对应的 *_locked 版本
+uint32_t allocate_block(void)
+{
+    pthread_mutex_lock(&alloc_lock);
+    uint32_t block_no = alloc_block_locked();
+    pthread_mutex_unlock(&alloc_lock);
+    return block_no;
+}
+
+uint32_t allocate_block_near(uint32_t goal)
+{
+    pthread_mutex_lock(&alloc_lock);
+    uint32_t block_no = alloc_near_locked(goal);
+    pthread_mutex_unlock(&alloc_lock);
+    return block_no;
+}
+
+uint32_t allocate_file_block(uint32_t inode_no, uint32_t goal)
+{
+    pthread_mutex_lock(&alloc_lock);
+    uint32_t block_no = alloc_file_block_locked(inode_no, goal);
+    pthread_mutex_unlock(&alloc_lock);
+    return block_no;
+}
+
+uint32_t allocate_block_run(uint32_t inode_no, uint32_t goal, uint32_t want, uint32_t *got)
+{
+    pthread_mutex_lock(&alloc_lock);
+    uint32_t block_no = alloc_run_locked(inode_no, goal, want, got);
+    pthread_mutex_unlock(&alloc_lock);
+    return block_no;
+}
+
+void release_block_reservation(uint32_t inode_no)
+{
+    pthread_mutex_lock(&alloc_lock);
+    release_window_locked(inode_no);
+    pthread_mutex_unlock(&alloc_lock);
+}
+
+void free_block(uint32_t block_no)
+{
+    // 活动快照还要用的块连同内容转归快照，不放回空闲
+    if (snapshot_keep_block(block_no))
+    {
+        return;
+    }
+    pthread_mutex_lock(&alloc_lock);
+    free_block_locked(block_no);
+    pthread_mutex_unlock(&alloc_lock);
+}
+
+uint32_t allocate_inode(uint32_t parent_inode, int is_dir)
+{
+    pthread_mutex_lock(&alloc_lock);
+    uint32_t inode_no = alloc_inode_locked(parent_inode, is_dir);
+    pthread_mutex_unlock(&alloc_lock);
+    return inode_no;
+}
+
+void free_inode(uint32_t inode_no, int is_dir)
+{
+    pthread_mutex_lock(&alloc_lock);
+    free_inode_locked(inode_no, is_dir);
+    pthread_mutex_unlock(&alloc_lock);
+}
+
+// inode是否已分配（统计等只读场合使用）
+int inode_is_allocated(uint32_t inode_no)
+{
+    if (inode_no == 0 || inode_no >= MAX_INODES || inode_bitmap == NULL)
+    {
+        return 0;
+    }
+    pthread_mutex_lock(&alloc_lock);
+    int used = get_bitmap_bit(inode_bitmap, inode_no - 1);
+    pthread_mutex_unlock(&alloc_lock);
+    return used;
+}
+
+// 超级块与位图的延迟写回
+void mark_superblock_dirty(void)
+{
+    pthread_mutex_lock(&alloc_lock);
+    superblock_dirty = 1;
+    pthread_mutex_unlock(&alloc_lock);
+}
+
+/*按位图重新统计每个组和整个文件系统的空闲块、空闲inode数（挂载时校正计数）。
+每个组的位范围都按字节对齐，可以直接用 count_free_bits 统计。*/
+static void recount_locked(void)
+{
+    fs.superblock.s_free_blocks_count = 0;
+    fs.superblock.s_free_inodes_count = 0;
+
+    for (uint32_t g = 0; g < fs.groups_count; g++)
+    {
+        int block_from = g * fs.blocks_per_group;
+        int block_to = min_int(block_from + fs.blocks_per_group, BLOCK_BITMAP_BITS);
+        int inode_from = g * fs.inodes_per_group;
+        int inode_to = min_int(inode_from + fs.inodes_per_group, INODE_BITMAP_BITS);
+
+        uint16_t free_blocks = count_free_bits(block_bitmap + block_from / 8, block_to - block_from);
+        uint16_t free_inodes = count_free_bits(inode_bitmap + inode_from / 8, inode_to - inode_from);
+        if (group_desc[g].bg_free_blocks_count != free_blocks || group_desc[g].bg_free_inodes_count != free_inodes)
+        {
+            group_desc[g].bg_free_blocks_count = free_blocks;
+            group_desc[g].bg_free_inodes_count = free_inodes;
+            gdt_dirty = 1;
+        }
+
+        fs.superblock.s_free_blocks_count += free_blocks;
+        fs.superblock.s_free_inodes_count += free_inodes;
+    }
+    superblock_dirty = 1;
+}
+
+void recount_free_counts(void)
+{
+    pthread_mutex_lock(&alloc_lock);
+    recount_locked();
+    pthread_mutex_unlock(&alloc_lock);
+}
+
+void install_bitmaps(const uint8_t *blocks, const uint8_t *inodes, const uint32_t *dirs)
+{
+    pthread_mutex_lock(&alloc_lock);
+    memcpy(block_bitmap, blocks, (size_t)fs.groups_count * BLOCK_SIZE);
+    memcpy(inode_bitmap, inodes, (size_t)fs.groups_count * fs.inodes_per_group / 8);
+
+    // 预留窗口和分配游标可能落在新释放或新占用的位上，统统重新开始
+    memset(rsv_windows, 0, sizeof(rsv_windows));
+    block_cursor = 0;
+
+    for (uint32_t g = 0; g < fs.groups_count; g++)
+    {
+        group_desc[g].bg_used_dirs_count = (uint16_t)dirs[g];
+        group_dirty[g] = GROUP_BLOCK_BITMAP_DIRTY | GROUP_INODE_BITMAP_DIRTY;
+    }
+    gdt_dirty = 1;
+    recount_locked();
+    pthread_mutex_unlock(&alloc_lock);
+}
+
+// 格式化：建立组描述符，把每个组的元数据块（组0还有组描述符表）标记为已用
+void format_groups(void)
+{
+    pthread_mutex_lock(&alloc_lock);
+    memset(block_bitmap, 0, (size_t)fs.groups_count * BLOCK_SIZE);
+    memset(inode_bitmap, 0, (size_t)fs.groups_count * fs.inodes_per_group / 8);
+    memset(group_desc, 0, (size_t)fs.gdt_blocks * BLOCK_SIZE);
+
+    for (uint32_t g = 0; g < fs.groups_count; g++)
+    {
+        uint32_t start = group_first_block(g);
+        uint32_t meta = g == 0 ? fs.gdt_blocks : 0;
+
+        group_desc[g].bg_block_bitmap = start + meta;
+        group_desc[g].bg_inode_bitmap = start + meta + 1;
+        group_desc[g].bg_inode_table = start + meta + 2;
+
+        for (uint32_t i = 0; i < meta + 2 + fs.inode_table_blocks; i++)
+        {
+            set_bitmap_bit(block_bitmap, start - 1 + i);
+        }
+        group_dirty[g] = GROUP_BLOCK_BITMAP_DIRTY | GROUP_INODE_BITMAP_DIRTY;
+    }
+
+    // 最后一个组超出文件系统的部分标记为已用
+    for (int bit = BLOCK_BITMAP_BITS; bit < (int)(fs.groups_count * fs.blocks_per_group); bit++)
+    {
+        set_bitmap_bit(block_bitmap, bit);
+    }
+
+    recount_locked();
+    gdt_dirty = 1;
+    pthread_mutex_unlock(&alloc_lock);
+}
+
+int write_superblock(const ext2_superblock_t *superblock)
+{
+    // 超级块结构小于一个块，块的其余部分补零
+    uint8_t buffer[EXT2_MAX_BLOCK_SIZE];
+    memset(buffer, 0, BLOCK_SIZE);
+    memcpy(buffer, superblock, sizeof(ext2_superblock_t));
+    return write_block(0, buffer);
+}
+
+/*写回被修改过的位图块和组描述符表。每个块先在分配锁内拷贝出来并清除脏标志，在锁外写入：
+写块可能触发快照的写时复制，复制要分配块，所以分配锁内不做任何I/O。写失败时重新置脏。*/
+static int flush_groups(void)
+{
+    int result = 0;
+    uint8_t buffer[EXT2_MAX_BLOCK_SIZE];
+
+    for (uint32_t g = 0; g < fs.groups_count; g++)
+    {
+        pthread_mutex_lock(&alloc_lock);
+        uint8_t dirty = group_dirty[g];
+        group_dirty[g] &= ~GROUP_BLOCK_BITMAP_DIRTY;
+        if (dirty & GROUP_BLOCK_BITMAP_DIRTY)
+        {
+            memcpy(buffer, block_bitmap + (size_t)g * BLOCK_SIZE, BLOCK_SIZE);
+        }
+        pthread_mutex_unlock(&alloc_lock);
+
+        if ((dirty & GROUP_BLOCK_BITMAP_DIRTY) && write_block(group_desc[g].bg_block_bitmap, buffer) != 0)
+        {
+            pthread_mutex_lock(&alloc_lock);
+            group_dirty[g] |= GROUP_BLOCK_BITMAP_DIRTY;
+            pthread_mutex_unlock(&alloc_lock);
+            result = -1;
+        }
+
+        if (dirty & GROUP_INODE_BITMAP_DIRTY)
+        {
+            // inode位图只用到块的前 inodes_per_group 位，其余位按已用填充
+            memset(buffer, 0xFF, BLOCK_SIZE);
+            pthread_mutex_lock(&alloc_lock);
+            group_dirty[g] &= ~GROUP_INODE_BITMAP_DIRTY;
+            memcpy(buffer, inode_bitmap + (size_t)g * fs.inodes_per_group / 8, fs.inodes_per_group / 8);
+            pthread_mutex_unlock(&alloc_lock);
+            if (write_block(group_desc[g].bg_inode_bitmap, buffer) != 0)
+            {
+                pthread_mutex_lock(&alloc_lock);
+                group_dirty[g] |= GROUP_INODE_BITMAP_DIRTY;
+                pthread_mutex_unlock(&alloc_lock);
+                result = -1;
+            }
+        }
+    }
+
+    pthread_mutex_lock(&alloc_lock);
+    int write_gdt = gdt_dirty;
+    gdt_dirty = 0;
+    pthread_mutex_unlock(&alloc_lock);
+
+    for (uint32_t i = 0; write_gdt && i < fs.gdt_blocks; i++)
+    {
+        pthread_mutex_lock(&alloc_lock);
+        memcpy(buffer, (uint8_t *)group_desc + (size_t)i * BLOCK_SIZE, BLOCK_SIZE);
+        pthread_mutex_unlock(&alloc_lock);
+        if (write_block(GDT_START + i, buffer) != 0)
+        {
+            pthread_mutex_lock(&alloc_lock);
+            gdt_dirty = 1;
+            pthread_mutex_unlock(&alloc_lock);
+            return -1;
+        }
+    }
+
+    return result;
+}
+
+/*把积累的位图、组描述符和超级块修改写入块缓存，每个块无论被修改多少次都只写一次。
+真正落盘由调用者随后的 bcache_flush 决定（见 ext2_op_end 的同步策略）。
+flush_lock 让同时写回的线程排队，后拷贝的新内容不会被先拷贝的旧内容覆盖。*/
+static pthread_mutex_t flush_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int flush_metadata(void)
+{
+    if (disk_fd == -1)
+    {
+        return 0; // 没有挂载镜像，位图和组描述符都还没有读入
+    }
+    pthread_mutex_lock(&flush_lock);
+    int result = flush_groups();
+
+    ext2_superblock_t sb;
+    pthread_mutex_lock(&alloc_lock);
+    int write_sb = superblock_dirty;
+    if (write_sb)
+    {
+        fs.superblock.s_wtime = time(NULL);
+        sb = fs.superblock;
+        superblock_dirty = 0;
+    }
+    pthread_mutex_unlock(&alloc_lock);
+
+    if (write_sb && write_superblock(&sb) != 0)
+    {
+        pthread_mutex_lock(&alloc_lock);
+        superblock_dirty = 1;
+        pthread_mutex_unlock(&alloc_lock);
+        result = -1;
+    }
+
+    pthread_mutex_unlock(&flush_lock);
+    return result;
+}
+
+static void unmap_disk_image(void)
+{
+    if (disk_map != NULL)
+    {
+        munmap(disk_map, disk_map_size);
+        disk_map = NULL;
+        disk_map_size = 0;
+    }
+}
+
+// 文件系统初始化：分配并读入组描述符表和每个组的位图
+static int load_groups(void)
+{
+    free(block_bitmap);
+    free(inode_bitmap);
+    free(group_desc);
+    free(group_dirty);
+    block_bitmap = calloc(fs.groups_count, BLOCK_SIZE);
+    inode_bitmap = calloc(fs.groups_count, fs.inodes_per_group / 8);
+    group_desc = calloc(fs.gdt_blocks, BLOCK_SIZE);
+    group_dirty = calloc(fs.groups_count, 1);
+    gdt_dirty = 0;
+    if (block_bitmap == NULL || inode_bitmap == NULL || group_desc == NULL || group_dirty == NULL)
+    {
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < fs.gdt_blocks; i++)
+    {
+        if (read_block(GDT_START + i, (uint8_t *)group_desc + (size_t)i * BLOCK_SIZE) != 0)
+        {
+            return -1;
+        }
+    }
+
+    uint8_t scratch[EXT2_MAX_BLOCK_SIZE];
+    for (uint32_t g = 0; g < fs.groups_count; g++)
+    {
+        ext2_group_desc_t *gd = &group_desc[g];
+        if (gd->bg_block_bitmap == 0)
+        {
+            continue; // 刚创建的镜像还没有组描述符，由 format_groups 建立
+        }
+        if (gd->bg_block_bitmap >= MAX_BLOCKS || gd->bg_inode_bitmap >= MAX_BLOCKS ||
+            gd->bg_inode_table + fs.inode_table_blocks > MAX_BLOCKS)
+        {
+            return -1;
+        }
+
+        if (read_block(gd->bg_block_bitmap, block_bitmap + (size_t)g * BLOCK_SIZE) != 0)
+        {
+            return -1;
+        }
+        const uint8_t *bits = read_block_ref(gd->bg_inode_bitmap, scratch);
+        if (bits == NULL)
+        {
+            return -1;
+        }
+        memcpy(inode_bitmap + (size_t)g * fs.inodes_per_group / 8, bits, fs.inodes_per_group / 8);
+    }
+    return 0;
+}
+
+// 快照占用的块并入块位图（崩溃时可能还没写回），并写出重放期间暂存的旧内容
+static int attach_snapshots(const ext2_superblock_t *sb)
+{
+    int claimed = snapshot_attach(sb);
+    if (claimed < 0)
+    {
+        return -1;
+    }
+    for (uint32_t g = 0; claimed > 0 && g < fs.groups_count; g++)
+    {
+        group_dirty[g] |= GROUP_BLOCK_BITMAP_DIRTY;
+    }
+    return 0;
+}
+
+/*打开镜像：先直接读出超级块，按其中的块大小、块数和inode数设置几何参数，
+再读入组描述符表和每个组的位图。*/
+int init_disk_image(const char *filename, disk_backend_t backend)
+{
+    disk_fd = open(filename, O_RDWR);
+    if (disk_fd == -1)
+    {
+        return -1;
+    }
+
+    ext2_superblock_t sb;
+    if (pread(disk_fd, &sb, sizeof(sb), 0) != (ssize_t)sizeof(sb) || sb.s_magic != 0xEF53 ||
+        sb.s_log_block_size > 2 ||
+        ext2_set_geometry(EXT2_MIN_BLOCK_SIZE << sb.s_log_block_size, sb.s_blocks_count, sb.s_inodes_count) != 0 ||
+        fs.blocks_count != sb.s_blocks_count || fs.inodes_count != sb.s_inodes_count)
+    {
+        close(disk_fd);
+        disk_fd = -1;
+        return -1;
+    }
+
+    if (backend == DISK_BACKEND_MMAP)
+    {
+        struct stat st;
+        void *map = MAP_FAILED;
+        if (fstat(disk_fd, &st) == 0 && st.st_size >= (off_t)MAX_BLOCKS * BLOCK_SIZE)
+        {
+            map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, disk_fd, 0);
+        }
+        if (map == MAP_FAILED)
+        {
+            close(disk_fd);
+            disk_fd = -1;
+            return -1;
+        }
+        disk_map = map;
+        disk_map_size = st.st_size;
+    }
+
+    // io_uring 后端：块缓存的内存注册为固定缓冲区；环建立不了时使用 pread/pwrite
+    disk_uring = 0;
+    if (backend == DISK_BACKEND_URING)
+    {
+        void *base;
+        size_t size;
+        bcache_region(&base, &size);
+        uring_set_region(base, size);
+        disk_uring = uring_probe() == 0;
+    }
+
+    bcache_init();
+    bcache_reset_stats();
+    block_cursor = 0;
+    memset(rsv_windows, 0, sizeof(rsv_windows));
+    superblock_dirty = 0;
+
+    /*先重放日志中已提交的元数据，再读入位图；mmap 后端的写不经过块缓存，不使用日志。
+    有快照时重放的写同样要先保存旧内容，快照表在重放之前读入，读入位图之后再接上分配器*/
+    if (snapshot_load(&sb) != 0 || journal_recover(&sb) != 0 ||
+        pread(disk_fd, &sb, sizeof(sb), 0) != (ssize_t)sizeof(sb) || load_groups() != 0 ||
+        attach_snapshots(&sb) != 0 || (backend != DISK_BACKEND_MMAP && journal_open(&sb) != 0))
+    {
+        snapshot_unload();
+        unmap_disk_image();
+        close(disk_fd);
+        disk_fd = -1;
+        disk_uring = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+disk_backend_t disk_get_backend(void)
+{
+    if (disk_map != NULL)
+    {
+        return DISK_BACKEND_MMAP;
+    }
+    return disk_uring ? DISK_BACKEND_URING : DISK_BACKEND_FD;
+}
+
+int disk_sync(void)
+{
+    if (disk_map != NULL)
+    {
+        return msync(disk_map, disk_map_size, MS_SYNC) == 0 ? 0 : -1;
+    }
+    return disk_fd != -1 && fdatasync(disk_fd) == 0 ? 0 : -1;
+}
+
+void close_disk_image(void)
+{
+    if (disk_fd != -1)
+    {
+        // 正常卸载，下次挂载不用检查
+        fs.superblock.s_state |= EXT2_VALID_FS;
+        superblock_dirty = 1;
+
+        // 卸载前提交日志并做检查点，再写回位图、超级块和所有脏块
+        journal_close();
+        flush_metadata();
+        bcache_flush();
+        if (snapshot_active())
+        {
+            // 写回时的写时复制又分配了块，位图再写回一次
+            flush_metadata();
+            bcache_flush();
+        }
+        snapshot_unload();
+        bcache_invalidate();
+        disk_sync();
+        unmap_disk_image();
         close(disk_fd);
         disk_fd = -1;
+        disk_uring = 0;
     }
 }
\ No newline at end of file
@@ -3,10 +3,17 @@
 #include "../include/user.h"
 #include "../include/commands.h"
 #include "../include/inode.h"
+#include "../include/icache.h"
+#include "../include/directory.h"
+#include "../include/cache.h"
+#include "../include/journal.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
 #include <time.h>
+#include <unistd.h>
+#include <pthread.h>
 
 // 全局变量
 ext2_fs_t fs;
@@ -15,47 +22,99 @@ ext2_fs_t fs;
 int ext2_init(const char *disk_image) {
     // 初始化文件系统状态
     memset(&fs, 0, sizeof(ext2_fs_t));
-    fs.current_user = -1;
-    fs.next_fd = 3; // 0, 1, 2 是标准输入输出
+    fs.sync_policy = SYNC_PER_OP;
+    fs.sync_interval = 1;
+    ext2_set_geometry(DEFAULT_BLOCK_SIZE, DEFAULT_BLOCKS_COUNT,
+                      (uint32_t)((uint64_t)DEFAULT_BLOCKS_COUNT * DEFAULT_BLOCK_SIZE / DEFAULT_INODE_RATIO));
 
     // 初始化用户系统
     init_users();
 
     // 挂载磁盘镜像
     if (disk_image != NULL) {
-        return cmd_mount(disk_image);
+        return cmd_mount(disk_image, DISK_BACKEND_FD);
     }
 
     return 0;
 }
 
+/*根据块大小、块数和inode数计算块组布局：每组的块数等于一个位图块的位数，
+每组inode数向上取整到 8 和每块inode数的公倍数，使inode位图按字节对齐、inode表按块对齐。
+最后一个组放不下元数据时舍弃。参数不合理时返回-1，不修改当前几何参数。*/
+int ext2_set_geometry(uint32_t block_size, uint32_t blocks_count, uint32_t inodes_count) {
+    if (block_size != 1024 && block_size != 2048 && block_size != 4096) {
+        return -1;
+    }
+    if (inodes_count < 16 || blocks_count < 64 || blocks_count > (1u << 24) || inodes_count > blocks_count) {
+        return -1;
+    }
+    
+    uint32_t blocks_per_group = block_size * 8;
+    uint32_t inodes_per_block = block_size / sizeof(ext2_inode_t);
+    uint32_t unit = inodes_per_block;
+    while (unit % 8 != 0) {
+        unit += inodes_per_block;
+    }
+    
+    for (;;) {
+        uint32_t groups_count = (blocks_count - 1 + blocks_per_group - 1) / blocks_per_group;
+        uint32_t inodes_per_group = (inodes_count + groups_count - 1) / groups_count;
+        inodes_per_group = (inodes_per_group + unit - 1) / unit * unit;
+        if (inodes_per_group > blocks_per_group) {
+            inodes_per_group = blocks_per_group / unit * unit;
+        }
+        uint32_t inode_table_blocks = inodes_per_group / inodes_per_block;
+        uint32_t gdt_blocks = (groups_count * sizeof(ext2_group_desc_t) + block_size - 1) / block_size;
+        
+        // 每个组除了元数据至少还要留出一些数据块
+        uint32_t last_blocks = blocks_count - 1 - (groups_count - 1) * blocks_per_group;
+        uint32_t last_meta = 2 + inode_table_blocks + (groups_count == 1 ? gdt_blocks : 0);
+        if (last_blocks < last_meta + 16) {
+            if (groups_count == 1) {
+                return -1;
+            }
+            blocks_count = 1 + (groups_count - 1) * blocks_per_group;
+            continue;
+        }
+        if (gdt_blocks + 2 + inode_table_blocks + 16 > blocks_per_group) {
+            return -1;
+        }
+        
+        fs.block_size = block_size;
+        fs.blocks_count = blocks_count;
+        fs.inodes_count = inodes_per_group * groups_count;
+        fs.groups_count = groups_count;
+        fs.blocks_per_group = blocks_per_group;
+        fs.inodes_per_group = inodes_per_group;
+        fs.inode_table_blocks = inode_table_blocks;
+        fs.gdt_blocks = gdt_blocks;
+        return 0;
+    }
+}
+
 // 文件系统格式化
-int ext2_format(const char *disk_image) {
-    printf("Formatting EXT2 file system: %s\n", disk_image);
+int ext2_format(const char *disk_image, uint32_t block_size, uint32_t blocks_count, uint32_t inodes_count) {
+    ext2_info("Formatting EXT2 file system: %s\n", disk_image);
     
-    // 创建磁盘镜像文件
+    if (ext2_set_geometry(block_size, blocks_count, inodes_count) != 0) {
+        printf("Error: Invalid geometry (block size %u, %u blocks, %u inodes)\n",
+               block_size, blocks_count, inodes_count);
+        return -1;
+    }
+    
+    // 创建磁盘镜像文件（文件扩展到目标大小，未写过的部分读出来都是0）
     FILE *fp = fopen(disk_image, "wb");
     if (fp == NULL) {
         printf("Error: Cannot create disk image file\n");
         return -1;
     }
     
-    // 写入空块
-    uint8_t zero_block[BLOCK_SIZE] = {0};
-    for (int i = 0; i < MAX_BLOCKS; i++) {
-        if (fwrite(zero_block, 1, BLOCK_SIZE, fp) != BLOCK_SIZE) {
-            printf("Error: Failed to write block %d\n", i);
-            fclose(fp);
-            /*uint8_t zero_block[BLOCK_SIZE] = {0};
-            fwrite(zero_block, 1, BLOCK_SIZE, fp);
-            解释一下，fwrite使用fp作为文件指针，向文件中写入：起始地址为zero_block，写入长度为BLOCK_SIZE字节的内容。（1表示每个数据项为一字节）
-            */
-            return -1;
-        }
+    if (ftruncate(fileno(fp), (off_t)MAX_BLOCKS * BLOCK_SIZE) != 0) {
+        printf("Error: Failed to size disk image\n");
+        fclose(fp);
+        return -1;
     }
     
-    fclose(fp);
-    
     // 初始化超级块
     ext2_superblock_t superblock;
     memset(&superblock, 0, sizeof(superblock));
@@ -64,20 +123,20 @@ int ext2_format(const char *disk_image) {
     superblock.s_inodes_count = MAX_INODES;
     superblock.s_blocks_count = MAX_BLOCKS;
     superblock.s_r_blocks_count = 10; // 保留块数
-    superblock.s_free_blocks_count = MAX_BLOCKS - 10;
-    superblock.s_free_inodes_count = MAX_INODES - 1;
+    superblock.s_free_blocks_count = 0; // 由 format_groups 计算
+    superblock.s_free_inodes_count = 0;
     superblock.s_first_data_block = 1;
-    superblock.s_log_block_size = 0; // 1KB块
+    superblock.s_log_block_size = block_size == 1024 ? 0 : block_size == 2048 ? 1 : 2; // 块大小为 1024 << s_log_block_size
     superblock.s_log_frag_size = 0;
-    superblock.s_blocks_per_group = MAX_BLOCKS;
-    superblock.s_frags_per_group = MAX_BLOCKS;
-    superblock.s_inodes_per_group = MAX_INODES;
+    superblock.s_blocks_per_group = fs.blocks_per_group;
+    superblock.s_frags_per_group = fs.blocks_per_group;
+    superblock.s_inodes_per_group = fs.inodes_per_group;
     superblock.s_mtime = time(NULL);
     superblock.s_wtime = time(NULL);
     superblock.s_mnt_count = 0;
     superblock.s_max_mnt_count = 20;
     superblock.s_magic = 0xEF53; // EXT2魔数
-    superblock.s_state = 1; // 干净状态
+    superblock.s_state = EXT2_VALID_FS; // 干净状态
     superblock.s_errors = 1; // 继续
     superblock.s_minor_rev_level = 0;
     superblock.s_lastcheck = time(NULL);
@@ -90,7 +149,7 @@ int ext2_format(const char *disk_image) {
     superblock.s_inode_size = sizeof(ext2_inode_t);
     superblock.s_block_group_nr = 0;
     superblock.s_feature_compat = 0;
-    superblock.s_feature_incompat = 0;
+    superblock.s_feature_incompat = EXT2_FEATURE_INCOMPAT_DEFAULT;
     superblock.s_feature_ro_compat = 0;
     
     // 生成UUID
@@ -102,57 +161,30 @@ int ext2_format(const char *disk_image) {
     strcpy(superblock.s_last_mounted, "/");
     
     // 写入超级块
-    FILE *fp2 = fopen(disk_image, "r+b");
-    if (fp2 == NULL) {
-        printf("Error: Cannot write superblock\n");
-        return -1;
-    }
-    
-    if (fwrite(&superblock, 1, sizeof(superblock), fp2) != sizeof(superblock)) {
+    if (fwrite(&superblock, 1, sizeof(superblock), fp) != sizeof(superblock)) {
         printf("Error: Failed to write superblock\n");
-        fclose(fp2);
-        return -1;
-    }
-    
-    fclose(fp2);
-    
-    // 初始化位图
-    memset(block_bitmap, 0, BLOCK_SIZE);
-    memset(inode_bitmap, 0, BLOCK_SIZE);
-    
-    // 标记已使用的块
-    for (int i = 0; i < 10; i++) {
-        set_bitmap_bit(block_bitmap, i);
-    }
-    
-    // 标记已使用的inode
-    set_bitmap_bit(inode_bitmap, 0); // inode 0 不使用
-    
-    // 写入位图
-    FILE *fp3 = fopen(disk_image, "r+b");
-    if (fp3 == NULL) {
-        printf("Error: Cannot write bitmaps\n");
+        fclose(fp);
         return -1;
     }
     
-    // 写入块位图
-    fseek(fp3, BLOCK_SIZE, SEEK_SET);
-    fwrite(block_bitmap, 1, BLOCK_SIZE, fp3);
-    
-    // 写入inode位图
-    fseek(fp3, 2 * BLOCK_SIZE, SEEK_SET);
-    fwrite(inode_bitmap, 1, BLOCK_SIZE, fp3);
-    
-    fclose(fp3);
+    fclose(fp);
     
-    // 创建根目录
-    if (init_disk_image(disk_image) != 0) {
+    // 创建根目录：分配计数记在刚格式化的超级块上，关闭镜像时一并写回
+    fs.superblock = superblock;
+    icache_invalidate();
+    dir_index_invalidate();
+    inode_map_invalidate();
+    if (init_disk_image(disk_image, DISK_BACKEND_FD) != 0) {
         printf("Error: Failed to initialize disk image\n");
         return -1;
     }
     
+    // 建立组描述符，标记每个组的元数据块，统计空闲块和inode
+    // inode位图位i对应inode i+1，inode 1留给根目录，由下面的create_inode分配
+    format_groups();
+    
     // 创建根目录inode
-    uint32_t root_inode = create_inode(EXT2_S_IFDIR | 0755, 0, 0);
+    uint32_t root_inode = create_inode(0, EXT2_S_IFDIR | 0755, 0, 0);
     if (root_inode == 0) {
         printf("Error: Failed to create root directory inode\n");
         close_disk_image();
@@ -160,7 +192,7 @@ int ext2_format(const char *disk_image) {
     }
     
     // 分配根目录数据块
-    uint32_t root_block = allocate_block();
+    uint32_t root_block = allocate_block_near(inode_goal_block(root_inode));
     if (root_block == 0) {
         printf("Error: Failed to allocate root directory block\n");
         delete_inode(root_inode);
@@ -172,34 +204,137 @@ int ext2_format(const char *disk_image) {
     set_inode_block(root_inode, 0, root_block);
     
     // 创建根目录的 . 和 .. 目录项
-    uint8_t root_data[BLOCK_SIZE] = {0};
-    ext2_dir_entry_t *entries = (ext2_dir_entry_t*)root_data;
-    
-    // . 目录项
-    entries[0].inode = root_inode;
-    entries[0].rec_len = sizeof(ext2_dir_entry_t);
-    entries[0].name_len = 1;
-    entries[0].file_type = 2; // 目录
-    strcpy(entries[0].name, ".");
-    
-    // .. 目录项
-    entries[1].inode = root_inode;
-    entries[1].rec_len = sizeof(ext2_dir_entry_t);
-    entries[1].name_len = 2;
-    entries[1].file_type = 2; // 目录
-    strcpy(entries[1].name, "..");
+    uint8_t root_data[EXT2_MAX_BLOCK_SIZE];
+    dir_block_init(root_data);
+    dir_block_insert(root_data, ".", root_inode, 2);  // 目录
+    dir_block_insert(root_data, "..", root_inode, 2);
     
     // 写入根目录数据
     write_block(root_block, root_data);
     
+    // 直接写入的 . 和 .. 都指向根目录自己，链接数为2
+    increment_link_count(root_inode);
+    increment_link_count(root_inode);
+    
+    // 默认用户数据库写在根目录之后
+    if (create_user_db() != 0) {
+        printf("Error: Failed to create user database\n");
+        close_disk_image();
+        return -1;
+    }
+    
+    // 元数据日志区（镜像太小时不建）
+    if (journal_create() != 0) {
+        printf("Error: Failed to create journal\n");
+        close_disk_image();
+        return -1;
+    }
+    
+    icache_flush();
     close_disk_image();
+    icache_invalidate();
+    dir_index_invalidate();
+    inode_map_invalidate();
     
-    printf("EXT2 file system formatted successfully\n");
+    ext2_info("EXT2 file system formatted successfully\n");
     return 0;
 }
 
+// 同步锁：多个会话同时结束操作时，操作计数和落盘一次只由一个线程进行
+static pthread_mutex_t sync_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int sync_locked(void) {
+    int result = icache_flush();
+    if (flush_metadata() != 0) {
+        result = -1;
+    }
+    if (bcache_flush() != 0) {
+        result = -1;
+    }
+    fs.ops_since_sync = 0;
+    return result;
+}
+
+/*把内存中的修改（脏inode、位图、超级块、脏块）写回磁盘。
+使用日志时只需把修改提交进日志（在操作中调用时推迟到操作结束）。*/
+int ext2_sync(void) {
+    if (journal_active()) {
+        return journal_sync();
+    }
+    pthread_mutex_lock(&sync_lock);
+    int result = sync_locked();
+    pthread_mutex_unlock(&sync_lock);
+    return result;
+}
+
+// 一次操作开始：之后的修改属于当前事务，提交会等这个操作结束
+void ext2_op_begin(void) {
+    journal_op_begin();
+}
+
+// 结束操作括号但不算作一次操作（没有处理任何请求时）
+void ext2_op_leave(void) {
+    int requested;
+    journal_op_end(&requested);
+}
+
+/*一次操作结束：合并写回本次弄脏的inode，再按同步策略决定是否落盘（调用者不能持有inode锁）。
+使用日志时按同步策略提交事务，同时结束的多个操作合成一次提交；
+未提交的脏块占满缓存时不论策略都提交。*/
+void ext2_op_end(void) {
+    int requested;
+    uint64_t txn = journal_op_end(&requested);
+    
+    if (journal_active()) {
+        pthread_mutex_lock(&sync_lock);
+        fs.ops_since_sync++;
+        int commit = requested || fs.sync_policy == SYNC_PER_OP ||
+                     (fs.sync_policy == SYNC_EVERY_N && fs.ops_since_sync >= fs.sync_interval);
+        if (commit) {
+            fs.ops_since_sync = 0;
+        }
+        pthread_mutex_unlock(&sync_lock);
+        if (commit || bcache_pressure()) {
+            journal_commit(txn);
+        }
+        return;
+    }
+    
+    pthread_mutex_lock(&sync_lock);
+    icache_flush();
+    
+    fs.ops_since_sync++;
+    switch (fs.sync_policy) {
+    case SYNC_PER_OP:
+        sync_locked();
+        break;
+    case SYNC_EVERY_N:
+        if (fs.ops_since_sync >= fs.sync_interval) {
+            sync_locked();
+        }
+        break;
+    case SYNC_ON_UMOUNT:
+        break;
+    }
+    pthread_mutex_unlock(&sync_lock);
+}
+
 // 文件系统清理
 void ext2_cleanup(void) {
+    icache_flush();
     close_disk_image();
-    printf("EXT2 file system cleaned up\n");
-} 
\ No newline at end of file
+    icache_invalidate();
+    dir_index_invalidate();
+    inode_map_invalidate();
+    ext2_info("EXT2 file system cleaned up\n");
+} 
+
+void ext2_info(const char *format, ...) {
+    if (fs.quiet) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+}
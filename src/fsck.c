@@ -0,0 +1,409 @@
+#include "../include/fsck.h"
+#include "../include/disk.h"
+#include "../include/directory.h"
+#include "../include/inode.h"
+#include "../include/snapshot.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/*一致性检查：
+
+1. 按块组并行扫描inode表。每个线程每次领取一个组，按 MAX_IO_BLOCKS 一批顺序读入inode表块；
+   对每个在用的inode（i_mode 不为0）遍历它的直接块和各级间接块，在共享的块位图中置位，
+   位已经被置过（重复引用或指向元数据）的记为冲突。目录的数据块随即解析，
+   给每个目录项指向的inode加引用计数。
+2. 扫描结束后（单线程，只是内存中的比较）把重建的块位图、inode位图与磁盘上的比较，
+   按组统计空闲块、空闲inode和目录数，与组描述符和超级块中的计数比较；
+   每个inode的链接计数与指向它的目录项数比较（修复时改为实际的目录项数）；
+   指向空闲inode的目录项和没有目录项指向的inode只报告，不修改。
+
+共享位图和计数都用原子操作更新，线程之间不需要加锁。
+所有读取经过 read_blocks，与块缓存中还没写回的内容保持一致。*/
+
+typedef struct {
+    uint8_t *used_blocks;      // 重建的块位图（与 block_bitmap 相同的布局）
+    uint8_t *live_inodes;      // 重建的inode位图
+    uint32_t *refs;            // 每个inode被目录项指向的次数（下标为inode号）
+    uint16_t *links;           // 每个inode记录的链接计数
+    uint32_t *dirs;            // 每组的目录数
+    uint32_t next_group;       // 下一个待扫描的组
+    int failed;                // 读盘或内存分配失败
+    fsck_report_t *report;
+} checker_t;
+
+static void add_count(uint32_t *counter, uint32_t n) {
+    __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+static void set_failed(checker_t *c) {
+    __atomic_store_n(&c->failed, 1, __ATOMIC_RELAXED);
+}
+
+// 原子地置位，返回之前是否已经置位
+static int test_and_set(uint8_t *bitmap, uint32_t bit) {
+    uint8_t mask = (uint8_t)(1u << (bit % 8));
+    return (__atomic_fetch_or(&bitmap[bit / 8], mask, __ATOMIC_RELAXED) & mask) != 0;
+}
+
+// 引用一个块：越界或已被引用时记录问题并返回-1
+static int claim_block(checker_t *c, uint32_t block_no) {
+    if (block_no >= MAX_BLOCKS) {
+        add_count(&c->report->bad_pointers, 1);
+        return -1;
+    }
+    if (test_and_set(c->used_blocks, block_no - 1)) {
+        add_count(&c->report->duplicate_blocks, 1);
+        return -1;
+    }
+    return 0;
+}
+
+// 元数据块：超级块之后的组描述符表、每组的位图和inode表、日志区、最后一组超出镜像的部分，以及快照占用的块
+static void mark_metadata(checker_t *c) {
+    for (uint32_t i = 0; i < fs.gdt_blocks; i++) {
+        test_and_set(c->used_blocks, GDT_START + i - 1);
+    }
+    for (uint32_t g = 0; g < fs.groups_count; g++) {
+        const ext2_group_desc_t *gd = &group_desc[g];
+        test_and_set(c->used_blocks, gd->bg_block_bitmap - 1);
+        test_and_set(c->used_blocks, gd->bg_inode_bitmap - 1);
+        for (uint32_t i = 0; i < fs.inode_table_blocks; i++) {
+            test_and_set(c->used_blocks, gd->bg_inode_table + i - 1);
+        }
+    }
+    if (fs.superblock.s_journal_block != 0 &&
+        fs.superblock.s_journal_block + fs.superblock.s_journal_blocks <= MAX_BLOCKS) {
+        for (uint32_t i = 0; i < fs.superblock.s_journal_blocks; i++) {
+            test_and_set(c->used_blocks, fs.superblock.s_journal_block + i - 1);
+        }
+    }
+    for (uint32_t bit = BLOCK_BITMAP_BITS; bit < fs.groups_count * fs.blocks_per_group; bit++) {
+        test_and_set(c->used_blocks, bit);
+    }
+    snapshot_claim_storage(c->used_blocks);
+}
+
+// 每个线程自己的目录数据块列表（遍历完一个目录的块树后再逐块解析）
+typedef struct {
+    uint32_t *blocks;
+    uint32_t count;
+    uint32_t capacity;
+} block_list_t;
+
+static int list_append(block_list_t *list, uint32_t block_no) {
+    if (list->count == list->capacity) {
+        uint32_t capacity = list->capacity ? list->capacity * 2 : 64;
+        uint32_t *grown = realloc(list->blocks, capacity * sizeof(uint32_t));
+        if (grown == NULL) {
+            return -1;
+        }
+        list->blocks = grown;
+        list->capacity = capacity;
+    }
+    list->blocks[list->count++] = block_no;
+    return 0;
+}
+
+/*引用 block_no 以及它下面 level 级间接块指向的所有块；
+dir_blocks 不为 NULL 时收集数据块（目录）。*/
+static void walk_tree(checker_t *c, uint32_t block_no, int level, block_list_t *dir_blocks) {
+    if (block_no == 0 || claim_block(c, block_no) != 0) {
+        return;
+    }
+    if (level == 0) {
+        if (dir_blocks != NULL && list_append(dir_blocks, block_no) != 0) {
+            set_failed(c);
+        }
+        return;
+    }
+
+    uint32_t pointers[EXT2_MAX_BLOCK_SIZE / sizeof(uint32_t)];
+    void *buf = pointers;
+    if (read_blocks(block_no, 1, &buf) != 0) {
+        set_failed(c);
+        return;
+    }
+    for (uint32_t i = 0; i < BLOCK_SIZE / sizeof(uint32_t); i++) {
+        walk_tree(c, pointers[i], level - 1, dir_blocks);
+    }
+}
+
+// 解析目录块，给每个目录项指向的inode加引用
+static void scan_dir_blocks(checker_t *c, const block_list_t *list) {
+    uint8_t block[EXT2_MAX_BLOCK_SIZE];
+    void *buf = block;
+
+    for (uint32_t i = 0; i < list->count; i++) {
+        if (read_blocks(list->blocks[i], 1, &buf) != 0) {
+            set_failed(c);
+            return;
+        }
+        int offset = 0;
+        ext2_dir_entry_t entry;
+        while (offset < (int)BLOCK_SIZE) {
+            int next = dir_block_next(block, offset, &entry);
+            if (next == -1) {
+                add_count(&c->report->damaged_dirs, 1);
+                break;
+            }
+            if (entry.inode != 0) {
+                if (entry.inode > MAX_INODES) {
+                    add_count(&c->report->bad_entries, 1);
+                } else {
+                    add_count(&c->refs[entry.inode], 1);
+                }
+            }
+            offset = next;
+        }
+    }
+}
+
+static void check_inode(checker_t *c, uint32_t inode_no, const ext2_inode_t *inode, block_list_t *dir_blocks) {
+    if (inode->i_mode == 0) {
+        return;
+    }
+    test_and_set(c->live_inodes, inode_no - 1);
+    add_count(&c->report->inodes, 1);
+    c->links[inode_no] = inode->i_links_count;
+
+    int is_dir = (inode->i_mode & 0xF000) == EXT2_S_IFDIR;
+    if (is_dir) {
+        add_count(&c->report->directories, 1);
+        add_count(&c->dirs[(inode_no - 1) / fs.inodes_per_group], 1);
+    }
+
+    // 内联数据和快速符号链接的 i_block 中是内容，不是块指针
+    if (inode->i_flags & EXT2_INLINE_DATA_FL) {
+        return;
+    }
+    
+    block_list_t *list = is_dir ? dir_blocks : NULL;
+    if (list != NULL) {
+        list->count = 0;
+    }
+    for (int i = 0; i < 12; i++) {
+        walk_tree(c, inode->i_block[i], 0, list);
+    }
+    for (int level = 1; level <= 3; level++) {
+        walk_tree(c, inode->i_block[11 + level], level, list);
+    }
+    if (list != NULL) {
+        scan_dir_blocks(c, list);
+    }
+}
+
+// 扫描一个组的inode表：连续的inode表块成批读入
+static void check_group(checker_t *c, uint32_t group, uint8_t *batch, block_list_t *dir_blocks) {
+    uint32_t table = group_desc[group].bg_inode_table;
+    void *bufs[MAX_IO_BLOCKS];
+
+    for (uint32_t done = 0; done < fs.inode_table_blocks && !__atomic_load_n(&c->failed, __ATOMIC_RELAXED);
+         done += MAX_IO_BLOCKS) {
+        uint32_t count = fs.inode_table_blocks - done;
+        if (count > MAX_IO_BLOCKS) {
+            count = MAX_IO_BLOCKS;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            bufs[i] = batch + (size_t)i * BLOCK_SIZE;
+        }
+        if (read_blocks(table + done, count, bufs) != 0) {
+            set_failed(c);
+            return;
+        }
+
+        for (uint32_t i = 0; i < count * INODES_PER_BLOCK; i++) {
+            uint32_t inode_no = group * fs.inodes_per_group + done * INODES_PER_BLOCK + i + 1;
+            if (inode_no - 1 >= (uint32_t)INODE_BITMAP_BITS) {
+                break;
+            }
+            // 每块只放 INODES_PER_BLOCK 个inode，块尾可能有空隙
+            const uint8_t *slot = batch + (size_t)(i / INODES_PER_BLOCK) * BLOCK_SIZE +
+                                  (i % INODES_PER_BLOCK) * sizeof(ext2_inode_t);
+            check_inode(c, inode_no, (const ext2_inode_t*)slot, dir_blocks);
+        }
+    }
+}
+
+static void *check_worker(void *arg) {
+    checker_t *c = arg;
+    uint8_t *batch = malloc((size_t)MAX_IO_BLOCKS * BLOCK_SIZE);
+    block_list_t dir_blocks = { NULL, 0, 0 };
+    if (batch == NULL) {
+        set_failed(c);
+        return NULL;
+    }
+
+    for (;;) {
+        uint32_t group = __atomic_fetch_add(&c->next_group, 1, __ATOMIC_RELAXED);
+        if (group >= fs.groups_count || __atomic_load_n(&c->failed, __ATOMIC_RELAXED)) {
+            break;
+        }
+        check_group(c, group, batch, &dir_blocks);
+    }
+
+    free(dir_blocks.blocks);
+    free(batch);
+    return NULL;
+}
+
+// [from, to) 位中两个位图不同的位数（from 按字节对齐，整字节直接异或后数位）
+static uint32_t count_diff(const uint8_t *expected, const uint8_t *actual, int from, int to) {
+    uint32_t diff = 0;
+    int bit = from;
+    for (; bit + 8 <= to; bit += 8) {
+        diff += __builtin_popcount(expected[bit / 8] ^ actual[bit / 8]);
+    }
+    for (; bit < to; bit++) {
+        diff += get_bitmap_bit((uint8_t*)expected, bit) != get_bitmap_bit((uint8_t*)actual, bit);
+    }
+    return diff;
+}
+
+// 比较重建的位图和计数，结果记入报告
+static void compare_groups(checker_t *c) {
+    fsck_report_t *r = c->report;
+    uint32_t free_blocks = 0;
+    uint32_t free_inodes = 0;
+
+    for (uint32_t g = 0; g < fs.groups_count; g++) {
+        int block_from = g * fs.blocks_per_group;
+        int block_to = block_from + fs.blocks_per_group;
+        if (block_to > BLOCK_BITMAP_BITS) {
+            block_to = BLOCK_BITMAP_BITS;
+        }
+        int inode_from = g * fs.inodes_per_group;
+        int inode_to = inode_from + fs.inodes_per_group;
+        if (inode_to > INODE_BITMAP_BITS) {
+            inode_to = INODE_BITMAP_BITS;
+        }
+
+        r->block_bitmap_errors += count_diff(c->used_blocks, block_bitmap, block_from, block_to);
+        r->inode_bitmap_errors += count_diff(c->live_inodes, inode_bitmap, inode_from, inode_to);
+
+        uint32_t group_free_blocks = count_free_bits(c->used_blocks + block_from / 8, block_to - block_from);
+        uint32_t group_free_inodes = count_free_bits(c->live_inodes + inode_from / 8, inode_to - inode_from);
+        r->count_errors += group_desc[g].bg_free_blocks_count != group_free_blocks;
+        r->count_errors += group_desc[g].bg_free_inodes_count != group_free_inodes;
+        r->count_errors += group_desc[g].bg_used_dirs_count != c->dirs[g];
+        free_blocks += group_free_blocks;
+        free_inodes += group_free_inodes;
+    }
+
+    r->count_errors += fs.superblock.s_free_blocks_count != free_blocks;
+    r->count_errors += fs.superblock.s_free_inodes_count != free_inodes;
+    r->blocks = BLOCK_BITMAP_BITS - free_blocks + 1;   // 加上超级块
+
+    // 目录项引用：指向空闲inode的目录项、在用但无人引用的inode（根目录和用户数据库除外）
+    for (uint32_t inode_no = 1; inode_no <= (uint32_t)INODE_BITMAP_BITS; inode_no++) {
+        int live = get_bitmap_bit(c->live_inodes, inode_no - 1);
+        if (!live) {
+            r->bad_entries += c->refs[inode_no];
+        } else if (c->refs[inode_no] == 0 && inode_no != 1 && inode_no != fs.superblock.s_users_inode) {
+            r->orphans++;
+        } else if (c->refs[inode_no] != 0 && c->refs[inode_no] != c->links[inode_no]) {
+            r->link_count_errors++;
+        }
+    }
+}
+
+static int thread_count(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = cpus > 0 ? (int)cpus : 1;
+    if (threads > FSCK_MAX_THREADS) {
+        threads = FSCK_MAX_THREADS;
+    }
+    if (threads > (int)fs.groups_count) {
+        threads = (int)fs.groups_count;
+    }
+    return threads;
+}
+
+int fsck_check(int repair, fsck_report_t *report) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    memset(report, 0, sizeof(*report));
+
+    checker_t c;
+    memset(&c, 0, sizeof(c));
+    c.report = report;
+    c.used_blocks = calloc(fs.groups_count, BLOCK_SIZE);
+    c.live_inodes = calloc(fs.groups_count, fs.inodes_per_group / 8);
+    c.refs = calloc((size_t)MAX_INODES + 1, sizeof(uint32_t));
+    c.links = calloc((size_t)MAX_INODES + 1, sizeof(uint16_t));
+    c.dirs = calloc(fs.groups_count, sizeof(uint32_t));
+    int result = -1;
+    if (c.used_blocks == NULL || c.live_inodes == NULL || c.refs == NULL || c.links == NULL || c.dirs == NULL) {
+        goto out;
+    }
+
+    mark_metadata(&c);
+
+    report->threads = thread_count();
+    pthread_t threads[FSCK_MAX_THREADS];
+    int started = 0;
+    for (int i = 1; i < report->threads; i++) {
+        if (pthread_create(&threads[started], NULL, check_worker, &c) == 0) {
+            started++;
+        }
+    }
+    check_worker(&c);   // 调用线程也参与扫描
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    report->threads = started + 1;
+    if (c.failed) {
+        goto out;
+    }
+
+    compare_groups(&c);
+    if (repair && (report->block_bitmap_errors || report->inode_bitmap_errors || report->count_errors)) {
+        install_bitmaps(c.used_blocks, c.live_inodes, c.dirs);
+        report->repaired = 1;
+    }
+    if (repair && report->link_count_errors) {
+        for (uint32_t inode_no = 1; inode_no <= (uint32_t)INODE_BITMAP_BITS; inode_no++) {
+            if (get_bitmap_bit(c.live_inodes, inode_no - 1) && c.refs[inode_no] != 0 &&
+                c.refs[inode_no] != c.links[inode_no]) {
+                set_link_count(inode_no, (uint16_t)c.refs[inode_no]);
+            }
+        }
+        report->repaired = 1;
+    }
+    result = 0;
+
+out:
+    free(c.used_blocks);
+    free(c.live_inodes);
+    free(c.refs);
+    free(c.links);
+    free(c.dirs);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    report->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    return result;
+}
+
+const char *fsck_reason(const ext2_superblock_t *sb) {
+    if (sb->s_state & EXT2_ERROR_FS) {
+        return "errors recorded";
+    }
+    if (!(sb->s_state & EXT2_VALID_FS)) {
+        return "not cleanly unmounted";
+    }
+    if (sb->s_max_mnt_count > 0 && sb->s_mnt_count >= sb->s_max_mnt_count) {
+        return "maximal mount count reached";
+    }
+    if (sb->s_checkinterval > 0 && (uint32_t)time(NULL) >= sb->s_lastcheck + sb->s_checkinterval) {
+        return "check interval reached";
+    }
+    return NULL;
+}
+
+int fsck_has_errors(const fsck_report_t *report) {
+    return report->bad_pointers || report->duplicate_blocks || report->damaged_dirs || report->bad_entries ||
+           report->orphans || report->block_bitmap_errors || report->inode_bitmap_errors || report->count_errors ||
+           report->link_count_errors;
+}
@@ -0,0 +1,184 @@
+#include "../include/icache.h"
+#include "../include/disk.h"
+#include "../include/ext2.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/*内存inode表：每个inode第一次被访问时从inode表读入，此后所有读写都针对内存副本。
+修改只置脏标志，时间戳等字段更新只是内存写入；脏inode在操作结束（ext2_op_end）
+或同步时按inode表块合并写回，每个块只做一次读-改-写。
+表的大小随挂载的文件系统的inode数变化，在 icache_invalidate 或第一次访问时分配。
+
+并发：table_lock 保护表本身（加载、引用计数、脏标志）；每个inode另有一把读写锁，
+修改inode内容（块指针、大小、权限、链接数等）的人持有写锁，写回时持有读锁拷贝，
+所以写回不会拷到改了一半的inode。*/
+
+static icache_entry_t *table = NULL;
+static uint32_t table_size = 0;
+static uint32_t dirty_count = 0;
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void reset_table(void) {
+    if (table_size != MAX_INODES) {
+        for (uint32_t i = 0; i < table_size; i++) {
+            pthread_rwlock_destroy(&table[i].lock);
+        }
+        free(table);
+        table = calloc(MAX_INODES, sizeof(icache_entry_t));
+        table_size = table != NULL ? MAX_INODES : 0;
+        for (uint32_t i = 0; i < table_size; i++) {
+            pthread_rwlock_init(&table[i].lock, NULL);
+        }
+    } else {
+        for (uint32_t i = 0; i < table_size; i++) {
+            memset(&table[i].inode, 0, sizeof(ext2_inode_t));
+            table[i].loaded = 0;
+            table[i].dirty = 0;
+            table[i].refcount = 0;
+        }
+    }
+    dirty_count = 0;
+}
+
+ext2_inode_t *icache_get(uint32_t inode_no) {
+    pthread_mutex_lock(&table_lock);
+    if (table_size != MAX_INODES) {
+        reset_table();
+    }
+    if (inode_no == 0 || inode_no >= table_size) {
+        pthread_mutex_unlock(&table_lock);
+        return NULL;
+    }
+
+    icache_entry_t *entry = &table[inode_no];
+    if (!entry->loaded) {
+        if (read_inode(inode_no, &entry->inode) != 0) {
+            pthread_mutex_unlock(&table_lock);
+            return NULL;
+        }
+        entry->loaded = 1;
+        entry->dirty = 0;
+    }
+
+    entry->refcount++;
+    pthread_mutex_unlock(&table_lock);
+    return &entry->inode;
+}
+
+void icache_put(uint32_t inode_no) {
+    pthread_mutex_lock(&table_lock);
+    if (inode_no != 0 && inode_no < table_size && table[inode_no].refcount > 0) {
+        table[inode_no].refcount--;
+    }
+    pthread_mutex_unlock(&table_lock);
+}
+
+void icache_mark_dirty(uint32_t inode_no) {
+    pthread_mutex_lock(&table_lock);
+    if (inode_no != 0 && inode_no < table_size && table[inode_no].loaded && !table[inode_no].dirty) {
+        table[inode_no].dirty = 1;
+        dirty_count++;
+    }
+    pthread_mutex_unlock(&table_lock);
+}
+
+// 读操作更新访问时间：只持有inode读锁的读者之间用表锁互斥
+void icache_set_atime(uint32_t inode_no, uint32_t atime) {
+    pthread_mutex_lock(&table_lock);
+    if (inode_no != 0 && inode_no < table_size && table[inode_no].loaded) {
+        table[inode_no].inode.i_atime = atime;
+        if (!table[inode_no].dirty) {
+            table[inode_no].dirty = 1;
+            dirty_count++;
+        }
+    }
+    pthread_mutex_unlock(&table_lock);
+}
+
+// inode读写锁
+void icache_lock_shared(uint32_t inode_no) {
+    if (inode_no != 0 && inode_no < table_size) {
+        pthread_rwlock_rdlock(&table[inode_no].lock);
+    }
+}
+
+void icache_lock_exclusive(uint32_t inode_no) {
+    if (inode_no != 0 && inode_no < table_size) {
+        pthread_rwlock_wrlock(&table[inode_no].lock);
+    }
+}
+
+void icache_unlock(uint32_t inode_no) {
+    if (inode_no != 0 && inode_no < table_size) {
+        pthread_rwlock_unlock(&table[inode_no].lock);
+    }
+}
+
+// 块中 [first, last) 范围内是否有脏inode
+static int block_has_dirty(uint32_t first, uint32_t last) {
+    for (uint32_t i = first; i < last; i++) {
+        if (table[i].loaded && table[i].dirty) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*调用者不能持有任何inode锁：写回时要对每个脏inode加读锁。
+等待inode锁时不持有表锁，正在修改inode的线程仍可以访问表。*/
+int icache_flush(void) {
+    int result = 0;
+
+    pthread_mutex_lock(&table_lock);
+    uint32_t size = table_size;
+    // 大多数操作结束时没有脏inode，不必扫描整张表
+    for (uint32_t first = 1; dirty_count > 0 && first < size; first += INODES_PER_BLOCK) {
+        uint32_t last = first + INODES_PER_BLOCK;
+        if (last > size) {
+            last = size;
+        }
+        if (!block_has_dirty(first, last)) {
+            continue;
+        }
+        pthread_mutex_unlock(&table_lock);
+
+        // 同一块中的脏inode一起写回
+        // 每组inode数是每块inode数的整数倍，同一块中的inode一定属于同一个组
+        uint32_t index;
+        uint32_t block_no = inode_table_block(first, &index);
+        uint8_t buffer[EXT2_MAX_BLOCK_SIZE];
+        if (read_block(block_no, buffer) != 0) {
+            result = -1;
+            pthread_mutex_lock(&table_lock);
+            continue;
+        }
+
+        for (uint32_t i = first; i < last; i++) {
+            pthread_rwlock_rdlock(&table[i].lock);
+            pthread_mutex_lock(&table_lock);
+            if (table[i].loaded && table[i].dirty) {
+                memcpy(buffer + (i - first) * sizeof(ext2_inode_t), &table[i].inode, sizeof(ext2_inode_t));
+                table[i].dirty = 0;
+                dirty_count--;
+            }
+            pthread_mutex_unlock(&table_lock);
+            pthread_rwlock_unlock(&table[i].lock);
+        }
+
+        if (write_block(block_no, buffer) != 0) {
+            result = -1;
+        }
+        pthread_mutex_lock(&table_lock);
+    }
+    pthread_mutex_unlock(&table_lock);
+
+    return result;
+}
+
+void icache_invalidate(void) {
+    pthread_mutex_lock(&table_lock);
+    reset_table();
+    pthread_mutex_unlock(&table_lock);
+}
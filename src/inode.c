@@ -2,404 +2,1899 @@
 #include "../include/disk.h"
 #include "../include/ext2.h"
 #include "../include/user.h"
+#include "../include/icache.h"
+#include "../include/compress.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <errno.h>
+#include <pthread.h>
+
+// 一个间接块中的块指针个数
+#define ADDR_PER_BLOCK ((uint32_t)BLOCK_SIZE / 4)
+
+/*间接块映射缓存：每个槽位保存某个文件最近用到的最底层间接块（块号和内容），
+顺序读写时这个间接块覆盖的 ADDR_PER_BLOCK 个逻辑块都不必再沿间接链读块。
+槽位数固定，按轮转替换；文件关闭时释放它的槽位。
+槽位分配由 map_lock 保护；一个槽位的内容只在持有该文件inode锁时读写。*/
+#define MAP_CACHE_SLOTS 16
+
+typedef struct {
+    uint32_t inode_no;     // 0 表示空槽
+    uint32_t first_index;  // 该间接块覆盖的第一个逻辑块号
+    uint32_t block_no;     // 间接块的物理块号
+    uint32_t entries[EXT2_MAX_BLOCK_SIZE / 4];
+} map_cache_t;
+
+static map_cache_t map_cache[MAP_CACHE_SLOTS];
+static int map_cache_next = 0;
+static int map_cache_last = 0;
+static pthread_mutex_t map_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static map_cache_t *map_cache_find(uint32_t inode_no, uint32_t block_index) {
+    // 顺序访问时几乎总是命中上一次用到的槽位
+    for (int n = 0; n < MAP_CACHE_SLOTS; n++) {
+        int i = (map_cache_last + n) % MAP_CACHE_SLOTS;
+        map_cache_t *c = &map_cache[i];
+        if (c->inode_no == inode_no && block_index >= c->first_index &&
+            block_index - c->first_index < ADDR_PER_BLOCK) {
+            map_cache_last = i;
+            return c;
+        }
+    }
+    return NULL;
+}
+
+static void map_cache_fill(uint32_t inode_no, uint32_t first_index, uint32_t block_no, const uint32_t *entries) {
+    // 同一文件优先复用自己的槽位，否则轮流替换
+    map_cache_t *c = NULL;
+    for (int i = 0; i < MAP_CACHE_SLOTS && c == NULL; i++) {
+        if (map_cache[i].inode_no == inode_no || map_cache[i].inode_no == 0) {
+            c = &map_cache[i];
+            map_cache_last = i;
+        }
+    }
+    if (c == NULL) {
+        c = &map_cache[map_cache_next];
+        map_cache_last = map_cache_next;
+        map_cache_next = (map_cache_next + 1) % MAP_CACHE_SLOTS;
+    }
+    c->inode_no = inode_no;
+    c->first_index = first_index;
+    c->block_no = block_no;
+    memcpy(c->entries, entries, BLOCK_SIZE);
+}
+
+/*解压缓存：最近解压过的压缩簇，小块顺序读同一个簇时只解压一次（压缩块本身经块缓存读写）。
+槽位由 cluster_lock 保护；写簇时放入新内容，释放文件的块、关闭文件或卸载时随映射缓存一起丢弃。*/
+#define CLUSTER_CACHE_SLOTS 8
+
+typedef struct {
+    uint32_t inode_no;     // 0 表示空槽
+    uint32_t cluster;
+    uint8_t data[EXT2_CLUSTER_SIZE];
+} cluster_cache_t;
+
+static cluster_cache_t cluster_cache[CLUSTER_CACHE_SLOTS];
+static int cluster_cache_next = 0;
+static pthread_mutex_t cluster_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int cluster_cache_get(uint32_t inode_no, uint32_t cluster, uint8_t *data) {
+    int found = 0;
+    pthread_mutex_lock(&cluster_lock);
+    for (int i = 0; i < CLUSTER_CACHE_SLOTS && !found; i++) {
+        if (cluster_cache[i].inode_no == inode_no && cluster_cache[i].cluster == cluster) {
+            memcpy(data, cluster_cache[i].data, EXT2_CLUSTER_SIZE);
+            found = 1;
+        }
+    }
+    pthread_mutex_unlock(&cluster_lock);
+    return found;
+}
+
+static void cluster_cache_put(uint32_t inode_no, uint32_t cluster, const uint8_t *data) {
+    pthread_mutex_lock(&cluster_lock);
+    cluster_cache_t *c = NULL;
+    for (int i = 0; i < CLUSTER_CACHE_SLOTS && c == NULL; i++) {
+        if (cluster_cache[i].inode_no == inode_no && cluster_cache[i].cluster == cluster) {
+            c = &cluster_cache[i];
+        }
+    }
+    if (c == NULL) {
+        c = &cluster_cache[cluster_cache_next];
+        cluster_cache_next = (cluster_cache_next + 1) % CLUSTER_CACHE_SLOTS;
+    }
+    c->inode_no = inode_no;
+    c->cluster = cluster;
+    memcpy(c->data, data, EXT2_CLUSTER_SIZE);
+    pthread_mutex_unlock(&cluster_lock);
+}
+
+// 间接块中的一项被修改后，同步缓存中的副本
+static void map_cache_update(uint32_t block_no, uint32_t offset, uint32_t value) {
+    pthread_mutex_lock(&map_lock);
+    for (int i = 0; i < MAP_CACHE_SLOTS; i++) {
+        if (map_cache[i].inode_no != 0 && map_cache[i].block_no == block_no) {
+            map_cache[i].entries[offset] = value;
+        }
+    }
+    pthread_mutex_unlock(&map_lock);
+}
+
+// 文件关闭、截断或删除时丢弃它的缓存
+void inode_map_release(uint32_t inode_no) {
+    pthread_mutex_lock(&map_lock);
+    for (int i = 0; i < MAP_CACHE_SLOTS; i++) {
+        if (map_cache[i].inode_no == inode_no) {
+            map_cache[i].inode_no = 0;
+        }
+    }
+    pthread_mutex_unlock(&map_lock);
+    
+    pthread_mutex_lock(&cluster_lock);
+    for (int i = 0; i < CLUSTER_CACHE_SLOTS; i++) {
+        if (cluster_cache[i].inode_no == inode_no) {
+            cluster_cache[i].inode_no = 0;
+        }
+    }
+    pthread_mutex_unlock(&cluster_lock);
+}
+
+// 卸载或重新挂载时丢弃所有缓存
+void inode_map_invalidate(void) {
+    pthread_mutex_lock(&map_lock);
+    memset(map_cache, 0, sizeof(map_cache));
+    map_cache_next = 0;
+    map_cache_last = 0;
+    pthread_mutex_unlock(&map_lock);
+    
+    pthread_mutex_lock(&cluster_lock);
+    memset(cluster_cache, 0, sizeof(cluster_cache));
+    cluster_cache_next = 0;
+    pthread_mutex_unlock(&cluster_lock);
+}
+
+/*单个文件的最大块数：12个直接块加一、二、三级间接块，
+同时不能超过32位 i_size 能表示的长度。*/
+uint32_t inode_max_blocks(void) {
+    uint64_t a = ADDR_PER_BLOCK;
+    uint64_t blocks = 12 + a + a * a + a * a * a;
+    uint64_t limit = (uint64_t)UINT32_MAX / BLOCK_SIZE;
+    return blocks < limit ? (uint32_t)blocks : (uint32_t)limit;
+}
+
+/*把逻辑块号分解成间接块树中的路径：返回层数（0为直接块，1~3为一、二、三级间接），
+*slot 为 i_block 的下标，offsets[i] 为第 i 层间接块中的下标。超出范围返回-1。*/
+static int block_path(uint32_t block_index, int *slot, uint32_t offsets[3]) {
+    uint32_t a = ADDR_PER_BLOCK;
+    
+    if (block_index >= inode_max_blocks()) {
+        return -1;
+    }
+    if (block_index < 12) {
+        *slot = block_index;
+        return 0;
+    }
+    block_index -= 12;
+    if (block_index < a) {
+        *slot = 12;
+        offsets[0] = block_index;
+        return 1;
+    }
+    block_index -= a;
+    if (block_index < a * a) {
+        *slot = 13;
+        offsets[0] = block_index / a;
+        offsets[1] = block_index % a;
+        return 2;
+    }
+    block_index -= a * a;
+    *slot = 14;
+    offsets[0] = block_index / (a * a);
+    offsets[1] = (block_index / a) % a;
+    offsets[2] = block_index % a;
+    return 3;
+}
+
+// 内联数据：镜像支持时，普通文件和符号链接的内容放在 i_block[] 中
+static int inline_allowed(const ext2_inode_t *inode) {
+    uint16_t type = inode->i_mode & 0xF000;
+    return (fs.superblock.s_feature_incompat & EXT2_FEATURE_INCOMPAT_INLINE_DATA) &&
+           (type == EXT2_S_IFREG || type == EXT2_S_IFLNK);
+}
+
+static int has_inline_data(const ext2_inode_t *inode) {
+    return (inode->i_flags & EXT2_INLINE_DATA_FL) != 0;
+}
+
+// 内容按簇压缩存放的普通文件（目录上的压缩标志只用于继承）
+static int has_compressed_data(const ext2_inode_t *inode) {
+    return (inode->i_flags & EXT2_COMPR_FL) != 0 && (inode->i_mode & 0xF000) == EXT2_S_IFREG;
+}
+
+// 沿间接链查找逻辑块对应的物理块（0 表示空洞），最底层的间接块放入映射缓存
+static int lookup_block(const ext2_inode_t *inode, uint32_t inode_no, uint32_t block_index, uint32_t *block_no) {
+    int slot;
+    uint32_t offsets[3];
+    int depth = block_path(block_index, &slot, offsets);
+    if (depth < 0) {
+        return -1; // 超出范围
+    }
+    if (has_inline_data(inode)) {
+        *block_no = 0; // 内联文件没有数据块
+        return 0;
+    }
+    if (depth == 0) {
+        *block_no = inode->i_block[slot];
+        return 0;
+    }
+    
+    pthread_mutex_lock(&map_lock);
+    map_cache_t *c = map_cache_find(inode_no, block_index);
+    if (c != NULL) {
+        *block_no = c->entries[block_index - c->first_index];
+        pthread_mutex_unlock(&map_lock);
+        return 0;
+    }
+    pthread_mutex_unlock(&map_lock);
+    
+    uint32_t indirect_blocks[EXT2_MAX_BLOCK_SIZE / 4];
+    uint32_t block = inode->i_block[slot];
+    for (int level = 0; level < depth; level++) {
+        if (block == 0) {
+            break; // 间接块不存在，整段都是空洞
+        }
+        if (read_block(block, indirect_blocks) != 0) {
+            return -1;
+        }
+        if (level == depth - 1) {
+            pthread_mutex_lock(&map_lock);
+            map_cache_fill(inode_no, block_index - offsets[level], block, indirect_blocks);
+            pthread_mutex_unlock(&map_lock);
+        }
+        block = indirect_blocks[offsets[level]];
+    }
+    *block_no = block;
+    return 0;
+}
+
+// 为间接链分配一个新的间接块，尽量靠近它所指向的数据块
+static uint32_t allocate_indirect_block(uint32_t inode_no, uint32_t data_block) {
+    return allocate_block_near(data_block != 0 ? data_block : inode_goal_block(inode_no));
+}
+
+/*释放以 block 为根、depth 层的间接块子树中相对下标在 [from, to) 内的数据块，一个间接块只读写一次；
+释放后变空的间接块一并释放。*freed 累加释放的数据块数。整个子树都空了（block 本身也已释放）时返回1。*/
+static int free_indirect_tree(uint32_t block, int depth, uint64_t from, uint64_t to, uint32_t *freed) {
+    uint32_t indirect_blocks[EXT2_MAX_BLOCK_SIZE / 4];
+    if (read_block(block, indirect_blocks) != 0) {
+        return 0;
+    }
+    
+    uint64_t span = 1; // 每一项覆盖的逻辑块数
+    for (int i = 1; i < depth; i++) {
+        span *= ADDR_PER_BLOCK;
+    }
+    
+    uint64_t first = from / span;
+    uint64_t last = (to + span - 1) / span;
+    if (last > ADDR_PER_BLOCK) {
+        last = ADDR_PER_BLOCK;
+    }
+    int changed = 0;
+    for (uint64_t i = first; i < last; i++) {
+        if (indirect_blocks[i] == 0) {
+            continue;
+        }
+        if (depth == 1) {
+            free_block(indirect_blocks[i]);
+            (*freed)++;
+        } else {
+            uint64_t base = i * span;
+            uint64_t sub_from = from > base ? from - base : 0;
+            uint64_t sub_to = to - base < span ? to - base : span;
+            if (!free_indirect_tree(indirect_blocks[i], depth - 1, sub_from, sub_to, freed)) {
+                continue;
+            }
+        }
+        indirect_blocks[i] = 0;
+        changed = 1;
+    }
+    
+    int empty = 1;
+    for (uint32_t i = 0; i < ADDR_PER_BLOCK && empty; i++) {
+        empty = indirect_blocks[i] == 0;
+    }
+    if (empty) {
+        free_block(block);
+        return 1;
+    }
+    if (changed) {
+        write_block(block, indirect_blocks);
+    }
+    return 0;
+}
+
+/*释放文件逻辑块 [from, to) 中的数据块和因此变空的间接块，返回释放的数据块数。
+间接块子树整棵释放时每个间接块只读写一次。*/
+static uint32_t free_block_range(ext2_inode_t *inode, uint32_t inode_no, uint64_t from, uint64_t to) {
+    if (has_inline_data(inode)) {
+        return 0; // i_block 中是文件内容，不是块指针
+    }
+    
+    uint32_t freed = 0;
+    for (uint64_t i = from; i < 12 && i < to; i++) {
+        if (inode->i_block[i] != 0) {
+            free_block(inode->i_block[i]);
+            inode->i_block[i] = 0;
+            freed++;
+        }
+    }
+    
+    uint64_t base = 12;
+    uint64_t span = ADDR_PER_BLOCK;
+    for (int depth = 1; depth <= 3; depth++) {
+        int slot = 11 + depth;
+        if (inode->i_block[slot] != 0 && from < base + span && to > base) {
+            uint64_t rel_from = from > base ? from - base : 0;
+            uint64_t rel_to = to - base < span ? to - base : span;
+            if (free_indirect_tree(inode->i_block[slot], depth, rel_from, rel_to, &freed)) {
+                inode->i_block[slot] = 0;
+            }
+        }
+        base += span;
+        span *= ADDR_PER_BLOCK;
+    }
+    
+    inode->i_blocks = inode->i_blocks > freed ? inode->i_blocks - freed : 0;
+    inode_map_release(inode_no);
+    icache_mark_dirty(inode_no);
+    return freed;
+}
+
+// 释放文件从逻辑块 from 开始的所有数据块和不再需要的间接块
+static void free_blocks_from(ext2_inode_t *inode, uint32_t inode_no, uint32_t from) {
+    free_block_range(inode, inode_no, from, UINT64_MAX);
+}
+
+/*压缩文件（EXT2_COMPR_FL）按 EXT2_CLUSTER_SIZE 字节分簇，每簇对应块映射中固定的 CLUSTER_BLOCKS 个逻辑块，
+块映射本身就是簇映射：释放、截断、一致性检查和快照都不用区分压缩文件。
+- 压缩后能省下至少一块的簇，簇头和压缩内容放在簇的前几个逻辑块上，其余逻辑块是空洞；
+  省不下的簇原样存放，全零的块留作空洞；全零的簇整个是空洞。
+- 读簇时第一块有映射、簇中有空洞、簇头和校验和都对得上，才按压缩簇解压。原样存放的簇第一块
+  恰好以簇头魔数开头时整簇的块都分配（没有空洞），不会被误认。
+- 簇中文件末尾之后的部分总是零：写簇时末尾之后清零，截短时重写末尾所在的簇。
+- 修改簇时读出整簇、修改、重新压缩，新块写好之后才换下旧块，空间不足时旧内容不变。*/
+#define CLUSTER_BLOCKS ((uint32_t)(EXT2_CLUSTER_SIZE / BLOCK_SIZE))
+#define MAX_CLUSTER_BLOCKS (EXT2_CLUSTER_SIZE / EXT2_MIN_BLOCK_SIZE)
+
+// 簇在长度为 size 的文件中的字节数
+static uint32_t cluster_length(off_t size, uint32_t cluster) {
+    off_t start = (off_t)cluster * EXT2_CLUSTER_SIZE;
+    if (size <= start) {
+        return 0;
+    }
+    return size - start < EXT2_CLUSTER_SIZE ? (uint32_t)(size - start) : EXT2_CLUSTER_SIZE;
+}
+
+// 长度为 size 的压缩文件用到的逻辑块之后的第一个逻辑块（末尾所在的簇之后）
+static uint32_t cluster_end_block(off_t size) {
+    return (uint32_t)((size + EXT2_CLUSTER_SIZE - 1) / EXT2_CLUSTER_SIZE) * CLUSTER_BLOCKS;
+}
+
+static int block_is_zero(const uint8_t *block) {
+    for (int i = 0; i < BLOCK_SIZE; i++) {
+        if (block[i] != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// 簇的块映射；超出单个文件最大块数的部分当作空洞
+static int map_cluster(uint32_t inode_no, uint32_t cluster, uint32_t *slots) {
+    uint32_t first = cluster * CLUSTER_BLOCKS;
+    uint32_t count = CLUSTER_BLOCKS;
+    memset(slots, 0, sizeof(uint32_t) * CLUSTER_BLOCKS);
+    if (first >= inode_max_blocks()) {
+        return 0;
+    }
+    if (count > inode_max_blocks() - first) {
+        count = inode_max_blocks() - first;
+    }
+    return map_inode_blocks(inode_no, first, count, slots);
+}
+
+// 把簇中有映射的块读到 data 中对应的位置，物理上连续的块一次读
+static int read_cluster_blocks(const uint32_t *slots, uint8_t *data) {
+    uint32_t i = 0;
+    while (i < CLUSTER_BLOCKS) {
+        if (slots[i] == 0) {
+            i++;
+            continue;
+        }
+        uint32_t n = 1;
+        while (i + n < CLUSTER_BLOCKS && slots[i + n] == slots[i] + n) {
+            n++;
+        }
+        void *bufs[MAX_CLUSTER_BLOCKS];
+        for (uint32_t j = 0; j < n; j++) {
+            bufs[j] = data + (size_t)(i + j) * BLOCK_SIZE;
+        }
+        if (read_blocks(slots[i], n, bufs) != 0) {
+            return -1;
+        }
+        i += n;
+    }
+    return 0;
+}
+
+/*packed 是读出的整簇内容：是压缩簇时解压到 data 返回1，不是返回0，
+簇头和校验和都对但解压失败（数据损坏）返回-1。*/
+static int decode_cluster(const uint32_t *slots, const uint8_t *packed, uint8_t *data) {
+    ext2_cluster_header_t header;
+    memcpy(&header, packed, sizeof(header));
+    if (header.c_magic != EXT2_CLUSTER_MAGIC || header.c_length > EXT2_CLUSTER_SIZE ||
+        header.c_compressed == 0) {
+        return 0;
+    }
+    uint32_t used = (sizeof(header) + header.c_compressed + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if (used >= CLUSTER_BLOCKS) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < CLUSTER_BLOCKS; i++) {
+        if ((slots[i] != 0) != (i < used)) {
+            return 0;
+        }
+    }
+    const uint8_t *payload = packed + sizeof(header);
+    if (lz_checksum(payload, header.c_compressed) != header.c_checksum) {
+        return 0;
+    }
+    memset(data, 0, EXT2_CLUSTER_SIZE);
+    if (lz_decompress(payload, header.c_compressed, data, header.c_length) != header.c_length) {
+        return -1;
+    }
+    return 1;
+}
+
+/*读出簇的内容（EXT2_CLUSTER_SIZE 字节，没有内容的部分为零）。compressed 为假时按原样存放读
+（文件还没有打开压缩）。调用者至少持有inode读锁。*/
+static int load_cluster(uint32_t inode_no, uint32_t cluster, int compressed, uint8_t *data) {
+    if (compressed && cluster_cache_get(inode_no, cluster, data)) {
+        return 0;
+    }
+    uint32_t slots[MAX_CLUSTER_BLOCKS];
+    if (map_cluster(inode_no, cluster, slots) != 0) {
+        return -1;
+    }
+    memset(data, 0, EXT2_CLUSTER_SIZE);
+    if (read_cluster_blocks(slots, data) != 0) {
+        return -1;
+    }
+    if (!compressed || slots[0] == 0) {
+        return 0;
+    }
+    
+    uint8_t packed[EXT2_CLUSTER_SIZE];
+    memcpy(packed, data, EXT2_CLUSTER_SIZE);
+    int result = decode_cluster(slots, packed, data);
+    if (result < 0) {
+        return -1;
+    }
+    if (result > 0) {
+        cluster_cache_put(inode_no, cluster, data);
+    }
+    return 0;
+}
+
+// 新块的目标位置：紧跟在前一簇的最后一个数据块之后
+static uint32_t cluster_goal(uint32_t inode_no, uint32_t cluster) {
+    uint32_t slots[MAX_CLUSTER_BLOCKS];
+    if (cluster == 0 || map_cluster(inode_no, cluster - 1, slots) != 0) {
+        return 0;
+    }
+    for (uint32_t i = CLUSTER_BLOCKS; i > 0; i--) {
+        if (slots[i - 1] != 0) {
+            return slots[i - 1] + 1;
+        }
+    }
+    return 0;
+}
+
+/*写回簇的内容 data（前 length 字节是文件内容，其余为零）：compressed 为真且能省下至少一块时压缩存放，
+否则原样存放。新块先分配并写好，再换下簇原来的块（释放时这个文件的映射缓存和解压缓存一并丢弃）。
+调用者持有inode写锁。空间不足时返回-1，簇的旧内容不变。*/
+static int store_cluster(ext2_inode_t *inode, uint32_t inode_no, uint32_t cluster,
+                         const uint8_t *data, uint32_t length, int compressed) {
+    uint32_t first = cluster * CLUSTER_BLOCKS;
+    uint32_t used = (length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    uint8_t packed[EXT2_CLUSTER_SIZE];
+    const uint8_t *src = data;
+    int whole = 0; // 所有块都分配，不留空洞
+    
+    if (compressed && used > 1) {
+        ext2_cluster_header_t header;
+        size_t capacity = (size_t)(used - 1) * BLOCK_SIZE - sizeof(header);
+        size_t size = lz_compress(data, length, packed + sizeof(header), capacity);
+        if (size > 0) {
+            header.c_magic = EXT2_CLUSTER_MAGIC;
+            header.c_length = length;
+            header.c_compressed = size;
+            header.c_checksum = lz_checksum(packed + sizeof(header), size);
+            header.c_reserved = 0;
+            memcpy(packed, &header, sizeof(header));
+            size_t total = sizeof(header) + size;
+            used = (total + BLOCK_SIZE - 1) / BLOCK_SIZE;
+            memset(packed + total, 0, (size_t)used * BLOCK_SIZE - total);
+            src = packed;
+            whole = 1;
+        }
+    }
+    if (src == data && used > 0) {
+        uint32_t magic;
+        memcpy(&magic, data, sizeof(magic));
+        if (magic == EXT2_CLUSTER_MAGIC) {
+            used = CLUSTER_BLOCKS;
+            whole = 1;
+        }
+    }
+    
+    uint32_t need[MAX_CLUSTER_BLOCKS]; // 要分配块的簇内序号
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < used; i++) {
+        if (whole || !block_is_zero(src + (size_t)i * BLOCK_SIZE)) {
+            need[count++] = i;
+        }
+    }
+    
+    uint32_t blocks[MAX_CLUSTER_BLOCKS];
+    uint32_t done = 0;
+    uint32_t goal = cluster_goal(inode_no, cluster);
+    while (done < count) {
+        uint32_t got;
+        uint32_t start = allocate_block_run(inode_no, goal, count - done, &got);
+        void *bufs[MAX_CLUSTER_BLOCKS];
+        for (uint32_t j = 0; start != 0 && j < got; j++) {
+            blocks[done + j] = start + j;
+            bufs[j] = (void*)(src + (size_t)need[done + j] * BLOCK_SIZE);
+        }
+        if (start == 0 || write_blocks(start, got, bufs) != 0) {
+            for (uint32_t j = 0; j < done + (start != 0 ? got : 0); j++) {
+                free_block(blocks[j]);
+            }
+            return -1;
+        }
+        done += got;
+        goal = start + got;
+    }
+    
+    free_block_range(inode, inode_no, first, first + CLUSTER_BLOCKS);
+    for (uint32_t j = 0; j < count; j++) {
+        if (set_inode_block(inode_no, first + need[j], blocks[j]) != 0) {
+            for (; j < count; j++) {
+                free_block(blocks[j]);
+            }
+            return -1;
+        }
+        inode->i_blocks++;
+    }
+    icache_mark_dirty(inode_no);
+    if (src == packed) {
+        cluster_cache_put(inode_no, cluster, data);
+    }
+    return 0;
+}
+
+// 压缩文件的读：逐簇解出，复制需要的部分
+static size_t read_clusters(uint32_t inode_no, uint8_t *buffer, size_t size, off_t offset) {
+    uint8_t data[EXT2_CLUSTER_SIZE];
+    size_t done = 0;
+    while (done < size) {
+        off_t pos = offset + done;
+        uint32_t cluster = pos / EXT2_CLUSTER_SIZE;
+        size_t in = pos % EXT2_CLUSTER_SIZE;
+        size_t len = EXT2_CLUSTER_SIZE - in < size - done ? EXT2_CLUSTER_SIZE - in : size - done;
+        if (load_cluster(inode_no, cluster, 1, data) != 0) {
+            break;
+        }
+        memcpy(buffer + done, data + in, len);
+        done += len;
+    }
+    return done;
+}
+
+/*压缩文件的写：每个涉及的簇读出、修改、重新压缩写回；整簇的旧内容都被覆盖时不用读。
+返回写入的字节数，文件长度由调用者更新。调用者持有inode写锁。*/
+static size_t write_clusters(ext2_inode_t *inode, uint32_t inode_no, const uint8_t *buffer,
+                             size_t size, off_t offset) {
+    uint8_t data[EXT2_CLUSTER_SIZE];
+    size_t done = 0;
+    while (done < size) {
+        off_t pos = offset + done;
+        uint32_t cluster = pos / EXT2_CLUSTER_SIZE;
+        size_t in = pos % EXT2_CLUSTER_SIZE;
+        size_t len = EXT2_CLUSTER_SIZE - in < size - done ? EXT2_CLUSTER_SIZE - in : size - done;
+        uint32_t old_length = cluster_length(inode->i_size, cluster);
+        
+        if (in == 0 && len >= old_length) {
+            memset(data, 0, EXT2_CLUSTER_SIZE);
+        } else if (load_cluster(inode_no, cluster, 1, data) != 0) {
+            break;
+        }
+        memcpy(data + in, buffer + done, len);
+        uint32_t length = in + len > old_length ? in + len : old_length;
+        if (store_cluster(inode, inode_no, cluster, data, length, 1) != 0) {
+            break;
+        }
+        done += len;
+    }
+    return done;
+}
+
+// 压缩文件截短到 length：末尾所在的簇重写（截掉的部分清零），之后的簇整个释放
+static int truncate_clusters(ext2_inode_t *inode, uint32_t inode_no, off_t length) {
+    uint32_t in = length % EXT2_CLUSTER_SIZE;
+    if (in != 0) {
+        uint32_t cluster = length / EXT2_CLUSTER_SIZE;
+        uint8_t data[EXT2_CLUSTER_SIZE];
+        if (load_cluster(inode_no, cluster, 1, data) != 0) {
+            return -1;
+        }
+        memset(data + in, 0, EXT2_CLUSTER_SIZE - in);
+        if (store_cluster(inode, inode_no, cluster, data, in, 1) != 0) {
+            return -1;
+        }
+    }
+    free_blocks_from(inode, inode_no, cluster_end_block(length));
+    return 0;
+}
+
+// 压缩文件打洞：整簇落在区间内（或区间到文件末尾）的簇变成空洞，其余重写。返回少占的块数
+static int punch_clusters(ext2_inode_t *inode, uint32_t inode_no, off_t offset, off_t end) {
+    uint32_t before = inode->i_blocks;
+    uint8_t data[EXT2_CLUSTER_SIZE];
+    off_t pos = offset;
+    while (pos < end) {
+        uint32_t cluster = pos / EXT2_CLUSTER_SIZE;
+        off_t start = (off_t)cluster * EXT2_CLUSTER_SIZE;
+        off_t cut_end = end < start + EXT2_CLUSTER_SIZE ? end : start + EXT2_CLUSTER_SIZE;
+        uint32_t length = cluster_length(inode->i_size, cluster);
+        
+        if (pos == start && cut_end >= start + length) {
+            free_block_range(inode, inode_no, cluster * CLUSTER_BLOCKS, (cluster + 1) * CLUSTER_BLOCKS);
+        } else {
+            if (load_cluster(inode_no, cluster, 1, data) != 0) {
+                return -1;
+            }
+            memset(data + (pos - start), 0, cut_end - pos);
+            if (store_cluster(inode, inode_no, cluster, data, length, 1) != 0) {
+                return -1;
+            }
+        }
+        pos = cut_end;
+    }
+    return before > inode->i_blocks ? (int)(before - inode->i_blocks) : 0;
+}
+
+// 把同一块中的字节区间 [from, to) 清零；这一块是空洞时什么都不用做
+static int zero_in_block(ext2_inode_t *inode, uint32_t inode_no, off_t from, off_t to) {
+    uint32_t block_no;
+    if (lookup_block(inode, inode_no, from / BLOCK_SIZE, &block_no) != 0) {
+        return -1;
+    }
+    if (block_no == 0) {
+        return 0;
+    }
+    uint8_t block[EXT2_MAX_BLOCK_SIZE];
+    if (read_block(block_no, block) != 0) {
+        return -1;
+    }
+    memset(block + from % BLOCK_SIZE, 0, to - from);
+    return write_block(block_no, block);
+}
+
+/*文件长度从 size 往后扩展而中间不写数据时（越过末尾写、截断加长、预分配）调用：
+size 所在块中 size 之后的部分清零，size 之后残留的块（预留后没写到、写到一半失败）释放，
+截断或预留留下的旧内容在扩展后不能被读到。调用者持有inode写锁。*/
+static int clear_beyond_eof(ext2_inode_t *inode, uint32_t inode_no, off_t size) {
+    if (has_inline_data(inode)) {
+        return 0; // 内联区长度之外的部分总是零
+    }
+    if (has_compressed_data(inode)) {
+        // 簇中末尾之后的部分总是零，只需释放末尾所在的簇之后残留的块
+        free_block_range(inode, inode_no, cluster_end_block(size), UINT64_MAX);
+        return 0;
+    }
+    
+    uint32_t tail_index = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    free_block_range(inode, inode_no, tail_index, UINT64_MAX);
+    if (size % BLOCK_SIZE == 0) {
+        return 0;
+    }
+    return zero_in_block(inode, inode_no, size, (off_t)tail_index * BLOCK_SIZE);
+}
+
+/*文件超过内联上限时把已有内容搬到一个新数据块，之后按普通文件读写。
+调用者持有inode写锁；分配失败时保持内联不变。*/
+static int inline_to_blocks(ext2_inode_t *inode, uint32_t inode_no) {
+    uint8_t data[EXT2_INLINE_DATA_MAX];
+    memcpy(data, inode->i_block, sizeof(data));
+    
+    // 压缩文件的内容写成第0簇
+    if (has_compressed_data(inode)) {
+        uint8_t cluster[EXT2_CLUSTER_SIZE];
+        memset(cluster, 0, sizeof(cluster));
+        memcpy(cluster, data, inode->i_size);
+        memset(inode->i_block, 0, sizeof(inode->i_block));
+        inode->i_flags &= ~EXT2_INLINE_DATA_FL;
+        inode->i_blocks = 0;
+        if (inode->i_size > 0 && store_cluster(inode, inode_no, 0, cluster, inode->i_size, 1) != 0) {
+            memcpy(inode->i_block, data, sizeof(data));
+            inode->i_flags |= EXT2_INLINE_DATA_FL;
+            return -1;
+        }
+        icache_mark_dirty(inode_no);
+        return 0;
+    }
+    
+    uint32_t block_no = 0;
+    if (inode->i_size > 0) {
+        block_no = allocate_file_block(inode_no, 0);
+        if (block_no == 0) {
+            return -1;
+        }
+        uint8_t block[EXT2_MAX_BLOCK_SIZE];
+        memset(block, 0, BLOCK_SIZE);
+        memcpy(block, data, inode->i_size);
+        if (write_block(block_no, block) != 0) {
+            free_block(block_no);
+            return -1;
+        }
+    }
+    
+    memset(inode->i_block, 0, sizeof(inode->i_block));
+    inode->i_flags &= ~EXT2_INLINE_DATA_FL;
+    inode->i_block[0] = block_no;
+    inode->i_blocks = block_no != 0 ? 1 : 0;
+    icache_mark_dirty(inode_no);
+    return 0;
+}
+
+/*截断到内联上限以内的普通文件或符号链接改回内联：先读出保留的内容，再释放所有数据块。
+调用者持有inode写锁。*/
+static int blocks_to_inline(ext2_inode_t *inode, uint32_t inode_no, off_t length) {
+    uint8_t block[EXT2_CLUSTER_SIZE];
+    memset(block, 0, BLOCK_SIZE);
+    if (length > 0 && has_compressed_data(inode)) {
+        if (load_cluster(inode_no, 0, 1, block) != 0) {
+            return -1;
+        }
+    } else if (length > 0 && inode->i_block[0] != 0 && read_block(inode->i_block[0], block) != 0) {
+        return -1;
+    }
+    
+    free_blocks_from(inode, inode_no, 0);
+    memset(inode->i_block, 0, sizeof(inode->i_block));
+    memcpy(inode->i_block, block, length);
+    inode->i_flags |= EXT2_INLINE_DATA_FL;
+    inode->i_blocks = 0;
+    return 0;
+}
 
 // Inode操作
-int create_inode(uint16_t mode, uint16_t uid, uint16_t gid) {
-    uint32_t inode_no = allocate_inode();
+// 在目录 parent_inode 下创建inode（inode所在的组由 allocate_inode 选择），失败返回0
+int create_inode(uint32_t parent_inode, uint16_t mode, uint16_t uid, uint16_t gid) {
+    int is_dir = (mode & 0xF000) == EXT2_S_IFDIR;
+    
+    // 普通文件和子目录继承父目录的压缩标志
+    uint32_t inherited = 0;
+    ext2_inode_t *parent = parent_inode != 0 ? icache_get(parent_inode) : NULL;
+    if (parent != NULL) {
+        if (is_dir || (mode & 0xF000) == EXT2_S_IFREG) {
+            inherited = parent->i_flags & EXT2_COMPR_FL;
+        }
+        icache_put(parent_inode);
+    }
+    
+    uint32_t inode_no = allocate_inode(parent_inode, is_dir);
     if (inode_no == 0) {
+        return 0;
+    }
+    
+    ext2_inode_t *inode = icache_get(inode_no);
+    if (inode == NULL) {
+        free_inode(inode_no, is_dir);
+        return 0;
+    }
+    
+    icache_lock_exclusive(inode_no);
+    memset(inode, 0, sizeof(ext2_inode_t));
+    
+    inode->i_mode = mode;
+    inode->i_uid = uid;
+    inode->i_gid = gid;
+    inode->i_size = 0;
+    inode->i_links_count = 0; // 每添加一个指向它的目录项加一
+    inode->i_blocks = 0;
+    inode->i_atime = time(NULL);
+    inode->i_ctime = time(NULL);
+    inode->i_mtime = time(NULL);
+    
+    // 初始化块指针数组
+    for (int i = 0; i < 15; i++) {
+        inode->i_block[i] = 0;
+    }
+    
+    // 普通文件和符号链接先以内联方式存放，写到超过上限时才分配数据块
+    if (inline_allowed(inode)) {
+        inode->i_flags |= EXT2_INLINE_DATA_FL;
+    }
+    inode->i_flags |= inherited;
+    
+    icache_mark_dirty(inode_no);
+    icache_unlock(inode_no);
+    icache_put(inode_no);
+    
+    return inode_no;
+}
+
+int delete_inode(uint32_t inode_no) {
+    ext2_inode_t *inode = icache_get(inode_no);
+    if (inode == NULL) {
+        return -1;
+    }
+    
+    // 释放所有数据块和间接块
+    icache_lock_exclusive(inode_no);
+    free_blocks_from(inode, inode_no, 0);
+    
+    release_block_reservation(inode_no);
+    
+    // 清除inode
+    int is_dir = (inode->i_mode & 0xF000) == EXT2_S_IFDIR;
+    memset(inode, 0, sizeof(ext2_inode_t));
+    icache_mark_dirty(inode_no);
+    icache_unlock(inode_no);
+    icache_put(inode_no);
+    
+    // 释放inode
+    free_inode(inode_no, is_dir);
+    
+    return 0;
+}
+
+/*块映射的读写不加inode锁：读映射的调用者至少持有inode读锁，修改映射的调用者持有写锁
+（目录的块由目录项操作持有写锁修改）。*/
+int get_inode_block(uint32_t inode_no, uint32_t block_index, uint32_t *block_no) {
+    ext2_inode_t *inode = icache_get(inode_no);
+    if (inode == NULL) {
         return -1;
     }
     
-    ext2_inode_t inode;
-    memset(&inode, 0, sizeof(ext2_inode_t));
+    int result = lookup_block(inode, inode_no, block_index, block_no);
     
-    inode.i_mode = mode;
-    inode.i_uid = uid;
-    inode.i_gid = gid;
-    inode.i_size = 0;
-    inode.i_links_count = 1;
-    inode.i_blocks = 0;
-    inode.i_atime = time(NULL);
-    inode.i_ctime = time(NULL);
-    inode.i_mtime = time(NULL);
+    icache_put(inode_no);
+    return result;
+}
+
+/*设置逻辑块对应的物理块，缺少的间接块按需分配并清零。
+block_no 为0（清除映射）且间接块不存在时什么都不用做。*/
+int set_inode_block(uint32_t inode_no, uint32_t block_index, uint32_t block_no) {
+    ext2_inode_t *inode = icache_get(inode_no);
+    if (inode == NULL) {
+        return -1;
+    }
+    
+    int slot;
+    uint32_t offsets[3];
+    int depth = block_path(block_index, &slot, offsets);
+    if (depth < 0) {
+        icache_put(inode_no);
+        return -1; // 超出范围
+    }
+    
+    int result = 0;
+    if (depth == 0) {
+        inode->i_block[slot] = block_no;
+        icache_mark_dirty(inode_no);
+        icache_put(inode_no);
+        return 0;
+    }
     
-    // 初始化块指针数组
-    for (int i = 0; i < 15; i++) {
-        inode.i_block[i] = 0;
+    uint32_t indirect_blocks[EXT2_MAX_BLOCK_SIZE / 4];
+    uint32_t block = inode->i_block[slot];
+    int fresh = 0;
+    if (block == 0) {
+        if (block_no == 0) {
+            icache_put(inode_no);
+            return 0;
+        }
+        block = allocate_indirect_block(inode_no, block_no);
+        if (block == 0) {
+            icache_put(inode_no);
+            return -1;
+        }
+        inode->i_block[slot] = block;
+        icache_mark_dirty(inode_no);
+        fresh = 1;
     }
     
-    if (write_inode(inode_no, &inode) != 0) {
-        free_inode(inode_no);
-        return -1;
+    for (int level = 0; level < depth; level++) {
+        // 新分配的间接块可能是刚释放的旧块，先清零
+        if (fresh) {
+            memset(indirect_blocks, 0, BLOCK_SIZE);
+        } else if (read_block(block, indirect_blocks) != 0) {
+            result = -1;
+            break;
+        }
+        
+        if (level == depth - 1) {
+            indirect_blocks[offsets[level]] = block_no;
+            result = write_block(block, indirect_blocks);
+            map_cache_update(block, offsets[level], block_no);
+            break;
+        }
+        
+        uint32_t next = indirect_blocks[offsets[level]];
+        fresh = 0;
+        if (next == 0) {
+            if (block_no == 0) {
+                break;
+            }
+            next = allocate_indirect_block(inode_no, block_no);
+            if (next == 0) {
+                result = -1;
+                break;
+            }
+            indirect_blocks[offsets[level]] = next;
+            if (write_block(block, indirect_blocks) != 0) {
+                result = -1;
+                break;
+            }
+            fresh = 1;
+        }
+        block = next;
     }
     
-    return inode_no;
+    icache_put(inode_no);
+    return result;
 }
 
-int delete_inode(uint32_t inode_no) {
-    ext2_inode_t inode;
-    if (read_inode(inode_no, &inode) != 0) {
+/*块映射：一次解析一段逻辑块，间接块经映射缓存只读一次。
+超出单个文件最大块数的部分返回 -1。*/
+int map_inode_blocks(uint32_t inode_no, uint32_t first_index, uint32_t count, uint32_t *block_nos) {
+    ext2_inode_t *inode = icache_get(inode_no);
+    if (inode == NULL) {
         return -1;
     }
     
-    // 释放所有数据块
-    for (int i = 0; i < 12; i++) {
-        if (inode.i_block[i] != 0) {
-            free_block(inode.i_block[i]);
+    for (uint32_t i = 0; i < count; i++) {
+        if (lookup_block(inode, inode_no, first_index + i, &block_nos[i]) != 0) {
+            icache_put(inode_no);
+            return -1;
         }
     }
     
-    // 释放间接块（简化实现，只处理一级间接）
-    if (inode.i_block[12] != 0) {
-        uint32_t indirect_blocks[BLOCK_SIZE / 4];
-        if (read_block(inode.i_block[12], indirect_blocks) == 0) {
-            for (int i = 0; i < BLOCK_SIZE / 4; i++) {
-                if (indirect_blocks[i] != 0) {
-                    free_block(indirect_blocks[i]);
-                }
+    icache_put(inode_no);
+    return 0;
+}
+
+/*把逻辑块区间解析成物理上连续的区段（physical 为 0 表示空洞）。
+最多返回 max_extents 个区段；区段数不够时只覆盖区间的前一部分，调用者从最后一个区段之后继续。*/
+int map_inode_extents(uint32_t inode_no, uint32_t first_index, uint32_t count,
+                      inode_extent_t *extents, int max_extents) {
+    int n = 0;
+    uint32_t done = 0;
+    
+    while (done < count && n < max_extents) {
+        uint32_t block_nos[MAX_IO_BLOCKS];
+        uint32_t chunk = count - done;
+        if (chunk > MAX_IO_BLOCKS) {
+            chunk = MAX_IO_BLOCKS;
+        }
+        if (map_inode_blocks(inode_no, first_index + done, chunk, block_nos) != 0) {
+            return n > 0 ? n : -1;
+        }
+        
+        for (uint32_t i = 0; i < chunk; i++) {
+            inode_extent_t *last = n > 0 ? &extents[n - 1] : NULL;
+            uint32_t logical = first_index + done + i;
+            int contiguous = last != NULL && last->logical + last->count == logical &&
+                             last->count < MAX_IO_BLOCKS &&
+                             ((last->physical == 0 && block_nos[i] == 0) ||
+                              (last->physical != 0 && last->physical + last->count == block_nos[i]));
+            if (contiguous) {
+                last->count++;
+                continue;
             }
+            if (n == max_extents) {
+                return n;
+            }
+            extents[n].logical = logical;
+            extents[n].physical = block_nos[i];
+            extents[n].count = 1;
+            n++;
         }
-        free_block(inode.i_block[12]);
+        done += chunk;
     }
     
-    // 清除inode
-    memset(&inode, 0, sizeof(ext2_inode_t));
-    write_inode(inode_no, &inode);
-    
-    // 释放inode
-    free_inode(inode_no);
-    
-    return 0;
+    return n;
 }
 
-int get_inode_block(uint32_t inode_no, uint32_t block_index, uint32_t *block_no) {
-    ext2_inode_t inode;
-    if (read_inode(inode_no, &inode) != 0) {
-        return -1;
+/*对一个区段中的字节区间 [start, end) 做一次多块I/O。
+完整的块直接使用调用者的缓冲区；首尾不足一块的部分使用临时块缓冲区。
+写入时，不完整的块先读出旧内容（新分配的块则清零），完整的块不需要先读。*/
+static int transfer_extent(const inode_extent_t *ext, char *data, off_t start, off_t end,
+                           int writing, int fresh) {
+    uint32_t first = start / BLOCK_SIZE;
+    uint32_t last = (end - 1) / BLOCK_SIZE;
+    uint32_t count = last - first + 1;
+    uint32_t physical = ext->physical + (first - ext->logical);
+    uint32_t head_offset = start % BLOCK_SIZE;
+    uint32_t tail_len = end - (off_t)last * BLOCK_SIZE;
+    
+    uint8_t head[EXT2_MAX_BLOCK_SIZE];
+    uint8_t tail[EXT2_MAX_BLOCK_SIZE];
+    void *bufs[MAX_IO_BLOCKS];
+    
+    int head_partial = head_offset != 0 || (count == 1 && tail_len != (uint32_t)BLOCK_SIZE);
+    int tail_partial = count > 1 && tail_len != (uint32_t)BLOCK_SIZE;
+    
+    for (uint32_t i = 0; i < count; i++) {
+        bufs[i] = data - head_offset + (size_t)i * BLOCK_SIZE;
+    }
+    if (head_partial) {
+        bufs[0] = head;
+    }
+    if (tail_partial) {
+        bufs[count - 1] = tail;
     }
     
-    if (block_index < 12) {
-        *block_no = inode.i_block[block_index];
-        return 0;
-    } else if (block_index < 12 + BLOCK_SIZE / 4) {
-        // 一级间接块
-        if (inode.i_block[12] == 0) {
-            *block_no = 0;
-            return 0;
-        }
-        
-        uint32_t indirect_blocks[BLOCK_SIZE / 4];
-        if (read_block(inode.i_block[12], indirect_blocks) != 0) {
+    if (!writing) {
+        if (read_blocks(physical, count, bufs) != 0) {
             return -1;
         }
-        
-        *block_no = indirect_blocks[block_index - 12];
+        if (head_partial) {
+            uint32_t len = count == 1 ? end - start : BLOCK_SIZE - head_offset;
+            memcpy(data, head + head_offset, len);
+        }
+        if (tail_partial) {
+            memcpy(data + (end - start) - tail_len, tail, tail_len);
+        }
         return 0;
     }
     
-    return -1; // 超出范围
+    if (head_partial) {
+        uint32_t len = count == 1 ? end - start : BLOCK_SIZE - head_offset;
+        if (fresh) {
+            memset(head, 0, BLOCK_SIZE);
+        } else if (read_block(physical, head) != 0) {
+            return -1;
+        }
+        memcpy(head + head_offset, data, len);
+    }
+    if (tail_partial) {
+        if (fresh) {
+            memset(tail, 0, BLOCK_SIZE);
+        } else if (read_block(physical + count - 1, tail) != 0) {
+            return -1;
+        }
+        memcpy(tail, data + (end - start) - tail_len, tail_len);
+    }
+    return write_blocks(physical, count, bufs);
 }
 
-int set_inode_block(uint32_t inode_no, uint32_t block_index, uint32_t block_no) {
-    ext2_inode_t inode;
-    if (read_inode(inode_no, &inode) != 0) {
-        return -1;
+// 为空洞区段分配数据块，并把结果重新整理成连续区段
+static int allocate_extent_blocks(uint32_t inode_no, const inode_extent_t *hole,
+                                  inode_extent_t *extents, int max_extents) {
+    // 目标块：紧跟在文件前一个数据块之后
+    uint32_t goal = 0;
+    if (hole->logical > 0) {
+        uint32_t prev;
+        if (map_inode_blocks(inode_no, hole->logical - 1, 1, &prev) == 0 && prev != 0) {
+            goal = prev + 1;
+        }
     }
     
-    if (block_index < 12) {
-        inode.i_block[block_index] = block_no;
-    } else if (block_index < 12 + BLOCK_SIZE / 4) {
-        // 一级间接块
-        if (inode.i_block[12] == 0) {
-            inode.i_block[12] = allocate_block();
-            if (inode.i_block[12] == 0) {
-                return -1;
-            }
+    int n = 0;
+    for (uint32_t i = 0; i < hole->count; i++) {
+        uint32_t block_no = allocate_file_block(inode_no, goal);
+        if (block_no == 0) {
+            break;
         }
-        
-        uint32_t indirect_blocks[BLOCK_SIZE / 4];
-        if (read_block(inode.i_block[12], indirect_blocks) != 0) {
-            memset(indirect_blocks, 0, BLOCK_SIZE);
+        if (set_inode_block(inode_no, hole->logical + i, block_no) != 0) {
+            free_block(block_no);
+            break;
         }
+        goal = block_no + 1;
         
-        indirect_blocks[block_index - 12] = block_no;
-        write_block(inode.i_block[12], indirect_blocks);
-    } else {
-        return -1; // 超出范围
+        if (n > 0 && extents[n - 1].physical + extents[n - 1].count == block_no) {
+            extents[n - 1].count++;
+        } else if (n < max_extents) {
+            extents[n].logical = hole->logical + i;
+            extents[n].physical = block_no;
+            extents[n].count = 1;
+            n++;
+        } else {
+            break;
+        }
     }
-    
-    return write_inode(inode_no, &inode);
+    return n;
 }
 
 // 文件读写操作
+// 读文件持有inode读锁，同一文件的多个读者可以并发；偏移为负或 offset + size 溢出时返回-1
 ssize_t read_inode_data(uint32_t inode_no, void *buffer, size_t size, off_t offset) {
-    ext2_inode_t inode;
-    if (read_inode(inode_no, &inode) != 0) {
+    if (offset < 0 || size > (uint64_t)INT64_MAX - (uint64_t)offset) {
+        return -1;
+    }
+    ext2_inode_t *inode = icache_get(inode_no);
+    if (inode == NULL) {
         return -1;
     }
     
-    if (offset >= inode.i_size) {
+    icache_lock_shared(inode_no);
+    if (offset >= inode->i_size) {
+        icache_unlock(inode_no);
+        icache_put(inode_no);
         return 0;
     }
+    if (size > (size_t)(inode->i_size - offset)) {
+        size = inode->i_size - offset;
+    }
     
+    // 内联数据直接从inode中复制，不读数据块
+    if (has_inline_data(inode)) {
+        memcpy(buffer, (const uint8_t*)inode->i_block + offset, size);
+        icache_set_atime(inode_no, time(NULL));
+        icache_unlock(inode_no);
+        icache_put(inode_no);
+        return size;
+    }
+    
+    // 压缩文件逐簇解压
+    if (has_compressed_data(inode)) {
+        size_t n = read_clusters(inode_no, buffer, size, offset);
+        icache_set_atime(inode_no, time(NULL));
+        icache_unlock(inode_no);
+        icache_put(inode_no);
+        return n;
+    }
+    
+    // 上面已把 size 截到文件末尾，end 不超过 i_size，按块号映射时不会越界
     size_t bytes_read = 0;
-    size_t remaining = size;
-    off_t current_offset = offset;
+    off_t end = offset + size;
     
-    while (remaining > 0 && current_offset < inode.i_size) {
-        uint32_t block_index = current_offset / BLOCK_SIZE;
-        uint32_t block_offset = current_offset % BLOCK_SIZE;
-        uint32_t block_no;
+    while (bytes_read < size) {
+        off_t current_offset = offset + bytes_read;
+        uint32_t first = current_offset / BLOCK_SIZE;
+        uint32_t last = (end - 1) / BLOCK_SIZE;
         
-        if (get_inode_block(inode_no, block_index, &block_no) != 0 || block_no == 0) {
+        inode_extent_t extents[16];
+        int n = map_inode_extents(inode_no, first, last - first + 1, extents, 16);
+        if (n <= 0) {
             break;
         }
         
-        uint8_t block_buffer[BLOCK_SIZE];
-        if (read_block(block_no, block_buffer) != 0) {
-            break;
-        }
-        
-        size_t bytes_in_block = BLOCK_SIZE - block_offset;
-        if (bytes_in_block > remaining) {
-            bytes_in_block = remaining;
+        int stop = 0;
+        for (int i = 0; i < n && !stop; i++) {
+            off_t ext_end = (off_t)(extents[i].logical + extents[i].count) * BLOCK_SIZE;
+            off_t start = offset + bytes_read;
+            off_t stop_at = ext_end < end ? ext_end : end;
+            
+            // 空洞（没有分配块的部分）读出来是零
+            if (extents[i].physical == 0) {
+                memset((char*)buffer + bytes_read, 0, stop_at - start);
+            } else if (transfer_extent(&extents[i], (char*)buffer + bytes_read, start, stop_at, 0, 0) != 0) {
+                stop = 1;
+                break;
+            }
+            bytes_read += stop_at - start;
         }
-        if (current_offset + bytes_in_block > inode.i_size) {
-            bytes_in_block = inode.i_size - current_offset;
+        if (stop) {
+            break;
         }
-        
-        memcpy((char*)buffer + bytes_read, block_buffer + block_offset, bytes_in_block);
-        
-        bytes_read += bytes_in_block;
-        remaining -= bytes_in_block;
-        current_offset += bytes_in_block;
     }
     
-    // 更新访问时间
-    update_atime(inode_no);
+    // 更新访问时间（读者之间由inode表的锁互斥）
+    icache_set_atime(inode_no, time(NULL));
     
+    icache_unlock(inode_no);
+    icache_put(inode_no);
     return bytes_read;
 }
 
+// 偏移为负、offset + size 溢出或超过32位 i_size 能表示的长度时返回-1，不修改文件
 ssize_t write_inode_data(uint32_t inode_no, const void *buffer, size_t size, off_t offset) {
-    ext2_inode_t inode;
-    if (read_inode(inode_no, &inode) != 0) {
+    if (offset < 0 || size > (uint64_t)UINT32_MAX || (uint64_t)offset > (uint64_t)UINT32_MAX - size) {
+        return -1;
+    }
+    ext2_inode_t *inode = icache_get(inode_no);
+    if (inode == NULL) {
         return -1;
     }
     
+    icache_lock_exclusive(inode_no);
     size_t bytes_written = 0;
-    size_t remaining = size;
-    off_t current_offset = offset;
+    off_t end = offset + size;
+    int failed = 0;
+    
+    // 越过文件末尾写时，原来末尾和 offset 之间留作空洞（不分配块），读出来是零
+    if (offset > inode->i_size && clear_beyond_eof(inode, inode_no, inode->i_size) != 0) {
+        icache_unlock(inode_no);
+        icache_put(inode_no);
+        return -1;
+    }
+    
+    // 内联文件：写完仍在上限以内时只改inode，否则先把已有内容迁移到数据块
+    if (has_inline_data(inode)) {
+        if (end <= (off_t)EXT2_INLINE_DATA_MAX) {
+            memcpy((uint8_t*)inode->i_block + offset, buffer, size);
+            if (end > inode->i_size) {
+                inode->i_size = end;
+            }
+            update_mtime(inode_no);
+            update_ctime(inode_no);
+            icache_unlock(inode_no);
+            icache_put(inode_no);
+            return size;
+        }
+        if (inline_to_blocks(inode, inode_no) != 0) {
+            icache_unlock(inode_no);
+            icache_put(inode_no);
+            return -1;
+        }
+    }
+    
+    // 压缩文件逐簇改写
+    if (has_compressed_data(inode)) {
+        bytes_written = write_clusters(inode, inode_no, buffer, size, offset);
+        failed = bytes_written < size;
+    }
     
-    while (remaining > 0) {
-        uint32_t block_index = current_offset / BLOCK_SIZE;
-        uint32_t block_offset = current_offset % BLOCK_SIZE;
-        uint32_t block_no;
+    while (bytes_written < size && !failed) {
+        off_t current_offset = offset + bytes_written;
+        uint32_t first = current_offset / BLOCK_SIZE;
+        uint32_t last = (end - 1) / BLOCK_SIZE;
         
-        if (get_inode_block(inode_no, block_index, &block_no) != 0) {
+        inode_extent_t extents[16];
+        int n = map_inode_extents(inode_no, first, last - first + 1, extents, 16);
+        if (n <= 0) {
             break;
         }
         
-        if (block_no == 0) {
-            block_no = allocate_block();
-            if (block_no == 0) {
-                break;
+        for (int i = 0; i < n && !failed; i++) {
+            // 空洞先分配数据块，新块中未写入的部分要清零
+            inode_extent_t runs[MAX_IO_BLOCKS];
+            int run_count = 1;
+            int fresh = 0;
+            runs[0] = extents[i];
+            if (extents[i].physical == 0) {
+                run_count = allocate_extent_blocks(inode_no, &extents[i], runs, MAX_IO_BLOCKS);
+                fresh = 1;
+                if (run_count == 0) {
+                    failed = 1;
+                    break;
+                }
+                for (int r = 0; r < run_count; r++) {
+                    inode->i_blocks += runs[r].count;
+                }
             }
-            if (set_inode_block(inode_no, block_index, block_no) != 0) {
-                free_block(block_no);
-                break;
+            
+            uint32_t mapped = 0;
+            for (int r = 0; r < run_count; r++) {
+                off_t run_end = (off_t)(runs[r].logical + runs[r].count) * BLOCK_SIZE;
+                off_t start = offset + bytes_written;
+                off_t stop_at = run_end < end ? run_end : end;
+                
+                if (transfer_extent(&runs[r], (char*)buffer + bytes_written, start, stop_at, 1, fresh) != 0) {
+                    failed = 1;
+                    break;
+                }
+                bytes_written += stop_at - start;
+                mapped += runs[r].count;
+            }
+            
+            // 空洞只分配到了一部分块（空间不足），写到已分配的部分为止
+            if (mapped < extents[i].count) {
+                failed = 1;
             }
         }
-        
-        uint8_t block_buffer[BLOCK_SIZE];
-        if (read_block(block_no, block_buffer) != 0) {
-            break;
-        }
-        
-        size_t bytes_in_block = BLOCK_SIZE - block_offset;
-        if (bytes_in_block > remaining) {
-            bytes_in_block = remaining;
+    }
+    
+    // 更新文件大小和时间戳（只修改内存副本，操作结束时统一写回）
+    off_t current_offset = offset + bytes_written;
+    if (current_offset > inode->i_size) {
+        inode->i_size = current_offset;
+    }
+    
+    update_mtime(inode_no);
+    update_ctime(inode_no);
+    
+    icache_unlock(inode_no);
+    icache_put(inode_no);
+    return bytes_written;
+}
+
+/*为逻辑块 [0, nblocks) 中的空洞分配数据块（已有的块保留），每段空洞尽量一次分配连续的块。
+zero 为真时新块清零。新分配的块数计入 i_blocks。调用者持有inode写锁。*/
+static int allocate_range(ext2_inode_t *inode, uint32_t inode_no, uint32_t nblocks, int zero) {
+    static const uint8_t zero_block[EXT2_MAX_BLOCK_SIZE];
+    void *zero_bufs[MAX_IO_BLOCKS];
+    for (int i = 0; i < MAX_IO_BLOCKS; i++) {
+        zero_bufs[i] = (void*)zero_block;
+    }
+    
+    uint32_t goal = 0;
+    uint32_t index = 0;
+    while (index < nblocks) {
+        inode_extent_t extents[16];
+        int n = map_inode_extents(inode_no, index, nblocks - index, extents, 16);
+        if (n <= 0) {
+            return -1;
         }
         
-        memcpy(block_buffer + block_offset, (char*)buffer + bytes_written, bytes_in_block);
-        
-        if (write_block(block_no, block_buffer) != 0) {
-            break;
+        for (int i = 0; i < n; i++) {
+            if (extents[i].physical != 0) {
+                goal = extents[i].physical + extents[i].count;
+                index = extents[i].logical + extents[i].count;
+                continue;
+            }
+            
+            uint32_t logical = extents[i].logical;
+            uint32_t remaining = extents[i].count;
+            while (remaining > 0) {
+                uint32_t got;
+                uint32_t start = allocate_block_run(inode_no, goal, remaining, &got);
+                if (start == 0) {
+                    return -1; // 空间不足
+                }
+                if (zero) {
+                    write_blocks(start, got, zero_bufs);
+                }
+                for (uint32_t j = 0; j < got; j++) {
+                    set_inode_block(inode_no, logical + j, start + j);
+                }
+                inode->i_blocks += got;
+                icache_mark_dirty(inode_no);
+                goal = start + got;
+                logical += got;
+                remaining -= got;
+            }
+            index = logical;
         }
-        
-        bytes_written += bytes_in_block;
-        remaining -= bytes_in_block;
-        current_offset += bytes_in_block;
     }
+    return 0;
+}
+
+/*预分配：为文件的前 length 字节分配数据块（已有的块保留），
+尽量使用连续的块，新块清零；文件长度小于 length 时扩展到 length。*/
+int preallocate_inode(uint32_t inode_no, off_t length) {
+    ext2_inode_t *inode = icache_get(inode_no);
+    if (inode == NULL) {
+        return -1;
+    }
+    
+    // 先按64位检查长度再换算块数，过大的长度不能在换算成32位块数时回绕
+    if (length < 0 || (uint64_t)length > (uint64_t)inode_max_blocks() * BLOCK_SIZE) {
+        icache_put(inode_no);
+        return length < 0 ? -1 : -EFBIG; // 超过最大文件大小
+    }
+    uint32_t nblocks = (length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    icache_lock_exclusive(inode_no);
     
-    // 更新文件大小和时间戳
-    if (current_offset > inode.i_size) {
-        inode.i_size = current_offset;
-        inode.i_blocks = (inode.i_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    // 预分配到内联上限以内时只需扩展长度（内联区的空余部分都是零）
+    if (has_inline_data(inode) && length <= (off_t)EXT2_INLINE_DATA_MAX) {
+        if (length > inode->i_size) {
+            inode->i_size = length;
+            update_mtime(inode_no);
+            update_ctime(inode_no);
+        }
+        icache_unlock(inode_no);
+        icache_put(inode_no);
+        return 0;
+    }
+    if (has_inline_data(inode) && inline_to_blocks(inode, inode_no) != 0) {
+        icache_unlock(inode_no);
+        icache_put(inode_no);
+        return -1;
     }
     
+    int result = 0;
+    if (length > inode->i_size) {
+        result = clear_beyond_eof(inode, inode_no, inode->i_size);
+    }
+    // 压缩文件的块在写入时按簇分配，预分配只扩展长度
+    if (result == 0 && !has_compressed_data(inode)) {
+        result = allocate_range(inode, inode_no, nblocks, 1);
+    }
+    if (result == 0 && length > inode->i_size) {
+        inode->i_size = length;
+        icache_mark_dirty(inode_no);
+    }
     update_mtime(inode_no);
     update_ctime(inode_no);
     
-    return bytes_written;
+    icache_unlock(inode_no);
+    icache_put(inode_no);
+    return result;
 }
 
-int truncate_inode(uint32_t inode_no, off_t length) {
-    ext2_inode_t inode;
-    if (read_inode(inode_no, &inode) != 0) {
+/*为马上要从头顺序写满的文件预留数据块：和 preallocate_inode 一样按连续区段分配，
+但新块不清零，文件长度也不变（长度之外的块读不到），省掉一遍写零。
+没有写满时用 truncate_inode 截到实际长度释放多余的块。内联文件和不超过内联上限的长度不需要预留。*/
+int reserve_inode_blocks(uint32_t inode_no, off_t length) {
+    ext2_inode_t *inode = icache_get(inode_no);
+    if (inode == NULL) {
         return -1;
     }
     
-    if (length >= inode.i_size) {
-        return 0; // 不需要截断
+    // 与 preallocate_inode 相同，先按64位检查长度，再换算成块数
+    if (length < 0 || (uint64_t)length > (uint64_t)inode_max_blocks() * BLOCK_SIZE) {
+        icache_put(inode_no);
+        return length < 0 ? -1 : -EFBIG;
+    }
+    uint32_t nblocks = (length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if ((length <= (off_t)EXT2_INLINE_DATA_MAX && inline_allowed(inode)) || has_compressed_data(inode)) {
+        icache_put(inode_no);
+        return 0; // 压缩文件写入时才知道要多少块
+    }
+    
+    icache_lock_exclusive(inode_no);
+    int result = -1;
+    if (!has_inline_data(inode) || inline_to_blocks(inode, inode_no) == 0) {
+        result = allocate_range(inode, inode_no, nblocks, 0);
+    }
+    icache_unlock(inode_no);
+    icache_put(inode_no);
+    return result;
+}
+
+int truncate_inode(uint32_t inode_no, off_t length) {
+    ext2_inode_t *inode = icache_get(inode_no);
+    if (inode == NULL) {
+        return -1;
     }
     
-    uint32_t new_blocks = (length + BLOCK_SIZE - 1) / BLOCK_SIZE;
-    uint32_t old_blocks = (inode.i_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    if (length < 0 || (uint64_t)length > (uint64_t)inode_max_blocks() * BLOCK_SIZE) {
+        icache_put(inode_no);
+        return -1; // 超过最大文件大小
+    }
     
-    // 释放多余的块
-    for (uint32_t i = new_blocks; i < old_blocks; i++) {
-        uint32_t block_no;
-        if (get_inode_block(inode_no, i, &block_no) == 0 && block_no != 0) {
-            free_block(block_no);
-            set_inode_block(inode_no, i, 0);
+    icache_lock_exclusive(inode_no);
+    if (length > inode->i_size) {
+        // 加长：增加的部分是空洞，不分配块（内联文件超过上限时先迁移到数据块）
+        int result = 0;
+        if (has_inline_data(inode) && length > (off_t)EXT2_INLINE_DATA_MAX) {
+            result = inline_to_blocks(inode, inode_no);
+        }
+        if (result == 0) {
+            result = clear_beyond_eof(inode, inode_no, inode->i_size);
+        }
+        if (result == 0) {
+            inode->i_size = length;
+            update_mtime(inode_no);
+            update_ctime(inode_no);
+        }
+        icache_unlock(inode_no);
+        icache_put(inode_no);
+        return result;
+    }
+    if (length == inode->i_size) {
+        // 长度不变时只释放长度之外预留而没写到的块
+        uint32_t new_blocks = has_compressed_data(inode) ? cluster_end_block(length) :
+                              (length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        uint32_t beyond = 0;
+        if (!has_inline_data(inode) && new_blocks < inode_max_blocks() &&
+            map_inode_blocks(inode_no, new_blocks, 1, &beyond) == 0 && beyond != 0) {
+            free_blocks_from(inode, inode_no, new_blocks);
         }
+        icache_unlock(inode_no);
+        icache_put(inode_no);
+        return 0;
     }
     
-    inode.i_size = length;
-    inode.i_blocks = new_blocks;
+    /*内联文件清零截掉的部分（以后扩展时读到的是零）；
+    截断到内联上限以内的文件把保留的内容搬回inode，数据块全部释放。*/
+    if (has_inline_data(inode)) {
+        memset((uint8_t*)inode->i_block + length, 0, inode->i_size - length);
+    } else if (!inline_allowed(inode) || length > (off_t)EXT2_INLINE_DATA_MAX ||
+               blocks_to_inline(inode, inode_no, length) != 0) {
+        uint32_t new_blocks = (length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        if (has_compressed_data(inode)) {
+            if (truncate_clusters(inode, inode_no, length) != 0) {
+                icache_unlock(inode_no);
+                icache_put(inode_no);
+                return -1;
+            }
+        } else {
+            // 释放多余的块：间接块子树整棵释放，每个间接块只读写一次
+            free_blocks_from(inode, inode_no, new_blocks);
+        }
+    }
+    inode->i_size = length;
     
     update_mtime(inode_no);
     update_ctime(inode_no);
     
-    return write_inode(inode_no, &inode);
+    icache_unlock(inode_no);
+    icache_put(inode_no);
+    return 0;
 }
 
-// 权限检查
-int check_permission(uint32_t inode_no, int access) {
-    ext2_inode_t inode;
-    if (read_inode(inode_no, &inode) != 0) {
-        return 0;
+/*打洞：把 [offset, offset + length) 变成空洞，文件长度不变。整块落在区间内的数据块释放，
+因此变空的间接块一并回收；首尾不足一块的部分在原块中清零。超出文件末尾的部分忽略，
+区间一直到文件末尾时最后一个不满的块也整块释放。返回释放的数据块数，失败返回-1。*/
+int punch_inode(uint32_t inode_no, off_t offset, off_t length) {
+    ext2_inode_t *inode = icache_get(inode_no);
+    if (inode == NULL) {
+        return -1;
+    }
+    if (offset < 0 || length < 0) {
+        icache_put(inode_no);
+        return -1;
+    }
+    
+    icache_lock_exclusive(inode_no);
+    off_t end = length > inode->i_size - offset ? inode->i_size : offset + length;
+    int result = 0;
+    if (offset < end && has_inline_data(inode)) {
+        memset((uint8_t*)inode->i_block + offset, 0, end - offset);
+    } else if (offset < end && has_compressed_data(inode)) {
+        result = punch_clusters(inode, inode_no, offset, end);
+    } else if (offset < end) {
+        uint64_t first_full = (offset + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        uint64_t last_full = end == inode->i_size ? (end + BLOCK_SIZE - 1) / BLOCK_SIZE : end / BLOCK_SIZE;
+        
+        // 首尾不完整的块：只清零区间内的部分
+        if (offset % BLOCK_SIZE != 0) {
+            off_t head_end = (off_t)first_full * BLOCK_SIZE;
+            result = zero_in_block(inode, inode_no, offset, head_end < end ? head_end : end);
+        }
+        off_t tail_start = (off_t)last_full * BLOCK_SIZE;
+        if (result == 0 && tail_start < end && tail_start >= offset && last_full >= first_full) {
+            result = zero_in_block(inode, inode_no, tail_start, end);
+        }
+        
+        if (result == 0 && first_full < last_full) {
+            result = free_block_range(inode, inode_no, first_full, last_full);
+        }
+    }
+    if (result >= 0 && offset < end) {
+        update_mtime(inode_no);
+        update_ctime(inode_no);
+    }
+    
+    icache_unlock(inode_no);
+    icache_put(inode_no);
+    return result;
+}
+
+// 镜像中第一次出现压缩文件时设置不兼容特性，不认识压缩簇的版本拒绝挂载
+static void enable_compression_feature(void) {
+    if ((fs.superblock.s_feature_incompat & EXT2_FEATURE_INCOMPAT_COMPRESSION) == 0) {
+        fs.superblock.s_feature_incompat |= EXT2_FEATURE_INCOMPAT_COMPRESSION;
+        mark_superblock_dirty();
+    }
+}
+
+/*普通文件逐簇改写成新的存放方式。打开压缩时先设标志：中途空间不足时还没改写的簇原样存放，仍然可读；
+关闭时全部改写完才清标志。内联文件不用改写，之后超过内联上限时按标志存放。*/
+int set_inode_compression(uint32_t inode_no, int enable) {
+    ext2_inode_t *inode = icache_get(inode_no);
+    if (inode == NULL) {
+        return -1;
+    }
+    
+    icache_lock_exclusive(inode_no);
+    uint16_t type = inode->i_mode & 0xF000;
+    int result = 0;
+    if (type != EXT2_S_IFREG && type != EXT2_S_IFDIR) {
+        result = -1;
+    } else if (enable != ((inode->i_flags & EXT2_COMPR_FL) != 0)) {
+        if (enable) {
+            enable_compression_feature();
+            inode->i_flags |= EXT2_COMPR_FL;
+        }
+        if (type == EXT2_S_IFREG && !has_inline_data(inode)) {
+            uint8_t data[EXT2_CLUSTER_SIZE];
+            uint32_t clusters = cluster_end_block(inode->i_size) / CLUSTER_BLOCKS;
+            // 长度之外预留而没写到的块先释放
+            free_blocks_from(inode, inode_no, clusters * CLUSTER_BLOCKS);
+            for (uint32_t c = 0; c < clusters && result == 0; c++) {
+                uint32_t length = cluster_length(inode->i_size, c);
+                result = load_cluster(inode_no, c, !enable, data);
+                if (result == 0) {
+                    memset(data + length, 0, EXT2_CLUSTER_SIZE - length); // 末尾之后可能有截断留下的旧内容
+                    result = store_cluster(inode, inode_no, c, data, length, enable);
+                }
+            }
+        }
+        if (!enable && result == 0) {
+            inode->i_flags &= ~EXT2_COMPR_FL;
+        }
+        update_ctime(inode_no);
+        icache_mark_dirty(inode_no);
     }
     
-    uint16_t uid = get_current_uid();
-    uint16_t gid = get_current_gid();
+    icache_unlock(inode_no);
+    icache_put(inode_no);
+    return result;
+}
+
+/*碎片统计：对所有正在使用的普通文件，统计数据块被分成了多少段物理上连续的区段。
+每个文件理想情况是一个区段。*/
+void compute_fragmentation(frag_stats_t *stats) {
+    memset(stats, 0, sizeof(frag_stats_t));
+    if (inode_bitmap == NULL) {
+        return; // 尚未挂载
+    }
     
-    uint16_t mode = 0;
-    if (uid == inode.i_uid) {
-        mode = (inode.i_mode >> 6) & 0x7;
-    } else if (gid == inode.i_gid) {
-        mode = (inode.i_mode >> 3) & 0x7;
-    } else {
-        mode = inode.i_mode & 0x7;
+    for (uint32_t inode_no = 1; inode_no < MAX_INODES; inode_no++) {
+        if (!inode_is_allocated(inode_no) || !is_regular_file(inode_no)) {
+            continue;
+        }
+        
+        // 内联文件没有数据块，单独计数
+        ext2_inode_t *inode = icache_get(inode_no);
+        if (inode == NULL) {
+            continue;
+        }
+        int inline_data = has_inline_data(inode);
+        int compressed = has_compressed_data(inode);
+        uint32_t blocks = inode->i_blocks;
+        uint32_t size = inode->i_size;
+        icache_put(inode_no);
+        if (inline_data) {
+            stats->inline_files++;
+            continue;
+        }
+        // 压缩簇中的空洞是压缩省下的块，不算稀疏文件和碎片
+        if (compressed) {
+            stats->compressed_files++;
+            stats->compressed_blocks += blocks;
+            stats->compressed_bytes += size;
+            continue;
+        }
+        
+        uint32_t nblocks = (get_file_size(inode_no) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        if (nblocks > inode_max_blocks()) {
+            nblocks = inode_max_blocks();
+        }
+        if (nblocks == 0) {
+            continue;
+        }
+        
+        uint32_t fragments = 0;
+        uint32_t holes = 0;
+        uint32_t next_physical = 0;
+        uint32_t index = 0;
+        icache_lock_shared(inode_no);
+        while (index < nblocks) {
+            inode_extent_t extents[16];
+            int n = map_inode_extents(inode_no, index, nblocks - index, extents, 16);
+            if (n <= 0) {
+                break;
+            }
+            for (int i = 0; i < n; i++) {
+                if (extents[i].physical != 0) {
+                    if (extents[i].physical != next_physical) {
+                        fragments++;
+                    }
+                    stats->blocks += extents[i].count;
+                    next_physical = extents[i].physical + extents[i].count;
+                } else {
+                    holes += extents[i].count;
+                }
+                index = extents[i].logical + extents[i].count;
+            }
+        }
+        icache_unlock(inode_no);
+        
+        stats->files++;
+        stats->fragments += fragments;
+        if (holes > 0) {
+            stats->sparse_files++;
+            stats->hole_blocks += holes;
+        }
+        if (fragments > 1) {
+            stats->fragmented_files++;
+        }
+    }
+}
+
+/*权限检查：只查一次inode缓存，在缓存的inode上同时检查类型和访问权限。
+type 为 EXT2_S_IFDIR 或 EXT2_S_IFREG 时要求对应的文件类型，0 表示不限。*/
+int check_access(uint32_t inode_no, uint16_t type, int access) {
+    ext2_inode_t *inode = icache_get(inode_no);
+    if (inode == NULL) {
+        return -ENOENT;
     }
     
-    return (mode & access) == access;
+    int result = 0;
+    if (type != 0 && (inode->i_mode & 0xF000) != type) {
+        result = type == EXT2_S_IFDIR ? -ENOTDIR : -EISDIR;
+    } else if (!inode_permits(inode, access)) {
+        result = -EACCES;
+    }
+    icache_put(inode_no);
+    return result;
+}
+
+int check_permission(uint32_t inode_no, int access) {
+    return check_access(inode_no, 0, access) == 0;
 }
 
 int change_permission(uint32_t inode_no, uint16_t mode) {
-    ext2_inode_t inode;
-    if (read_inode(inode_no, &inode) != 0) {
+    ext2_inode_t *inode = icache_get(inode_no);
+    if (inode == NULL) {
         return -1;
     }
     
-    inode.i_mode = (inode.i_mode & 0xF000) | (mode & 0x0FFF);
+    icache_lock_exclusive(inode_no);
+    inode->i_mode = (inode->i_mode & 0xF000) | (mode & 0x0FFF);
     update_ctime(inode_no);
+    icache_unlock(inode_no);
     
-    return write_inode(inode_no, &inode);
+    icache_put(inode_no);
+    return 0;
 }
 
 int change_owner(uint32_t inode_no, uint16_t uid, uint16_t gid) {
-    ext2_inode_t inode;
-    if (read_inode(inode_no, &inode) != 0) {
+    ext2_inode_t *inode = icache_get(inode_no);
+    if (inode == NULL) {
         return -1;
     }
     
-    inode.i_uid = uid;
-    inode.i_gid = gid;
+    icache_lock_exclusive(inode_no);
+    inode->i_uid = uid;
+    inode->i_gid = gid;
     update_ctime(inode_no);
+    icache_unlock(inode_no);
     
-    return write_inode(inode_no, &inode);
+    icache_put(inode_no);
+    return 0;
 }
 
-// 时间戳更新
+// 时间戳更新（只写内存副本，调用者持有inode写锁）
 void update_atime(uint32_t inode_no) {
-    ext2_inode_t inode;
-    if (read_inode(inode_no, &inode) == 0) {
-        inode.i_atime = time(NULL);
-        write_inode(inode_no, &inode);
+    ext2_inode_t *inode = icache_get(inode_no);
+    if (inode != NULL) {
+        inode->i_atime = time(NULL);
+        icache_mark_dirty(inode_no);
+        icache_put(inode_no);
     }
 }
 
 void update_mtime(uint32_t inode_no) {
-    ext2_inode_t inode;
-    if (read_inode(inode_no, &inode) == 0) {
-        inode.i_mtime = time(NULL);
-        write_inode(inode_no, &inode);
+    ext2_inode_t *inode = icache_get(inode_no);
+    if (inode != NULL) {
+        inode->i_mtime = time(NULL);
+        icache_mark_dirty(inode_no);
+        icache_put(inode_no);
     }
 }
 
 void update_ctime(uint32_t inode_no) {
-    ext2_inode_t inode;
-    if (read_inode(inode_no, &inode) == 0) {
-        inode.i_ctime = time(NULL);
-        write_inode(inode_no, &inode);
+    ext2_inode_t *inode = icache_get(inode_no);
+    if (inode != NULL) {
+        inode->i_ctime = time(NULL);
+        icache_mark_dirty(inode_no);
+        icache_put(inode_no);
     }
 }
 
 // 链接计数
 int increment_link_count(uint32_t inode_no) {
-    ext2_inode_t inode;
-    if (read_inode(inode_no, &inode) != 0) {
+    ext2_inode_t *inode = icache_get(inode_no);
+    if (inode == NULL) {
         return -1;
     }
     
-    inode.i_links_count++;
+    icache_lock_exclusive(inode_no);
+    inode->i_links_count++;
     update_ctime(inode_no);
+    icache_unlock(inode_no);
     
-    return write_inode(inode_no, &inode);
+    icache_put(inode_no);
+    return 0;
 }
 
 int decrement_link_count(uint32_t inode_no) {
-    ext2_inode_t inode;
-    if (read_inode(inode_no, &inode) != 0) {
+    ext2_inode_t *inode = icache_get(inode_no);
+    if (inode == NULL) {
         return -1;
     }
     
-    if (inode.i_links_count > 0) {
-        inode.i_links_count--;
+    icache_lock_exclusive(inode_no);
+    if (inode->i_links_count > 0) {
+        inode->i_links_count--;
     }
     update_ctime(inode_no);
+    icache_unlock(inode_no);
+    
+    icache_put(inode_no);
+    return 0;
+}
+
+// fsck 按实际的目录项数修正链接计数
+int set_link_count(uint32_t inode_no, uint16_t count) {
+    ext2_inode_t *inode = icache_get(inode_no);
+    if (inode == NULL) {
+        return -1;
+    }
+    
+    icache_lock_exclusive(inode_no);
+    inode->i_links_count = count;
+    update_ctime(inode_no);
+    icache_unlock(inode_no);
     
-    return write_inode(inode_no, &inode);
+    icache_put(inode_no);
+    return 0;
 }
 
-// 工具函数
+// 工具函数（只读一个字段，不加inode锁）
 int is_directory(uint32_t inode_no) {
-    ext2_inode_t inode;
-    if (read_inode(inode_no, &inode) != 0) {
+    ext2_inode_t *inode = icache_get(inode_no);
+    if (inode == NULL) {
         return 0;
     }
-    return (inode.i_mode & 0xF000) == EXT2_S_IFDIR;
+    int result = (inode->i_mode & 0xF000) == EXT2_S_IFDIR;
+    icache_put(inode_no);
+    return result;
 }
 
 int is_regular_file(uint32_t inode_no) {
-    ext2_inode_t inode;
-    if (read_inode(inode_no, &inode) != 0) {
+    ext2_inode_t *inode = icache_get(inode_no);
+    if (inode == NULL) {
+        return 0;
+    }
+    int result = (inode->i_mode & 0xF000) == EXT2_S_IFREG;
+    icache_put(inode_no);
+    return result;
+}
+
+int is_symlink(uint32_t inode_no) {
+    ext2_inode_t *inode = icache_get(inode_no);
+    if (inode == NULL) {
+        return 0;
+    }
+    int result = (inode->i_mode & 0xF000) == EXT2_S_IFLNK;
+    icache_put(inode_no);
+    return result;
+}
+
+// 读符号链接的目标（以 '\0' 结尾），返回目标长度；不是符号链接或目标放不下时返回-1
+int read_symlink(uint32_t inode_no, char *target, size_t size) {
+    if (!is_symlink(inode_no) || get_file_size(inode_no) >= size) {
+        return -1;
+    }
+    ssize_t len = read_inode_data(inode_no, target, size - 1, 0);
+    if (len < 0) {
+        return -1;
+    }
+    target[len] = '\0';
+    return (int)len;
+}
+
+uint16_t get_link_count(uint32_t inode_no) {
+    ext2_inode_t *inode = icache_get(inode_no);
+    if (inode == NULL) {
         return 0;
     }
-    return (inode.i_mode & 0xF000) == EXT2_S_IFREG;
+    uint16_t count = inode->i_links_count;
+    icache_put(inode_no);
+    return count;
 }
 
 uint32_t get_file_size(uint32_t inode_no) {
-    ext2_inode_t inode;
-    if (read_inode(inode_no, &inode) != 0) {
+    ext2_inode_t *inode = icache_get(inode_no);
+    if (inode == NULL) {
         return 0;
     }
-    return inode.i_size;
-} 
\ No newline at end of file
+    uint32_t size = inode->i_size;
+    icache_put(inode_no);
+    return size;
+}
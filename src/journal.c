@@ -0,0 +1,731 @@
+#include "../include/journal.h"
+#include "../include/disk.h"
+#include "../include/cache.h"
+#include "../include/icache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/*元数据日志（只记录元数据，数据块仍直接写盘，相当于 ext3 的 ordered 模式）。
+
+日志区是格式化时分配的一段连续块，第一个块是日志超级块，之后顺序追加事务：
+  描述块（块号列表和撤销块号）+ 各块的副本 …… + 提交块（CRC32 校验）
+一个事务包含两次提交之间所有操作弄脏的元数据块（位图、组描述符、超级块、inode表、
+目录块等都经过块缓存）。所有块和提交块一次写入，然后只同步一次；
+提交块和前面的块一起落盘，靠校验和识别写了一半的事务。
+
+提交之后块仍是缓存中的脏块，被淘汰时原地写回（惰性检查点）；日志剩余空间
+不够再放一个最大的事务时做检查点：脏块全部原地写回并同步，然后清空日志。
+挂载时重放日志中校验通过的事务，被后来的事务撤销的块不重放。
+
+组提交：操作在 journal_op_begin/journal_op_end 之间持有事务锁的读锁，
+提交时取写锁，等正在进行的操作结束；同时结束操作的多个线程中只有第一个真正提交，
+其余线程发现自己的事务已经提交就直接返回。*/
+
+#define JOURNAL_MAGIC 0x4C4E524Au   // "JRNL"
+
+enum {
+    JOURNAL_SUPER = 1,
+    JOURNAL_DESCRIPTOR = 2,
+    JOURNAL_COMMIT = 3
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t type;
+    uint64_t sequence;     // 所属事务的序号
+} journal_header_t;
+
+// 日志区第一个块
+typedef struct {
+    journal_header_t header;   // sequence 为日志中第一个事务的序号
+    uint32_t uuid[4];          // 与超级块 s_journal_uuid 相同
+    uint32_t blocks;           // 日志区块数
+    uint32_t start;            // 第一个事务在日志区内的位置，0 表示日志为空
+} journal_super_t;
+
+// 描述块：后面紧跟 count 个块的副本；tags 中先是这些块的块号，再是 revokes 个撤销的块号
+typedef struct {
+    journal_header_t header;
+    uint32_t count;
+    uint32_t revokes;
+    uint32_t tags[];
+} journal_descriptor_t;
+
+typedef struct {
+    journal_header_t header;
+    uint32_t checksum;         // 本事务所有描述块和块副本的 CRC32
+    uint32_t blocks;           // 本事务占用的日志块数（含提交块）
+} journal_commit_t;
+
+static struct {
+    int active;
+    uint32_t first;            // 日志超级块的块号
+    uint32_t blocks;
+    uint32_t uuid[4];
+    uint32_t head;             // 下一个事务写入的位置（日志区内的序号）
+    int empty;                 // 日志中没有未检查点的事务
+    uint64_t sequence;         // 下一个写进日志的事务序号（没有修改的提交不占序号）
+    uint64_t running;          // 正在进行的事务（操作括号用来判断是否已被别的线程提交）
+    uint64_t committed;        // 最近提交完成的事务
+    uint32_t *live;            // 日志中有副本的块（块号+1，0 为空槽），用于判断是否需要撤销
+    uint32_t live_capacity;
+    uint32_t live_count;
+    uint32_t *revokes;         // 本事务撤销的块
+    uint32_t revoke_count;
+    uint32_t revoke_capacity;
+} jnl;
+
+static journal_stats_t stats;
+
+static pthread_rwlock_t txn_lock;
+static pthread_once_t txn_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t commit_lock = PTHREAD_MUTEX_INITIALIZER;   // 一次只有一个线程提交
+static pthread_mutex_t revoke_lock = PTHREAD_MUTEX_INITIALIZER;   // 保护 live 和 revokes
+
+static __thread int in_op = 0;
+static __thread int sync_wanted = 0;
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+// 写者优先：持续不断的操作不会让提交一直等下去
+static void init_txn_lock(void) {
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&txn_lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+}
+
+static void init_crc(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        crc_table[i] = c;
+    }
+}
+
+static uint32_t crc32_update(uint32_t crc, const void *data, size_t size) {
+    const uint8_t *p = data;
+    pthread_once(&crc_once, init_crc);
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) {
+        crc = crc_table[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+// 一个描述块能放的块号个数
+static uint32_t tags_per_block(void) {
+    return (BLOCK_SIZE - sizeof(journal_descriptor_t)) / sizeof(uint32_t);
+}
+
+// 事务最多占用的日志块数：缓存中全部是未提交的脏块，并撤销日志中所有的块
+static uint32_t max_transaction(void) {
+    uint32_t entries = BCACHE_BUFFERS + jnl.live_count;
+    return (entries + tags_per_block() - 1) / tags_per_block() + BCACHE_BUFFERS + 1;
+}
+
+static void fill_super(uint8_t *block, uint32_t start, uint64_t sequence) {
+    memset(block, 0, BLOCK_SIZE);
+    journal_super_t *js = (journal_super_t*)block;
+    js->header.magic = JOURNAL_MAGIC;
+    js->header.type = JOURNAL_SUPER;
+    js->header.sequence = sequence;
+    memcpy(js->uuid, jnl.uuid, sizeof(js->uuid));
+    js->blocks = jnl.blocks;
+    js->start = start;
+}
+
+static int write_super(uint32_t start, uint64_t sequence) {
+    uint8_t block[EXT2_MAX_BLOCK_SIZE];
+    fill_super(block, start, sequence);
+    return disk_write_block(jnl.first, block);
+}
+
+// 日志超级块有效时读入 js 并返回0
+static int read_super(const ext2_superblock_t *sb, journal_super_t *js) {
+    uint8_t block[EXT2_MAX_BLOCK_SIZE];
+    if (disk_read_block(sb->s_journal_block, block) != 0) {
+        return -1;
+    }
+    memcpy(js, block, sizeof(*js));
+    if (js->header.magic != JOURNAL_MAGIC || js->header.type != JOURNAL_SUPER ||
+        memcmp(js->uuid, sb->s_journal_uuid, sizeof(js->uuid)) != 0 ||
+        js->blocks != sb->s_journal_blocks || js->start >= js->blocks) {
+        return -1;
+    }
+    return 0;
+}
+
+// 日志区的位置是否合理
+static int valid_area(const ext2_superblock_t *sb) {
+    return sb->s_journal_blocks >= JOURNAL_MIN_BLOCKS && sb->s_journal_blocks <= JOURNAL_MAX_BLOCKS &&
+           sb->s_journal_block > 0 && sb->s_journal_block + sb->s_journal_blocks <= MAX_BLOCKS;
+}
+
+static uint32_t live_slot(uint32_t block_no) {
+    return (block_no * 2654435761u) & (jnl.live_capacity - 1);
+}
+
+static int live_contains(uint32_t block_no) {
+    for (uint32_t i = live_slot(block_no); jnl.live[i] != 0; i = (i + 1) & (jnl.live_capacity - 1)) {
+        if (jnl.live[i] == block_no + 1) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// 容量是日志块数的两倍以上，检查点之前记录的块不会超过日志块数，不会装满
+static void live_insert(uint32_t block_no) {
+    uint32_t i = live_slot(block_no);
+    while (jnl.live[i] != 0) {
+        if (jnl.live[i] == block_no + 1) {
+            return;
+        }
+        i = (i + 1) & (jnl.live_capacity - 1);
+    }
+    jnl.live[i] = block_no + 1;
+    jnl.live_count++;
+}
+
+static void live_clear(void) {
+    memset(jnl.live, 0, jnl.live_capacity * sizeof(uint32_t));
+    jnl.live_count = 0;
+}
+
+int journal_create(void) {
+    if (MAX_BLOCKS < JOURNAL_MIN_FS_BLOCKS) {
+        return 0;
+    }
+    uint32_t want = MAX_BLOCKS / 32;
+    if (want < JOURNAL_MIN_BLOCKS) {
+        want = JOURNAL_MIN_BLOCKS;
+    }
+    if (want > JOURNAL_MAX_BLOCKS) {
+        want = JOURNAL_MAX_BLOCKS;
+    }
+
+    // 和 ext3 一样把日志放在镜像中部，离两端的元数据都不太远
+    uint32_t got = 0;
+    uint32_t first = allocate_block_run(0, MAX_BLOCKS / 2, want, &got);
+    if (first == 0 || got < JOURNAL_MIN_BLOCKS) {
+        for (uint32_t i = 0; i < got; i++) {
+            free_block(first + i);
+        }
+        return 0;
+    }
+
+    memcpy(fs.superblock.s_journal_uuid, fs.superblock.s_uuid, sizeof(fs.superblock.s_journal_uuid));
+    fs.superblock.s_journal_block = first;
+    fs.superblock.s_journal_blocks = got;
+    mark_superblock_dirty();
+
+    jnl.first = first;
+    jnl.blocks = got;
+    memcpy(jnl.uuid, fs.superblock.s_journal_uuid, sizeof(jnl.uuid));
+    return write_super(0, 1);
+}
+
+typedef struct {
+    uint32_t block_no;
+    uint64_t sequence;
+} revoke_rec_t;
+
+static int compare_revoke(const void *a, const void *b) {
+    uint32_t x = ((const revoke_rec_t*)a)->block_no;
+    uint32_t y = ((const revoke_rec_t*)b)->block_no;
+    return (x > y) - (x < y);
+}
+
+// 块是否被序号大于 sequence 的事务撤销（recs 已按块号排序，同一块只保留最大序号）
+static int revoked_after(const revoke_rec_t *recs, uint32_t count, uint32_t block_no, uint64_t sequence) {
+    revoke_rec_t key = { block_no, 0 };
+    const revoke_rec_t *r = bsearch(&key, recs, count, sizeof(revoke_rec_t), compare_revoke);
+    return r != NULL && r->sequence > sequence;
+}
+
+/*从 pos 开始扫描一个序号为 sequence 的事务，校验通过返回它占用的块数，否则返回0。
+revokes 不为 NULL 时把撤销记录追加进去。*/
+static uint32_t scan_transaction(uint32_t pos, uint64_t sequence, revoke_rec_t **revokes,
+                                 uint32_t *revoke_count, uint32_t *revoke_capacity) {
+    uint8_t block[EXT2_MAX_BLOCK_SIZE];
+    uint32_t crc = 0;
+    uint32_t start = pos;
+    uint32_t added = 0;
+
+    while (pos < jnl.blocks) {
+        if (disk_read_block(jnl.first + pos, block) != 0) {
+            break;
+        }
+        journal_header_t *h = (journal_header_t*)block;
+        if (h->magic != JOURNAL_MAGIC || h->sequence != sequence) {
+            break;
+        }
+
+        if (h->type == JOURNAL_COMMIT) {
+            journal_commit_t *c = (journal_commit_t*)block;
+            if (c->checksum != crc || c->blocks != pos + 1 - start) {
+                break;
+            }
+            return pos + 1 - start;
+        }
+        if (h->type != JOURNAL_DESCRIPTOR) {
+            break;
+        }
+
+        journal_descriptor_t *d = (journal_descriptor_t*)block;
+        if (d->count + d->revokes > tags_per_block() || pos + 1 + d->count >= jnl.blocks) {
+            break;
+        }
+        crc = crc32_update(crc, block, BLOCK_SIZE);
+        for (uint32_t i = 0; i < d->revokes; i++) {
+            if (*revoke_count == *revoke_capacity) {
+                uint32_t capacity = *revoke_capacity ? *revoke_capacity * 2 : 64;
+                revoke_rec_t *grown = realloc(*revokes, capacity * sizeof(revoke_rec_t));
+                if (grown == NULL) {
+                    return 0;
+                }
+                *revokes = grown;
+                *revoke_capacity = capacity;
+            }
+            (*revokes)[*revoke_count].block_no = d->tags[d->count + i];
+            (*revokes)[*revoke_count].sequence = sequence;
+            (*revoke_count)++;
+            added++;
+        }
+
+        uint32_t count = d->count;
+        uint8_t data[EXT2_MAX_BLOCK_SIZE];
+        for (uint32_t i = 0; i < count; i++) {
+            if (disk_read_block(jnl.first + pos + 1 + i, data) != 0) {
+                *revoke_count -= added;
+                return 0;
+            }
+            crc = crc32_update(crc, data, BLOCK_SIZE);
+        }
+        pos += 1 + count;
+    }
+
+    *revoke_count -= added;
+    return 0;
+}
+
+// 把事务中没有被后来撤销的块写回原位置
+static int replay_transaction(uint32_t pos, uint64_t sequence, const revoke_rec_t *revokes, uint32_t revoke_count) {
+    uint8_t block[EXT2_MAX_BLOCK_SIZE];
+    uint8_t data[EXT2_MAX_BLOCK_SIZE];
+
+    for (;;) {
+        if (disk_read_block(jnl.first + pos, block) != 0) {
+            return -1;
+        }
+        journal_header_t *h = (journal_header_t*)block;
+        if (h->type == JOURNAL_COMMIT) {
+            return 0;
+        }
+        journal_descriptor_t *d = (journal_descriptor_t*)block;
+        for (uint32_t i = 0; i < d->count; i++) {
+            uint32_t target = d->tags[i];
+            if (target >= MAX_BLOCKS || revoked_after(revokes, revoke_count, target, sequence)) {
+                continue;
+            }
+            if (disk_read_block(jnl.first + pos + 1 + i, data) != 0 || disk_write_block(target, data) != 0) {
+                return -1;
+            }
+        }
+        pos += 1 + d->count;
+    }
+}
+
+int journal_recover(const ext2_superblock_t *sb) {
+    if (sb->s_journal_block == 0) {
+        return 0;
+    }
+    journal_super_t js;
+    if (!valid_area(sb) || read_super(sb, &js) != 0) {
+        printf("Error: Journal superblock is corrupt\n");
+        return -1;
+    }
+    jnl.first = sb->s_journal_block;
+    jnl.blocks = sb->s_journal_blocks;
+    memcpy(jnl.uuid, sb->s_journal_uuid, sizeof(jnl.uuid));
+    if (js.start == 0) {
+        return 0;
+    }
+
+    // 第一遍：找出校验通过的事务，收集撤销记录
+    uint32_t starts_capacity = 16;
+    uint32_t *starts = malloc(starts_capacity * sizeof(uint32_t));
+    revoke_rec_t *revokes = NULL;
+    uint32_t revoke_count = 0;
+    uint32_t revoke_capacity = 0;
+    uint32_t ntxn = 0;
+    uint32_t pos = js.start;
+    uint64_t sequence = js.header.sequence;
+
+    while (starts != NULL) {
+        uint32_t used = scan_transaction(pos, sequence + ntxn, &revokes, &revoke_count, &revoke_capacity);
+        if (used == 0) {
+            break;
+        }
+        if (ntxn == starts_capacity) {
+            uint32_t *grown = realloc(starts, starts_capacity * 2 * sizeof(uint32_t));
+            if (grown == NULL) {
+                break;
+            }
+            starts = grown;
+            starts_capacity *= 2;
+        }
+        starts[ntxn++] = pos;
+        pos += used;
+    }
+
+    // 同一块只保留最大的撤销序号
+    qsort(revokes, revoke_count, sizeof(revoke_rec_t), compare_revoke);
+    uint32_t unique = 0;
+    for (uint32_t i = 0; i < revoke_count; i++) {
+        if (unique > 0 && revokes[unique - 1].block_no == revokes[i].block_no) {
+            if (revokes[i].sequence > revokes[unique - 1].sequence) {
+                revokes[unique - 1].sequence = revokes[i].sequence;
+            }
+        } else {
+            revokes[unique++] = revokes[i];
+        }
+    }
+
+    // 第二遍：按顺序重放
+    int result = starts == NULL ? -1 : 0;
+    for (uint32_t t = 0; t < ntxn && result == 0; t++) {
+        result = replay_transaction(starts[t], sequence + t, revokes, unique);
+    }
+    free(starts);
+    free(revokes);
+
+    // 重放的内容落盘之后才能清空日志
+    if (result != 0 || disk_sync() != 0 || write_super(0, sequence + ntxn) != 0 || disk_sync() != 0) {
+        printf("Error: Failed to replay journal\n");
+        return -1;
+    }
+    stats.replayed += ntxn;
+    if (ntxn > 0) {
+        ext2_info("Journal: replayed %u transaction(s)\n", ntxn);
+    }
+    return 0;
+}
+
+int journal_open(const ext2_superblock_t *sb) {
+    if (sb->s_journal_block == 0) {
+        return 0;
+    }
+    journal_super_t js;
+    if (!valid_area(sb) || read_super(sb, &js) != 0 || js.start != 0) {
+        return -1;
+    }
+
+    uint32_t capacity = 1;
+    while (capacity < 2 * sb->s_journal_blocks) {
+        capacity *= 2;
+    }
+    uint32_t *live = calloc(capacity, sizeof(uint32_t));
+    if (live == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&commit_lock);
+    jnl.first = sb->s_journal_block;
+    jnl.blocks = sb->s_journal_blocks;
+    memcpy(jnl.uuid, sb->s_journal_uuid, sizeof(jnl.uuid));
+    jnl.head = 1;
+    jnl.empty = 1;
+    jnl.sequence = js.header.sequence;
+    jnl.running = 1;
+    jnl.committed = 0;
+    jnl.live = live;
+    jnl.live_capacity = capacity;
+    jnl.live_count = 0;
+    jnl.revoke_count = 0;
+    uint64_t replayed = stats.replayed;
+    memset(&stats, 0, sizeof(stats));
+    stats.replayed = replayed;
+    stats.blocks = jnl.blocks;
+    bcache_set_journaling(1);
+    jnl.active = 1;
+    pthread_mutex_unlock(&commit_lock);
+    return 0;
+}
+
+int journal_active(void) {
+    return jnl.active;
+}
+
+typedef struct {
+    const uint32_t *revokes;
+    uint32_t revoke_count;
+    uint32_t used;             // 写入的日志块数
+} txn_t;
+
+// bcache_commit 的回调：把一个事务顺序写进日志并同步
+static int log_transaction(const uint32_t *blocks, void *const *bufs, int count, void *arg) {
+    txn_t *t = arg;
+    t->used = 0;
+    if (count == 0 && t->revoke_count == 0) {
+        return 0;
+    }
+
+    uint32_t per = tags_per_block();
+    uint32_t entries = (uint32_t)count + t->revoke_count;
+    uint32_t ndesc = (entries + per - 1) / per;
+    uint32_t total = ndesc + (uint32_t)count + 1;
+    if (jnl.head + total > jnl.blocks) {
+        return -1;   // 提交后总会留出一个最大事务的空间，不应该发生
+    }
+
+    // 描述块、提交块和日志超级块各占一个块
+    uint8_t *meta = calloc(ndesc + 2, BLOCK_SIZE);
+    uint32_t *jblocks = malloc((total + 1) * sizeof(uint32_t));
+    void **jbufs = malloc((total + 1) * sizeof(void*));
+    if (meta == NULL || jblocks == NULL || jbufs == NULL) {
+        free(meta);
+        free(jblocks);
+        free(jbufs);
+        return -1;
+    }
+
+    uint32_t n = 0;
+    if (jnl.empty) {
+        uint8_t *super = meta + (size_t)(ndesc + 1) * BLOCK_SIZE;
+        fill_super(super, jnl.head, jnl.sequence);
+        jblocks[n] = jnl.first;
+        jbufs[n++] = super;
+    }
+
+    uint32_t crc = 0;
+    uint32_t pos = jnl.head;
+    uint32_t next = 0;   // 下一个要放进描述块的条目：先是块，再是撤销
+    for (uint32_t k = 0; k < ndesc; k++) {
+        journal_descriptor_t *d = (journal_descriptor_t*)(meta + (size_t)k * BLOCK_SIZE);
+        d->header.magic = JOURNAL_MAGIC;
+        d->header.type = JOURNAL_DESCRIPTOR;
+        d->header.sequence = jnl.sequence;
+        uint32_t first_block = next < (uint32_t)count ? next : (uint32_t)count;
+        while (next < entries && d->count + d->revokes < per) {
+            if (next < (uint32_t)count) {
+                d->tags[d->count++] = blocks[next];
+            } else {
+                d->tags[d->count + d->revokes++] = t->revokes[next - count];
+            }
+            next++;
+        }
+        crc = crc32_update(crc, d, BLOCK_SIZE);
+        jblocks[n] = jnl.first + pos++;
+        jbufs[n++] = d;
+        for (uint32_t i = 0; i < d->count; i++) {
+            crc = crc32_update(crc, bufs[first_block + i], BLOCK_SIZE);
+            jblocks[n] = jnl.first + pos++;
+            jbufs[n++] = bufs[first_block + i];
+        }
+    }
+
+    journal_commit_t *c = (journal_commit_t*)(meta + (size_t)ndesc * BLOCK_SIZE);
+    c->header.magic = JOURNAL_MAGIC;
+    c->header.type = JOURNAL_COMMIT;
+    c->header.sequence = jnl.sequence;
+    c->checksum = crc;
+    c->blocks = total;
+    jblocks[n] = jnl.first + pos;
+    jbufs[n++] = c;
+
+    // 一次写入整个事务，一次同步
+    int result = disk_write_scattered(jblocks, jbufs, n) == 0 && disk_sync() == 0 ? 0 : -1;
+    free(meta);
+    free(jblocks);
+    free(jbufs);
+    if (result != 0) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&revoke_lock);
+    for (int i = 0; i < count; i++) {
+        live_insert(blocks[i]);
+    }
+    pthread_mutex_unlock(&revoke_lock);
+    t->used = total;
+    return 0;
+}
+
+// 检查点：日志中的修改全部原地写回并同步，然后清空日志
+static int checkpoint_locked(void) {
+    if (jnl.empty) {
+        return 0;
+    }
+    if (bcache_flush() != 0 || disk_sync() != 0) {
+        return -1;
+    }
+    if (write_super(0, jnl.sequence) != 0 || disk_sync() != 0) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&revoke_lock);
+    live_clear();
+    jnl.revoke_count = 0;   // 日志清空后不再有需要撤销的旧副本
+    pthread_mutex_unlock(&revoke_lock);
+    jnl.head = 1;
+    jnl.empty = 1;
+    stats.checkpoints++;
+    stats.used = 0;
+    return 0;
+}
+
+// 提交正在进行的事务（调用者持有 commit_lock，并保证没有操作在进行）
+static int commit_locked(void) {
+    int result = icache_flush();
+    if (flush_metadata() != 0) {
+        result = -1;
+    }
+
+    txn_t t = { NULL, 0, 0 };
+    pthread_mutex_lock(&revoke_lock);
+    t.revokes = jnl.revokes;
+    t.revoke_count = jnl.revoke_count;
+    jnl.revokes = NULL;
+    jnl.revoke_count = 0;
+    jnl.revoke_capacity = 0;
+    pthread_mutex_unlock(&revoke_lock);
+
+    if (bcache_commit(log_transaction, &t) != 0) {
+        // 日志写不进去：退回到直接原地写回，这一批修改不再是原子的
+        result = -1;
+        jnl.empty = 0;
+        checkpoint_locked();
+    } else if (t.used > 0) {
+        jnl.head += t.used;
+        jnl.empty = 0;
+        jnl.sequence++;
+        stats.commits++;
+        stats.used = jnl.head - 1;
+    }
+    free((void*)t.revokes);
+
+    jnl.committed = jnl.running++;
+    if (!jnl.empty && jnl.blocks - jnl.head < max_transaction() && checkpoint_locked() != 0) {
+        result = -1;
+    }
+    return result;
+}
+
+void journal_close(void) {
+    pthread_mutex_lock(&commit_lock);
+    if (jnl.active) {
+        commit_locked();
+        checkpoint_locked();
+        jnl.active = 0;
+        bcache_set_journaling(0);
+        pthread_mutex_lock(&revoke_lock);
+        free(jnl.live);
+        free(jnl.revokes);
+        jnl.live = NULL;
+        jnl.revokes = NULL;
+        jnl.live_capacity = 0;
+        jnl.live_count = 0;
+        jnl.revoke_count = 0;
+        jnl.revoke_capacity = 0;
+        pthread_mutex_unlock(&revoke_lock);
+    }
+    pthread_mutex_unlock(&commit_lock);
+}
+
+int journal_checkpoint(void) {
+    pthread_mutex_lock(&commit_lock);
+    int result = 0;
+    if (jnl.active) {
+        result = commit_locked();
+        if (checkpoint_locked() != 0) {
+            result = -1;
+        }
+    }
+    pthread_mutex_unlock(&commit_lock);
+    return result;
+}
+
+void journal_op_begin(void) {
+    pthread_once(&txn_once, init_txn_lock);
+    pthread_rwlock_rdlock(&txn_lock);
+    in_op = 1;
+    sync_wanted = 0;
+}
+
+uint64_t journal_op_end(int *sync_requested) {
+    // 持有读锁时事务不会切换，读到的就是本操作所属的事务
+    uint64_t txn = jnl.running;
+    *sync_requested = sync_wanted;
+    if (in_op) {
+        in_op = 0;
+        sync_wanted = 0;
+        pthread_rwlock_unlock(&txn_lock);
+    }
+    return txn;
+}
+
+int journal_commit(uint64_t txn) {
+    pthread_once(&txn_once, init_txn_lock);
+    pthread_mutex_lock(&commit_lock);
+    if (!jnl.active || jnl.committed >= txn) {
+        if (jnl.active) {
+            stats.grouped++;
+        }
+        pthread_mutex_unlock(&commit_lock);
+        return 0;
+    }
+
+    pthread_rwlock_wrlock(&txn_lock);
+    int result = commit_locked();
+    pthread_rwlock_unlock(&txn_lock);
+    pthread_mutex_unlock(&commit_lock);
+    return result;
+}
+
+int journal_sync(void) {
+    if (in_op) {
+        sync_wanted = 1;   // 自己持有读锁，不能等自己结束
+        return 0;
+    }
+    return journal_commit(jnl.running);
+}
+
+void journal_revoke(uint32_t block_no) {
+    pthread_mutex_lock(&revoke_lock);
+    if (jnl.live != NULL && live_contains(block_no)) {
+        uint32_t i = 0;
+        while (i < jnl.revoke_count && jnl.revokes[i] != block_no) {
+            i++;
+        }
+        if (i == jnl.revoke_count) {
+            if (jnl.revoke_count == jnl.revoke_capacity) {
+                uint32_t capacity = jnl.revoke_capacity ? jnl.revoke_capacity * 2 : 64;
+                uint32_t *grown = realloc(jnl.revokes, capacity * sizeof(uint32_t));
+                if (grown == NULL) {
+                    pthread_mutex_unlock(&revoke_lock);
+                    return;
+                }
+                jnl.revokes = grown;
+                jnl.revoke_capacity = capacity;
+            }
+            jnl.revokes[jnl.revoke_count++] = block_no;
+        }
+    }
+    pthread_mutex_unlock(&revoke_lock);
+}
+
+const journal_stats_t *journal_get_stats(void) {
+    if (!jnl.active) {
+        stats.blocks = 0;
+        stats.used = 0;
+    }
+    return &stats;
+}
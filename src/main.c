@@ -1,21 +1,79 @@
 #include "../include/ext2.h"
 #include "../include/commands.h"
 #include "../include/user.h"
+#include "../include/server.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <signal.h>
 #include <time.h>
+#include <unistd.h>
+
+static int server_mode = 0;
 
 // 信号处理函数
 void signal_handler(int sig) {
+    if (server_mode) {
+        server_stop(); // 由 server_run 返回后统一清理
+        return;
+    }
     printf("\nReceived signal %d, cleaning up...\n", sig);
     ext2_cleanup();
     exit(0);
 }
 
 int main(int argc, char *argv[]) {
-    (void)argc; // 避免未使用参数警告
-    (void)argv;
+    const char *image = NULL;
+    const char *address = NULL;
+    disk_backend_t backend = DISK_BACKEND_FD;
+    int workers = SRV_DEFAULT_WORKERS;
+    const char *script = NULL;
+    char *commands = NULL;
+    
+    int opt;
+    while ((opt = getopt(argc, argv, "i:MUl:w:b:c:h")) != -1) {
+        switch (opt) {
+        case 'i':
+            image = optarg;
+            break;
+        case 'M':
+            backend = DISK_BACKEND_MMAP;
+            break;
+        case 'U':
+            backend = DISK_BACKEND_URING;
+            break;
+        case 'l':
+            address = optarg;
+            break;
+        case 'w':
+            workers = atoi(optarg);
+            break;
+        case 'b':
+            script = optarg;
+            break;
+        case 'c':
+            commands = optarg;
+            break;
+        default:
+            print_usage();
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    server_mode = address != NULL;
+    int batch_mode = script != NULL || commands != NULL;
+    if (server_mode && batch_mode) {
+        print_usage();
+        return 1;
+    }
+    
+    FILE *input = NULL;
+    if (script != NULL) {
+        input = strcmp(script, "-") == 0 ? stdin : fopen(script, "r");
+        if (input == NULL) {
+            printf("Error: Cannot open script: %s\n", script);
+            return 1;
+        }
+    }
     
     // 设置信号处理
     signal(SIGINT, signal_handler);
@@ -29,6 +87,33 @@ int main(int argc, char *argv[]) {
         printf("Error: Failed to initialize file system\n");
         return 1;
     }
+    // 批处理模式只输出错误和查询结果，挂载信息也不输出
+    fs.quiet = batch_mode;
+    if (image != NULL && cmd_mount(image, backend) != 0) {
+        return 1;
+    }
+    
+    // 守护进程模式：镜像只挂载一次，所有客户端共享
+    if (server_mode) {
+        if (image == NULL) {
+            printf("Error: Daemon mode needs a disk image (-i)\n");
+            return 1;
+        }
+        int result = server_run(address, workers);
+        ext2_cleanup();
+        return result == 0 ? 0 : 1;
+    }
+    
+    // 批处理模式：镜像只挂载一次，执行完所有命令后写回并退出
+    if (batch_mode) {
+        int result = input != NULL ? command_batch(input) : command_string(commands);
+        if (input != NULL && input != stdin) {
+            fclose(input);
+        }
+        ext2_cleanup();
+        fflush(stdout);
+        return result == 0 ? 0 : 1;
+    }
     
     // 显示欢迎信息
     printf("========================================\n");
@@ -51,4 +136,4 @@ int main(int argc, char *argv[]) {
     
     printf("Goodbye!\n");
     return 0;
-} 
\ No newline at end of file
+}
@@ -0,0 +1,128 @@
+#include "../include/readahead.h"
+#include "../include/inode.h"
+#include "../include/disk.h"
+#include "../include/ext2.h"
+#include "../include/icache.h"
+#include <string.h>
+#include <pthread.h>
+
+/*顺序预读：每个打开文件记录上一次读的结束位置，下一次读正好从那里开始就认为是顺序读。
+第一次检测到顺序读时在当前读之后开一个 RA_MIN_BLOCKS 的窗口，
+读到当前窗口时再发起下一个窗口，窗口每次翻倍直到 RA_MAX_BLOCKS，始终领先读者一个窗口。
+窗口中的块通过 disk_prefetch 交给内核在后台读入，读本身不等待预读完成。
+随机读会关闭窗口，直到再次出现顺序读。
+窗口状态属于打开文件，只有它的持有者访问；全局统计由 stats_lock 保护。*/
+
+static int enabled = 1;
+static readahead_stats_t stats;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void readahead_reset(readahead_t *ra) {
+    memset(ra, 0, sizeof(readahead_t));
+}
+
+// 预读逻辑块 [start, start+size) 中已分配的部分（超出文件末尾的部分忽略）
+static void issue_window(readahead_t *ra, uint32_t inode_no, uint32_t start, uint32_t size, uint32_t file_blocks) {
+    // 与上一个窗口不连续时，之前未读到的预读块不再计入命中
+    if (start != ra->issued_end) {
+        ra->hit_from = start;
+    }
+    ra->start = start;
+    ra->size = size;
+    ra->async_start = start;
+    
+    uint32_t end = start + size;
+    if (end > file_blocks) {
+        end = file_blocks;
+    }
+    ra->issued_end = end > start ? end : start;
+    
+    uint64_t prefetched = 0;
+    uint32_t index = start;
+    icache_lock_shared(inode_no);
+    while (index < end) {
+        inode_extent_t extents[16];
+        int n = map_inode_extents(inode_no, index, end - index, extents, 16);
+        if (n <= 0) {
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            if (extents[i].physical != 0) {
+                disk_prefetch(extents[i].physical, extents[i].count);
+                prefetched += extents[i].count;
+            }
+            index = extents[i].logical + extents[i].count;
+        }
+    }
+    icache_unlock(inode_no);
+    
+    pthread_mutex_lock(&stats_lock);
+    stats.prefetched += prefetched;
+    stats.windows++;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+void readahead_access(readahead_t *ra, uint32_t inode_no, off_t offset, size_t size) {
+    if (!enabled || size == 0) {
+        return;
+    }
+    
+    int sequential = offset == ra->next_offset;
+    ra->next_offset = offset + size;
+    
+    uint32_t file_blocks = (get_file_size(inode_no) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    uint32_t first = offset / BLOCK_SIZE;
+    uint32_t last = (offset + size - 1) / BLOCK_SIZE;
+    if (first >= file_blocks) {
+        return;
+    }
+    if (last >= file_blocks) {
+        last = file_blocks - 1;
+    }
+    
+    // 统计命中：本次读到的块中有多少是之前预读过的
+    uint32_t lo = first > ra->hit_from ? first : ra->hit_from;
+    uint32_t hi = last + 1 < ra->issued_end ? last + 1 : ra->issued_end;
+    if (hi > lo) {
+        pthread_mutex_lock(&stats_lock);
+        stats.hits += hi - lo;
+        pthread_mutex_unlock(&stats_lock);
+    }
+    if (last + 1 > ra->hit_from) {
+        ra->hit_from = last + 1;
+    }
+    
+    if (!sequential) {
+        ra->size = 0;
+        ra->issued_end = 0;
+        ra->hit_from = 0;
+        return;
+    }
+    
+    if (ra->size == 0) {
+        // 刚开始顺序读：窗口至少是本次读长度的两倍
+        uint32_t size = (last - first + 1) * 2;
+        size = size < RA_MIN_BLOCKS ? RA_MIN_BLOCKS : size > RA_MAX_BLOCKS ? RA_MAX_BLOCKS : size;
+        issue_window(ra, inode_no, last + 1, size, file_blocks);
+    } else if (last >= ra->async_start) {
+        // 读者进入了当前窗口，发起下一个更大的窗口
+        uint32_t start = ra->start + ra->size;
+        if (start <= last) {
+            start = last + 1; // 读者一次读得比窗口还多
+        }
+        uint32_t size = ra->size * 2 > RA_MAX_BLOCKS ? RA_MAX_BLOCKS : ra->size * 2;
+        issue_window(ra, inode_no, start, size, file_blocks);
+    }
+}
+
+void readahead_set_enabled(int on) {
+    enabled = on;
+}
+
+int readahead_enabled(void) {
+    return enabled;
+}
+
+const readahead_stats_t *readahead_get_stats(void) {
+    return &stats;
+}
@@ -0,0 +1,758 @@
+#include "../include/server.h"
+#include "../include/session.h"
+#include "../include/user.h"
+#include "../include/inode.h"
+#include "../include/directory.h"
+#include "../include/icache.h"
+#include "../include/readahead.h"
+#include "../include/disk.h"
+#include "../include/stats.h"
+#include "../include/ext2.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+/*守护进程：一个事件线程用 epoll 等待新连接和可读的连接，工作线程池处理请求。
+
+连接以 EPOLLONESHOT 注册，可读时交给一个工作线程，处理期间不会再被分发，
+所以同一连接上的请求按顺序执行，会话也只被一个线程使用。工作线程读出所有已到达的数据，
+依次处理其中完整的请求帧，响应追加到输出缓冲区，整批处理完后调用一次 ext2_op_end
+再把响应一起写回，然后重新注册连接。客户端一次发出多个请求时只需要一个往返。*/
+
+// 输入缓冲区最多积压的数据，超过时先处理已收到的请求
+#define SRV_INPUT_LIMIT (2 * (SRV_MAX_PAYLOAD + sizeof(srv_request_t)))
+// 输出缓冲区超过这个大小时先写出一部分，避免大量流水线读占用太多内存
+#define SRV_OUTPUT_FLUSH (SRV_MAX_PAYLOAD + sizeof(srv_response_t))
+#define SRV_READ_CHUNK 65536
+#define SRV_MAX_EVENTS 64
+
+typedef struct conn {
+    int fd;
+    pthread_mutex_t lock;                  // 工作线程处理连接期间持有（连接在线程间交接）
+    session_t *session;
+    uint8_t *in;
+    size_t in_len, in_cap;
+    uint8_t *out;
+    size_t out_len, out_cap;
+    struct conn *queue_next;               // 工作队列
+    struct conn *all_prev, *all_next;      // 所有连接（退出时关闭）
+} conn_t;
+
+static int epoll_fd = -1;
+static int wake_pipe[2] = { -1, -1 };
+static volatile sig_atomic_t stopping = 0;
+
+// 用作 epoll 事件数据，区分监听套接字和唤醒管道
+static int listen_tag, wake_tag;
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static conn_t *queue_head = NULL, *queue_tail = NULL;
+
+static pthread_mutex_t conns_lock = PTHREAD_MUTEX_INITIALIZER;
+static conn_t *all_conns = NULL;
+
+// 缓冲区
+static int reserve(uint8_t **buf, size_t *cap, size_t need) {
+    if (need <= *cap) {
+        return 0;
+    }
+    size_t size = *cap > 0 ? *cap : 4096;
+    while (size < need) {
+        size *= 2;
+    }
+    uint8_t *p = realloc(*buf, size);
+    if (p == NULL) {
+        return -1;
+    }
+    *buf = p;
+    *cap = size;
+    return 0;
+}
+
+// 响应
+static void reply(conn_t *c, uint32_t id, int32_t status, const void *data, size_t length) {
+    if (reserve(&c->out, &c->out_cap, c->out_len + sizeof(srv_response_t) + length) != 0) {
+        length = 0;
+        status = -ENOMEM;
+        if (reserve(&c->out, &c->out_cap, c->out_len + sizeof(srv_response_t)) != 0) {
+            return;
+        }
+    }
+    srv_response_t header = { (uint32_t)length, id, status };
+    memcpy(c->out + c->out_len, &header, sizeof(header));
+    if (length > 0) {
+        memcpy(c->out + c->out_len + sizeof(header), data, length);
+    }
+    c->out_len += sizeof(header) + length;
+}
+
+// 负载中以 '\0' 结尾的字符串，不完整时返回NULL
+static const char *payload_string(const uint8_t *payload, size_t length, size_t offset) {
+    if (offset >= length || memchr(payload + offset, '\0', length - offset) == NULL) {
+        return NULL;
+    }
+    return (const char*)payload + offset;
+}
+
+// 请求处理，返回值即响应的 status
+static int32_t op_login(conn_t *c, const srv_request_t *req, const uint8_t *payload) {
+    const char *username = payload_string(payload, req->length, 0);
+    const char *password = username != NULL ? payload_string(payload, req->length, strlen(username) + 1) : NULL;
+    if (password == NULL) {
+        return -EINVAL;
+    }
+    (void)c;
+    return login(username, password) == 0 ? 0 : -EACCES;
+}
+
+static int32_t op_open(conn_t *c, const srv_request_t *req, const uint8_t *payload) {
+    uint32_t flags;
+    const char *path = payload_string(payload, req->length, sizeof(flags));
+    if (path == NULL) {
+        return -EINVAL;
+    }
+    memcpy(&flags, payload, sizeof(flags));
+
+    dir_lock_shared();
+    int fd = session_open(c->session, path, (int)flags);
+    dir_unlock();
+    return fd;
+}
+
+static int32_t op_close(conn_t *c, const srv_request_t *req, const uint8_t *payload) {
+    uint32_t fd;
+    if (req->length < sizeof(fd)) {
+        return -EINVAL;
+    }
+    memcpy(&fd, payload, sizeof(fd));
+    return session_close(c->session, (int)fd);
+}
+
+/*客户端给出的偏移（SRV_OFFSET_CURRENT 除外）：超出 off_t 范围的返回 -EINVAL，
+offset + size 超过文件最大长度（32位 i_size，也不能超过块树能映射的范围）的返回 -EFBIG。*/
+static int32_t check_offset(const srv_io_t *io, uint64_t size) {
+    if (io->offset == SRV_OFFSET_CURRENT) {
+        return 0;
+    }
+    if (io->offset > INT64_MAX) {
+        return -EINVAL;
+    }
+    uint64_t limit = (uint64_t)inode_max_blocks() * BLOCK_SIZE;
+    if (io->offset > limit || size > limit - io->offset) {
+        return -EFBIG;
+    }
+    return 0;
+}
+
+// 读：数据直接读进输出缓冲区的响应负载位置
+static void op_read(conn_t *c, const srv_request_t *req, const uint8_t *payload) {
+    srv_io_t io;
+    if (req->length < sizeof(io)) {
+        reply(c, req->id, -EINVAL, NULL, 0);
+        return;
+    }
+    memcpy(&io, payload, sizeof(io));
+
+    open_file_t *file = session_file(c->session, (int)io.fd);
+    if (file == NULL || (file->flags & O_ACCMODE) == O_WRONLY) {
+        reply(c, req->id, -EBADF, NULL, 0);
+        return;
+    }
+    if (io.size > SRV_MAX_PAYLOAD) {
+        io.size = SRV_MAX_PAYLOAD;
+    }
+    if (reserve(&c->out, &c->out_cap, c->out_len + sizeof(srv_response_t) + io.size) != 0) {
+        reply(c, req->id, -ENOMEM, NULL, 0);
+        return;
+    }
+
+    int current = io.offset == SRV_OFFSET_CURRENT;
+    int32_t error = check_offset(&io, io.size);
+    if (error != 0) {
+        reply(c, req->id, error, NULL, 0);
+        return;
+    }
+    off_t offset = current ? file->offset : (off_t)io.offset;
+    if (current) {
+        readahead_access(&file->ra, file->inode_no, offset, io.size);
+    }
+    ssize_t n = read_inode_data(file->inode_no, c->out + c->out_len + sizeof(srv_response_t), io.size, offset);
+    if (n > 0 && current) {
+        file->offset += n;
+    }
+
+    srv_response_t header = { n > 0 ? (uint32_t)n : 0, req->id, n >= 0 ? (int32_t)n : -EIO };
+    memcpy(c->out + c->out_len, &header, sizeof(header));
+    c->out_len += sizeof(header) + header.length;
+}
+
+static int32_t op_write(conn_t *c, const srv_request_t *req, const uint8_t *payload) {
+    srv_io_t io;
+    if (req->length < sizeof(io)) {
+        return -EINVAL;
+    }
+    memcpy(&io, payload, sizeof(io));
+
+    open_file_t *file = session_file(c->session, (int)io.fd);
+    if (file == NULL || (file->flags & O_ACCMODE) == O_RDONLY) {
+        return -EBADF;
+    }
+
+    int current = io.offset == SRV_OFFSET_CURRENT;
+    int32_t error = check_offset(&io, req->length - sizeof(io));
+    if (error != 0) {
+        return error;
+    }
+    off_t offset = current ? file->offset : (off_t)io.offset;
+    ssize_t n = write_inode_data(file->inode_no, payload + sizeof(io), req->length - sizeof(io), offset);
+    if (n > 0 && current) {
+        file->offset += n;
+    }
+    return n >= 0 ? (int32_t)n : -EIO;
+}
+
+static void op_stat(conn_t *c, const srv_request_t *req, const uint8_t *payload) {
+    const char *path = payload_string(payload, req->length, 0);
+    if (path == NULL) {
+        reply(c, req->id, -EINVAL, NULL, 0);
+        return;
+    }
+
+    dir_lock_shared();
+    uint32_t inode_no;
+    ext2_inode_t *inode = NULL;
+    if (path_to_inode(path, &inode_no) == 0) {
+        inode = icache_get(inode_no);
+    }
+    if (inode == NULL) {
+        dir_unlock();
+        reply(c, req->id, -ENOENT, NULL, 0);
+        return;
+    }
+
+    srv_stat_t st;
+    memset(&st, 0, sizeof(st));
+    icache_lock_shared(inode_no);
+    st.inode = inode_no;
+    st.mode = inode->i_mode;
+    st.links_count = inode->i_links_count;
+    st.uid = inode->i_uid;
+    st.gid = inode->i_gid;
+    st.size = inode->i_size;
+    st.blocks = inode->i_blocks;
+    st.atime = inode->i_atime;
+    st.mtime = inode->i_mtime;
+    st.ctime = inode->i_ctime;
+    icache_unlock(inode_no);
+    icache_put(inode_no);
+    dir_unlock();
+
+    reply(c, req->id, 0, &st, sizeof(st));
+}
+
+static void op_readdir(conn_t *c, const srv_request_t *req, const uint8_t *payload) {
+    const char *path = payload_string(payload, req->length, 0);
+    if (path == NULL) {
+        reply(c, req->id, -EINVAL, NULL, 0);
+        return;
+    }
+
+    // 目录最多12个块，每个目录项至少 EXT2_DIR_REC_LEN(1) 字节
+    int max_entries = 12 * BLOCK_SIZE / EXT2_DIR_REC_LEN(1);
+    ext2_dir_entry_t *entries = malloc(sizeof(ext2_dir_entry_t) * max_entries);
+    if (entries == NULL) {
+        reply(c, req->id, -ENOMEM, NULL, 0);
+        return;
+    }
+
+    int32_t status;
+    int count = 0;
+    uint32_t inode_no;
+    dir_lock_shared();
+    if (path_to_inode(path, &inode_no) != 0) {
+        status = -ENOENT;
+    } else {
+        status = check_access(inode_no, EXT2_S_IFDIR, EXT2_S_IRUSR);
+        if (status == 0) {
+            count = read_directory_entries(inode_no, entries, max_entries);
+            status = count >= 0 ? count : -EIO;
+        }
+    }
+    dir_unlock();
+
+    size_t length = 0;
+    for (int i = 0; i < count; i++) {
+        length += sizeof(srv_dirent_t) + entries[i].name_len;
+    }
+    uint8_t *data = malloc(length > 0 ? length : 1);
+    if (data == NULL) {
+        free(entries);
+        reply(c, req->id, -ENOMEM, NULL, 0);
+        return;
+    }
+
+    size_t pos = 0;
+    for (int i = 0; i < count; i++) {
+        srv_dirent_t d = { entries[i].inode, entries[i].name_len, entries[i].file_type, 0 };
+        memcpy(data + pos, &d, sizeof(d));
+        memcpy(data + pos + sizeof(d), entries[i].name, entries[i].name_len);
+        pos += sizeof(d) + entries[i].name_len;
+    }
+    reply(c, req->id, status, data, length);
+    free(data);
+    free(entries);
+}
+
+static void op_stats(conn_t *c, const srv_request_t *req, const uint8_t *payload) {
+    uint32_t flags = 0;
+    if (req->length >= sizeof(flags)) {
+        memcpy(&flags, payload, sizeof(flags));
+    }
+    if (!stats_enabled()) {
+        reply(c, req->id, -ENOSYS, NULL, 0);
+        return;
+    }
+    if ((flags & SRV_STATS_RESET) && get_current_uid() != 0) {
+        reply(c, req->id, -EPERM, NULL, 0);
+        return;
+    }
+
+    stats_counter_t counters[STATS_COUNT];
+    double seconds;
+    stats_collect(counters, &seconds, NULL);
+    if (flags & SRV_STATS_RESET) {
+        stats_reset();
+    }
+
+    srv_stats_t out[STATS_COUNT];
+    memset(out, 0, sizeof(out));
+    for (int id = 0; id < STATS_COUNT; id++) {
+        strncpy(out[id].name, stats_name(id), sizeof(out[id].name) - 1);
+        out[id].calls = counters[id].calls;
+        out[id].failed = counters[id].failed;
+        out[id].total_ns = counters[id].total_ns;
+        out[id].max_ns = counters[id].max_ns;
+        out[id].seconds_ms = (uint64_t)(seconds * 1000);
+        for (int b = 0; b < STATS_BUCKETS && b < SRV_STATS_BUCKETS; b++) {
+            out[id].buckets[b] = counters[id].buckets[b];
+        }
+    }
+    reply(c, req->id, STATS_COUNT, out, sizeof(out));
+}
+
+static void handle_request(conn_t *c, const srv_request_t *req, const uint8_t *payload) {
+    if (req->op != SRV_OP_LOGIN && !is_logged_in()) {
+        reply(c, req->id, -EPERM, NULL, 0);
+        return;
+    }
+
+    switch (req->op) {
+    case SRV_OP_LOGIN:
+        reply(c, req->id, op_login(c, req, payload), NULL, 0);
+        break;
+    case SRV_OP_OPEN:
+        reply(c, req->id, op_open(c, req, payload), NULL, 0);
+        break;
+    case SRV_OP_CLOSE:
+        reply(c, req->id, op_close(c, req, payload), NULL, 0);
+        break;
+    case SRV_OP_READ:
+        op_read(c, req, payload);
+        break;
+    case SRV_OP_WRITE:
+        reply(c, req->id, op_write(c, req, payload), NULL, 0);
+        break;
+    case SRV_OP_STAT:
+        op_stat(c, req, payload);
+        break;
+    case SRV_OP_READDIR:
+        op_readdir(c, req, payload);
+        break;
+    case SRV_OP_SYNC:
+        reply(c, req->id, ext2_sync() == 0 && disk_sync() == 0 ? 0 : -EIO, NULL, 0);
+        break;
+    case SRV_OP_STATS:
+        op_stats(c, req, payload);
+        break;
+    default:
+        reply(c, req->id, -ENOSYS, NULL, 0);
+        break;
+    }
+}
+
+// 写出输出缓冲区；套接字写满时等待它可写
+static int flush_output(conn_t *c) {
+    size_t pos = 0;
+    while (pos < c->out_len) {
+        ssize_t n = send(c->fd, c->out + pos, c->out_len - pos, MSG_NOSIGNAL);
+        if (n > 0) {
+            pos += n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && !stopping) {
+            struct pollfd p = { c->fd, POLLOUT, 0 };
+            poll(&p, 1, 1000);
+            continue;
+        }
+        return -1;
+    }
+    c->out_len = 0;
+    return 0;
+}
+
+// 读出已到达的数据，对端关闭或出错返回-1
+static int read_input(conn_t *c) {
+    while (c->in_len < SRV_INPUT_LIMIT) {
+        if (reserve(&c->in, &c->in_cap, c->in_len + SRV_READ_CHUNK) != 0) {
+            return -1;
+        }
+        ssize_t n = read(c->fd, c->in + c->in_len, c->in_cap - c->in_len);
+        if (n > 0) {
+            c->in_len += n;
+        } else if (n == 0) {
+            return -1;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        } else if (errno != EINTR) {
+            return -1;
+        }
+    }
+    return 0; // 剩下的数据等这一批处理完再读
+}
+
+// 处理输入缓冲区中所有完整的请求，协议错误返回-1
+static int process_input(conn_t *c, int *handled) {
+    size_t pos = 0;
+    int result = 0;
+    while (c->in_len - pos >= sizeof(srv_request_t)) {
+        srv_request_t req;
+        memcpy(&req, c->in + pos, sizeof(req));
+        if (req.length > SRV_MAX_PAYLOAD + sizeof(srv_io_t)) {
+            result = -1;
+            break;
+        }
+        if (c->in_len - pos - sizeof(req) < req.length) {
+            break; // 请求还没有收完
+        }
+
+        handle_request(c, &req, c->in + pos + sizeof(req));
+        pos += sizeof(req) + req.length;
+        (*handled)++;
+
+        if (c->out_len >= SRV_OUTPUT_FLUSH && flush_output(c) != 0) {
+            result = -1;
+            break;
+        }
+    }
+
+    memmove(c->in, c->in + pos, c->in_len - pos);
+    c->in_len -= pos;
+    return result;
+}
+
+static void close_conn(conn_t *c) {
+    pthread_mutex_lock(&conns_lock);
+    if (c->all_prev != NULL) {
+        c->all_prev->all_next = c->all_next;
+    } else {
+        all_conns = c->all_next;
+    }
+    if (c->all_next != NULL) {
+        c->all_next->all_prev = c->all_prev;
+    }
+    pthread_mutex_unlock(&conns_lock);
+
+    session_destroy(c->session);
+    close(c->fd);
+    pthread_mutex_destroy(&c->lock);
+    free(c->in);
+    free(c->out);
+    free(c);
+}
+
+static void serve_conn(conn_t *c) {
+    pthread_mutex_lock(&c->lock);
+    session_attach(c->session);
+
+    int closing = read_input(c) != 0;
+    int handled = 0;
+    ext2_op_begin();
+    if (process_input(c, &handled) != 0) {
+        closing = 1;
+    }
+    // 一批请求结束后统一写回修改（同时结束的几个连接合成一次提交）
+    if (handled > 0) {
+        ext2_op_end();
+    } else {
+        ext2_op_leave();
+    }
+    if (flush_output(c) != 0) {
+        closing = 1;
+    }
+
+    session_attach(NULL);
+    int fd = c->fd;
+    pthread_mutex_unlock(&c->lock);
+
+    if (closing) {
+        close_conn(c);
+        return;
+    }
+    // 重新注册之后连接可能立即被另一个工作线程取走，这里不再访问它
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+    ev.data.ptr = c;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev) != 0) {
+        close_conn(c);
+    }
+}
+
+static void *worker_main(void *arg) {
+    (void)arg;
+    while (1) {
+        pthread_mutex_lock(&queue_lock);
+        while (queue_head == NULL && !stopping) {
+            pthread_cond_wait(&queue_cond, &queue_lock);
+        }
+        conn_t *c = queue_head;
+        if (c == NULL) {
+            pthread_mutex_unlock(&queue_lock);
+            break;
+        }
+        queue_head = c->queue_next;
+        if (queue_head == NULL) {
+            queue_tail = NULL;
+        }
+        pthread_mutex_unlock(&queue_lock);
+
+        serve_conn(c);
+    }
+    return NULL;
+}
+
+static void enqueue(conn_t *c) {
+    pthread_mutex_lock(&queue_lock);
+    c->queue_next = NULL;
+    if (queue_tail != NULL) {
+        queue_tail->queue_next = c;
+    } else {
+        queue_head = c;
+    }
+    queue_tail = c;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+}
+
+static void accept_all(int listen_fd) {
+    while (1) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return; // EAGAIN：没有更多连接
+        }
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // Unix域套接字上会失败，忽略
+
+        conn_t *c = calloc(1, sizeof(conn_t));
+        session_t *session = c != NULL ? session_create() : NULL;
+        if (session == NULL) {
+            free(c);
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+        c->session = session;
+        pthread_mutex_init(&c->lock, NULL);
+
+        pthread_mutex_lock(&conns_lock);
+        c->all_next = all_conns;
+        if (all_conns != NULL) {
+            all_conns->all_prev = c;
+        }
+        all_conns = c;
+        pthread_mutex_unlock(&conns_lock);
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+        ev.data.ptr = c;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            close_conn(c);
+        }
+    }
+}
+
+// 建立监听套接字
+static int open_listener(const char *address, struct sockaddr_un *unix_addr) {
+    int fd;
+    if (strchr(address, '/') != NULL) {
+        if (strlen(address) >= sizeof(unix_addr->sun_path)) {
+            return -1;
+        }
+        memset(unix_addr, 0, sizeof(*unix_addr));
+        unix_addr->sun_family = AF_UNIX;
+        strcpy(unix_addr->sun_path, address);
+        unlink(address);
+
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0 || bind(fd, (struct sockaddr*)unix_addr, sizeof(*unix_addr)) != 0) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            return -1;
+        }
+    } else {
+        char host[64] = "127.0.0.1";
+        const char *port = address;
+        const char *colon = strrchr(address, ':');
+        if (colon != NULL) {
+            size_t len = colon - address;
+            if (len >= sizeof(host)) {
+                return -1;
+            }
+            memcpy(host, address, len);
+            host[len] = '\0';
+            port = colon + 1;
+        }
+
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t)atoi(port));
+        if (atoi(port) <= 0 || inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+            return -1;
+        }
+
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int one = 1;
+        if (fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+            bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            return -1;
+        }
+    }
+
+    if (listen(fd, 128) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void server_stop(void) {
+    stopping = 1;
+    if (wake_pipe[1] != -1) {
+        char b = 0;
+        ssize_t n = write(wake_pipe[1], &b, 1); // 信号处理函数中只能做这样的调用
+        (void)n;
+    }
+}
+
+int server_run(const char *address, int workers) {
+    struct sockaddr_un unix_addr;
+    unix_addr.sun_path[0] = '\0';
+
+    int listen_fd = open_listener(address, &unix_addr);
+    if (listen_fd < 0) {
+        printf("Error: Cannot listen on %s\n", address);
+        return -1;
+    }
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0 || pipe2(wake_pipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+        printf("Error: Cannot start event loop\n");
+        close(listen_fd);
+        return -1;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &listen_tag;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+    ev.data.ptr = &wake_tag;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_pipe[0], &ev);
+
+    if (workers <= 0) {
+        workers = SRV_DEFAULT_WORKERS;
+    }
+    pthread_t *threads = malloc(sizeof(pthread_t) * workers);
+    int started = 0;
+    while (threads != NULL && started < workers &&
+           pthread_create(&threads[started], NULL, worker_main, NULL) == 0) {
+        started++;
+    }
+
+    printf("Listening on %s (%d workers)\n", address, started);
+    fflush(stdout);
+
+    struct epoll_event events[SRV_MAX_EVENTS];
+    while (!stopping && started > 0) {
+        int n = epoll_wait(epoll_fd, events, SRV_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == &listen_tag) {
+                accept_all(listen_fd);
+            } else if (events[i].data.ptr == &wake_tag) {
+                char buf[64];
+                while (read(wake_pipe[0], buf, sizeof(buf)) > 0) {
+                }
+            } else {
+                enqueue(events[i].data.ptr);
+            }
+        }
+    }
+
+    // 停止工作线程（正在处理的批次先做完），再关闭剩下的连接
+    stopping = 1;
+    pthread_mutex_lock(&queue_lock);
+    pthread_cond_broadcast(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+
+    queue_head = queue_tail = NULL;
+    while (all_conns != NULL) {
+        close_conn(all_conns);
+    }
+
+    close(listen_fd);
+    if (unix_addr.sun_path[0] != '\0') {
+        unlink(unix_addr.sun_path);
+    }
+    close(epoll_fd);
+    close(wake_pipe[0]);
+    close(wake_pipe[1]);
+    epoll_fd = -1;
+    wake_pipe[0] = wake_pipe[1] = -1;
+    stopping = 0;
+
+    printf("Server stopped\n");
+    return 0;
+}
@@ -0,0 +1,168 @@
+#include "../include/session.h"
+#include "../include/ext2.h"
+#include "../include/disk.h"
+#include "../include/inode.h"
+#include "../include/directory.h"
+#include "../include/readahead.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+
+// 文件表的初始项数（包括保留的 0, 1, 2）
+#define SESSION_INITIAL_FILES 16
+
+// 控制台会话：交互式命令行和没有绑定会话的线程使用
+static session_t console = { .free_hint = SESSION_FIRST_FD };
+static __thread session_t *current = NULL;
+
+session_t *session_create(void) {
+    session_t *session = calloc(1, sizeof(session_t));
+    if (session == NULL) {
+        return NULL;
+    }
+    session->free_hint = SESSION_FIRST_FD;
+    return session;
+}
+
+void session_destroy(session_t *session) {
+    if (session == NULL) {
+        return;
+    }
+    
+    // 关闭仍然打开的文件，释放它们的预留窗口和映射缓存
+    for (int fd = SESSION_FIRST_FD; fd < session->capacity; fd++) {
+        if (session->files[fd].is_open) {
+            release_block_reservation(session->files[fd].inode_no);
+            inode_map_release(session->files[fd].inode_no);
+        }
+    }
+    
+    free(session->files);
+    if (current == session) {
+        current = NULL;
+    }
+    if (session == &console) {
+        memset(&console, 0, sizeof(console));
+        console.free_hint = SESSION_FIRST_FD;
+    } else {
+        free(session);
+    }
+}
+
+session_t *session_current(void) {
+    return current != NULL ? current : &console;
+}
+
+void session_attach(session_t *session) {
+    current = session;
+}
+
+// 扩大文件表，新的项都是空闲的
+static int grow(session_t *session) {
+    int capacity = session->capacity > 0 ? session->capacity * 2 : SESSION_INITIAL_FILES;
+    open_file_t *files = realloc(session->files, sizeof(open_file_t) * capacity);
+    if (files == NULL) {
+        return -1;
+    }
+    memset(files + session->capacity, 0, sizeof(open_file_t) * (capacity - session->capacity));
+    session->files = files;
+    session->capacity = capacity;
+    return 0;
+}
+
+int session_alloc_fd(session_t *session) {
+    int fd = session->free_hint;
+    while (fd < session->capacity && session->files[fd].is_open) {
+        fd++;
+    }
+    if (fd >= session->capacity && grow(session) != 0) {
+        return -1;
+    }
+    
+    memset(&session->files[fd], 0, sizeof(open_file_t));
+    session->files[fd].fd = fd;
+    session->files[fd].is_open = 1;
+    session->open_count++;
+    session->free_hint = fd + 1;
+    return fd;
+}
+
+open_file_t *session_file(session_t *session, int fd) {
+    if (fd < SESSION_FIRST_FD || fd >= session->capacity || !session->files[fd].is_open) {
+        return NULL;
+    }
+    return &session->files[fd];
+}
+
+void session_free_fd(session_t *session, int fd) {
+    open_file_t *file = session_file(session, fd);
+    if (file == NULL) {
+        return;
+    }
+    file->is_open = 0;
+    session->open_count--;
+    if (fd < session->free_hint) {
+        session->free_hint = fd;
+    }
+}
+
+int session_has_inode(const session_t *session, uint32_t inode_no) {
+    for (int fd = SESSION_FIRST_FD; fd < session->capacity; fd++) {
+        if (session->files[fd].is_open && session->files[fd].inode_no == inode_no) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int session_open(session_t *session, const char *path, int flags) {
+    uint32_t inode_no;
+    if (path_to_inode(path, &inode_no) != 0) {
+        return -ENOENT;
+    }
+    
+    // 类型和权限只查一次inode缓存
+    // O_RDONLY 为 0，必须按访问模式取值比较而不能按位测试
+    int access = 0;
+    int accmode = flags & O_ACCMODE;
+    if (accmode == O_RDONLY) access |= EXT2_S_IRUSR;
+    if (accmode == O_WRONLY) access |= EXT2_S_IWUSR;
+    if (accmode == O_RDWR) access |= (EXT2_S_IRUSR | EXT2_S_IWUSR);
+    
+    int error = check_access(inode_no, EXT2_S_IFREG, access);
+    if (error != 0) {
+        return error;
+    }
+    
+    int fd = session_alloc_fd(session);
+    if (fd == -1) {
+        return -EMFILE;
+    }
+    
+    open_file_t *file = session_file(session, fd);
+    file->inode_no = inode_no;
+    file->flags = flags;
+    file->offset = 0;
+    readahead_reset(&file->ra);
+    return fd;
+}
+
+int session_close(session_t *session, int fd) {
+    open_file_t *file = session_file(session, fd);
+    if (file == NULL) {
+        return -EBADF;
+    }
+    
+    uint32_t inode_no = file->inode_no;
+    session_free_fd(session, fd);
+    
+    // 本会话不再打开这个文件时释放它的预留窗口和映射缓存（两者都只是提示，
+    // 其他会话仍在使用时只会多一次重建）
+    if (!session_has_inode(session, inode_no)) {
+        release_block_reservation(inode_no);
+        inode_map_release(inode_no);
+    }
+    return 0;
+}
@@ -0,0 +1,1107 @@
+#include "../include/snapshot.h"
+#include "../include/disk.h"
+#include "../include/cache.h"
+#include "../include/icache.h"
+#include "../include/journal.h"
+#include "../include/ext2.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+/*整个镜像的写时复制快照：
+
+1. 创建快照只把所有修改写回镜像，再记下"哪些块要保护"：当前位图中已用的块（加上超级块和日志超级块，
+   不含日志区的其余部分和别的快照占用的块）。不复制任何数据块，耗时只和位图大小有关。
+2. 只有最新的快照（活动快照）在跟踪。受保护的块第一次要被原地覆盖时（disk_write_*），
+   先把磁盘上的旧内容复制到一个新分配的块，在快照的映射树中记下"块号 -> 副本"；
+   受保护的块被释放时（free_block）不复制，块本身直接转归快照（映射到自己），不再放回空闲。
+   之后这个块再被覆盖或释放都与快照无关。
+3. 映射树与inode的间接块类似：每层一个块，按块号逐层索引，叶子是副本所在的块，0 表示没有记录。
+   树的节点和副本都直接读写磁盘，不经过块缓存。
+4. 读快照 k 时刻的块 b：依次查快照 k、k+1 …… 最新快照的映射树，第一个有记录的就是旧内容；
+   都没有记录说明块 b 从快照 k 以来没有变过，直接读镜像中的块。
+   更早的快照只在更新的快照创建之前记录，之后就不再变化。
+
+锁：snap_lock 保护映射树和两张位图的修改。写时复制发生在写盘的最底层，调用者可能持有块缓存的段锁，
+所以 snap_lock 之内只会再拿分配锁（分配锁内不做I/O，见 flush_metadata）。
+不需要保存的块在 pending 中没有置位，检查不加锁，没有活动快照时写盘只多一次判断。*/
+
+// 挂载时重放日志产生的写时复制：位图还没读入，不能分配块，旧内容暂存在内存里
+typedef struct {
+    uint32_t block_no;
+    uint32_t root;        // 要记入的映射树
+    uint8_t *data;
+} deferred_t;
+
+static struct {
+    uint32_t count;
+    ext2_snapshot_t table[EXT2_MAX_SNAPSHOTS];
+    uint32_t depth;            // 映射树的层数
+    uint8_t *pending;          // 位b：块b是活动快照还没保存的块
+    uint8_t *storage;          // 位b：块b属于某个快照（映射树节点、副本、转归快照的块）
+    int tracking;              // 活动快照正在跟踪写入
+    int ready;                 // 位图已读入，可以分配块
+    uint32_t cow_root;         // 新的记录写进哪棵映射树（一般是活动快照的）
+    uint32_t journal_from;     // 日志区中不需要保护的块：日志超级块之后的 [from, to)
+    uint32_t journal_to;
+    deferred_t *deferred;
+    uint32_t deferred_count;
+    uint32_t deferred_capacity;
+    uint32_t *converted;       // 分配时遇到的受保护空闲块，随后转归快照
+    uint32_t converted_count;
+    uint32_t converted_capacity;
+} snap;
+
+static pthread_mutex_t snap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// 快照时刻的视图：remap 是已经冻结的映射树（快照 index 到倒数第二个）合并的结果
+typedef struct {
+    uint32_t index;
+    uint32_t *remap;
+    int locked;                // 调用者已持有 snap_lock
+} view_t;
+
+typedef void (*map_fn)(void *arg, uint32_t block_no, uint32_t value);
+
+// 位图按块号索引（与文件系统位图不同，位b对应块b）；位的读写是原子的，写时复制的检查不加锁
+static int test_bit(const uint8_t *bits, uint32_t b) {
+    return (__atomic_load_n(&bits[b / 8], __ATOMIC_RELAXED) >> (b % 8)) & 1;
+}
+
+static void put_bit(uint8_t *bits, uint32_t b, int on) {
+    uint8_t mask = (uint8_t)(1u << (b % 8));
+    if (on) {
+        __atomic_fetch_or(&bits[b / 8], mask, __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_and(&bits[b / 8], (uint8_t)~mask, __ATOMIC_RELAXED);
+    }
+}
+
+static size_t bitmap_bytes(void) {
+    return ((size_t)MAX_BLOCKS + 7) / 8;
+}
+
+static int in_journal(uint32_t b) {
+    return b >= snap.journal_from && b < snap.journal_to;
+}
+
+static double elapsed_since(const struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// 映射树
+static uint32_t entries_per_node(void) {
+    return BLOCK_SIZE / sizeof(uint32_t);
+}
+
+static uint64_t level_span(uint32_t level) {
+    uint64_t span = 1;
+    for (uint32_t i = 0; i < level; i++) {
+        span *= entries_per_node();
+    }
+    return span;
+}
+
+static void set_geometry(const ext2_superblock_t *sb) {
+    snap.depth = 1;
+    while (level_span(snap.depth) < MAX_BLOCKS) {
+        snap.depth++;
+    }
+    snap.journal_from = snap.journal_to = 0;
+    if (sb->s_journal_block != 0) {
+        snap.journal_from = sb->s_journal_block + 1;
+        snap.journal_to = sb->s_journal_block + sb->s_journal_blocks;
+    }
+}
+
+static int map_lookup(uint32_t root, uint32_t block_no, uint32_t *value) {
+    uint32_t node[EXT2_MAX_BLOCK_SIZE / sizeof(uint32_t)];
+    uint32_t at = root;
+    for (uint32_t level = snap.depth; level-- > 0;) {
+        if (at >= MAX_BLOCKS || disk_read_block(at, node) != 0) {
+            return -1;
+        }
+        uint32_t next = node[(block_no / level_span(level)) % entries_per_node()];
+        if (level == 0 || next == 0) {
+            *value = next;
+            return 0;
+        }
+        at = next;
+    }
+    return -1;
+}
+
+static int write_zero_block(uint32_t block_no) {
+    uint8_t zero[EXT2_MAX_BLOCK_SIZE];
+    memset(zero, 0, BLOCK_SIZE);
+    return disk_write_block(block_no, zero);
+}
+
+static void break_snapshots(void);
+
+/*给快照分配一个块（调用者持有 snap_lock）。空闲块一般都不受保护（受保护的块释放时已经转归快照），
+只有一致性检查释放过的泄漏块例外：这样的块记下来，随后直接转归快照，再分配下一个。*/
+static uint32_t alloc_storage(void) {
+    for (;;) {
+        uint32_t b = allocate_block();
+        if (b == 0) {
+            return 0;
+        }
+        put_bit(snap.storage, b, 1);
+        if (!snap.tracking || !test_bit(snap.pending, b)) {
+            return b;
+        }
+        put_bit(snap.pending, b, 0);
+        if (snap.converted_count == snap.converted_capacity) {
+            uint32_t capacity = snap.converted_capacity ? snap.converted_capacity * 2 : 16;
+            uint32_t *grown = realloc(snap.converted, capacity * sizeof(uint32_t));
+            if (grown == NULL) {
+                break_snapshots();
+                continue;
+            }
+            snap.converted = grown;
+            snap.converted_capacity = capacity;
+        }
+        snap.converted[snap.converted_count++] = b;
+    }
+}
+
+// 在映射树中记下 block_no -> value，缺少的中间节点随时分配（先写好子节点再写父节点）
+static int map_insert(uint32_t root, uint32_t block_no, uint32_t value) {
+    uint32_t node[EXT2_MAX_BLOCK_SIZE / sizeof(uint32_t)];
+    uint32_t at = root;
+    for (uint32_t level = snap.depth; level-- > 0;) {
+        if (at >= MAX_BLOCKS || disk_read_block(at, node) != 0) {
+            return -1;
+        }
+        uint32_t slot = (block_no / level_span(level)) % entries_per_node();
+        if (level == 0) {
+            node[slot] = value;
+            return disk_write_block(at, node);
+        }
+        if (node[slot] == 0) {
+            uint32_t child = alloc_storage();
+            if (child == 0 || write_zero_block(child) != 0) {
+                return -1;
+            }
+            node[slot] = child;
+            if (disk_write_block(at, node) != 0) {
+                return -1;
+            }
+        }
+        at = node[slot];
+    }
+    return -1;
+}
+
+static int walk_node(uint32_t at, uint32_t level, uint64_t base, map_fn fn, void *arg) {
+    uint32_t node[EXT2_MAX_BLOCK_SIZE / sizeof(uint32_t)];
+    if (at == 0 || at >= MAX_BLOCKS || disk_read_block(at, node) != 0) {
+        return -1;
+    }
+    fn(arg, at, 0);
+    uint64_t span = level_span(level);
+    for (uint32_t i = 0; i < entries_per_node(); i++) {
+        uint64_t b = base + i * span;
+        if (node[i] == 0) {
+            continue;
+        }
+        if (b >= MAX_BLOCKS || node[i] >= MAX_BLOCKS) {
+            return -1;
+        }
+        if (level == 0) {
+            fn(arg, (uint32_t)b, node[i]);
+        } else if (walk_node(node[i], level - 1, b, fn, arg) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// 遍历映射树：每个节点块回调一次（value 为0），每条记录回调一次
+static int map_walk(uint32_t root, map_fn fn, void *arg) {
+    return walk_node(root, snap.depth - 1, 0, fn, arg);
+}
+
+static void mark_storage(void *arg, uint32_t block_no, uint32_t value) {
+    put_bit(arg, value != 0 ? value : block_no, 1);
+}
+
+static void clear_key(void *arg, uint32_t block_no, uint32_t value) {
+    if (value != 0) {
+        put_bit(arg, block_no, 0);
+    }
+}
+
+static void mark_changed(void *arg, uint32_t block_no, uint32_t value) {
+    if (value != 0 && value != block_no) {
+        put_bit(arg, block_no, 1);
+    }
+}
+
+static void count_block(void *arg, uint32_t block_no, uint32_t value) {
+    (void)block_no;
+    (void)value;
+    (*(uint32_t *)arg)++;
+}
+
+static void fill_remap(void *arg, uint32_t block_no, uint32_t value) {
+    if (value != 0) {
+        ((uint32_t *)arg)[block_no] = value;
+    }
+}
+
+// 把快照表写进超级块，随下一次元数据写回落盘
+static void publish_table(void) {
+    fs.superblock.s_snapshot_count = snap.count;
+    memset(fs.superblock.s_snapshots, 0, sizeof(fs.superblock.s_snapshots));
+    memcpy(fs.superblock.s_snapshots, snap.table, snap.count * sizeof(ext2_snapshot_t));
+    if (snap.count > 0) {
+        fs.superblock.s_feature_incompat |= EXT2_FEATURE_INCOMPAT_SNAPSHOTS;
+    } else {
+        fs.superblock.s_feature_incompat &= ~EXT2_FEATURE_INCOMPAT_SNAPSHOTS;
+    }
+    mark_superblock_dirty();
+}
+
+// 旧内容保存不下来（空间不足或读写失败）：所有快照都要经过活动快照找旧内容，一起标记为不完整
+static void break_snapshots(void) {
+    if (!snap.tracking) {
+        return;
+    }
+    __atomic_store_n(&snap.tracking, 0, __ATOMIC_RELAXED);
+    for (uint32_t i = 0; i < snap.count; i++) {
+        snap.table[i].flags |= EXT2_SNAPSHOT_BROKEN;
+    }
+    publish_table();
+    printf("Error: No space to preserve snapshot data, all snapshots are now incomplete\n");
+}
+
+// 分配中遇到的受保护块转归快照
+static void drain_converted(void) {
+    while (snap.converted_count > 0) {
+        uint32_t b = snap.converted[--snap.converted_count];
+        if (map_insert(snap.cow_root, b, b) != 0) {
+            break_snapshots();
+        }
+    }
+}
+
+// 保存块 b 的旧内容（调用者持有 snap_lock，b 在 pending 中置位）
+static void preserve_block(uint32_t b) {
+    uint8_t data[EXT2_MAX_BLOCK_SIZE];
+    if (!snap.ready) {
+        if (snap.deferred_count == snap.deferred_capacity) {
+            uint32_t capacity = snap.deferred_capacity ? snap.deferred_capacity * 2 : 64;
+            deferred_t *grown = realloc(snap.deferred, capacity * sizeof(deferred_t));
+            if (grown == NULL) {
+                break_snapshots();
+                return;
+            }
+            snap.deferred = grown;
+            snap.deferred_capacity = capacity;
+        }
+        deferred_t *d = &snap.deferred[snap.deferred_count];
+        d->block_no = b;
+        d->root = snap.cow_root;
+        d->data = malloc(BLOCK_SIZE);
+        if (d->data == NULL || disk_read_block(b, d->data) != 0) {
+            free(d->data);
+            break_snapshots();
+            return;
+        }
+        snap.deferred_count++;
+        put_bit(snap.pending, b, 0);
+        return;
+    }
+
+    uint32_t copy = alloc_storage();
+    if (copy == 0 || disk_read_block(b, data) != 0 || disk_write_block(copy, data) != 0 ||
+        map_insert(snap.cow_root, b, copy) != 0) {
+        break_snapshots();
+        return;
+    }
+    put_bit(snap.pending, b, 0);
+    drain_converted();
+}
+
+void snapshot_cow(uint32_t block_no, uint32_t count) {
+    if (!__atomic_load_n(&snap.tracking, __ATOMIC_RELAXED)) {
+        return;
+    }
+    for (uint32_t i = 0; i < count && block_no + i < MAX_BLOCKS; i++) {
+        uint32_t b = block_no + i;
+        if (!test_bit(snap.pending, b)) {
+            continue;
+        }
+        pthread_mutex_lock(&snap_lock);
+        if (snap.tracking && test_bit(snap.pending, b)) {
+            preserve_block(b);
+        }
+        pthread_mutex_unlock(&snap_lock);
+    }
+}
+
+/*受保护的块被释放：块连同内容原样交给快照。缓存中可能还有它没写回的修改（释放前最后的内容），
+先丢弃，免得以后写到快照的块上；日志中的副本同样要撤销。*/
+int snapshot_keep_block(uint32_t block_no) {
+    if (!__atomic_load_n(&snap.tracking, __ATOMIC_RELAXED) || !snap.ready || block_no >= MAX_BLOCKS ||
+        !test_bit(snap.pending, block_no)) {
+        return 0;
+    }
+    bcache_discard(block_no);
+    journal_revoke(block_no);
+
+    int kept = 0;
+    pthread_mutex_lock(&snap_lock);
+    if (snap.tracking && test_bit(snap.pending, block_no)) {
+        if (map_insert(snap.cow_root, block_no, block_no) == 0) {
+            put_bit(snap.pending, block_no, 0);
+            put_bit(snap.storage, block_no, 1);
+            kept = 1;
+            drain_converted();
+        } else {
+            break_snapshots();
+        }
+    }
+    pthread_mutex_unlock(&snap_lock);
+    return kept;
+}
+
+// 快照视图
+static int view_open(view_t *v, uint32_t index, int locked) {
+    v->index = index;
+    v->locked = locked;
+    v->remap = NULL;
+    if (index + 1 >= snap.count) {
+        return 0;
+    }
+    v->remap = calloc(MAX_BLOCKS, sizeof(uint32_t));
+    if (v->remap == NULL) {
+        return -1;
+    }
+    // 从新到旧填入，同一个块以最早的记录为准
+    for (uint32_t j = snap.count - 1; j-- > index;) {
+        if (map_walk(snap.table[j].map, fill_remap, v->remap) != 0) {
+            free(v->remap);
+            v->remap = NULL;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void view_close(view_t *v) {
+    free(v->remap);
+    v->remap = NULL;
+}
+
+// 读快照时刻的块：冻结的映射树已经合并在 remap 中，活动快照的映射树和镜像本身在锁内读（期间不会被覆盖）
+static int view_read(const view_t *v, uint32_t block_no, void *buffer) {
+    if (v->remap != NULL && v->remap[block_no] != 0) {
+        return disk_read_block(v->remap[block_no], buffer);
+    }
+    if (!v->locked) {
+        pthread_mutex_lock(&snap_lock);
+    }
+    uint32_t copy = 0;
+    int result = map_lookup(snap.table[snap.count - 1].map, block_no, &copy);
+    if (result == 0) {
+        result = disk_read_block(copy != 0 ? copy : block_no, buffer);
+    }
+    if (!v->locked) {
+        pthread_mutex_unlock(&snap_lock);
+    }
+    return result;
+}
+
+// 快照时刻在用的块（按快照时刻的组描述符和块位图），块0总是在用
+static int view_in_use(const view_t *v, uint8_t *used) {
+    uint8_t *gdt = malloc((size_t)fs.gdt_blocks * BLOCK_SIZE);
+    uint8_t bits[EXT2_MAX_BLOCK_SIZE];
+    if (gdt == NULL) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < fs.gdt_blocks; i++) {
+        if (view_read(v, GDT_START + i, gdt + (size_t)i * BLOCK_SIZE) != 0) {
+            free(gdt);
+            return -1;
+        }
+    }
+
+    memset(used, 0, bitmap_bytes());
+    put_bit(used, 0, 1);
+    const ext2_group_desc_t *groups = (const ext2_group_desc_t *)gdt;
+    for (uint32_t g = 0; g < fs.groups_count; g++) {
+        if (groups[g].bg_block_bitmap == 0 || groups[g].bg_block_bitmap >= MAX_BLOCKS ||
+            view_read(v, groups[g].bg_block_bitmap, bits) != 0) {
+            free(gdt);
+            return -1;
+        }
+        for (uint32_t i = 0; i < fs.blocks_per_group; i++) {
+            uint32_t b = g * fs.blocks_per_group + i + 1;   // 位i对应块i+1
+            if (b < MAX_BLOCKS && get_bitmap_bit(bits, i)) {
+                put_bit(used, b, 1);
+            }
+        }
+    }
+    free(gdt);
+    return 0;
+}
+
+/*活动快照（最后一个）要保护的块：快照时刻在用、不属于别的快照、不在日志区中，
+去掉映射树中已经有记录的。调用者持有 snap_lock 或保证没有并发访问。*/
+static int build_pending(void) {
+    view_t v;
+    if (view_open(&v, snap.count - 1, 1) != 0 || view_in_use(&v, snap.pending) != 0) {
+        view_close(&v);
+        return -1;
+    }
+    view_close(&v);
+    for (uint32_t b = 0; b < MAX_BLOCKS; b++) {
+        if (test_bit(snap.pending, b) && (test_bit(snap.storage, b) || in_journal(b))) {
+            put_bit(snap.pending, b, 0);
+        }
+    }
+    return map_walk(snap.table[snap.count - 1].map, clear_key, snap.pending);
+}
+
+// 属于快照 0 到 end-1 的块
+static int mark_storage_before(uint32_t end, uint8_t *bits) {
+    for (uint32_t j = 0; j < end; j++) {
+        if (map_walk(snap.table[j].map, mark_storage, bits) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void free_state(void) {
+    __atomic_store_n(&snap.tracking, 0, __ATOMIC_RELAXED);
+    free(snap.pending);
+    free(snap.storage);
+    snap.pending = NULL;
+    snap.storage = NULL;
+    snap.count = 0;
+}
+
+// 按超级块中的快照表建立跟踪状态（deferred 保留）
+static int load_table(const ext2_superblock_t *sb) {
+    free_state();
+    set_geometry(sb);
+    if (sb->s_snapshot_count == 0) {
+        return 0;
+    }
+    if (sb->s_snapshot_count > EXT2_MAX_SNAPSHOTS) {
+        printf("Error: Snapshot table is corrupt\n");
+        return -1;
+    }
+    snap.count = sb->s_snapshot_count;
+    memcpy(snap.table, sb->s_snapshots, snap.count * sizeof(ext2_snapshot_t));
+    snap.pending = calloc(1, bitmap_bytes());
+    snap.storage = calloc(1, bitmap_bytes());
+    if (snap.pending == NULL || snap.storage == NULL || mark_storage_before(snap.count, snap.storage) != 0) {
+        printf("Error: Snapshot table is corrupt\n");
+        free_state();
+        return -1;
+    }
+
+    snap.cow_root = snap.table[snap.count - 1].map;
+    if (!(snap.table[snap.count - 1].flags & EXT2_SNAPSHOT_BROKEN)) {
+        if (build_pending() != 0) {
+            printf("Error: Failed to read snapshot map\n");
+            free_state();
+            return -1;
+        }
+        snap.tracking = 1;
+    }
+    return 0;
+}
+
+int snapshot_load(const ext2_superblock_t *sb) {
+    pthread_mutex_lock(&snap_lock);
+    snap.ready = 0;
+    int result = load_table(sb);
+    pthread_mutex_unlock(&snap_lock);
+    return result;
+}
+
+/*重放之后的超级块：重放可能带来了更新的快照表（创建快照的事务已提交但没来得及检查点），
+这时按新的表重新建立状态。然后把快照的块并入块位图，写出重放期间暂存的旧内容。*/
+int snapshot_attach(const ext2_superblock_t *sb) {
+    pthread_mutex_lock(&snap_lock);
+    int result = 0;
+    if (sb->s_snapshot_count != snap.count ||
+        memcmp(sb->s_snapshots, snap.table, snap.count * sizeof(ext2_snapshot_t)) != 0) {
+        result = load_table(sb);
+    }
+    snap.ready = 1;
+    pthread_mutex_unlock(&snap_lock);
+    if (result != 0) {
+        return -1;
+    }
+
+    uint32_t claimed = snapshot_claim_storage(block_bitmap);
+
+    pthread_mutex_lock(&snap_lock);
+    for (uint32_t i = 0; i < snap.deferred_count; i++) {
+        deferred_t *d = &snap.deferred[i];
+        uint32_t copy = snap.count > 0 ? alloc_storage() : 0;
+        if (copy == 0 || disk_write_block(copy, d->data) != 0 || map_insert(d->root, d->block_no, copy) != 0) {
+            break_snapshots();
+        }
+        free(d->data);
+    }
+    snap.deferred_count = 0;
+    if (snap.count > 0) {
+        drain_converted();
+    }
+    pthread_mutex_unlock(&snap_lock);
+    return (int)claimed;
+}
+
+uint32_t snapshot_claim_storage(uint8_t *bitmap) {
+    uint32_t claimed = 0;
+    pthread_mutex_lock(&snap_lock);
+    for (uint32_t b = 1; snap.storage != NULL && b < MAX_BLOCKS; b++) {
+        if (test_bit(snap.storage, b) && !get_bitmap_bit(bitmap, b - 1)) {
+            set_bitmap_bit(bitmap, b - 1);
+            claimed++;
+        }
+    }
+    pthread_mutex_unlock(&snap_lock);
+    return claimed;
+}
+
+void snapshot_unload(void) {
+    pthread_mutex_lock(&snap_lock);
+    free_state();
+    for (uint32_t i = 0; i < snap.deferred_count; i++) {
+        free(snap.deferred[i].data);
+    }
+    free(snap.deferred);
+    free(snap.converted);
+    snap.deferred = NULL;
+    snap.deferred_count = snap.deferred_capacity = 0;
+    snap.converted = NULL;
+    snap.converted_count = snap.converted_capacity = 0;
+    snap.ready = 0;
+    pthread_mutex_unlock(&snap_lock);
+}
+
+int snapshot_active(void) {
+    return snap.count > 0;
+}
+
+// 快照命令
+
+// 所有修改写回镜像原处：用日志时提交并做检查点，日志清空
+static int write_back_all(void) {
+    if (journal_active()) {
+        return journal_checkpoint();
+    }
+    int result = icache_flush();
+    if (flush_metadata() != 0 || bcache_flush() != 0) {
+        result = -1;
+    }
+    return result;
+}
+
+static int find_snapshot(const char *name) {
+    for (uint32_t i = 0; i < snap.count; i++) {
+        if (strcmp(snap.table[i].name, name) == 0) {
+            return (int)i;
+        }
+    }
+    printf("Error: No such snapshot: %s\n", name);
+    return -1;
+}
+
+int snapshot_create(const char *name) {
+    if (name[0] == '\0' || strlen(name) >= EXT2_SNAPSHOT_NAME_LEN) {
+        printf("Error: Snapshot name must be 1-%d characters\n", EXT2_SNAPSHOT_NAME_LEN - 1);
+        return -1;
+    }
+    for (uint32_t i = 0; i < snap.count; i++) {
+        if (strcmp(snap.table[i].name, name) == 0) {
+            printf("Error: Snapshot already exists: %s\n", name);
+            return -1;
+        }
+    }
+    if (snap.count == EXT2_MAX_SNAPSHOTS) {
+        printf("Error: Too many snapshots (at most %d)\n", EXT2_MAX_SNAPSHOTS);
+        return -1;
+    }
+    if (write_back_all() != 0) {
+        printf("Error: Failed to write back changes\n");
+        return -1;
+    }
+
+    pthread_mutex_lock(&snap_lock);
+    if (snap.count == 0) {
+        free_state();
+        snap.pending = calloc(1, bitmap_bytes());
+        snap.storage = calloc(1, bitmap_bytes());
+        if (snap.pending == NULL || snap.storage == NULL) {
+            free_state();
+            pthread_mutex_unlock(&snap_lock);
+            printf("Error: Out of memory\n");
+            return -1;
+        }
+        set_geometry(&fs.superblock);
+    }
+
+    uint32_t root = alloc_storage();
+    if (root == 0 || write_zero_block(root) != 0) {
+        if (root != 0) {
+            put_bit(snap.storage, root, 0);
+            free_block(root);
+        }
+        pthread_mutex_unlock(&snap_lock);
+        printf("Error: No space for snapshot\n");
+        return -1;
+    }
+    drain_converted();
+
+    ext2_snapshot_t *s = &snap.table[snap.count++];
+    memset(s, 0, sizeof(*s));
+    strcpy(s->name, name);
+    if (fs.superblock.s_snapshot_next_id == 0) {
+        fs.superblock.s_snapshot_next_id = 1;
+    }
+    s->id = fs.superblock.s_snapshot_next_id++;
+    s->time = time(NULL);
+    s->map = root;
+
+    // 旧的活动快照不再跟踪：它还没保存的块此刻仍在用，新快照同样会保护
+    __atomic_store_n(&snap.tracking, 0, __ATOMIC_RELAXED);
+    snap.cow_root = root;
+    if (build_pending() != 0) {
+        snap.count--;
+        put_bit(snap.storage, root, 0);
+        free_block(root);
+        if (snap.count > 0) {
+            snap.cow_root = snap.table[snap.count - 1].map;
+            snap.tracking = build_pending() == 0 && !(snap.table[snap.count - 1].flags & EXT2_SNAPSHOT_BROKEN);
+        }
+        pthread_mutex_unlock(&snap_lock);
+        printf("Error: Failed to read block bitmaps\n");
+        return -1;
+    }
+    __atomic_store_n(&snap.tracking, 1, __ATOMIC_RELAXED);
+    publish_table();
+    pthread_mutex_unlock(&snap_lock);
+
+    // 快照表马上写回原处，挂载时重放之前就能读到
+    return write_back_all() == 0 ? 0 : -1;
+}
+
+typedef struct {
+    uint32_t *keys;
+    uint32_t *values;
+    uint32_t count;
+    uint32_t capacity;
+    int failed;
+} entry_list_t;
+
+// 收集映射树中的记录（value 为0的是节点块本身）
+static void collect_entry(void *arg, uint32_t block_no, uint32_t value) {
+    entry_list_t *list = arg;
+    if (list->count == list->capacity) {
+        uint32_t capacity = list->capacity ? list->capacity * 2 : 256;
+        uint32_t *keys = realloc(list->keys, capacity * sizeof(uint32_t));
+        if (keys != NULL) {
+            list->keys = keys;
+        }
+        uint32_t *values = realloc(list->values, capacity * sizeof(uint32_t));
+        if (values != NULL) {
+            list->values = values;
+        }
+        if (keys == NULL || values == NULL) {
+            list->failed = 1;
+            return;
+        }
+        list->capacity = capacity;
+    }
+    list->keys[list->count] = block_no;
+    list->values[list->count] = value;
+    list->count++;
+}
+
+// 释放属于快照的块
+static void free_storage(uint32_t block_no) {
+    put_bit(snap.storage, block_no, 0);
+    free_block(block_no);
+}
+
+/*删除快照 k：它的记录中更早的快照 k-1 还需要的（k-1 时刻在用、k-1 自己没有记录的）移交给 k-1，
+其余的副本、转归的块和映射树节点都释放。删除的是活动快照时由 k-1 接着跟踪，
+它要保护的块是 k 还没保存的块中 k-1 时刻在用、k-1 也没保存的那些。*/
+int snapshot_delete(const char *name) {
+    pthread_mutex_lock(&snap_lock);
+    int found = find_snapshot(name);
+    if (found < 0) {
+        pthread_mutex_unlock(&snap_lock);
+        return -1;
+    }
+    uint32_t k = (uint32_t)found;
+    int was_active = k == snap.count - 1;
+    uint8_t *prev_used = NULL;
+    entry_list_t list = { NULL, NULL, 0, 0, 0 };
+    int result = -1;
+
+    if (k > 0) {
+        view_t v;
+        prev_used = malloc(bitmap_bytes());
+        if (prev_used == NULL || view_open(&v, k - 1, 1) != 0) {
+            goto out;
+        }
+        int failed = view_in_use(&v, prev_used);
+        view_close(&v);
+        if (failed) {
+            goto out;
+        }
+    }
+    if (map_walk(snap.table[k].map, collect_entry, &list) != 0 || list.failed) {
+        goto out;
+    }
+
+    uint32_t prev_root = k > 0 ? snap.table[k - 1].map : 0;
+    if (was_active && k > 0) {
+        snap.cow_root = prev_root;
+    }
+    for (uint32_t i = 0; i < list.count; i++) {
+        uint32_t b = list.keys[i];
+        uint32_t value = list.values[i];
+        if (value == 0) {
+            free_storage(b);  // 映射树节点
+            continue;
+        }
+        uint32_t have = 0;
+        if (k > 0 && test_bit(prev_used, b) && (map_lookup(prev_root, b, &have) != 0 ||
+                                                (have == 0 && map_insert(prev_root, b, value) != 0))) {
+            // 更早的快照需要的内容移交不过去，这份内容不释放，更早的快照记为不完整
+            snap.table[k - 1].flags |= EXT2_SNAPSHOT_BROKEN;
+            continue;
+        }
+        if (k > 0 && test_bit(prev_used, b) && have == 0) {
+            continue;
+        }
+        free_storage(value);
+    }
+    drain_converted();
+
+    if (was_active && k > 0 && snap.tracking) {
+        for (size_t i = 0; i < bitmap_bytes(); i++) {
+            __atomic_fetch_and(&snap.pending[i], prev_used[i], __ATOMIC_RELAXED);
+        }
+        if (map_walk(prev_root, clear_key, snap.pending) != 0) {
+            break_snapshots();
+        }
+    } else if (was_active) {
+        __atomic_store_n(&snap.tracking, 0, __ATOMIC_RELAXED);
+    }
+
+    memmove(&snap.table[k], &snap.table[k + 1], (snap.count - k - 1) * sizeof(ext2_snapshot_t));
+    snap.count--;
+    publish_table();
+    result = 0;
+
+out:
+    pthread_mutex_unlock(&snap_lock);
+    free(prev_used);
+    free(list.keys);
+    free(list.values);
+    if (result != 0) {
+        printf("Error: Failed to read snapshot map\n");
+        return -1;
+    }
+    return write_back_all() == 0 ? 0 : -1;
+}
+
+int snapshot_list(snapshot_info_t *infos, int max) {
+    pthread_mutex_lock(&snap_lock);
+    int n = 0;
+    for (uint32_t i = 0; i < snap.count && n < max; i++) {
+        infos[n].snapshot = snap.table[i];
+        infos[n].blocks = 0;
+        map_walk(snap.table[i].map, count_block, &infos[n].blocks);
+        n++;
+    }
+    pthread_mutex_unlock(&snap_lock);
+    return n;
+}
+
+/*导出的超级块：去掉快照表和快照特性，清除 VALID。导出的是某一时刻的镜像，
+位图中还有更早快照占用的块，挂载时的检查会把它们释放。*/
+static void sanitize_superblock(uint8_t *block) {
+    ext2_superblock_t sb;
+    memcpy(&sb, block, sizeof(sb));
+    sb.s_snapshot_count = 0;
+    memset(sb.s_snapshots, 0, sizeof(sb.s_snapshots));
+    sb.s_feature_incompat &= ~EXT2_FEATURE_INCOMPAT_SNAPSHOTS;
+    sb.s_state &= ~EXT2_VALID_FS;
+    memcpy(block, &sb, sizeof(sb));
+}
+
+static int is_zero_block(const uint8_t *block) {
+    for (int i = 0; i < BLOCK_SIZE; i++) {
+        if (block[i] != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*快照 index 时刻要导出的块：在用，不在日志区（日志超级块除外），不属于更早的快照。
+放在 wanted 中，调用者负责释放；失败返回-1。*/
+static int wanted_blocks(const view_t *v, uint8_t **wanted) {
+    uint8_t *used = malloc(bitmap_bytes());
+    uint8_t *older = calloc(1, bitmap_bytes());
+    int result = -1;
+    if (used != NULL && older != NULL && view_in_use(v, used) == 0 && mark_storage_before(v->index, older) == 0) {
+        for (size_t i = 0; i < bitmap_bytes(); i++) {
+            used[i] &= ~older[i];
+        }
+        for (uint32_t b = snap.journal_from; b < snap.journal_to && b < MAX_BLOCKS; b++) {
+            put_bit(used, b, 0);
+        }
+        result = 0;
+    }
+    free(older);
+    if (result != 0) {
+        free(used);
+        used = NULL;
+    }
+    *wanted = used;
+    return result;
+}
+
+int snapshot_export(const char *name, const char *host_image, snapshot_stats_t *stats) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    memset(stats, 0, sizeof(*stats));
+    int k = find_snapshot(name);
+    if (k < 0) {
+        return -1;
+    }
+    if (snap.table[k].flags & EXT2_SNAPSHOT_BROKEN) {
+        printf("Error: Snapshot %s is incomplete\n", name);
+        return -1;
+    }
+
+    view_t v;
+    uint8_t *wanted = NULL;
+    if (view_open(&v, (uint32_t)k, 0) != 0 || wanted_blocks(&v, &wanted) != 0) {
+        view_close(&v);
+        printf("Error: Failed to read snapshot map\n");
+        return -1;
+    }
+
+    int fd = open(host_image, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, (off_t)MAX_BLOCKS * BLOCK_SIZE) != 0) {
+        printf("Error: Cannot create host file %s\n", host_image);
+        if (fd >= 0) {
+            close(fd);
+        }
+        view_close(&v);
+        free(wanted);
+        return -1;
+    }
+
+    int result = 0;
+    uint8_t block[EXT2_MAX_BLOCK_SIZE];
+    for (uint32_t b = 0; b < MAX_BLOCKS && result == 0; b++) {
+        if (!test_bit(wanted, b)) {
+            continue;
+        }
+        if (view_read(&v, b, block) != 0) {
+            printf("Error: Failed to read block %u\n", b);
+            result = -1;
+            break;
+        }
+        if (b == 0) {
+            sanitize_superblock(block);
+        }
+        if (is_zero_block(block)) {
+            continue;   // 新建的文件已经全是0，留作空洞
+        }
+        if (pwrite(fd, block, BLOCK_SIZE, (off_t)b * BLOCK_SIZE) != BLOCK_SIZE) {
+            printf("Error: Failed to write host file %s\n", host_image);
+            result = -1;
+        }
+        stats->blocks++;
+        stats->bytes += BLOCK_SIZE;
+    }
+
+    if (close(fd) != 0) {
+        result = -1;
+    }
+    view_close(&v);
+    free(wanted);
+    stats->seconds = elapsed_since(&start);
+    return result;
+}
+
+/*从快照 from 到 to 变化的块：to 时刻要导出的块中，from 时刻不在用的，
+或者在 from 到 to 之间被覆盖过的（快照 from 到 to-1 的映射树中有副本的记录）。*/
+int snapshot_diff(const char *from, const char *to, const char *host_delta, snapshot_stats_t *stats) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    memset(stats, 0, sizeof(*stats));
+    int a = find_snapshot(from);
+    int z = a < 0 ? -1 : find_snapshot(to);
+    if (a < 0 || z < 0) {
+        return -1;
+    }
+    if (a >= z) {
+        printf("Error: Snapshot %s is not older than %s\n", from, to);
+        return -1;
+    }
+    if ((snap.table[a].flags | snap.table[z].flags) & EXT2_SNAPSHOT_BROKEN) {
+        printf("Error: Snapshot is incomplete\n");
+        return -1;
+    }
+
+    view_t va, vz;
+    uint8_t *old_used = malloc(bitmap_bytes());
+    uint8_t *changed = calloc(1, bitmap_bytes());
+    uint8_t *wanted = NULL;
+    int result = -1;
+    va.remap = vz.remap = NULL;
+    if (old_used == NULL || changed == NULL || view_open(&va, (uint32_t)a, 0) != 0) {
+        goto fail;
+    }
+    int failed = view_in_use(&va, old_used);
+    view_close(&va);
+    if (failed || view_open(&vz, (uint32_t)z, 0) != 0 || wanted_blocks(&vz, &wanted) != 0) {
+        goto fail;
+    }
+    for (int j = a; j < z; j++) {
+        if (map_walk(snap.table[j].map, mark_changed, changed) != 0) {
+            goto fail;
+        }
+    }
+
+    snapshot_delta_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = SNAPSHOT_DELTA_MAGIC;
+    header.version = SNAPSHOT_DELTA_VERSION;
+    header.block_size = BLOCK_SIZE;
+    header.blocks_count = MAX_BLOCKS;
+    header.from_id = snap.table[a].id;
+    header.to_id = snap.table[z].id;
+    for (uint32_t b = 0; b < MAX_BLOCKS; b++) {
+        if (test_bit(wanted, b) && (test_bit(changed, b) || !test_bit(old_used, b))) {
+            header.count++;
+        } else {
+            put_bit(wanted, b, 0);
+        }
+    }
+
+    FILE *out = fopen(host_delta, "wb");
+    if (out == NULL) {
+        printf("Error: Cannot create host file %s\n", host_delta);
+        goto out;
+    }
+    result = fwrite(&header, sizeof(header), 1, out) == 1 ? 0 : -1;
+    uint8_t block[EXT2_MAX_BLOCK_SIZE];
+    for (uint32_t b = 0; b < MAX_BLOCKS && result == 0; b++) {
+        if (!test_bit(wanted, b)) {
+            continue;
+        }
+        if (view_read(&vz, b, block) != 0) {
+            printf("Error: Failed to read block %u\n", b);
+            result = -1;
+            break;
+        }
+        if (b == 0) {
+            sanitize_superblock(block);
+        }
+        if (fwrite(&b, sizeof(b), 1, out) != 1 || fwrite(block, BLOCK_SIZE, 1, out) != 1) {
+            result = -1;
+            break;
+        }
+        stats->blocks++;
+        stats->bytes += BLOCK_SIZE;
+    }
+    if (fclose(out) != 0 || result != 0) {
+        printf("Error: Failed to write host file %s\n", host_delta);
+        result = -1;
+    }
+    goto out;
+
+fail:
+    printf("Error: Failed to read snapshot map\n");
+out:
+    view_close(&vz);
+    free(old_used);
+    free(changed);
+    free(wanted);
+    stats->seconds = elapsed_since(&start);
+    return result;
+}
+
+int snapshot_apply(const char *host_delta, const char *host_image, snapshot_stats_t *stats) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    memset(stats, 0, sizeof(*stats));
+
+    FILE *in = fopen(host_delta, "rb");
+    if (in == NULL) {
+        printf("Error: Cannot open host file %s\n", host_delta);
+        return -1;
+    }
+    snapshot_delta_header_t header;
+    if (fread(&header, sizeof(header), 1, in) != 1 || header.magic != SNAPSHOT_DELTA_MAGIC ||
+        header.version != SNAPSHOT_DELTA_VERSION || header.block_size < EXT2_MIN_BLOCK_SIZE ||
+        header.block_size > EXT2_MAX_BLOCK_SIZE) {
+        printf("Error: %s is not a snapshot delta\n", host_delta);
+        fclose(in);
+        return -1;
+    }
+
+    int fd = open(host_image, O_WRONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size != (off_t)header.blocks_count * header.block_size) {
+        printf("Error: %s does not match the delta's image size\n", host_image);
+        if (fd >= 0) {
+            close(fd);
+        }
+        fclose(in);
+        return -1;
+    }
+
+    int result = 0;
+    uint8_t block[EXT2_MAX_BLOCK_SIZE];
+    for (uint32_t i = 0; i < header.count; i++) {
+        uint32_t b;
+        if (fread(&b, sizeof(b), 1, in) != 1 || fread(block, header.block_size, 1, in) != 1 ||
+            b >= header.blocks_count) {
+            printf("Error: %s is truncated or corrupt\n", host_delta);
+            result = -1;
+            break;
+        }
+        if (pwrite(fd, block, header.block_size, (off_t)b * header.block_size) != (ssize_t)header.block_size) {
+            printf("Error: Failed to write host file %s\n", host_image);
+            result = -1;
+            break;
+        }
+        stats->blocks++;
+        stats->bytes += header.block_size;
+    }
+
+    if (fsync(fd) != 0 || close(fd) != 0) {
+        result = -1;
+    }
+    fclose(in);
+    stats->seconds = elapsed_since(&start);
+    return result;
+}
@@ -0,0 +1,210 @@
+#include "../include/stats.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *names[STATS_COUNT] = {
+    "read_block", "write_block", "read_inode", "write_inode",
+    "find_free_bit", "find_directory_entry", "path_to_inode"
+};
+
+const char *stats_name(int id) {
+    return id >= 0 && id < STATS_COUNT ? names[id] : "?";
+}
+
+#ifndef EXT2_NO_STATS
+
+/*每个线程一个计数块，挂在全局链表上，只有所属线程写它（用普通的读加 relaxed 原子写，
+汇总的线程用 relaxed 原子读，不会读到撕裂的值）。线程退出后计数块留在链表上，计数照常汇总，
+下一个新线程接着使用它，服务器反复创建连接不会让链表无限增长。
+
+清零不直接改别的线程的计数块：全局代数加一，汇总时跳过代数不同的块，
+所属线程下次计数时发现代数变了，先清空自己的计数块。*/
+typedef struct stats_thread {
+    stats_counter_t counters[STATS_COUNT];
+    uint32_t epoch;
+    int in_use;
+    struct stats_thread *next;
+} stats_thread_t;
+
+static __thread stats_thread_t *self = NULL;
+static __thread int self_failed = 0;   // 分配失败后这个线程不再计数
+
+static pthread_key_t thread_key;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static stats_thread_t *threads = NULL;
+static uint32_t epoch = 1;
+static uint64_t reset_at = 0;           // 开始计数或上次清零的时间（CLOCK_MONOTONIC 纳秒）
+
+static void release_thread(void *arg) {
+    stats_thread_t *t = arg;
+    pthread_mutex_lock(&registry_lock);
+    t->in_use = 0;
+    pthread_mutex_unlock(&registry_lock);
+}
+
+static void create_key(void) {
+    pthread_key_create(&thread_key, release_thread);
+}
+
+// 当前线程的计数块，第一次计数时取一个空闲的或新分配一个
+static stats_thread_t *thread_block(void) {
+    if (self != NULL || self_failed) {
+        return self;
+    }
+    pthread_once(&key_once, create_key);
+
+    pthread_mutex_lock(&registry_lock);
+    stats_thread_t *t = threads;
+    while (t != NULL && t->in_use) {
+        t = t->next;
+    }
+    if (t == NULL) {
+        t = calloc(1, sizeof(stats_thread_t));
+        if (t != NULL) {
+            t->next = threads;
+            threads = t;
+        }
+    }
+    if (t != NULL) {
+        t->in_use = 1;
+    }
+    if (reset_at == 0) {
+        reset_at = stats_clock();
+    }
+    pthread_mutex_unlock(&registry_lock);
+
+    if (t == NULL) {
+        self_failed = 1;
+        return NULL;
+    }
+    pthread_setspecific(thread_key, t);
+    self = t;
+    return t;
+}
+
+static void add(uint64_t *counter, uint64_t n) {
+    __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+static int bucket_of(uint64_t ns) {
+    if (ns == 0) {
+        return 0;
+    }
+    int bucket = 63 - __builtin_clzll(ns);
+    return bucket < STATS_BUCKETS ? bucket : STATS_BUCKETS - 1;
+}
+
+void stats_record(int id, uint64_t start, int failed) {
+    uint64_t ns = stats_clock() - start;
+    stats_thread_t *t = thread_block();
+    if (t == NULL) {
+        return;
+    }
+
+    uint32_t current = __atomic_load_n(&epoch, __ATOMIC_RELAXED);
+    if (t->epoch != current) {
+        uint64_t *words = (uint64_t *)t->counters;
+        for (size_t i = 0; i < STATS_COUNT * sizeof(stats_counter_t) / sizeof(uint64_t); i++) {
+            __atomic_store_n(&words[i], 0, __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&t->epoch, current, __ATOMIC_RELEASE);
+    }
+
+    stats_counter_t *c = &t->counters[id];
+    add(&c->calls, 1);
+    if (failed) {
+        add(&c->failed, 1);
+    }
+    add(&c->total_ns, ns);
+    if (ns > c->max_ns) {
+        __atomic_store_n(&c->max_ns, ns, __ATOMIC_RELAXED);
+    }
+    add(&c->buckets[bucket_of(ns)], 1);
+}
+
+int stats_enabled(void) {
+    return 1;
+}
+
+void stats_collect(stats_counter_t *out, double *seconds, int *thread_count) {
+    memset(out, 0, sizeof(stats_counter_t) * STATS_COUNT);
+    int count = 0;
+
+    pthread_mutex_lock(&registry_lock);
+    uint32_t current = __atomic_load_n(&epoch, __ATOMIC_RELAXED);
+    for (stats_thread_t *t = threads; t != NULL; t = t->next) {
+        if (__atomic_load_n(&t->epoch, __ATOMIC_ACQUIRE) != current) {
+            continue; // 清零之后还没有计过数
+        }
+        count++;
+        for (int id = 0; id < STATS_COUNT; id++) {
+            const stats_counter_t *c = &t->counters[id];
+            out[id].calls += __atomic_load_n(&c->calls, __ATOMIC_RELAXED);
+            out[id].failed += __atomic_load_n(&c->failed, __ATOMIC_RELAXED);
+            out[id].total_ns += __atomic_load_n(&c->total_ns, __ATOMIC_RELAXED);
+            uint64_t max = __atomic_load_n(&c->max_ns, __ATOMIC_RELAXED);
+            if (max > out[id].max_ns) {
+                out[id].max_ns = max;
+            }
+            for (int b = 0; b < STATS_BUCKETS; b++) {
+                out[id].buckets[b] += __atomic_load_n(&c->buckets[b], __ATOMIC_RELAXED);
+            }
+        }
+    }
+    uint64_t since = reset_at;
+    pthread_mutex_unlock(&registry_lock);
+
+    if (seconds != NULL) {
+        *seconds = since != 0 ? (stats_clock() - since) / 1e9 : 0.0;
+    }
+    if (thread_count != NULL) {
+        *thread_count = count;
+    }
+}
+
+void stats_reset(void) {
+    pthread_mutex_lock(&registry_lock);
+    __atomic_store_n(&epoch, epoch + 1, __ATOMIC_RELAXED);
+    reset_at = stats_clock();
+    pthread_mutex_unlock(&registry_lock);
+}
+
+#else
+
+int stats_enabled(void) {
+    return 0;
+}
+
+void stats_collect(stats_counter_t *out, double *seconds, int *thread_count) {
+    memset(out, 0, sizeof(stats_counter_t) * STATS_COUNT);
+    if (seconds != NULL) {
+        *seconds = 0.0;
+    }
+    if (thread_count != NULL) {
+        *thread_count = 0;
+    }
+}
+
+void stats_reset(void) {
+}
+
+#endif // EXT2_NO_STATS
+
+uint64_t stats_percentile(const stats_counter_t *c, double p) {
+    if (c->calls == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(p * c->calls);
+    uint64_t seen = 0;
+    for (int b = 0; b < STATS_BUCKETS; b++) {
+        seen += c->buckets[b];
+        if (seen > rank) {
+            uint64_t upper = b < STATS_BUCKETS - 1 ? (1ull << (b + 1)) : c->max_ns;
+            return upper < c->max_ns ? upper : c->max_ns;
+        }
+    }
+    return c->max_ns;
+}
@@ -0,0 +1,769 @@
+#include "../include/transfer.h"
+#include "../include/inode.h"
+#include "../include/directory.h"
+#include "../include/icache.h"
+#include "../include/user.h"
+#include "../include/ext2.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+/*批量导入导出的流水线：读的一方按深度优先顺序遍历源树，把"目录、文件开始、数据段、文件结束、
+符号链接"依次放进一个环形队列，写的一方按同样的顺序在目标端重建。队列有 TRANSFER_DEPTH 个槽位，
+每个槽位带一块 TRANSFER_CHUNK 的缓冲区，只有一个生产者和一个消费者：
+读满一段就交给对方，读端最多领先 TRANSFER_DEPTH 段，宿主I/O和镜像I/O互相重叠。
+
+镜像一侧的操作始终在调用线程中进行（会话和凭据属于调用线程，名字空间锁也由它持有），
+后台线程只做宿主文件系统上的读写。任何一方遇到无法继续的错误（空间不足、宿主写失败）时取消队列，
+另一方在下一次取放时停下来。*/
+
+typedef enum {
+    ITEM_DIR,      // 目录（path 为空表示顶层）
+    ITEM_FILE,     // 普通文件开始，size 是源文件大小
+    ITEM_DATA,     // 文件内容的一段
+    ITEM_END,      // 文件结束，error 表示读源文件中途出错
+    ITEM_SYMLINK,  // 符号链接，目标在 data 中
+    ITEM_DONE      // 源树遍历完毕
+} item_kind_t;
+
+typedef struct {
+    item_kind_t kind;
+    char path[MAX_PATH];  // 相对于顶层的路径
+    uint16_t mode;        // 权限位
+    uint64_t size;
+    size_t len;
+    int error;
+    uint8_t *data;
+} transfer_item_t;
+
+typedef struct {
+    transfer_item_t items[TRANSFER_DEPTH];
+    int head;             // 下一个待消费的槽位
+    int count;            // 已放入还没消费的槽位数
+    int cancelled;
+    pthread_mutex_t lock;
+    pthread_cond_t filled;
+    pthread_cond_t drained;
+} transfer_pipe_t;
+
+// 一次导入或导出：两个线程共享的参数
+typedef struct {
+    transfer_pipe_t pipe;
+    const char *image_root;
+    const char *host_root;
+    uint32_t producer_failed;  // 读端跳过的项目数（只由读端修改）
+    uint32_t consumer_failed;  // 写端跳过的项目数（只由写端修改）
+    int fatal;                 // 写端中止
+    transfer_stats_t *stats;   // 计数只由写端修改
+} transfer_job_t;
+
+static int pipe_init(transfer_pipe_t *p) {
+    memset(p, 0, sizeof(*p));
+    for (int i = 0; i < TRANSFER_DEPTH; i++) {
+        p->items[i].data = malloc(TRANSFER_CHUNK);
+        if (p->items[i].data == NULL) {
+            while (--i >= 0) {
+                free(p->items[i].data);
+            }
+            return -1;
+        }
+    }
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->filled, NULL);
+    pthread_cond_init(&p->drained, NULL);
+    return 0;
+}
+
+static void pipe_destroy(transfer_pipe_t *p) {
+    for (int i = 0; i < TRANSFER_DEPTH; i++) {
+        free(p->items[i].data);
+    }
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->filled);
+    pthread_cond_destroy(&p->drained);
+}
+
+/*生产者取得下一个空槽位（等到有空位为止），填好后用 pipe_push 交出；队列已取消时返回 NULL。
+取得的槽位在 pipe_push 之前不属于消费者，不用的话直接放弃即可，下次还会取到同一个。*/
+static transfer_item_t *pipe_claim(transfer_pipe_t *p) {
+    pthread_mutex_lock(&p->lock);
+    while (p->count == TRANSFER_DEPTH && !p->cancelled) {
+        pthread_cond_wait(&p->drained, &p->lock);
+    }
+    transfer_item_t *item = NULL;
+    if (!p->cancelled) {
+        item = &p->items[(p->head + p->count) % TRANSFER_DEPTH];
+    }
+    pthread_mutex_unlock(&p->lock);
+    if (item != NULL) {
+        item->path[0] = '\0';
+        item->mode = 0;
+        item->size = 0;
+        item->len = 0;
+        item->error = 0;
+    }
+    return item;
+}
+
+static void pipe_push(transfer_pipe_t *p) {
+    pthread_mutex_lock(&p->lock);
+    p->count++;
+    pthread_cond_signal(&p->filled);
+    pthread_mutex_unlock(&p->lock);
+}
+
+// 消费者取得最早放入的槽位，处理完用 pipe_pop 归还；队列已取消时返回 NULL
+static transfer_item_t *pipe_peek(transfer_pipe_t *p) {
+    pthread_mutex_lock(&p->lock);
+    while (p->count == 0 && !p->cancelled) {
+        pthread_cond_wait(&p->filled, &p->lock);
+    }
+    transfer_item_t *item = p->cancelled ? NULL : &p->items[p->head];
+    pthread_mutex_unlock(&p->lock);
+    return item;
+}
+
+static void pipe_pop(transfer_pipe_t *p) {
+    pthread_mutex_lock(&p->lock);
+    p->head = (p->head + 1) % TRANSFER_DEPTH;
+    p->count--;
+    pthread_cond_signal(&p->drained);
+    pthread_mutex_unlock(&p->lock);
+}
+
+static void pipe_cancel(transfer_pipe_t *p) {
+    pthread_mutex_lock(&p->lock);
+    p->cancelled = 1;
+    pthread_cond_broadcast(&p->filled);
+    pthread_cond_broadcast(&p->drained);
+    pthread_mutex_unlock(&p->lock);
+}
+
+// 放入一个不带数据的项目；队列已取消时返回-1
+static int pipe_put(transfer_pipe_t *p, item_kind_t kind, const char *path, uint16_t mode, uint64_t size, int error) {
+    transfer_item_t *item = pipe_claim(p);
+    if (item == NULL) {
+        return -1;
+    }
+    item->kind = kind;
+    snprintf(item->path, sizeof(item->path), "%s", path);
+    item->mode = mode;
+    item->size = size;
+    item->error = error;
+    pipe_push(p);
+    return 0;
+}
+
+// 顶层路径接上相对路径；结果超过 MAX_PATH 时返回-1
+static int join_path(char *out, const char *base, const char *rel) {
+    int n;
+    if (rel[0] == '\0') {
+        n = snprintf(out, MAX_PATH, "%s", base);
+    } else {
+        size_t len = strlen(base);
+        n = snprintf(out, MAX_PATH, "%s%s%s", base, len > 0 && base[len - 1] == '/' ? "" : "/", rel);
+    }
+    return n < 0 || n >= MAX_PATH ? -1 : 0;
+}
+
+static int child_path(char *out, const char *rel, const char *name) {
+    int n = rel[0] == '\0' ? snprintf(out, MAX_PATH, "%s", name)
+                           : snprintf(out, MAX_PATH, "%s/%s", rel, name);
+    return n < 0 || n >= MAX_PATH ? -1 : 0;
+}
+
+static double elapsed_since(const struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// 读满 size 字节，只在文件末尾返回较少的字节数；出错返回-1
+static ssize_t read_full(int fd, uint8_t *buffer, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = read(fd, buffer + done, size - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        done += n;
+    }
+    return done;
+}
+
+static int write_full(int fd, const uint8_t *buffer, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = write(fd, buffer + done, size - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+/* ---------- 导入：后台线程读宿主树，调用线程写镜像 ---------- */
+
+static int host_read_file(transfer_job_t *job, const char *host, const char *rel, const struct stat *st) {
+    transfer_pipe_t *p = &job->pipe;
+    int fd = open(host, O_RDONLY);
+    if (fd < 0) {
+        printf("Error: Cannot open host file: %s\n", host);
+        job->producer_failed++;
+        return 0;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    if (pipe_put(p, ITEM_FILE, rel, st->st_mode & 0777, st->st_size, 0) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    int error = 0;
+    for (;;) {
+        transfer_item_t *item = pipe_claim(p);
+        if (item == NULL) {
+            close(fd);
+            return -1;
+        }
+        ssize_t n = read_full(fd, item->data, TRANSFER_CHUNK);
+        if (n < 0) {
+            printf("Error: Failed to read host file: %s\n", host);
+            job->producer_failed++;
+            error = 1;
+            break;
+        }
+        if (n > 0) {
+            item->kind = ITEM_DATA;
+            item->len = n;
+            pipe_push(p);
+        }
+        if (n < TRANSFER_CHUNK) {
+            break; // 文件末尾
+        }
+    }
+    close(fd);
+    return pipe_put(p, ITEM_END, rel, 0, 0, error);
+}
+
+static int host_walk(transfer_job_t *job, const char *rel, int follow) {
+    char host[MAX_PATH];
+    if (join_path(host, job->host_root, rel) != 0) {
+        printf("Error: Path too long: %s\n", rel);
+        job->producer_failed++;
+        return 0;
+    }
+
+    // 顶层路径跟随符号链接，树中的符号链接原样导入
+    struct stat st;
+    if ((follow ? stat(host, &st) : lstat(host, &st)) != 0) {
+        printf("Error: Cannot open host file: %s\n", host);
+        job->producer_failed++;
+        return 0;
+    }
+
+    if (S_ISREG(st.st_mode)) {
+        return host_read_file(job, host, rel, &st);
+    }
+
+    if (S_ISLNK(st.st_mode)) {
+        transfer_item_t *item = pipe_claim(&job->pipe);
+        if (item == NULL) {
+            return -1;
+        }
+        ssize_t n = readlink(host, (char*)item->data, MAX_PATH - 1);
+        if (n <= 0) {
+            printf("Error: Cannot read host symlink: %s\n", host);
+            job->producer_failed++;
+            return 0;
+        }
+        item->kind = ITEM_SYMLINK;
+        snprintf(item->path, sizeof(item->path), "%s", rel);
+        item->len = n;
+        pipe_push(&job->pipe);
+        return 0;
+    }
+
+    if (!S_ISDIR(st.st_mode)) {
+        printf("Error: Skipping special file: %s\n", host);
+        job->producer_failed++;
+        return 0;
+    }
+
+    // 按名字排序遍历，导入的结果和块布局不依赖宿主目录的顺序
+    struct dirent **names;
+    int count = scandir(host, &names, NULL, alphasort);
+    if (count < 0) {
+        printf("Error: Cannot read host directory: %s\n", host);
+        job->producer_failed++;
+        return 0;
+    }
+
+    int result = pipe_put(&job->pipe, ITEM_DIR, rel, st.st_mode & 0777, 0, 0);
+    for (int i = 0; i < count; i++) {
+        const char *name = names[i]->d_name;
+        if (result == 0 && strcmp(name, ".") != 0 && strcmp(name, "..") != 0) {
+            char child[MAX_PATH];
+            if (strlen(name) > MAX_FILENAME || child_path(child, rel, name) != 0) {
+                printf("Error: Name too long: %s/%s\n", host, name);
+                job->producer_failed++;
+            } else {
+                result = host_walk(job, child, 0);
+            }
+        }
+        free(names[i]);
+    }
+    free(names);
+    return result;
+}
+
+static void *import_reader(void *arg) {
+    transfer_job_t *job = arg;
+    if (host_walk(job, "", 1) == 0) {
+        pipe_put(&job->pipe, ITEM_DONE, "", 0, 0, 0);
+    }
+    return NULL;
+}
+
+/*在镜像中创建普通文件或符号链接（不打印成功信息，批量导入时逐个打印太多）。
+成功返回0并通过 inode_no 返回新inode，失败时已打印原因。*/
+static int image_create(const char *path, uint16_t mode, uint8_t file_type, uint32_t *inode_no) {
+    uint32_t parent_inode;
+    char child_name[MAX_FILENAME];
+    if (get_parent_inode(path, &parent_inode, child_name) != 0 || parent_inode == 0) {
+        printf("Error: Parent directory does not exist: %s\n", path);
+        return -1;
+    }
+
+    int error = check_access(parent_inode, EXT2_S_IFDIR, EXT2_S_IWUSR);
+    if (error != 0) {
+        printf(error == -ENOTDIR ? "Error: Parent is not a directory: %s\n" : "Error: Permission denied: %s\n", path);
+        return -1;
+    }
+
+    uint32_t created = create_inode(parent_inode, mode, get_current_uid(), get_current_gid());
+    if (created == 0) {
+        printf("Error: Failed to create file: %s\n", path);
+        return -1;
+    }
+    if (add_directory_entry(parent_inode, child_name, created, file_type) != 0) {
+        delete_inode(created);
+        printf("Error: Failed to add directory entry: %s\n", path);
+        return -1;
+    }
+
+    *inode_no = created;
+    return 0;
+}
+
+static int import_dir(const char *path, uint16_t mode) {
+    uint32_t inode_no;
+    if (path_to_inode(path, &inode_no) == 0) {
+        if (!is_directory(inode_no)) {
+            printf("Error: Not a directory: %s\n", path);
+            return -1;
+        }
+        return 0; // 已有的目录：合并
+    }
+    if (create_directory(path, mode) != 0) {
+        printf("Error: Failed to create directory: %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+// 打开要导入的文件：已有的普通文件截断为空，不存在时创建；然后按源文件大小预留连续块
+static int import_file_begin(const char *path, uint16_t mode, uint64_t size, uint32_t *inode_no) {
+    if (path_to_inode(path, inode_no) == 0) {
+        int error = check_access(*inode_no, EXT2_S_IFREG, EXT2_S_IWUSR);
+        if (error != 0) {
+            printf(error == -EISDIR ? "Error: Not a regular file: %s\n" : "Error: Permission denied: %s\n", path);
+            return -1;
+        }
+        truncate_inode(*inode_no, 0);
+    } else if (image_create(path, EXT2_S_IFREG | mode, 1, inode_no) != 0) {
+        return -1;
+    }
+
+    if (reserve_inode_blocks(*inode_no, size) != 0) {
+        // 预留失败（空间不足或超过最大文件大小）：放弃已经预留的部分，照常写入，写不下时再报错
+        truncate_inode(*inode_no, 0);
+    }
+    return 0;
+}
+
+// 导入符号链接：已有同名的符号链接时替换它
+static int import_symlink(const char *path, const char *target, size_t len) {
+    uint32_t inode_no;
+    if (path_to_inode_nofollow(path, &inode_no) == 0) {
+        uint32_t parent_inode;
+        char child_name[MAX_FILENAME];
+        if (!is_symlink(inode_no) || get_parent_inode(path, &parent_inode, child_name) != 0 ||
+            check_access(parent_inode, EXT2_S_IFDIR, EXT2_S_IWUSR) != 0 ||
+            unlink_entry(parent_inode, child_name) != 0) {
+            printf("Error: File exists: %s\n", path);
+            return -1;
+        }
+    }
+
+    if (image_create(path, EXT2_S_IFLNK | 0777, 7, &inode_no) != 0) {
+        return -1;
+    }
+    if (write_inode_data(inode_no, target, len, 0) != (ssize_t)len) {
+        printf("Error: Failed to create symlink: %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+// 调用线程：按顺序把队列中的项目写进镜像
+static void import_writer(transfer_job_t *job) {
+    transfer_pipe_t *p = &job->pipe;
+    transfer_stats_t *stats = job->stats;
+    char path[MAX_PATH] = "";
+    uint32_t inode_no = 0;
+    uint64_t offset = 0;
+    int skip = 1;
+
+    transfer_item_t *item;
+    while ((item = pipe_peek(p)) != NULL && item->kind != ITEM_DONE) {
+        int ok = item->kind == ITEM_DATA || item->kind == ITEM_END || join_path(path, job->image_root, item->path) == 0;
+        if (!ok) {
+            printf("Error: Path too long: %s\n", item->path);
+            job->consumer_failed++;
+        }
+
+        switch (item->kind) {
+        case ITEM_DIR:
+            if (ok && import_dir(path, item->mode) == 0) {
+                stats->directories++;
+            } else if (ok) {
+                job->consumer_failed++;
+            }
+            break;
+        case ITEM_FILE:
+            skip = !ok || import_file_begin(path, item->mode, item->size, &inode_no) != 0;
+            if (ok && skip) {
+                job->consumer_failed++;
+            }
+            offset = 0;
+            break;
+        case ITEM_DATA:
+            if (skip) {
+                break;
+            }
+            if (write_inode_data(inode_no, item->data, item->len, offset) != (ssize_t)item->len) {
+                printf("Error: Failed to write file (disk full?): %s\n", path);
+                job->consumer_failed++;
+                job->fatal = 1;
+                truncate_inode(inode_no, offset);
+                pipe_cancel(p);
+                return;
+            }
+            offset += item->len;
+            stats->bytes += item->len;
+            break;
+        case ITEM_END:
+            if (!skip) {
+                // 源文件比开始时小（或读到一半出错）时释放多余的预留块
+                truncate_inode(inode_no, offset);
+                stats->files += !item->error;
+            }
+            skip = 1;
+            break;
+        case ITEM_SYMLINK:
+            if (ok && import_symlink(path, (const char*)item->data, item->len) == 0) {
+                stats->symlinks++;
+            } else if (ok) {
+                job->consumer_failed++;
+            }
+            break;
+        case ITEM_DONE:
+            break;
+        }
+        pipe_pop(p);
+    }
+}
+
+static int run_job(transfer_job_t *job, void *(*worker)(void *), void (*local)(transfer_job_t *)) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, worker, job) != 0) {
+        printf("Error: Cannot start transfer thread\n");
+        return -1;
+    }
+    local(job);
+    pthread_join(thread, NULL);
+
+    job->stats->failed = job->producer_failed + job->consumer_failed;
+    return job->fatal || job->stats->failed > 0 ? -1 : 0;
+}
+
+static int start_job(transfer_job_t *job, const char *image_root, const char *host_root, transfer_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    memset(job, 0, sizeof(*job));
+    if (pipe_init(&job->pipe) != 0) {
+        printf("Error: Out of memory\n");
+        return -1;
+    }
+    job->image_root = image_root;
+    job->host_root = host_root;
+    job->stats = stats;
+    return 0;
+}
+
+int transfer_import(const char *host_path, const char *path, transfer_stats_t *stats) {
+    transfer_job_t job;
+    if (start_job(&job, path, host_path, stats) != 0) {
+        return -1;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int result = run_job(&job, import_reader, import_writer);
+    stats->seconds = elapsed_since(&start);
+
+    pipe_destroy(&job.pipe);
+    return result;
+}
+
+/* ---------- 导出：调用线程读镜像，后台线程写宿主树 ---------- */
+
+static uint16_t image_mode(uint32_t inode_no) {
+    ext2_inode_t *inode = icache_get(inode_no);
+    if (inode == NULL) {
+        return 0;
+    }
+    uint16_t mode = inode->i_mode;
+    icache_put(inode_no);
+    return mode;
+}
+
+static int image_read_file(transfer_job_t *job, uint32_t inode_no, const char *path, const char *rel) {
+    transfer_pipe_t *p = &job->pipe;
+    if (check_access(inode_no, EXT2_S_IFREG, EXT2_S_IRUSR) != 0) {
+        printf("Error: Permission denied: %s\n", path);
+        job->producer_failed++;
+        return 0;
+    }
+
+    uint64_t size = get_file_size(inode_no);
+    if (pipe_put(p, ITEM_FILE, rel, image_mode(inode_no) & 0777, size, 0) != 0) {
+        return -1;
+    }
+
+    int error = 0;
+    uint64_t offset = 0;
+    while (offset < size) {
+        transfer_item_t *item = pipe_claim(p);
+        if (item == NULL) {
+            return -1;
+        }
+        size_t want = size - offset < TRANSFER_CHUNK ? size - offset : TRANSFER_CHUNK;
+        ssize_t n = read_inode_data(inode_no, item->data, want, offset);
+        if (n <= 0) {
+            printf("Error: Failed to read file: %s\n", path);
+            job->producer_failed++;
+            error = 1;
+            break;
+        }
+        item->kind = ITEM_DATA;
+        item->len = n;
+        pipe_push(p);
+        offset += n;
+    }
+    return pipe_put(p, ITEM_END, rel, 0, 0, error);
+}
+
+static int image_walk(transfer_job_t *job, uint32_t inode_no, const char *rel) {
+    char path[MAX_PATH];
+    if (join_path(path, job->image_root, rel) != 0) {
+        printf("Error: Path too long: %s\n", rel);
+        job->producer_failed++;
+        return 0;
+    }
+
+    if (is_regular_file(inode_no)) {
+        return image_read_file(job, inode_no, path, rel);
+    }
+
+    if (is_symlink(inode_no)) {
+        transfer_item_t *item = pipe_claim(&job->pipe);
+        if (item == NULL) {
+            return -1;
+        }
+        int len = read_symlink(inode_no, (char*)item->data, MAX_PATH);
+        if (len < 0) {
+            printf("Error: Cannot read symlink: %s\n", path);
+            job->producer_failed++;
+            return 0;
+        }
+        item->kind = ITEM_SYMLINK;
+        snprintf(item->path, sizeof(item->path), "%s", rel);
+        item->len = len;
+        pipe_push(&job->pipe);
+        return 0;
+    }
+
+    if (check_access(inode_no, EXT2_S_IFDIR, EXT2_S_IRUSR) != 0) {
+        printf("Error: Permission denied: %s\n", path);
+        job->producer_failed++;
+        return 0;
+    }
+
+    // 先把目录项读出来再逐个递归；数组收缩到实际项数，深层目录只占用需要的内存
+    int max_entries = DIR_MAX_BLOCKS * BLOCK_SIZE / EXT2_DIR_REC_LEN(1);
+    ext2_dir_entry_t *entries = malloc(max_entries * sizeof(ext2_dir_entry_t));
+    int count = entries != NULL ? read_directory_entries(inode_no, entries, max_entries) : -1;
+    if (count < 0) {
+        printf("Error: Failed to read directory: %s\n", path);
+        job->producer_failed++;
+        free(entries);
+        return 0;
+    }
+    if (count > 0) {
+        ext2_dir_entry_t *shrunk = realloc(entries, count * sizeof(ext2_dir_entry_t));
+        entries = shrunk != NULL ? shrunk : entries;
+    }
+
+    int result = pipe_put(&job->pipe, ITEM_DIR, rel, image_mode(inode_no) & 0777, 0, 0);
+    for (int i = 0; i < count && result == 0; i++) {
+        if (strcmp(entries[i].name, ".") == 0 || strcmp(entries[i].name, "..") == 0) {
+            continue;
+        }
+        char child[MAX_PATH];
+        if (child_path(child, rel, entries[i].name) != 0) {
+            printf("Error: Path too long: %s/%s\n", path, entries[i].name);
+            job->producer_failed++;
+            continue;
+        }
+        result = image_walk(job, entries[i].inode, child);
+    }
+    free(entries);
+    return result;
+}
+
+static void export_reader(transfer_job_t *job) {
+    uint32_t inode_no;
+    if (path_to_inode(job->image_root, &inode_no) != 0) {
+        printf("Error: File not found: %s\n", job->image_root);
+        job->producer_failed++;
+    } else if (image_walk(job, inode_no, "") != 0) {
+        return; // 写端已中止
+    }
+    pipe_put(&job->pipe, ITEM_DONE, "", 0, 0, 0);
+}
+
+// 后台线程：按顺序在宿主端重建
+static void *export_writer(void *arg) {
+    transfer_job_t *job = arg;
+    transfer_pipe_t *p = &job->pipe;
+    transfer_stats_t *stats = job->stats;
+    char host[MAX_PATH] = "";
+    int fd = -1;
+
+    transfer_item_t *item;
+    while ((item = pipe_peek(p)) != NULL && item->kind != ITEM_DONE) {
+        int ok = item->kind == ITEM_DATA || item->kind == ITEM_END || join_path(host, job->host_root, item->path) == 0;
+        if (!ok) {
+            printf("Error: Path too long: %s\n", item->path);
+            job->consumer_failed++;
+        }
+
+        struct stat st;
+        switch (item->kind) {
+        case ITEM_DIR:
+            // 目录至少对自己可写，后面才能在里面创建内容
+            if (ok && (mkdir(host, item->mode | 0700) == 0 ||
+                       (errno == EEXIST && stat(host, &st) == 0 && S_ISDIR(st.st_mode)))) {
+                stats->directories++;
+            } else if (ok) {
+                printf("Error: Cannot create host directory: %s\n", host);
+                job->consumer_failed++;
+            }
+            break;
+        case ITEM_FILE:
+            fd = ok ? open(host, O_WRONLY | O_CREAT | O_TRUNC, item->mode) : -1;
+            if (ok && fd < 0) {
+                printf("Error: Cannot create host file: %s\n", host);
+                job->consumer_failed++;
+            }
+            break;
+        case ITEM_DATA:
+            if (fd < 0) {
+                break;
+            }
+            if (write_full(fd, item->data, item->len) != 0) {
+                printf("Error: Failed to write host file: %s\n", host);
+                job->consumer_failed++;
+                job->fatal = 1;
+                close(fd);
+                pipe_cancel(p);
+                return NULL;
+            }
+            stats->bytes += item->len;
+            break;
+        case ITEM_END:
+            if (fd >= 0) {
+                if (close(fd) != 0) {
+                    printf("Error: Failed to write host file: %s\n", host);
+                    job->consumer_failed++;
+                } else {
+                    stats->files += !item->error;
+                }
+            }
+            fd = -1;
+            break;
+        case ITEM_SYMLINK:
+            if (!ok) {
+                break;
+            }
+            item->data[item->len] = '\0';
+            if (lstat(host, &st) == 0 && S_ISLNK(st.st_mode)) {
+                unlink(host);
+            }
+            if (symlink((const char*)item->data, host) == 0) {
+                stats->symlinks++;
+            } else {
+                printf("Error: Cannot create host symlink: %s\n", host);
+                job->consumer_failed++;
+            }
+            break;
+        case ITEM_DONE:
+            break;
+        }
+        pipe_pop(p);
+    }
+    return NULL;
+}
+
+int transfer_export(const char *path, const char *host_path, transfer_stats_t *stats) {
+    transfer_job_t job;
+    if (start_job(&job, path, host_path, stats) != 0) {
+        return -1;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int result = run_job(&job, export_writer, export_reader);
+    stats->seconds = elapsed_since(&start);
+
+    pipe_destroy(&job.pipe);
+    return result;
+}
@@ -0,0 +1,323 @@
+#include "../include/uring.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/*io_uring 后端：直接用系统调用建立提交/完成队列（不依赖 liburing）。
+
+每个线程有自己的环，第一次提交时建立，线程退出时释放，线程之间不需要加锁。
+一批请求只需一次 io_uring_enter 提交，然后等待完成队列；
+短读写在完成时推进 iovec 并重新提交剩余部分，直到整个请求完成。
+块缓存的内存注册为固定缓冲区，落在其中的单段请求使用 READ_FIXED/WRITE_FIXED，
+省去内核每次映射用户页的开销。*/
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+
+typedef struct {
+    int fd;
+    unsigned int entries;      // 同时在途的请求数上限（不超过提交队列长度，完成队列不会溢出）
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr;
+    size_t sq_size;
+    void *cq_ptr;              // 内核支持单次映射时与 sq_ptr 相同
+    size_t cq_size;
+    size_t sqes_size;
+    char *fixed_base;          // 注册的固定缓冲区，NULL 表示没有注册
+    size_t fixed_size;
+} ring_t;
+
+static __thread ring_t *thread_ring = NULL;
+static __thread int thread_ring_failed = 0;   // 建立失败后不再重试
+
+static pthread_key_t ring_key;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+
+static pthread_mutex_t region_lock = PTHREAD_MUTEX_INITIALIZER;
+static void *region_base = NULL;
+static size_t region_size = 0;
+
+static int sys_setup(unsigned int entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_register(int fd, unsigned int opcode, void *arg, unsigned int nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void free_ring(ring_t *r) {
+    if (r->sqes != NULL && r->sqes != MAP_FAILED) {
+        munmap(r->sqes, r->sqes_size);
+    }
+    if (r->cq_ptr != NULL && r->cq_ptr != MAP_FAILED && r->cq_ptr != r->sq_ptr) {
+        munmap(r->cq_ptr, r->cq_size);
+    }
+    if (r->sq_ptr != NULL && r->sq_ptr != MAP_FAILED) {
+        munmap(r->sq_ptr, r->sq_size);
+    }
+    if (r->fd != -1) {
+        close(r->fd);   // 关闭环时内核同时注销固定缓冲区
+    }
+    free(r);
+}
+
+static void destroy_thread_ring(void *arg) {
+    free_ring((ring_t*)arg);
+}
+
+static void create_key(void) {
+    pthread_key_create(&ring_key, destroy_thread_ring);
+}
+
+// 注册固定缓冲区，失败时只是不用 *_FIXED 操作
+static void register_region(ring_t *r) {
+    pthread_mutex_lock(&region_lock);
+    struct iovec region = { region_base, region_size };
+    pthread_mutex_unlock(&region_lock);
+
+    if (region.iov_base == NULL || region.iov_len == 0) {
+        return;
+    }
+    if (sys_register(r->fd, IORING_REGISTER_BUFFERS, &region, 1) == 0) {
+        r->fixed_base = region.iov_base;
+        r->fixed_size = region.iov_len;
+    }
+}
+
+static ring_t *create_ring(void) {
+    ring_t *r = calloc(1, sizeof(ring_t));
+    if (r == NULL) {
+        return NULL;
+    }
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    r->fd = sys_setup(URING_ENTRIES, &p);
+    if (r->fd < 0) {
+        r->fd = -1;
+        free_ring(r);
+        return NULL;
+    }
+
+    r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_size > r->sq_size) {
+            r->sq_size = r->cq_size;
+        }
+        r->cq_size = r->sq_size;
+    }
+
+    r->sq_ptr = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED) {
+        free_ring(r);
+        return NULL;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ptr = r->sq_ptr;
+    } else {
+        r->cq_ptr = mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ptr == MAP_FAILED) {
+            free_ring(r);
+            return NULL;
+        }
+    }
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        free_ring(r);
+        return NULL;
+    }
+
+    char *sq = r->sq_ptr;
+    char *cq = r->cq_ptr;
+    r->sq_head = (unsigned int*)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned int*)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned int*)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned int*)(sq + p.sq_off.array);
+    r->cq_head = (unsigned int*)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned int*)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned int*)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    r->entries = p.sq_entries;
+
+    register_region(r);
+    return r;
+}
+
+// 调用线程的环，第一次使用时建立
+static ring_t *get_ring(void) {
+    if (thread_ring != NULL || thread_ring_failed) {
+        return thread_ring;
+    }
+    pthread_once(&key_once, create_key);
+
+    thread_ring = create_ring();
+    if (thread_ring == NULL) {
+        thread_ring_failed = 1;
+        return NULL;
+    }
+    pthread_setspecific(ring_key, thread_ring);
+    return thread_ring;
+}
+
+int uring_probe(void) {
+    return get_ring() != NULL ? 0 : -1;
+}
+
+void uring_set_region(void *base, size_t size) {
+    pthread_mutex_lock(&region_lock);
+    region_base = base;
+    region_size = size;
+    pthread_mutex_unlock(&region_lock);
+}
+
+// 把请求 index 放进提交队列（调用者保证队列有空位）
+static void queue_io(ring_t *r, int fd, const uring_io_t *io, int index) {
+    unsigned int tail = *r->sq_tail;
+    unsigned int slot = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[slot];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd = fd;
+    sqe->off = (uint64_t)io->offset;
+    sqe->user_data = (uint64_t)index;
+
+    char *base = io->iov[0].iov_base;
+    if (io->iovcnt == 1 && r->fixed_base != NULL && base >= r->fixed_base &&
+        base + io->iov[0].iov_len <= r->fixed_base + r->fixed_size) {
+        sqe->opcode = io->writing ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+        sqe->addr = (uint64_t)(uintptr_t)base;
+        sqe->len = (uint32_t)io->iov[0].iov_len;
+        sqe->buf_index = 0;
+    } else {
+        sqe->opcode = io->writing ? IORING_OP_WRITEV : IORING_OP_READV;
+        sqe->addr = (uint64_t)(uintptr_t)io->iov;
+        sqe->len = (uint32_t)io->iovcnt;
+    }
+
+    r->sq_array[slot] = slot;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+// 完成了 done 字节：推进 iovec，返回是否还有剩余
+static int advance_io(uring_io_t *io, size_t done) {
+    io->offset += done;
+    io->length -= done;
+    while (done > 0) {
+        if (done >= io->iov[0].iov_len) {
+            done -= io->iov[0].iov_len;
+            io->iov++;
+            io->iovcnt--;
+        } else {
+            io->iov[0].iov_base = (char*)io->iov[0].iov_base + done;
+            io->iov[0].iov_len -= done;
+            done = 0;
+        }
+    }
+    return io->length > 0;
+}
+
+int uring_submit_batch(int fd, uring_io_t *ios, int count) {
+    ring_t *r = get_ring();
+    if (r == NULL) {
+        return URING_UNAVAILABLE;
+    }
+    if (count <= 0) {
+        return 0;
+    }
+
+    // 需要（重新）提交的请求：先是续传的，再是还没提交过的
+    int retry[count];
+    int nretry = 0;
+    int next = 0;
+    unsigned int inflight = 0;    // 已提交未完成
+    unsigned int queued = 0;      // 已放进队列但内核还没取走
+    int failed = 0;
+
+    while (inflight > 0 || queued > 0 || (!failed && (nretry > 0 || next < count))) {
+        while (!failed && inflight + queued < r->entries && (nretry > 0 || next < count)) {
+            int index = nretry > 0 ? retry[--nretry] : next++;
+            queue_io(r, fd, &ios[index], index);
+            queued++;
+        }
+
+        int submitted = sys_enter(r->fd, queued, inflight + queued > 0 ? 1 : 0, IORING_ENTER_GETEVENTS);
+        if (submitted < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                continue;
+            }
+            // 环本身出错：队列中的请求无法再提交，只能放弃这一批
+            return -1;
+        }
+        queued -= (unsigned int)submitted;
+        inflight += (unsigned int)submitted;
+
+        unsigned int head = *r->cq_head;
+        unsigned int tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+            int index = (int)cqe->user_data;
+            int res = cqe->res;
+            head++;
+            inflight--;
+
+            if (res == -EAGAIN || res == -EINTR) {
+                retry[nretry++] = index;
+            } else if (res <= 0) {
+                failed = 1;   // 读到文件末尾或I/O错误
+            } else if (advance_io(&ios[index], (size_t)res)) {
+                retry[nretry++] = index;
+            }
+        }
+        __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return failed ? -1 : 0;
+}
+
+#else
+
+// 没有 io_uring 的平台：总是让调用者使用同步I/O
+int uring_probe(void) {
+    return -1;
+}
+
+void uring_set_region(void *base, size_t size) {
+    (void)base;
+    (void)size;
+}
+
+int uring_submit_batch(int fd, uring_io_t *ios, int count) {
+    (void)fd;
+    (void)ios;
+    (void)count;
+    return URING_UNAVAILABLE;
+}
+
+#endif
@@ -1,193 +1,543 @@
 #include "../include/user.h"
 #include "../include/ext2.h"
 #include "../include/disk.h"
+#include "../include/inode.h"
+#include "../include/icache.h"
+#include "../include/session.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <crypt.h>
+#include <pthread.h>
 
 // 全局变量
 extern ext2_fs_t fs;
 
-// 用户管理
-int init_users(void) {
-    memset(fs.users, 0, sizeof(fs.users));
-    fs.current_user = -1;
-    
-    // 创建默认用户
-    add_user("root", "root", 0, 0);
-    add_user("user1", "password1", 1, 1);
-    add_user("user2", "password2", 2, 1);
-    
+/*用户表和组表：记录按下标连续存放，数组满时成倍增长；按名字哈希查找，
+桶和链中存的都是记录下标（-1 表示结束），增长或删除后整体重建索引。
+记录的第一个字段是名字（见 user_t、group_t）。*/
+typedef struct {
+    uint8_t *records;
+    size_t record_size;
+    int count;
+    int capacity;      // 记录和哈希桶的个数，2的幂
+    int *buckets;
+    int *next;
+} name_table_t;
+
+#define TABLE_INITIAL_CAPACITY 16
+
+static name_table_t users = { NULL, sizeof(user_t), 0, 0, NULL, NULL };
+static name_table_t groups = { NULL, sizeof(group_t), 0, 0, NULL, NULL };
+
+// 保护两张表；登录时把身份复制到会话中，权限检查不需要加这把锁
+static pthread_rwlock_t users_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/*数据库文件格式：头部之后依次是 user_count 个 user_t 和 group_count 个 group_t。*/
+#define USER_DB_MAGIC 0x42445355   // "USDB"
+#define USER_DB_VERSION 1
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    uint32_t user_count;
+    uint32_t group_count;
+} user_db_header_t;
+
+static unsigned int hash_name(const char *name) {
+    unsigned int hash = 2166136261u; // FNV-1a
+    for (; *name != '\0'; name++) {
+        hash = (hash ^ (uint8_t)*name) * 16777619u;
+    }
+    return hash;
+}
+
+static void *record_at(const name_table_t *t, int index) {
+    return t->records + (size_t)index * t->record_size;
+}
+
+static void rebuild_index(name_table_t *t) {
+    for (int b = 0; b < t->capacity; b++) {
+        t->buckets[b] = -1;
+    }
+    for (int i = 0; i < t->count; i++) {
+        unsigned int b = hash_name(record_at(t, i)) & (t->capacity - 1);
+        t->next[i] = t->buckets[b];
+        t->buckets[b] = i;
+    }
+}
+
+static int table_find(const name_table_t *t, const char *name) {
+    if (t->capacity == 0) {
+        return -1;
+    }
+    int i = t->buckets[hash_name(name) & (t->capacity - 1)];
+    while (i != -1) {
+        if (strcmp(record_at(t, i), name) == 0) {
+            return i;
+        }
+        i = t->next[i];
+    }
+    return -1;
+}
+
+static int table_grow(name_table_t *t) {
+    int capacity = t->capacity > 0 ? t->capacity * 2 : TABLE_INITIAL_CAPACITY;
+    uint8_t *records = realloc(t->records, (size_t)capacity * t->record_size);
+    if (records == NULL) {
+        return -1;
+    }
+    t->records = records;
+
+    int *buckets = malloc(capacity * sizeof(int));
+    int *next = malloc(capacity * sizeof(int));
+    if (buckets == NULL || next == NULL) {
+        free(buckets);
+        free(next);
+        return -1;
+    }
+    free(t->buckets);
+    free(t->next);
+    t->buckets = buckets;
+    t->next = next;
+    t->capacity = capacity;
+    rebuild_index(t);
     return 0;
 }
 
-int add_user(const char *username, const char *password, uint16_t uid, uint16_t gid) {
+static int table_append(name_table_t *t, const void *record) {
+    if (t->count == t->capacity && table_grow(t) != 0) {
+        return -1;
+    }
+    int i = t->count++;
+    memcpy(record_at(t, i), record, t->record_size);
+    unsigned int b = hash_name(record) & (t->capacity - 1);
+    t->next[i] = t->buckets[b];
+    t->buckets[b] = i;
+    return 0;
+}
+
+// 用最后一条记录填补空位
+static void table_remove(name_table_t *t, int index) {
+    t->count--;
+    if (index != t->count) {
+        memcpy(record_at(t, index), record_at(t, t->count), t->record_size);
+    }
+    rebuild_index(t);
+}
+
+static void table_clear(name_table_t *t) {
+    t->count = 0;
+    if (t->capacity > 0) {
+        rebuild_index(t);
+    }
+}
+
+static user_t *user_at(int index) {
+    return record_at(&users, index);
+}
+
+static group_t *group_at(int index) {
+    return record_at(&groups, index);
+}
+
+static int group_exists(uint16_t gid) {
+    for (int i = 0; i < groups.count; i++) {
+        if (group_at(i)->gid == gid) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// 组ID对应的组名，找不到时返回 NULL
+static const char *group_name(uint16_t gid) {
+    for (int i = 0; i < groups.count; i++) {
+        if (group_at(i)->gid == gid) {
+            return group_at(i)->name;
+        }
+    }
+    return NULL;
+}
+
+static int add_group_locked(const char *name, uint16_t gid) {
+    if (name == NULL || name[0] == '\0' || strlen(name) >= sizeof(((group_t*)0)->name)) {
+        return -3;
+    }
+    if (table_find(&groups, name) != -1 || group_exists(gid)) {
+        return -2;
+    }
+
+    group_t group;
+    memset(&group, 0, sizeof(group));
+    strcpy(group.name, name);
+    group.gid = gid;
+    return table_append(&groups, &group);
+}
+
+static int add_user_locked(const char *username, const char *password, uint16_t uid, uint16_t gid) {
     if (!username || !password) return -3; // 参数无效
+    if (username[0] == '\0' || strlen(username) >= sizeof(((user_t*)0)->username) ||
+        strlen(password) >= sizeof(((user_t*)0)->password) || !group_exists(gid)) {
+        return -3;
+    }
 
-    // 检查UID/GID冲突
-    for (int i = 0; i < MAX_USERS; i++) {
-        if (fs.users[i].is_active && 
-           (fs.users[i].uid == uid || fs.users[i].gid == gid)) {
-            return -2; // UID/GID冲突
+    // 检查用户名和UID冲突（同一个组可以有多个用户）
+    if (table_find(&users, username) != -1) {
+        return -2;
+    }
+    for (int i = 0; i < users.count; i++) {
+        if (user_at(i)->uid == uid) {
+            return -2;
         }
     }
-    
-    for (int i = 0; i < MAX_USERS; i++) {
-        if (!fs.users[i].is_active) {
-            strncpy(fs.users[i].username, username, sizeof(fs.users[i].username) - 1);
-            fs.users[i].username[sizeof(fs.users[i].username) - 1] = '\0';
-            
-            // 简单的密码加密（实际应用中应使用更安全的方法）
-            strncpy(fs.users[i].password, password, sizeof(fs.users[i].password) - 1);
-            fs.users[i].password[sizeof(fs.users[i].password) - 1] = '\0';
-            
-            fs.users[i].uid = uid;
-            fs.users[i].gid = gid;
-            fs.users[i].is_active = 1;
-            
-            return 0;//找到就返回
+
+    user_t user;
+    memset(&user, 0, sizeof(user));
+    strcpy(user.username, username);
+    // 简单的密码存储（实际应用中应使用更安全的方法）
+    strcpy(user.password, password);
+    user.uid = uid;
+    user.gid = gid;
+    return table_append(&users, &user);
+}
+
+static void set_defaults_locked(void) {
+    table_clear(&users);
+    table_clear(&groups);
+
+    // 默认组和用户
+    add_group_locked("root", 0);
+    add_group_locked("users", 1);
+    add_user_locked("root", "root", 0, 0);
+    add_user_locked("user1", "password1", 1, 1);
+    add_user_locked("user2", "password2", 2, 1);
+}
+
+/*把数据库写回镜像：第一次写时创建隐藏inode（不出现在任何目录中）并记入超级块。*/
+static int save_users_locked(void) {
+    size_t size = sizeof(user_db_header_t) + users.count * sizeof(user_t) + groups.count * sizeof(group_t);
+    uint8_t *buffer = malloc(size);
+    if (buffer == NULL) {
+        return -1;
+    }
+
+    user_db_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = USER_DB_MAGIC;
+    header.version = USER_DB_VERSION;
+    header.user_count = users.count;
+    header.group_count = groups.count;
+    memcpy(buffer, &header, sizeof(header));
+    memcpy(buffer + sizeof(header), users.records, users.count * sizeof(user_t));
+    memcpy(buffer + sizeof(header) + users.count * sizeof(user_t), groups.records, groups.count * sizeof(group_t));
+
+    uint32_t inode_no = fs.superblock.s_users_inode;
+    if (inode_no == 0) {
+        inode_no = create_inode(1, EXT2_S_IFREG | 0600, 0, 0);
+        if (inode_no == 0) {
+            free(buffer);
+            return -1;
+        }
+        // 数据库文件不在任何目录中，由超级块引用，链接数记为1
+        increment_link_count(inode_no);
+        fs.superblock.s_users_inode = inode_no;
+        mark_superblock_dirty();
+    }
+
+    int result = write_inode_data(inode_no, buffer, size, 0) == (ssize_t)size ? 0 : -1;
+    if (result == 0) {
+        result = truncate_inode(inode_no, size);
+    }
+    free(buffer);
+    return result;
+}
+
+// 解析数据库文件内容，格式不对返回-1（表的内容此时不确定，调用者应恢复默认）
+static int parse_users_locked(const uint8_t *data, size_t size) {
+    user_db_header_t header;
+    if (size < sizeof(header)) {
+        return -1;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != USER_DB_MAGIC || header.version != USER_DB_VERSION ||
+        size != sizeof(header) + (uint64_t)header.user_count * sizeof(user_t) +
+                (uint64_t)header.group_count * sizeof(group_t)) {
+        return -1;
+    }
+
+    table_clear(&users);
+    table_clear(&groups);
+
+    const uint8_t *p = data + sizeof(header) + header.user_count * sizeof(user_t);
+    for (uint32_t i = 0; i < header.group_count; i++, p += sizeof(group_t)) {
+        group_t group;
+        memcpy(&group, p, sizeof(group));
+        group.name[sizeof(group.name) - 1] = '\0';
+        if (add_group_locked(group.name, group.gid) != 0) {
+            return -1;
+        }
+    }
+
+    p = data + sizeof(header);
+    for (uint32_t i = 0; i < header.user_count; i++, p += sizeof(user_t)) {
+        user_t user;
+        memcpy(&user, p, sizeof(user));
+        user.username[sizeof(user.username) - 1] = '\0';
+        user.password[sizeof(user.password) - 1] = '\0';
+        if (add_user_locked(user.username, user.password, user.uid, user.gid) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// 用户管理
+int init_users(void) {
+    pthread_rwlock_wrlock(&users_lock);
+    set_defaults_locked();
+    pthread_rwlock_unlock(&users_lock);
+
+    session_current()->logged_in = 0;
+    return 0;
+}
+
+// 挂载时读入镜像中的数据库；没有数据库时使用默认用户，数据库损坏时也恢复默认并返回-1
+int load_users(void) {
+    pthread_rwlock_wrlock(&users_lock);
+    uint32_t inode_no = fs.superblock.s_users_inode;
+    int result = 0;
+
+    if (inode_no != 0) {
+        size_t size = get_file_size(inode_no);
+        uint8_t *data = malloc(size > 0 ? size : 1);
+        result = -1;
+        if (data != NULL && read_inode_data(inode_no, data, size, 0) == (ssize_t)size) {
+            result = parse_users_locked(data, size);
         }
+        free(data);
+    }
+    if (inode_no == 0 || result != 0) {
+        set_defaults_locked();
     }
-    
-    return -1; // 用户表已满
+
+    pthread_rwlock_unlock(&users_lock);
+    return result;
+}
+
+// 格式化时调用：把默认数据库写进新镜像
+int create_user_db(void) {
+    pthread_rwlock_wrlock(&users_lock);
+    set_defaults_locked();
+    fs.superblock.s_users_inode = 0;
+    int result = save_users_locked();
+    pthread_rwlock_unlock(&users_lock);
+    return result;
+}
+
+int add_user(const char *username, const char *password, uint16_t uid, uint16_t gid) {
+    pthread_rwlock_wrlock(&users_lock);
+    int result = add_user_locked(username, password, uid, gid);
+    if (result == 0 && save_users_locked() != 0) {
+        table_remove(&users, users.count - 1);
+        result = -1;
+    }
+    pthread_rwlock_unlock(&users_lock);
+    return result;
 }
 
 int remove_user(const char *username) {
-    for (int i = 0; i < MAX_USERS; i++) {
-        if (fs.users[i].is_active && strcmp(fs.users[i].username, username) == 0) {
-            fs.users[i].is_active = 0;
-            return 0;
+    pthread_rwlock_wrlock(&users_lock);
+    int index = table_find(&users, username);
+    int result = -3; // 用户不存在
+    if (index != -1) {
+        user_t removed = *user_at(index);
+        table_remove(&users, index);
+        result = 0;
+        if (save_users_locked() != 0) {
+            table_append(&users, &removed);
+            result = -1;
         }
     }
-    
-    return -1; // 用户不存在
+    pthread_rwlock_unlock(&users_lock);
+    return result;
 }
 
 int find_user(const char *username) {
-    for (int i = 0; i < MAX_USERS; i++) {
-        if (fs.users[i].is_active && strcmp(fs.users[i].username, username) == 0) {
-            return i;
-        }
+    pthread_rwlock_rdlock(&users_lock);
+    int index = table_find(&users, username);
+    pthread_rwlock_unlock(&users_lock);
+    return index; // 不存在时为-1
+}
+
+int add_group(const char *name, uint16_t gid) {
+    pthread_rwlock_wrlock(&users_lock);
+    int result = add_group_locked(name, gid);
+    if (result == 0 && save_users_locked() != 0) {
+        table_remove(&groups, groups.count - 1);
+        result = -1;
     }
-    
-    return -1; // 用户不存在
+    pthread_rwlock_unlock(&users_lock);
+    return result;
+}
+
+int find_group(const char *name) {
+    pthread_rwlock_rdlock(&users_lock);
+    int index = table_find(&groups, name);
+    pthread_rwlock_unlock(&users_lock);
+    return index;
 }
 
 // 用户认证
 int login(const char *username, const char *password) {
-    int user_index = find_user(username);
-    if (user_index == -1) {
-        return -1; // 用户不存在
-    }
-    
+    pthread_rwlock_rdlock(&users_lock);
+    int user_index = table_find(&users, username);
     // 简单的密码验证（实际应用中应使用加密）
-    if (strcmp(fs.users[user_index].password, password) == 0) {
-        fs.current_user = user_index;
-        printf("Login successful. Welcome, %s!\n", username);
-        return 0;
+    if (user_index == -1 || strcmp(user_at(user_index)->password, password) != 0) {
+        pthread_rwlock_unlock(&users_lock);
+        return -1; // 用户不存在或密码错误
     }
-    
-    return -1; // 密码错误
+
+    session_t *session = session_current();
+    const user_t *user = user_at(user_index);
+    session->uid = user->uid;
+    session->gid = user->gid;
+    strcpy(session->username, user->username);
+    session->logged_in = 1;
+    pthread_rwlock_unlock(&users_lock);
+
+    ext2_info("Login successful. Welcome, %s!\n", username);
+    return 0;
 }
 
 void logout(void) {
-    if (fs.current_user != -1) {
-        printf("Logout successful. Goodbye, %s!\n", fs.users[fs.current_user].username);
-        fs.current_user = -1;
+    session_t *session = session_current();
+    if (session->logged_in) {
+        ext2_info("Logout successful. Goodbye, %s!\n", session->username);
+        session->logged_in = 0;
     }
 }
 
 int is_logged_in(void) {
-    return fs.current_user != -1;
+    return session_current()->logged_in;
 }
 
 // 权限检查
-int check_file_permission(uint32_t inode_no, int access) {
-    ext2_inode_t inode;
-    if (read_inode(inode_no, &inode) != 0) {
-        return 0;
-    }
-    
+int inode_permits(const ext2_inode_t *inode, int access) {
     uint16_t uid = get_current_uid();
     uint16_t gid = get_current_gid();
-    
+
     // root用户有所有权限
     if (uid == 0) {
         return 1;
     }
-    
+
+    // access 以属主权限位(EXT2_S_IRUSR等)给出，换算成rwx三位再比较
+    access = (access >> 6) & 0x7;
+
     uint16_t mode = 0;
-    if (uid == inode.i_uid) {
-        mode = (inode.i_mode >> 6) & 0x7;
-    } else if (gid == inode.i_gid) {
-        mode = (inode.i_mode >> 3) & 0x7;
+    if (uid == inode->i_uid) {
+        mode = (inode->i_mode >> 6) & 0x7;
+    } else if (gid == inode->i_gid) {
+        mode = (inode->i_mode >> 3) & 0x7;
     } else {
-        mode = inode.i_mode & 0x7;
+        mode = inode->i_mode & 0x7;
     }
-    
-    return (mode & access) == access;
-}
 
-int check_directory_permission(uint32_t inode_no, int access) {
-    return check_file_permission(inode_no, access);
+    return (mode & access) == access;
 }
 
-// 当前用户信息
+// 当前用户信息（当前线程所绑定会话的登录用户）
 uint16_t get_current_uid(void) {
-    if (fs.current_user == -1) {
+    session_t *session = session_current();
+    if (!session->logged_in) {
         return 65535; // 无效用户ID
     }
-    return fs.users[fs.current_user].uid;
+    return session->uid;
 }
 
 uint16_t get_current_gid(void) {
-    if (fs.current_user == -1) {
+    session_t *session = session_current();
+    if (!session->logged_in) {
         return 65535; // 无效组ID
     }
-    return fs.users[fs.current_user].gid;
+    return session->gid;
 }
 
 const char* get_current_username(void) {
-    if (fs.current_user == -1) {
+    session_t *session = session_current();
+    if (!session->logged_in) {
         return "anonymous";
     }
-    return fs.users[fs.current_user].username;
+    return session->username;
 }
 
 // 用户列表
 void list_users(void) {
+    session_t *session = session_current();
     printf("User List:\n");
-    printf("%-15s %-10s %-10s %-10s\n", "Username", "UID", "GID", "Status");
+    printf("%-15s %-10s %-10s %-15s %-10s\n", "Username", "UID", "GID", "Group", "Status");
+    printf("------------------------------------------------------------\n");
+
+    pthread_rwlock_rdlock(&users_lock);
+    for (int i = 0; i < users.count; i++) {
+        const user_t *user = user_at(i);
+        const char *status = (session->logged_in && strcmp(user->username, session->username) == 0) ?
+                             "Logged in" : "Active";
+        const char *group = group_name(user->gid);
+        printf("%-15s %-10u %-10u %-15s %-10s\n",
+               user->username,
+               user->uid,
+               user->gid,
+               group != NULL ? group : "-",
+               status);
+    }
+    pthread_rwlock_unlock(&users_lock);
+}
+
+void list_groups(void) {
+    printf("Group List:\n");
+    printf("%-15s %-10s %-10s\n", "Group", "GID", "Members");
     printf("----------------------------------------\n");
-    
-    for (int i = 0; i < MAX_USERS; i++) {
-        if (fs.users[i].is_active) {
-            const char *status = (i == fs.current_user) ? "Logged in" : "Active";
-            printf("%-15s %-10u %-10u %-10s\n", 
-                   fs.users[i].username, 
-                   fs.users[i].uid, 
-                   fs.users[i].gid, 
-                   status);
+
+    pthread_rwlock_rdlock(&users_lock);
+    for (int i = 0; i < groups.count; i++) {
+        const group_t *group = group_at(i);
+        int members = 0;
+        for (int j = 0; j < users.count; j++) {
+            if (user_at(j)->gid == group->gid) {
+                members++;
+            }
         }
+        printf("%-15s %-10u %-10d\n", group->name, group->gid, members);
     }
+    pthread_rwlock_unlock(&users_lock);
 }
 
 // 密码管理
 int change_password(const char *username, const char *old_password, const char *new_password) {
-    int user_index = find_user(username);
-    if (user_index == -1) {
-        return -1; // 用户不存在
+    if (new_password == NULL || strlen(new_password) >= sizeof(((user_t*)0)->password)) {
+        return -3;
     }
-    
+
+    pthread_rwlock_wrlock(&users_lock);
+    int user_index = table_find(&users, username);
     // 验证旧密码
-    if (strcmp(fs.users[user_index].password, old_password) != 0) {
-        return -1; // 旧密码错误
+    if (user_index == -1 || strcmp(user_at(user_index)->password, old_password) != 0) {
+        pthread_rwlock_unlock(&users_lock);
+        return -1; // 用户不存在或旧密码错误
     }
-    
+
     // 更新密码
-    strncpy(fs.users[user_index].password, new_password, sizeof(fs.users[user_index].password) - 1);
-    fs.users[user_index].password[sizeof(fs.users[user_index].password) - 1] = '\0';
-    
-    return 0;
-} 
\ No newline at end of file
+    user_t *user = user_at(user_index);
+    char saved[sizeof(user->password)];
+    strcpy(saved, user->password);
+    strcpy(user->password, new_password);
+
+    int result = save_users_locked();
+    if (result != 0) {
+        strcpy(user->password, saved);
+    }
+    pthread_rwlock_unlock(&users_lock);
+    return result;
+}